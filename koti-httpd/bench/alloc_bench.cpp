@@ -0,0 +1,219 @@
+// Counts heap allocations made while serving keep-alive requests.
+//
+// A client thread drives one http_connection over a socketpair; the
+// connection runs on the main thread, whose allocations are counted by the
+// operator new replacement below. After a warm-up, the steady state should
+// report 0 allocations per request.
+//
+//	koti_httpd_alloc_bench [requests] [warmup]
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+} // extern "C"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "httpd.hpp"
+
+namespace {
+
+thread_local std::size_t thread_allocations = 0;
+
+} // namespace
+
+void *
+operator new(
+	std::size_t size
+)
+{
+	++thread_allocations;
+	if ( void * p = std::malloc(size ? size : 1) )
+	{
+		return p;
+	}
+	throw std::bad_alloc{};
+}
+
+void
+operator delete(
+	void * p
+) noexcept
+{
+	std::free(p);
+}
+
+void
+operator delete(
+	void * p,
+	std::size_t
+) noexcept
+{
+	std::free(p);
+}
+
+namespace {
+
+class bench_logs
+: public koti::httpd_logs
+{
+public:
+	using koti::httpd_logs::logger;
+};
+
+class ok_endpoint
+: public koti::http_endpoint
+{
+public:
+	koti::http_response
+	handle(
+		koti::http_connection &,
+		koti::http_request & request
+	) override
+	{
+		auto response = koti::http_make_response(request.get_allocator());
+		response.result(koti::http::status::ok);
+		response.version(request.version());
+		response.set(koti::http::field::content_type, "text/plain");
+		response.body() = "ok";
+		response.prepare_payload();
+		return response;
+	}
+};
+
+bool
+write_all(
+	int fd,
+	std::string_view data
+)
+{
+	while ( ! data.empty() )
+	{
+		auto written = ::write(fd, data.data(), data.size());
+		if ( written <= 0 )
+		{
+			return false;
+		}
+		data.remove_prefix(static_cast<std::size_t>(written));
+	}
+	return true;
+}
+
+// reads one response: everything up to and including the "ok" body
+bool
+read_response(
+	int fd
+)
+{
+	static constexpr std::string_view end{"\r\n\r\nok"};
+	char buffer[512];
+	std::size_t have = 0;
+	for ( ;; )
+	{
+		auto got = ::read(fd, buffer + have, sizeof(buffer) - have);
+		if ( got <= 0 )
+		{
+			return false;
+		}
+		have += static_cast<std::size_t>(got);
+		if (
+			end.size() <= have
+			&& std::string_view{buffer + have - end.size(), end.size()} == end
+		)
+		{
+			return true;
+		}
+		if ( sizeof(buffer) == have )
+		{
+			return false;
+		}
+	}
+}
+
+} // namespace
+
+int
+main(
+	int argc,
+	char ** argv
+)
+{
+	std::size_t requests = 1 < argc ? std::strtoul(argv[1], nullptr, 10) : 100000;
+	std::size_t warmup = 2 < argc ? std::strtoul(argv[2], nullptr, 10) : 1000;
+
+	bench_logs::logger()->set_level(spdlog::level::warn);
+
+	boost::asio::io_context iox{1};
+	koti::local_stream::socket server_side{iox};
+	koti::local_stream::socket client_side{iox};
+	boost::asio::local::connect_pair(server_side, client_side);
+
+	ok_endpoint root;
+	koti::http_buffer_pool pool;
+	koti::http_connection connection{std::move(server_side)};
+	connection.set_root_endpoint(&root);
+	connection.set_read_buffer(&pool);
+	connection.async_read();
+
+	std::atomic<std::size_t> completed{0};
+	std::atomic<bool> failed{false};
+	int client = client_side.native_handle();
+
+	std::thread driver([&]()
+	{
+		static constexpr std::string_view request{
+			"GET /bench HTTP/1.1\r\n"
+			"Host: bench\r\n"
+			"User-Agent: koti_httpd_alloc_bench\r\n"
+			"Accept: */*\r\n"
+			"\r\n"
+		};
+		for ( std::size_t i = 0; i < warmup + requests; ++i )
+		{
+			if ( ! write_all(client, request) || ! read_response(client) )
+			{
+				failed = true;
+				break;
+			}
+			++completed;
+		}
+		::shutdown(client, SHUT_RDWR);
+	});
+
+	// warm up: let the arena, buffer pool and handler memory reach their size
+	while ( completed < warmup && ! failed )
+	{
+		iox.run_one();
+	}
+
+	auto before = thread_allocations;
+	auto started = completed.load();
+	iox.run();
+	auto measured = completed.load() - started;
+	auto allocations = thread_allocations - before;
+
+	driver.join();
+
+	if ( failed && completed < warmup + requests )
+	{
+		std::cerr << "client failed after " << completed << " requests\n";
+		return EXIT_FAILURE;
+	}
+
+	std::cout
+		<< "requests\t" << measured << '\n'
+		<< "allocations\t" << allocations << '\n'
+		<< "allocations_per_request\t"
+		<< (measured ? static_cast<double>(allocations) / measured : 0.0)
+		<< '\n';
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,264 @@
+// Compares the cost of answering a request from a plain endpoint with that
+// of a coroutine endpoint (koti::http_coroutine_endpoint).
+//
+// For each kind of endpoint, a client thread drives one http_connection
+// over a socketpair with sequential keep-alive requests. The connection
+// runs on the main thread; the bench reports requests per second and the
+// heap allocations that thread made per request.
+//
+//	koti_httpd_coroutine_bench [requests] [warmup]
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+} // extern "C"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include "httpd.hpp"
+#include "http_coroutine_endpoint.hpp"
+
+namespace {
+
+thread_local std::size_t thread_allocations = 0;
+
+} // namespace
+
+void *
+operator new(
+	std::size_t size
+)
+{
+	++thread_allocations;
+	if ( void * p = std::malloc(size ? size : 1) )
+	{
+		return p;
+	}
+	throw std::bad_alloc{};
+}
+
+void
+operator delete(
+	void * p
+) noexcept
+{
+	std::free(p);
+}
+
+void
+operator delete(
+	void * p,
+	std::size_t
+) noexcept
+{
+	std::free(p);
+}
+
+namespace {
+
+class bench_logs
+: public koti::httpd_logs
+{
+public:
+	using koti::httpd_logs::logger;
+};
+
+koti::http_response
+ok_response(
+	koti::http_request & request
+)
+{
+	auto response = koti::http_make_response(request.get_allocator());
+	response.result(koti::http::status::ok);
+	response.version(request.version());
+	response.set(koti::http::field::content_type, "text/plain");
+	response.body() = "ok";
+	response.prepare_payload();
+	return response;
+}
+
+class callback_endpoint
+: public koti::http_endpoint
+{
+public:
+	koti::http_response
+	handle(
+		koti::http_connection &,
+		koti::http_request & request
+	) override
+	{
+		return ok_response(request);
+	}
+};
+
+class coroutine_endpoint
+: public koti::http_coroutine_endpoint
+{
+public:
+	asio::awaitable<koti::http_response>
+	async_handle(
+		koti::http_connection &,
+		koti::http_request & request
+	) override
+	{
+		co_return ok_response(request);
+	}
+};
+
+bool
+write_all(
+	int fd,
+	std::string_view data
+)
+{
+	while ( ! data.empty() )
+	{
+		auto written = ::write(fd, data.data(), data.size());
+		if ( written <= 0 )
+		{
+			return false;
+		}
+		data.remove_prefix(static_cast<std::size_t>(written));
+	}
+	return true;
+}
+
+// reads one response: everything up to and including the "ok" body
+bool
+read_response(
+	int fd
+)
+{
+	static constexpr std::string_view end{"\r\n\r\nok"};
+	char buffer[512];
+	std::size_t have = 0;
+	for ( ;; )
+	{
+		auto got = ::read(fd, buffer + have, sizeof(buffer) - have);
+		if ( got <= 0 )
+		{
+			return false;
+		}
+		have += static_cast<std::size_t>(got);
+		if (
+			end.size() <= have
+			&& std::string_view{buffer + have - end.size(), end.size()} == end
+		)
+		{
+			return true;
+		}
+		if ( sizeof(buffer) == have )
+		{
+			return false;
+		}
+	}
+}
+
+bool
+run(
+	const char * name,
+	koti::http_endpoint & root,
+	std::size_t requests,
+	std::size_t warmup
+)
+{
+	boost::asio::io_context iox{1};
+	koti::local_stream::socket server_side{iox};
+	koti::local_stream::socket client_side{iox};
+	boost::asio::local::connect_pair(server_side, client_side);
+
+	koti::http_buffer_pool pool;
+	koti::http_connection connection{std::move(server_side)};
+	connection.set_root_endpoint(&root);
+	connection.set_read_buffer(&pool);
+	connection.async_read();
+
+	std::atomic<std::size_t> completed{0};
+	std::atomic<bool> failed{false};
+	int client = client_side.native_handle();
+
+	std::thread driver([&]()
+	{
+		static constexpr std::string_view request{
+			"GET /bench HTTP/1.1\r\n"
+			"Host: bench\r\n"
+			"User-Agent: koti_httpd_coroutine_bench\r\n"
+			"Accept: */*\r\n"
+			"\r\n"
+		};
+		for ( std::size_t i = 0; i < warmup + requests; ++i )
+		{
+			if ( ! write_all(client, request) || ! read_response(client) )
+			{
+				failed = true;
+				break;
+			}
+			++completed;
+		}
+		::shutdown(client, SHUT_RDWR);
+	});
+
+	while ( completed < warmup && ! failed )
+	{
+		iox.run_one();
+	}
+
+	auto before = thread_allocations;
+	auto started = completed.load();
+	auto began = std::chrono::steady_clock::now();
+	iox.run();
+	auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - began);
+	auto measured = completed.load() - started;
+	auto allocations = thread_allocations - before;
+
+	driver.join();
+
+	if ( failed && completed < warmup + requests )
+	{
+		std::cerr << name << ": client failed after " << completed << " requests\n";
+		return false;
+	}
+
+	std::cout
+		<< name
+		<< "\trequests\t" << measured
+		<< "\trequests_per_second\t" << (0 < elapsed.count() ? measured / elapsed.count() : 0.0)
+		<< "\tallocations_per_request\t"
+		<< (measured ? static_cast<double>(allocations) / measured : 0.0)
+		<< '\n';
+	return true;
+}
+
+} // namespace
+
+int
+main(
+	int argc,
+	char ** argv
+)
+{
+	std::size_t requests = 1 < argc ? std::strtoul(argv[1], nullptr, 10) : 100000;
+	std::size_t warmup = 2 < argc ? std::strtoul(argv[2], nullptr, 10) : 1000;
+
+	bench_logs::logger()->set_level(spdlog::level::warn);
+
+	callback_endpoint callback;
+	coroutine_endpoint coroutine;
+	if (
+		! run("callback", callback, requests, warmup)
+		|| ! run("coroutine", coroutine, requests, warmup)
+	)
+	{
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
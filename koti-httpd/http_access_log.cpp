@@ -0,0 +1,258 @@
+#include "http_access_log.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include <boost/beast/http/status.hpp>
+
+namespace koti {
+
+void
+http_access_record::set_target(
+	std::string_view value
+)
+{
+	target_truncated = target_capacity < value.size();
+	target_length = static_cast<std::uint16_t>(std::min(value.size(), target_capacity));
+	std::memcpy(target, value.data(), target_length);
+}
+
+http_access_log::http_access_log(
+	std::shared_ptr<spdlog::logger> logger,
+	std::size_t capacity,
+	overflow policy
+)
+: logger_(std::move(logger))
+, policy_(policy)
+{
+	std::size_t size = 2;
+	while ( size < capacity )
+	{
+		size <<= 1;
+	}
+
+	cells_ = std::vector<cell>(size);
+	for ( std::size_t i = 0; i < size; ++i )
+	{
+		cells_[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	mask_ = size - 1;
+
+	flusher_ = std::thread{[this]()
+	{
+		run_flusher();
+	}};
+}
+
+http_access_log::~http_access_log()
+{
+	stop();
+}
+
+bool
+http_access_log::push(
+	const http_access_record & record
+)
+{
+	if ( try_push(record) )
+	{
+		return true;
+	}
+
+	if ( overflow::block == policy_ )
+	{
+		// the ring only drains on the flusher; make sure it is awake, then
+		// wait our turn
+		while ( ! stopping_.load(std::memory_order_relaxed) )
+		{
+			wake_flusher();
+			std::this_thread::yield();
+			if ( try_push(record) )
+			{
+				return true;
+			}
+		}
+	}
+
+	dropped_.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+void
+http_access_log::stop()
+{
+	if ( ! flusher_.joinable() )
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+		stopping_.store(true, std::memory_order_relaxed);
+	}
+	wake_.notify_one();
+	flusher_.join();
+}
+
+bool
+http_access_log::try_push(
+	const http_access_record & record
+)
+{
+	if ( stopping_.load(std::memory_order_relaxed) )
+	{
+		return false;
+	}
+
+	auto position = enqueue_.load(std::memory_order_relaxed);
+	cell * at;
+	for ( ;; )
+	{
+		at = &cells_[position & mask_];
+		auto sequence = at->sequence.load(std::memory_order_acquire);
+		auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+		if ( 0 == difference )
+		{
+			if ( enqueue_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed) )
+			{
+				break;
+			}
+		}
+		else if ( difference < 0 )
+		{
+			// full: the flusher has not freed this cell yet
+			return false;
+		}
+		else
+		{
+			position = enqueue_.load(std::memory_order_relaxed);
+		}
+	}
+
+	at->record = record;
+
+	// publish, then look for a sleeping flusher; sequentially consistent
+	// together with the flusher's own flag store and ring check, so either
+	// it sees the record or we see it asleep
+	at->sequence.store(position + 1);
+	pushed_.fetch_add(1, std::memory_order_relaxed);
+
+	if ( flusher_sleeping_.load() )
+	{
+		wake_flusher();
+	}
+	return true;
+}
+
+bool
+http_access_log::try_pop(
+	http_access_record & record
+)
+{
+	auto & at = cells_[dequeue_ & mask_];
+	if ( at.sequence.load(std::memory_order_acquire) != dequeue_ + 1 )
+	{
+		return false;
+	}
+
+	record = at.record;
+	at.sequence.store(dequeue_ + mask_ + 1, std::memory_order_release);
+	++dequeue_;
+	return true;
+}
+
+void
+http_access_log::wake_flusher()
+{
+	if ( flusher_sleeping_.exchange(false, std::memory_order_relaxed) )
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+		wake_.notify_one();
+	}
+}
+
+void
+http_access_log::run_flusher()
+{
+	http_access_record record;
+	for ( ;; )
+	{
+		std::size_t drained = 0;
+		while ( try_pop(record) )
+		{
+			write(record);
+			++drained;
+		}
+
+		if ( 0 < drained )
+		{
+			logger_->flush();
+			continue;
+		}
+
+		if ( stopping_.load(std::memory_order_relaxed) )
+		{
+			// a push racing stop() may still land; take it too
+			while ( try_pop(record) )
+			{
+				write(record);
+			}
+			logger_->flush();
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock{mutex_};
+		flusher_sleeping_.store(true);
+		if ( cells_[dequeue_ & mask_].sequence.load() == dequeue_ + 1 )
+		{
+			flusher_sleeping_.store(false, std::memory_order_relaxed);
+			continue;
+		}
+
+		// the timeout only matters for a producer blocked in push(), which
+		// spins on wake_flusher() anyway
+		wake_.wait_for(lock, std::chrono::milliseconds(50), [this]()
+		{
+			return stopping_.load(std::memory_order_relaxed)
+				|| ! flusher_sleeping_.load(std::memory_order_relaxed);
+		});
+		flusher_sleeping_.store(false, std::memory_order_relaxed);
+	}
+}
+
+void
+http_access_log::write(
+	const http_access_record & record
+)
+{
+	namespace http = boost::beast::http;
+
+	auto status = static_cast<http::status>(record.status);
+	auto method = http::to_string(record.method);
+	auto reason = http::obsolete_reason(status);
+
+	fmt::memory_buffer line;
+	fmt::format_to(
+		std::back_inserter(line),
+		"UID:{}\tGID:{}\tPID:{}\t{}\t{}\t{}\t{}{}",
+		record.uid,
+		record.gid,
+		record.pid,
+		record.status,
+		std::string_view{reason.data(), reason.size()},
+		std::string_view{method.data(), method.size()},
+		record.target_view(),
+		record.target_truncated ? "..." : ""
+	);
+
+	logger_->log(
+		record.when,
+		spdlog::source_loc{},
+		spdlog::level::info,
+		spdlog::string_view_t{line.data(), line.size()}
+	);
+	written_.fetch_add(1, std::memory_order_relaxed);
+}
+
+} // namespace koti
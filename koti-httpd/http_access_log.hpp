@@ -0,0 +1,173 @@
+#pragma once
+
+#include "spdlog/spdlog.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <boost/beast/http/verb.hpp>
+
+namespace koti {
+
+// One request as the access log sees it. Plain data, filled in on the I/O
+// thread and only turned into text by the flusher.
+struct http_access_record
+{
+	static constexpr std::size_t target_capacity = 192;
+
+	std::chrono::system_clock::time_point when;
+	std::uint32_t uid = 0;
+	std::uint32_t gid = 0;
+	std::int32_t pid = 0;
+	std::uint16_t status = 0;
+	boost::beast::http::verb method = boost::beast::http::verb::unknown;
+
+	// the target, cut short at target_capacity bytes
+	std::uint16_t target_length = 0;
+	bool target_truncated = false;
+	char target[target_capacity];
+
+	void
+	set_target(
+		std::string_view value
+	);
+
+	std::string_view
+	target_view() const
+	{
+		return {target, target_length};
+	}
+};
+
+// Access log that keeps formatting and I/O off the connection threads.
+//
+// Connections push binary records into a bounded lock-free ring; a single
+// background thread drains it, formats each record and hands the line to
+// the logger, stamped with the time the request was served. When the ring
+// is full the record is either dropped (and counted) or the pushing thread
+// waits for room, as chosen by the overflow policy.
+class http_access_log
+{
+public:
+	enum class overflow
+	{
+		drop,
+		block
+	};
+
+	// capacity is rounded up to a power of two
+	http_access_log(
+		std::shared_ptr<spdlog::logger> logger,
+		std::size_t capacity = 64 * 1024,
+		overflow policy = overflow::drop
+	);
+
+	http_access_log(const http_access_log & copy_ctor) = delete;
+	http_access_log & operator=(const http_access_log & copy_assign) = delete;
+
+	~http_access_log();
+
+	// queue a record; false when it was dropped
+	bool
+	push(
+		const http_access_record & record
+	);
+
+	// write out everything queued so far, then stop the flusher. records
+	// pushed afterwards are dropped
+	void
+	stop();
+
+	std::size_t
+	capacity() const
+	{
+		return cells_.size();
+	}
+
+	overflow
+	policy() const
+	{
+		return policy_;
+	}
+
+	// records accepted into the ring
+	std::size_t
+	pushed() const
+	{
+		return pushed_.load(std::memory_order_relaxed);
+	}
+
+	// records lost to a full ring (or to a stopped log)
+	std::size_t
+	dropped() const
+	{
+		return dropped_.load(std::memory_order_relaxed);
+	}
+
+	// records handed to the logger
+	std::size_t
+	written() const
+	{
+		return written_.load(std::memory_order_relaxed);
+	}
+
+protected:
+	// bounded MPMC ring after Dmitry Vyukov; only one thread ever pops.
+	// a cell's sequence says whose turn it is: equal to the position when
+	// it is free for that push, position + 1 once it holds that record
+	struct alignas(64) cell
+	{
+		std::atomic<std::size_t> sequence{0};
+		http_access_record record;
+	};
+
+	bool
+	try_push(
+		const http_access_record & record
+	);
+
+	bool
+	try_pop(
+		http_access_record & record
+	);
+
+	void
+	wake_flusher();
+
+	void
+	run_flusher();
+
+	void
+	write(
+		const http_access_record & record
+	);
+
+	std::shared_ptr<spdlog::logger> logger_;
+	overflow policy_;
+	std::vector<cell> cells_;
+	std::size_t mask_;
+
+	alignas(64) std::atomic<std::size_t> enqueue_{0};
+	alignas(64) std::size_t dequeue_ = 0;
+
+	alignas(64) std::atomic<std::size_t> pushed_{0};
+	std::atomic<std::size_t> dropped_{0};
+	std::atomic<std::size_t> written_{0};
+
+	std::atomic<bool> stopping_{false};
+	std::atomic<bool> flusher_sleeping_{false};
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::thread flusher_;
+};
+
+} // namespace koti
@@ -0,0 +1,490 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace koti {
+
+// Bump allocator for everything belonging to one request: parsed header
+// fields, the request body, the response. Deallocation is a no-op; reset()
+// rewinds the whole arena at once between requests.
+//
+// Unlike std::pmr::monotonic_buffer_resource, reset() keeps every chunk
+// obtained so far, so once a connection has seen its largest request it
+// stops touching the upstream resource entirely. trim() lets go of all but
+// the first few, for a connection that goes idle.
+class http_arena
+: public std::pmr::memory_resource
+{
+public:
+	explicit
+	http_arena(
+		std::size_t initial_chunk_size = 4096,
+		std::pmr::memory_resource * upstream = std::pmr::new_delete_resource()
+	)
+	: upstream_(upstream)
+	, next_chunk_size_(initial_chunk_size)
+	{
+	}
+
+	http_arena(const http_arena & copy_ctor) = delete;
+	http_arena & operator=(const http_arena & copy_assign) = delete;
+
+	~http_arena() override
+	{
+		release();
+	}
+
+	// forget every allocation, keeping the chunks for reuse
+	void
+	reset(
+	)
+	{
+		current_ = head_;
+		used_ = 0;
+	}
+
+	// forget every allocation, keeping the first chunks up to retained
+	// bytes (always the first one) and giving the rest back upstream
+	void
+	trim(
+		std::size_t retained
+	)
+	{
+		reset();
+		if ( nullptr == head_ )
+		{
+			return;
+		}
+
+		auto * last = head_;
+		std::size_t kept = head_->size;
+		while ( last->next && kept + last->next->size <= retained )
+		{
+			last = last->next;
+			kept += last->size;
+		}
+
+		auto * at = last->next;
+		last->next = nullptr;
+		if ( at )
+		{
+			// grow again from where the released chunks started
+			next_chunk_size_ = at->size;
+		}
+		while ( at )
+		{
+			auto * next = at->next;
+			upstream_->deallocate(at, sizeof(chunk) + at->size, alignof(chunk));
+			at = next;
+		}
+	}
+
+	// forget every allocation and give the chunks back upstream
+	void
+	release(
+	)
+	{
+		while ( head_ )
+		{
+			auto * next = head_->next;
+			upstream_->deallocate(head_, sizeof(chunk) + head_->size, alignof(chunk));
+			head_ = next;
+		}
+		current_ = nullptr;
+		used_ = 0;
+	}
+
+	// bytes held in chunks, used or not
+	std::size_t
+	capacity() const
+	{
+		std::size_t total = 0;
+		for ( auto * at = head_; at; at = at->next )
+		{
+			total += at->size;
+		}
+		return total;
+	}
+
+protected:
+	struct alignas(std::max_align_t) chunk
+	{
+		chunk * next;
+		std::size_t size;
+
+		std::byte *
+		data()
+		{
+			return reinterpret_cast<std::byte *>(this + 1);
+		}
+	};
+
+	void *
+	do_allocate(
+		std::size_t bytes,
+		std::size_t alignment
+	) override
+	{
+		for ( ;; )
+		{
+			if ( current_ )
+			{
+				auto base = reinterpret_cast<std::uintptr_t>(current_->data());
+				auto aligned = (base + used_ + alignment - 1) & ~(alignment - 1);
+				auto end = aligned + bytes;
+				if ( end <= base + current_->size )
+				{
+					used_ = end - base;
+					return reinterpret_cast<void *>(aligned);
+				}
+
+				// move on to a chunk kept from an earlier request
+				if ( current_->next )
+				{
+					current_ = current_->next;
+					used_ = 0;
+					continue;
+				}
+			}
+
+			grow(bytes + alignment);
+		}
+	}
+
+	void
+	do_deallocate(
+		void *,
+		std::size_t,
+		std::size_t
+	) override
+	{
+	}
+
+	bool
+	do_is_equal(
+		const std::pmr::memory_resource & other
+	) const noexcept override
+	{
+		return this == &other;
+	}
+
+	void
+	grow(
+		std::size_t at_least
+	)
+	{
+		while ( next_chunk_size_ < at_least )
+		{
+			next_chunk_size_ *= 2;
+		}
+
+		auto * added = static_cast<chunk *>(
+			upstream_->allocate(sizeof(chunk) + next_chunk_size_, alignof(chunk))
+		);
+		added->next = nullptr;
+		added->size = next_chunk_size_;
+		next_chunk_size_ *= 2;
+
+		if ( current_ )
+		{
+			// current_ is always the last chunk when growing
+			current_->next = added;
+		}
+		else
+		{
+			head_ = added;
+		}
+		current_ = added;
+		used_ = 0;
+	}
+
+	std::pmr::memory_resource * upstream_;
+	std::size_t next_chunk_size_;
+	chunk * head_ = nullptr;
+	chunk * current_ = nullptr;
+	std::size_t used_ = 0;
+};
+
+// Allocator over a std::pmr::memory_resource (default: the global heap).
+// Like std::pmr::polymorphic_allocator, except that it is assignable, which
+// beast's basic_fields requires. The allocator never propagates on
+// assignment: a message keeps the resource it was constructed with, and a
+// message assigned in from another resource is copied into it.
+template <
+	typename T
+>
+class http_arena_allocator
+{
+public:
+	using value_type = T;
+	using propagate_on_container_copy_assignment = std::false_type;
+	using propagate_on_container_move_assignment = std::false_type;
+	using propagate_on_container_swap = std::false_type;
+
+	http_arena_allocator() noexcept
+	: resource_(std::pmr::new_delete_resource())
+	{
+	}
+
+	http_arena_allocator(
+		std::pmr::memory_resource * resource
+	) noexcept
+	: resource_(resource)
+	{
+	}
+
+	template <
+		typename U
+	>
+	http_arena_allocator(
+		const http_arena_allocator<U> & other
+	) noexcept
+	: resource_(other.resource())
+	{
+	}
+
+	T *
+	allocate(
+		std::size_t n
+	) const
+	{
+		return static_cast<T *>(resource_->allocate(sizeof(T) * n, alignof(T)));
+	}
+
+	void
+	deallocate(
+		T * pointer,
+		std::size_t n
+	) const
+	{
+		resource_->deallocate(pointer, sizeof(T) * n, alignof(T));
+	}
+
+	std::pmr::memory_resource *
+	resource() const noexcept
+	{
+		return resource_;
+	}
+
+	template <
+		typename U
+	>
+	friend
+	bool
+	operator==(
+		const http_arena_allocator & lhs,
+		const http_arena_allocator<U> & rhs
+	) noexcept
+	{
+		return lhs.resource_ == rhs.resource() || lhs.resource_->is_equal(*rhs.resource());
+	}
+
+	template <
+		typename U
+	>
+	friend
+	bool
+	operator!=(
+		const http_arena_allocator & lhs,
+		const http_arena_allocator<U> & rhs
+	) noexcept
+	{
+		return !(lhs == rhs);
+	}
+
+protected:
+	std::pmr::memory_resource * resource_;
+};
+
+// A few fixed slots for the state of a connection's in-flight asynchronous
+// operations. A connection has at most one read or write outstanding, and
+// each completes before the next starts, so the same slots are reused for
+// every request. Anything too large falls back to the heap.
+class http_handler_memory
+{
+public:
+	static constexpr std::size_t slot_size = 1024;
+	static constexpr std::size_t slot_count = 4;
+
+	http_handler_memory() = default;
+	http_handler_memory(const http_handler_memory & copy_ctor) = delete;
+	http_handler_memory & operator=(const http_handler_memory & copy_assign) = delete;
+
+	void *
+	allocate(
+		std::size_t size
+	)
+	{
+		if ( size <= slot_size )
+		{
+			for ( std::size_t i = 0; i < slot_count; ++i )
+			{
+				if ( ! in_use_[i] )
+				{
+					in_use_[i] = true;
+					return &slots_[i];
+				}
+			}
+		}
+		return ::operator new(size);
+	}
+
+	void
+	deallocate(
+		void * pointer
+	)
+	{
+		for ( std::size_t i = 0; i < slot_count; ++i )
+		{
+			if ( pointer == &slots_[i] )
+			{
+				in_use_[i] = false;
+				return;
+			}
+		}
+		::operator delete(pointer);
+	}
+
+protected:
+	std::aligned_storage_t<slot_size, alignof(std::max_align_t)> slots_[slot_count];
+	bool in_use_[slot_count] = {};
+};
+
+template <
+	typename T
+>
+class http_handler_allocator
+{
+public:
+	using value_type = T;
+
+	explicit
+	http_handler_allocator(
+		http_handler_memory & memory
+	) noexcept
+	: memory_(&memory)
+	{
+	}
+
+	template <
+		typename U
+	>
+	http_handler_allocator(
+		const http_handler_allocator<U> & other
+	) noexcept
+	: memory_(other.memory_)
+	{
+	}
+
+	T *
+	allocate(
+		std::size_t n
+	) const
+	{
+		return static_cast<T *>(memory_->allocate(sizeof(T) * n));
+	}
+
+	void
+	deallocate(
+		T * pointer,
+		std::size_t
+	) const
+	{
+		memory_->deallocate(pointer);
+	}
+
+	template <
+		typename U
+	>
+	friend
+	bool
+	operator==(
+		const http_handler_allocator & lhs,
+		const http_handler_allocator<U> & rhs
+	) noexcept
+	{
+		return lhs.memory_ == rhs.memory_;
+	}
+
+	template <
+		typename U
+	>
+	friend
+	bool
+	operator!=(
+		const http_handler_allocator & lhs,
+		const http_handler_allocator<U> & rhs
+	) noexcept
+	{
+		return lhs.memory_ != rhs.memory_;
+	}
+
+protected:
+	template <
+		typename
+	>
+	friend class http_handler_allocator;
+
+	http_handler_memory * memory_;
+};
+
+// Completion handler that asks asio/beast to allocate its operation state
+// from a connection's http_handler_memory.
+template <
+	typename Handler
+>
+class http_allocating_handler
+{
+public:
+	using allocator_type = http_handler_allocator<Handler>;
+
+	http_allocating_handler(
+		http_handler_memory & memory,
+		Handler handler
+	)
+	: memory_(memory)
+	, handler_(std::move(handler))
+	{
+	}
+
+	allocator_type
+	get_allocator() const noexcept
+	{
+		return allocator_type{memory_};
+	}
+
+	template <
+		typename... Args
+	>
+	void
+	operator()(
+		Args&&... args
+	)
+	{
+		handler_(std::forward<Args>(args)...);
+	}
+
+protected:
+	http_handler_memory & memory_;
+	Handler handler_;
+};
+
+template <
+	typename Handler
+>
+http_allocating_handler<std::decay_t<Handler>>
+make_http_allocating_handler(
+	http_handler_memory & memory,
+	Handler && handler
+)
+{
+	return {memory, std::forward<Handler>(handler)};
+}
+
+} // namespace koti
@@ -0,0 +1,82 @@
+#include "http_body_sink.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+} // extern "C"
+
+#include <cerrno>
+
+namespace koti {
+
+http_file_body_sink::http_file_body_sink(
+	fs::path path
+)
+: path_(std::move(path))
+{
+	fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if ( fd_ < 0 )
+	{
+		// reported by the first write, from the connection's error path
+		open_errno_ = errno;
+	}
+}
+
+http_file_body_sink::~http_file_body_sink()
+{
+	if ( 0 <= fd_ )
+	{
+		::close(fd_);
+	}
+}
+
+void
+http_file_body_sink::write(
+	std::string_view data,
+	boost::system::error_code & ec
+)
+{
+	if ( fd_ < 0 )
+	{
+		ec.assign(open_errno_, boost::system::system_category());
+		return;
+	}
+
+	while ( ! data.empty() )
+	{
+		auto written = ::write(fd_, data.data(), data.size());
+		if ( written < 0 )
+		{
+			if ( EINTR == errno )
+			{
+				continue;
+			}
+			ec.assign(errno, boost::system::system_category());
+			return;
+		}
+		data.remove_prefix(static_cast<std::size_t>(written));
+		size_ += static_cast<std::uint64_t>(written);
+	}
+}
+
+void
+http_file_body_sink::finish(
+	boost::system::error_code & ec
+)
+{
+	if ( fd_ < 0 )
+	{
+		ec.assign(open_errno_, boost::system::system_category());
+		return;
+	}
+
+	if ( 0 != ::close(fd_) )
+	{
+		ec.assign(errno, boost::system::system_category());
+	}
+	fd_ = -1;
+}
+
+} // namespace koti
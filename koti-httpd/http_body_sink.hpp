@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <utility>
+
+#include <boost/filesystem/path.hpp>
+namespace fs = boost::filesystem;
+
+#include <boost/system/error_code.hpp>
+
+namespace koti {
+
+// Receives a request body piece by piece as it comes off the socket, so
+// the body never has to fit in memory. See http_endpoint::body_handling().
+class http_body_sink
+{
+public:
+	virtual
+	~http_body_sink() = default;
+
+	// the next piece of the body, in order. setting ec abandons the
+	// request: the client is answered with 500 and disconnected
+	virtual
+	void
+	write(
+		std::string_view data,
+		boost::system::error_code & ec
+	) = 0;
+
+	// the whole body has been written
+	virtual
+	void
+	finish(
+		boost::system::error_code & ec
+	)
+	{
+		(void)ec;
+	}
+};
+
+// Writes the body to a file, created or truncated when the sink is made.
+class http_file_body_sink
+: public http_body_sink
+{
+public:
+	explicit
+	http_file_body_sink(
+		fs::path path
+	);
+
+	http_file_body_sink(const http_file_body_sink & copy_ctor) = delete;
+	http_file_body_sink & operator=(const http_file_body_sink & copy_assign) = delete;
+
+	~http_file_body_sink() override;
+
+	void
+	write(
+		std::string_view data,
+		boost::system::error_code & ec
+	) override;
+
+	void
+	finish(
+		boost::system::error_code & ec
+	) override;
+
+	const fs::path &
+	path() const
+	{
+		return path_;
+	}
+
+	// bytes written so far
+	std::uint64_t
+	size() const
+	{
+		return size_;
+	}
+
+protected:
+	fs::path path_;
+	int fd_ = -1;
+	int open_errno_ = 0;
+	std::uint64_t size_ = 0;
+};
+
+// Hands every piece of the body to a callback.
+class http_callback_body_sink
+: public http_body_sink
+{
+public:
+	using callback = std::function<void(std::string_view, boost::system::error_code &)>;
+
+	explicit
+	http_callback_body_sink(
+		callback on_data
+	)
+	: on_data_(std::move(on_data))
+	{
+	}
+
+	void
+	write(
+		std::string_view data,
+		boost::system::error_code & ec
+	) override
+	{
+		on_data_(data, ec);
+	}
+
+protected:
+	callback on_data_;
+};
+
+} // namespace koti
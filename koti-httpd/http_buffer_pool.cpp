@@ -0,0 +1,167 @@
+#include "http_buffer_pool.hpp"
+
+#include <new>
+
+namespace koti {
+
+http_buffer_pool::http_buffer_pool(
+	std::size_t retained_limit
+)
+: retained_limit_(retained_limit)
+{
+}
+
+http_buffer_pool::~http_buffer_pool()
+{
+	trim();
+}
+
+// the statistics only ever feed stats(), which does not need them to agree
+// with each other or with the free lists to the byte, so every counter is
+// relaxed
+
+void *
+http_buffer_pool::allocate(
+	std::size_t bytes
+)
+{
+	auto index = class_of(bytes);
+	if ( class_count == index )
+	{
+		oversize_.allocations.fetch_add(1, std::memory_order_relaxed);
+		oversize_.bytes_in_use.fetch_add(bytes, std::memory_order_relaxed);
+		return ::operator new(bytes);
+	}
+
+	auto size = class_size(index);
+	auto & from = classes_[index];
+	from.allocations.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock{from.mutex};
+		if ( auto * reused = from.head )
+		{
+			from.head = reused->next;
+			--from.cached;
+			++from.reused;
+			bytes_cached_.fetch_sub(size, std::memory_order_relaxed);
+			return reused;
+		}
+	}
+
+	return ::operator new(size);
+}
+
+void
+http_buffer_pool::deallocate(
+	void * pointer,
+	std::size_t bytes
+) noexcept
+{
+	if ( nullptr == pointer )
+	{
+		return;
+	}
+
+	auto index = class_of(bytes);
+	if ( class_count == index )
+	{
+		oversize_.releases.fetch_add(1, std::memory_order_relaxed);
+		oversize_.bytes_in_use.fetch_sub(bytes, std::memory_order_relaxed);
+		::operator delete(pointer);
+		return;
+	}
+
+	auto size = class_size(index);
+	auto & to = classes_[index];
+	to.releases.fetch_add(1, std::memory_order_relaxed);
+
+	if (
+		retained_limit_.load(std::memory_order_relaxed)
+		< bytes_cached_.load(std::memory_order_relaxed) + size
+	)
+	{
+		::operator delete(pointer);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock{to.mutex};
+	auto * returned = static_cast<free_buffer *>(pointer);
+	returned->next = to.head;
+	to.head = returned;
+	++to.cached;
+	bytes_cached_.fetch_add(size, std::memory_order_relaxed);
+}
+
+void
+http_buffer_pool::trim()
+{
+	for ( std::size_t index = 0; index < class_count; ++index )
+	{
+		auto & at = classes_[index];
+		free_buffer * head;
+		std::size_t cached;
+		{
+			std::lock_guard<std::mutex> lock{at.mutex};
+			head = at.head;
+			cached = at.cached;
+			at.head = nullptr;
+			at.cached = 0;
+		}
+
+		bytes_cached_.fetch_sub(cached * class_size(index), std::memory_order_relaxed);
+
+		while ( head )
+		{
+			auto * next = head->next;
+			::operator delete(head);
+			head = next;
+		}
+	}
+}
+
+void
+http_buffer_pool::set_retained_limit(
+	std::size_t bytes
+)
+{
+	retained_limit_.store(bytes, std::memory_order_relaxed);
+}
+
+std::size_t
+http_buffer_pool::retained_limit() const
+{
+	return retained_limit_.load(std::memory_order_relaxed);
+}
+
+http_buffer_pool::statistics
+http_buffer_pool::stats() const
+{
+	// releases before allocations, so that in use never goes below zero
+	statistics s;
+	for ( std::size_t index = 0; index < class_count; ++index )
+	{
+		const auto & at = classes_[index];
+		auto releases = at.releases.load(std::memory_order_relaxed);
+		auto allocations = at.allocations.load(std::memory_order_relaxed);
+		auto in_use = allocations - releases;
+
+		s.allocations += allocations;
+		s.buffers_in_use += in_use;
+		s.bytes_in_use += in_use * class_size(index);
+
+		std::lock_guard<std::mutex> lock{at.mutex};
+		s.reused += at.reused;
+		s.buffers_cached += at.cached;
+		s.bytes_cached += at.cached * class_size(index);
+	}
+
+	auto releases = oversize_.releases.load(std::memory_order_relaxed);
+	auto allocations = oversize_.allocations.load(std::memory_order_relaxed);
+	s.allocations += allocations;
+	s.oversize = allocations;
+	s.buffers_in_use += allocations - releases;
+	s.bytes_in_use += oversize_.bytes_in_use.load(std::memory_order_relaxed);
+	return s;
+}
+
+} // namespace koti
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <type_traits>
+
+namespace koti {
+
+// Shared cache of read buffers, in power-of-two size classes from
+// min_class_size to max_class_size. A buffer handed back is kept on its
+// class's free list for the next connection that needs one of that size,
+// up to (roughly) retained_limit bytes across all classes; anything beyond that, or
+// larger than the biggest class, goes straight back to the heap.
+//
+// Connections on every io_context thread share one pool, so each class
+// has its own lock and keeps its own statistics on its own cache line;
+// stats() sums them.
+class http_buffer_pool
+{
+public:
+	static constexpr std::size_t min_class_size = 512;
+	static constexpr std::size_t max_class_size = 64 * 1024;
+	static constexpr std::size_t class_count = 8;
+
+	static_assert(min_class_size << (class_count - 1) == max_class_size);
+
+	struct statistics
+	{
+		// buffers handed out, and how many of those came off a free list
+		std::size_t allocations = 0;
+		std::size_t reused = 0;
+
+		// buffers too large for any class
+		std::size_t oversize = 0;
+
+		// lent out right now
+		std::size_t buffers_in_use = 0;
+		std::size_t bytes_in_use = 0;
+
+		// sitting on the free lists
+		std::size_t buffers_cached = 0;
+		std::size_t bytes_cached = 0;
+	};
+
+	explicit
+	http_buffer_pool(
+		std::size_t retained_limit = 16 * 1024 * 1024
+	);
+
+	http_buffer_pool(const http_buffer_pool & copy_ctor) = delete;
+	http_buffer_pool & operator=(const http_buffer_pool & copy_assign) = delete;
+
+	~http_buffer_pool();
+
+	// at least bytes long; must be returned with the same bytes
+	void *
+	allocate(
+		std::size_t bytes
+	);
+
+	void
+	deallocate(
+		void * pointer,
+		std::size_t bytes
+	) noexcept;
+
+	// give every cached buffer back to the heap
+	void
+	trim();
+
+	void
+	set_retained_limit(
+		std::size_t bytes
+	);
+
+	std::size_t
+	retained_limit() const;
+
+	statistics
+	stats() const;
+
+	// size class serving bytes, or class_count when there is none
+	static
+	constexpr
+	std::size_t
+	class_of(
+		std::size_t bytes
+	)
+	{
+		std::size_t index = 0;
+		for ( auto size = min_class_size; size < bytes; size <<= 1 )
+		{
+			if ( class_count == ++index )
+			{
+				break;
+			}
+		}
+		return index;
+	}
+
+	static
+	constexpr
+	std::size_t
+	class_size(
+		std::size_t index
+	)
+	{
+		return min_class_size << index;
+	}
+
+protected:
+	struct free_buffer
+	{
+		free_buffer * next;
+	};
+
+	struct alignas(64) size_class
+	{
+		mutable std::mutex mutex;
+		free_buffer * head = nullptr;
+
+		// with mutex held
+		std::size_t cached = 0;
+		std::size_t reused = 0;
+
+		// buffers handed out and given back; the difference is in use
+		std::atomic<std::size_t> allocations{0};
+		std::atomic<std::size_t> releases{0};
+	};
+
+	// buffers too large for any class
+	struct alignas(64) oversize_class
+	{
+		std::atomic<std::size_t> allocations{0};
+		std::atomic<std::size_t> releases{0};
+		std::atomic<std::size_t> bytes_in_use{0};
+	};
+
+	std::array<size_class, class_count> classes_;
+	oversize_class oversize_;
+
+	// across all classes, against retained_limit_
+	alignas(64) std::atomic<std::size_t> bytes_cached_{0};
+	std::atomic<std::size_t> retained_limit_;
+};
+
+// Allocator for beast::basic_flat_buffer that borrows from an
+// http_buffer_pool. Without a pool it is the global heap. It propagates on
+// move assignment, which is how a connection's buffer is pointed at a pool.
+template <
+	typename T
+>
+class http_buffer_allocator
+{
+public:
+	using value_type = T;
+	using propagate_on_container_copy_assignment = std::true_type;
+	using propagate_on_container_move_assignment = std::true_type;
+	using propagate_on_container_swap = std::true_type;
+
+	http_buffer_allocator() noexcept = default;
+
+	explicit
+	http_buffer_allocator(
+		http_buffer_pool * pool
+	) noexcept
+	: pool_(pool)
+	{
+	}
+
+	template <
+		typename U
+	>
+	http_buffer_allocator(
+		const http_buffer_allocator<U> & other
+	) noexcept
+	: pool_(other.pool())
+	{
+	}
+
+	T *
+	allocate(
+		std::size_t n
+	) const
+	{
+		if ( pool_ )
+		{
+			return static_cast<T *>(pool_->allocate(sizeof(T) * n));
+		}
+		return static_cast<T *>(::operator new(sizeof(T) * n));
+	}
+
+	void
+	deallocate(
+		T * pointer,
+		std::size_t n
+	) const noexcept
+	{
+		if ( pool_ )
+		{
+			pool_->deallocate(pointer, sizeof(T) * n);
+			return;
+		}
+		::operator delete(pointer);
+	}
+
+	http_buffer_pool *
+	pool() const noexcept
+	{
+		return pool_;
+	}
+
+	template <
+		typename U
+	>
+	friend
+	bool
+	operator==(
+		const http_buffer_allocator & lhs,
+		const http_buffer_allocator<U> & rhs
+	) noexcept
+	{
+		return lhs.pool_ == rhs.pool();
+	}
+
+	template <
+		typename U
+	>
+	friend
+	bool
+	operator!=(
+		const http_buffer_allocator & lhs,
+		const http_buffer_allocator<U> & rhs
+	) noexcept
+	{
+		return !(lhs == rhs);
+	}
+
+protected:
+	http_buffer_pool * pool_ = nullptr;
+};
+
+} // namespace koti
@@ -0,0 +1,625 @@
+#include "http_compression.hpp"
+
+extern "C" {
+#include <bzlib.h>
+#include <zlib.h>
+} // extern "C"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+namespace koti {
+
+namespace {
+
+std::string_view
+to_std(
+	boost::string_view value
+)
+{
+	return {value.data(), value.size()};
+}
+
+std::string_view
+trim(
+	std::string_view value
+)
+{
+	while ( ! value.empty() && ( ' ' == value.front() || '\t' == value.front() ) )
+	{
+		value.remove_prefix(1);
+	}
+	while ( ! value.empty() && ( ' ' == value.back() || '\t' == value.back() ) )
+	{
+		value.remove_suffix(1);
+	}
+	return value;
+}
+
+bool
+iequals(
+	std::string_view lhs,
+	std::string_view rhs
+)
+{
+	return lhs.size() == rhs.size() && std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](char l, char r)
+	{
+		return std::tolower(static_cast<unsigned char>(l)) == std::tolower(static_cast<unsigned char>(r));
+	});
+}
+
+bool
+istarts_with(
+	std::string_view value,
+	std::string_view prefix
+)
+{
+	return prefix.size() <= value.size() && iequals(value.substr(0, prefix.size()), prefix);
+}
+
+// calls each(element) for every comma separated element of list
+template <
+	class Each
+>
+void
+for_each_element(
+	std::string_view list,
+	Each each
+)
+{
+	while ( ! list.empty() )
+	{
+		auto comma = list.find(',');
+		auto element = trim(list.substr(0, comma));
+		list.remove_prefix(std::string_view::npos == comma ? list.size() : comma + 1);
+		if ( ! element.empty() )
+		{
+			each(element);
+		}
+	}
+}
+
+// q-value of an Accept-Encoding element, in thousandths; `gzip;q=0.5` is
+// 500, a missing or malformed q is 1000
+int
+quality(
+	std::string_view parameters
+)
+{
+	auto q = parameters.find("q=");
+	if ( std::string_view::npos == q )
+	{
+		q = parameters.find("Q=");
+	}
+	if ( std::string_view::npos == q )
+	{
+		return 1000;
+	}
+
+	auto value = trim(parameters.substr(q + 2));
+	if ( value.empty() || ( '0' != value.front() && '1' != value.front() ) )
+	{
+		return 1000;
+	}
+	int thousandths = ( '1' == value.front() ) ? 1000 : 0;
+	value.remove_prefix(1);
+	if ( ! value.empty() && '.' == value.front() )
+	{
+		value.remove_prefix(1);
+		int scale = 100;
+		while ( ! value.empty() && '0' <= value.front() && value.front() <= '9' && 0 < scale )
+		{
+			thousandths += ( value.front() - '0' ) * scale;
+			scale /= 10;
+			value.remove_prefix(1);
+		}
+	}
+	return std::min(thousandths, 1000);
+}
+
+// q-value accept_encoding gives coding, in thousandths; -1 when it does not
+// mention it at all, not even through `*`
+int
+coding_quality(
+	std::string_view accept_encoding,
+	http_content_coding coding
+)
+{
+	int named = -1;
+	int wildcard = -1;
+	for_each_element(accept_encoding, [&](std::string_view element)
+	{
+		auto semicolon = element.find(';');
+		auto token = trim(element.substr(0, semicolon));
+		auto q = quality(std::string_view::npos == semicolon ? std::string_view{} : element.substr(semicolon + 1));
+
+		if ( "*" == token )
+		{
+			wildcard = q;
+		}
+		else if (
+			iequals(token, http_coding_name(coding))
+			|| ( http_content_coding::gzip == coding && iequals(token, "x-gzip") )
+		)
+		{
+			named = q;
+		}
+	});
+	return 0 <= named ? named : wildcard;
+}
+
+std::uint64_t
+mix(
+	std::uint64_t h
+)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+// word at a time; seed picks one of a family of hashes
+std::uint64_t
+hash_bytes(
+	std::string_view bytes,
+	std::uint64_t seed
+)
+{
+	std::uint64_t h = mix(seed ^ bytes.size());
+	std::size_t i = 0;
+	for ( ; i + 8 <= bytes.size(); i += 8 )
+	{
+		std::uint64_t word;
+		std::memcpy(&word, bytes.data() + i, sizeof(word));
+		h = mix(h ^ word) + 0x9e3779b97f4a7c15ull;
+	}
+
+	std::uint64_t tail = 0;
+	if ( i < bytes.size() )
+	{
+		std::memcpy(&tail, bytes.data() + i, bytes.size() - i);
+	}
+	return mix(h ^ tail);
+}
+
+} // namespace
+
+std::string_view
+http_coding_name(
+	http_content_coding coding
+)
+{
+	switch ( coding )
+	{
+	case http_content_coding::gzip:
+		return "gzip";
+	case http_content_coding::bzip2:
+		return "bzip2";
+	case http_content_coding::identity:
+		break;
+	}
+	return "identity";
+}
+
+http_content_coding
+http_negotiate_coding(
+	boost::string_view accept_encoding,
+	const http_compression_policy & policy
+)
+{
+	if ( accept_encoding.empty() )
+	{
+		return http_content_coding::identity;
+	}
+
+	auto best = http_content_coding::identity;
+	int best_quality = 0;
+	auto consider = [&](bool allowed, http_content_coding coding)
+	{
+		if ( allowed )
+		{
+			auto q = coding_quality(to_std(accept_encoding), coding);
+			if ( best_quality < q )
+			{
+				best = coding;
+				best_quality = q;
+			}
+		}
+	};
+
+	// in order of preference on a tie
+	consider(policy.gzip, http_content_coding::gzip);
+	consider(policy.bzip2, http_content_coding::bzip2);
+	return best;
+}
+
+bool
+http_accepts_coding(
+	boost::string_view accept_encoding,
+	http_content_coding coding
+)
+{
+	return 0 < coding_quality(to_std(accept_encoding), coding);
+}
+
+struct http_compressor::state
+{
+	z_stream zlib{};
+	bz_stream bzip2{};
+	bool finished = false;
+};
+
+http_compressor::http_compressor(
+	http_content_coding coding,
+	int level
+)
+: coding_(coding)
+, state_(std::make_unique<state>())
+{
+	switch ( coding_ )
+	{
+	case http_content_coding::gzip:
+		// 16 + window bits asks for a gzip header and trailer
+		if ( Z_OK != ::deflateInit2(&state_->zlib, std::clamp(level, 1, 9), Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) )
+		{
+			throw std::runtime_error{"deflateInit2 failed"};
+		}
+		break;
+
+	case http_content_coding::bzip2:
+		if ( BZ_OK != ::BZ2_bzCompressInit(&state_->bzip2, std::clamp(level, 1, 9), 0, 0) )
+		{
+			throw std::runtime_error{"BZ2_bzCompressInit failed"};
+		}
+		break;
+
+	case http_content_coding::identity:
+		throw std::invalid_argument{"identity is not a compression"};
+	}
+}
+
+http_compressor::~http_compressor()
+{
+	if ( http_content_coding::gzip == coding_ )
+	{
+		::deflateEnd(&state_->zlib);
+	}
+	else
+	{
+		::BZ2_bzCompressEnd(&state_->bzip2);
+	}
+}
+
+void
+http_compressor::write(
+	std::string_view in,
+	std::string & out,
+	bool flush
+)
+{
+	run(in, out, flush ? 1 : 0);
+}
+
+void
+http_compressor::finish(
+	std::string & out
+)
+{
+	run({}, out, 2);
+	state_->finished = true;
+}
+
+void
+http_compressor::compress(
+	http_content_coding coding,
+	int level,
+	std::string_view in,
+	std::string & out
+)
+{
+	http_compressor compressor{coding, level};
+	out.reserve(out.size() + in.size() / 2 + 64);
+	compressor.write(in, out);
+	compressor.finish(out);
+}
+
+// action: 0 compresses what it can, 1 flushes everything so far, 2 ends
+// the stream
+void
+http_compressor::run(
+	std::string_view in,
+	std::string & out,
+	int action
+)
+{
+	if ( state_->finished )
+	{
+		throw std::logic_error{"http_compressor written after finish"};
+	}
+
+	// the libraries count in unsigned int
+	constexpr std::size_t most = UINT_MAX / 2;
+
+	for ( ;; )
+	{
+		auto piece = in.substr(0, most);
+		in.remove_prefix(piece.size());
+		bool last = in.empty();
+
+		auto used = out.size();
+		out.resize(used + std::max<std::size_t>(piece.size() / 2 + 64, 4096));
+		auto room = [&]()
+		{
+			return static_cast<unsigned>(std::min(out.size() - used, most));
+		};
+
+		if ( http_content_coding::gzip == coding_ )
+		{
+			auto & z = state_->zlib;
+			z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(piece.data()));
+			z.avail_in = static_cast<uInt>(piece.size());
+			int flush = ! last || 0 == action ? Z_NO_FLUSH : 1 == action ? Z_SYNC_FLUSH : Z_FINISH;
+			for ( ;; )
+			{
+				z.next_out = reinterpret_cast<Bytef *>(&out[used]);
+				z.avail_out = room();
+				auto result = ::deflate(&z, flush);
+				if ( Z_STREAM_ERROR == result )
+				{
+					throw std::runtime_error{"deflate failed"};
+				}
+				used = out.size() - z.avail_out;
+
+				bool done = Z_FINISH == flush
+					? Z_STREAM_END == result
+					: 0 == z.avail_in && 0 != z.avail_out;
+				if ( done )
+				{
+					break;
+				}
+				out.resize(out.size() * 2);
+			}
+		}
+		else
+		{
+			auto & bz = state_->bzip2;
+			bz.next_in = const_cast<char *>(piece.data());
+			bz.avail_in = static_cast<unsigned>(piece.size());
+			int mode = ! last || 0 == action ? BZ_RUN : 1 == action ? BZ_FLUSH : BZ_FINISH;
+
+			// running with nothing to take in is an error to bzip2
+			for ( ; BZ_RUN != mode || 0 != bz.avail_in; )
+			{
+				bz.next_out = &out[used];
+				bz.avail_out = room();
+				auto result = ::BZ2_bzCompress(&bz, mode);
+				if ( result < 0 )
+				{
+					throw std::runtime_error{"BZ2_bzCompress failed"};
+				}
+				used = out.size() - bz.avail_out;
+
+				bool done = BZ_RUN == mode
+					? 0 == bz.avail_in
+					: BZ_FLUSH == mode
+					? BZ_RUN_OK == result
+					: BZ_STREAM_END == result;
+				if ( done )
+				{
+					break;
+				}
+				if ( 0 == bz.avail_out )
+				{
+					out.resize(out.size() * 2);
+				}
+			}
+		}
+
+		out.resize(used);
+		if ( last )
+		{
+			return;
+		}
+	}
+}
+
+http_compression_cache::http_compression_cache(
+	std::size_t capacity_bytes
+)
+: capacity_(capacity_bytes)
+{
+}
+
+http_compression_cache::key
+http_compression_cache::key_of(
+	http_content_coding coding,
+	int level,
+	std::string_view content
+)
+{
+	auto variant = static_cast<std::uint64_t>(coding) << 8 | static_cast<std::uint64_t>(level & 0xff);
+	key k;
+	k.first = hash_bytes(content, variant);
+	k.second = hash_bytes(content, ~variant);
+	k.length = content.size();
+	return k;
+}
+
+std::shared_ptr<const std::string>
+http_compression_cache::find(
+	http_content_coding coding,
+	int level,
+	std::string_view content
+)
+{
+	if ( 0 == capacity_ )
+	{
+		return {};
+	}
+
+	auto k = key_of(coding, level, content);
+
+	std::lock_guard<std::mutex> lock{mutex_};
+	auto found = index_.find(k);
+	if ( index_.end() == found )
+	{
+		misses_.fetch_add(1, std::memory_order_relaxed);
+		return {};
+	}
+
+	hits_.fetch_add(1, std::memory_order_relaxed);
+	entries_.splice(entries_.begin(), entries_, found->second);
+	return entries_.front().second;
+}
+
+void
+http_compression_cache::insert(
+	http_content_coding coding,
+	int level,
+	std::string_view content,
+	std::shared_ptr<const std::string> compressed
+)
+{
+	if ( ! compressed || capacity_ < compressed->size() )
+	{
+		return;
+	}
+
+	auto k = key_of(coding, level, content);
+
+	std::lock_guard<std::mutex> lock{mutex_};
+
+	// another thread may have compressed it in the meantime
+	auto found = index_.find(k);
+	if ( index_.end() != found )
+	{
+		bytes_ -= found->second->second->size();
+		entries_.erase(found->second);
+		index_.erase(found);
+	}
+
+	bytes_ += compressed->size();
+	entries_.emplace_front(k, std::move(compressed));
+	index_.emplace(k, entries_.begin());
+
+	while ( capacity_ < bytes_ )
+	{
+		bytes_ -= entries_.back().second->size();
+		index_.erase(entries_.back().first);
+		entries_.pop_back();
+	}
+}
+
+std::size_t
+http_compression_cache::size() const
+{
+	std::lock_guard<std::mutex> lock{mutex_};
+	return bytes_;
+}
+
+http_compression::http_compression(
+	const http_compression_policy & policy
+)
+: policy_(policy)
+, cache_(policy.cache_bytes)
+{
+}
+
+int
+http_compression::level(
+	http_content_coding coding
+) const
+{
+	return http_content_coding::bzip2 == coding ? policy_.bzip2_level : policy_.gzip_level;
+}
+
+bool
+http_compression::compress(
+	http_content_coding coding,
+	std::string_view content,
+	std::shared_ptr<const std::string> & out
+)
+{
+	auto level = this->level(coding);
+	bool cacheable = content.size() <= policy_.cache_maximum_entry;
+
+	std::shared_ptr<const std::string> compressed;
+	if ( cacheable )
+	{
+		compressed = cache_.find(coding, level, content);
+	}
+	if ( ! compressed )
+	{
+		// incompressible payloads are cached too, so they are only tried once
+		auto fresh = std::make_shared<std::string>();
+		http_compressor::compress(coding, level, content, *fresh);
+		compressed = std::move(fresh);
+		if ( cacheable )
+		{
+			cache_.insert(coding, level, content, compressed);
+		}
+	}
+
+	if ( content.size() <= compressed->size() )
+	{
+		return false;
+	}
+	out = std::move(compressed);
+	return true;
+}
+
+bool
+http_compression::forbids_transform(
+	boost::string_view cache_control
+)
+{
+	bool forbidden = false;
+	for_each_element(to_std(cache_control), [&](std::string_view directive)
+	{
+		forbidden = forbidden || iequals(directive, "no-transform");
+	});
+	return forbidden;
+}
+
+bool
+http_compression::compressible_type(
+	boost::string_view content_type
+)
+{
+	auto type = trim(to_std(content_type));
+	if ( istarts_with(type, "image/svg+xml") )
+	{
+		return true;
+	}
+
+	// compressed already; another pass only costs time
+	static constexpr std::string_view compressed[] = {
+		"image/",
+		"video/",
+		"audio/",
+		"font/woff",
+		"application/gzip",
+		"application/x-gzip",
+		"application/x-bzip2",
+		"application/x-xz",
+		"application/zip",
+		"application/zstd",
+	};
+	for ( auto prefix : compressed )
+	{
+		if ( istarts_with(type, prefix) )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+} // namespace koti
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <boost/beast/http/field.hpp>
+#include <boost/utility/string_view.hpp>
+
+namespace koti {
+
+// Content codings responses can be compressed with. bzip2 is not a
+// registered HTTP coding, but is what the clients that want it send.
+enum class http_content_coding
+{
+	identity,
+	gzip,
+	bzip2
+};
+
+// the token for coding in Accept-Encoding and Content-Encoding
+std::string_view
+http_coding_name(
+	http_content_coding coding
+);
+
+// What gets compressed, and how hard.
+struct http_compression_policy
+{
+	bool gzip = true;
+
+	// slow; only for clients on links where every byte counts
+	bool bzip2 = false;
+
+	// zlib levels, 1 (fastest) to 9 (smallest)
+	int gzip_level = 6;
+
+	// bzip2 block size in units of 100k, 1 to 9
+	int bzip2_level = 9;
+
+	// bodies smaller than this are sent as they are
+	std::size_t minimum_size = 1024;
+
+	// bytes of compressed payloads kept for responses that repeat; 0 keeps
+	// none
+	std::size_t cache_bytes = 16 * 1024 * 1024;
+
+	// bodies larger than this are compressed every time
+	std::size_t cache_maximum_entry = 1024 * 1024;
+};
+
+// the coding the client prefers among those policy allows, by the q-values
+// of its Accept-Encoding; gzip wins a tie. identity when there is none
+http_content_coding
+http_negotiate_coding(
+	boost::string_view accept_encoding,
+	const http_compression_policy & policy
+);
+
+// whether accept_encoding allows coding at all, whatever its preference
+bool
+http_accepts_coding(
+	boost::string_view accept_encoding,
+	http_content_coding coding
+);
+
+// Incremental zlib (gzip framing) or bzip2 compressor. Output is appended
+// to whatever is passed in; with flush, everything written so far comes
+// out, at some cost in ratio, so a streamed body can be decoded as it
+// arrives. Throws std::runtime_error when the library fails.
+class http_compressor
+{
+public:
+	http_compressor(
+		http_content_coding coding,
+		int level
+	);
+
+	http_compressor(const http_compressor & copy_ctor) = delete;
+	http_compressor & operator=(const http_compressor & copy_assign) = delete;
+
+	~http_compressor();
+
+	http_content_coding
+	coding() const
+	{
+		return coding_;
+	}
+
+	void
+	write(
+		std::string_view in,
+		std::string & out,
+		bool flush = false
+	);
+
+	// ends the stream; nothing may be written afterwards
+	void
+	finish(
+		std::string & out
+	);
+
+	// in, compressed whole, into out
+	static
+	void
+	compress(
+		http_content_coding coding,
+		int level,
+		std::string_view in,
+		std::string & out
+	);
+
+protected:
+	struct state;
+
+	void
+	run(
+		std::string_view in,
+		std::string & out,
+		int action
+	);
+
+	http_content_coding coding_;
+	std::unique_ptr<state> state_;
+};
+
+// Compressed payloads of recent responses, addressed by their content:
+// the key is a hash of the uncompressed body and the coding and level it
+// was compressed with, so any endpoint returning the same bytes shares an
+// entry. Least recently used entries go once the cache holds more than
+// its byte limit. Safe to use from every thread.
+class http_compression_cache
+{
+public:
+	explicit
+	http_compression_cache(
+		std::size_t capacity_bytes
+	);
+
+	http_compression_cache(const http_compression_cache & copy_ctor) = delete;
+	http_compression_cache & operator=(const http_compression_cache & copy_assign) = delete;
+
+	// the compressed payload of content, or null
+	std::shared_ptr<const std::string>
+	find(
+		http_content_coding coding,
+		int level,
+		std::string_view content
+	);
+
+	void
+	insert(
+		http_content_coding coding,
+		int level,
+		std::string_view content,
+		std::shared_ptr<const std::string> compressed
+	);
+
+	std::size_t
+	capacity() const
+	{
+		return capacity_;
+	}
+
+	// bytes of compressed payloads held
+	std::size_t
+	size() const;
+
+	std::uint64_t
+	hits() const
+	{
+		return hits_.load(std::memory_order_relaxed);
+	}
+
+	std::uint64_t
+	misses() const
+	{
+		return misses_.load(std::memory_order_relaxed);
+	}
+
+protected:
+	// two independent hashes and the length; telling apart two bodies
+	// that agree on all three is not worth keeping a copy of each
+	struct key
+	{
+		std::uint64_t first = 0;
+		std::uint64_t second = 0;
+		std::uint64_t length = 0;
+
+		bool
+		operator==(
+			const key & other
+		) const
+		{
+			return first == other.first && second == other.second && length == other.length;
+		}
+	};
+
+	struct key_hash
+	{
+		std::size_t
+		operator()(
+			const key & k
+		) const
+		{
+			return static_cast<std::size_t>(k.first);
+		}
+	};
+
+	static
+	key
+	key_of(
+		http_content_coding coding,
+		int level,
+		std::string_view content
+	);
+
+	using entry = std::pair<key, std::shared_ptr<const std::string>>;
+	using entries = std::list<entry>;
+
+	std::size_t capacity_;
+	mutable std::mutex mutex_;
+
+	// most recently used first
+	entries entries_;
+	std::unordered_map<key, entries::iterator, key_hash> index_;
+	std::size_t bytes_ = 0;
+	std::atomic<std::uint64_t> hits_{0};
+	std::atomic<std::uint64_t> misses_{0};
+};
+
+// Response compression for a server: the policy, and the cache shared by
+// every connection it is handed to (see http_connection::set_compression()).
+class http_compression
+{
+public:
+	explicit
+	http_compression(
+		const http_compression_policy & policy
+	);
+
+	http_compression(const http_compression & copy_ctor) = delete;
+	http_compression & operator=(const http_compression & copy_assign) = delete;
+
+	const http_compression_policy &
+	policy() const
+	{
+		return policy_;
+	}
+
+	http_compression_cache &
+	cache()
+	{
+		return cache_;
+	}
+
+	// the level policy has for coding
+	int
+	level(
+		http_content_coding coding
+	) const;
+
+	// whether a response with this status and these fields may be
+	// compressed at all, size aside: a full, not already encoded response
+	// to something other than HEAD, of a type that is not compressed
+	// already, that does not forbid transformation
+	template <
+		class Fields
+	>
+	static
+	bool
+	eligible(
+		bool head,
+		unsigned status,
+		const Fields & response
+	)
+	{
+		using field = boost::beast::http::field;
+		return false == head
+			&& 200 <= status && status < 300 && 204 != status && 206 != status
+			&& response.end() == response.find(field::content_encoding)
+			&& response.end() == response.find(field::content_range)
+			&& false == forbids_transform(response[field::cache_control])
+			&& compressible_type(response[field::content_type]);
+	}
+
+	// content, compressed with coding into out, through the cache. false
+	// when compressing does not make it any smaller; out is then untouched
+	bool
+	compress(
+		http_content_coding coding,
+		std::string_view content,
+		std::shared_ptr<const std::string> & out
+	);
+
+	static
+	bool
+	forbids_transform(
+		boost::string_view cache_control
+	);
+
+	static
+	bool
+	compressible_type(
+		boost::string_view content_type
+	);
+
+protected:
+	http_compression_policy policy_;
+	http_compression_cache cache_;
+};
+
+} // namespace koti
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <exception>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include <boost/asio.hpp>
+namespace asio = boost::asio;
+
+#include <boost/system/system_error.hpp>
+
+#include "httpd.hpp"
+#include "worker_pool.hpp"
+
+namespace koti {
+
+namespace detail {
+
+template <
+	typename Handler,
+	typename Function
+>
+struct worker_pool_operation
+{
+	using executor_type = asio::associated_executor_t<Handler>;
+
+	worker_pool_operation(
+		Handler && handler,
+		Function && function
+	)
+	: handler_(std::move(handler))
+	, function_(std::move(function))
+	, work_(asio::get_associated_executor(handler_))
+	{
+	}
+
+	// on the handler's executor
+	void
+	complete()
+	{
+		auto error = error_;
+		work_.reset();
+		std::move(handler_)(error);
+	}
+
+	Handler handler_;
+	Function function_;
+	asio::executor_work_guard<executor_type> work_;
+	std::exception_ptr error_;
+};
+
+} // namespace detail
+
+// Runs function on pool, then completes on the handler's executor with
+// void(std::exception_ptr): null once function has returned, whatever it
+// threw, or a system_error of resource_unavailable_try_again when the pool
+// refused the job. function hands results back through what it captured.
+//
+//	co_await koti::async_run(pool, [&]() { digest = hash(body); }, asio::use_awaitable);
+template <
+	typename Function,
+	typename CompletionToken
+>
+auto
+async_run(
+	worker_pool & pool,
+	Function && function,
+	CompletionToken && token
+)
+{
+	return asio::async_initiate<CompletionToken, void(std::exception_ptr)>(
+		[&pool](auto handler, auto function)
+	{
+		using operation = detail::worker_pool_operation<
+			decltype(handler),
+			decltype(function)
+		>;
+		auto op = std::make_shared<operation>(std::move(handler), std::move(function));
+
+		auto submitted = pool.try_submit([op]()
+		{
+			try
+			{
+				op->function_();
+			}
+			catch (...)
+			{
+				op->error_ = std::current_exception();
+			}
+			asio::post(op->work_.get_executor(), [op]()
+			{
+				op->complete();
+			});
+		});
+		if ( submitted )
+		{
+			return;
+		}
+
+		op->error_ = std::make_exception_ptr(boost::system::system_error{
+			boost::system::errc::make_error_code(boost::system::errc::resource_unavailable_try_again)
+		});
+		asio::post(op->work_.get_executor(), [op]()
+		{
+			op->complete();
+		});
+	}, token, std::forward<Function>(function));
+}
+
+#if defined(KOTI_HTTPD_COROUTINES)
+
+// An endpoint written as a coroutine. async_handle() may co_await timers,
+// sockets or async_run() jobs; the connection's thread serves other
+// connections meanwhile. The coroutine runs on the connection's executor
+// and the connection waits for its response (see
+// http_connection::defer_response()), so connection and request stay
+// valid until it returns. An escaping exception is answered with 500.
+class http_coroutine_endpoint
+: public http_endpoint
+, protected httpd_logs
+{
+public:
+	virtual
+	asio::awaitable<http_response>
+	async_handle(
+		http_connection & connection,
+		http_request & request
+	) = 0;
+
+	http_response
+	handle(
+		http_connection & connection,
+		http_request & request
+	) final
+	{
+		connection.defer_response();
+		asio::co_spawn(
+			connection.get_executor(),
+			respond(connection, request),
+			asio::detached
+		);
+		return http_make_response(request.get_allocator());
+	}
+
+	// the coroutine already frees the connection's thread; a worker would
+	// only add a hop
+	http_execution
+	execution(
+		http_connection & connection,
+		const http_request_header & header
+	) final
+	{
+		(void)connection;
+		(void)header;
+		return http_execution::io_thread;
+	}
+
+protected:
+	asio::awaitable<void>
+	respond(
+		http_connection & connection,
+		http_request & request
+	)
+	{
+		http_response response{http_make_response(request.get_allocator())};
+		try
+		{
+			response = co_await async_handle(connection, request);
+		}
+		catch (const std::exception & e)
+		{
+			logger()->error(
+				"UID:{}\tGID:{}\tPID:{}\t{}\t{}\terror: {}",
+				connection.cached_remote_identity().uid,
+				connection.cached_remote_identity().gid,
+				connection.cached_remote_identity().pid,
+				request.method(),
+				request.target(),
+				e.what()
+			);
+			response = http_status_response(request, http::status::internal_server_error);
+			response.keep_alive(false);
+		}
+		connection.complete_response(std::move(response));
+	}
+};
+
+#endif // defined(KOTI_HTTPD_COROUTINES)
+
+} // namespace koti
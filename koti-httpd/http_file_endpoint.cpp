@@ -0,0 +1,680 @@
+#include "http_file_endpoint.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+} // extern "C"
+
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+#include <utility>
+
+namespace koti {
+
+namespace {
+
+boost::beast::string_view
+to_beast(
+	std::string_view value
+)
+{
+	return {value.data(), value.size()};
+}
+
+std::string_view
+to_std(
+	boost::beast::string_view value
+)
+{
+	return {value.data(), value.size()};
+}
+
+int
+hex_value(
+	char c
+)
+{
+	if ( '0' <= c && c <= '9' )
+	{
+		return c - '0';
+	}
+	if ( 'a' <= c && c <= 'f' )
+	{
+		return c - 'a' + 10;
+	}
+	if ( 'A' <= c && c <= 'F' )
+	{
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+// false on a malformed escape or an encoded NUL
+bool
+percent_decode(
+	std::string_view encoded,
+	std::string & decoded
+)
+{
+	decoded.clear();
+	decoded.reserve(encoded.size());
+	for ( std::size_t i = 0; i < encoded.size(); ++i )
+	{
+		char c = encoded[i];
+		if ( '%' == c )
+		{
+			if ( encoded.size() < i + 3 )
+			{
+				return false;
+			}
+			auto high = hex_value(encoded[i + 1]);
+			auto low = hex_value(encoded[i + 2]);
+			if ( high < 0 || low < 0 )
+			{
+				return false;
+			}
+			c = static_cast<char>(high * 16 + low);
+			i += 2;
+		}
+		if ( '\0' == c )
+		{
+			return false;
+		}
+		decoded.push_back(c);
+	}
+	return true;
+}
+
+// IMF-fixdate, eg. `Sun, 06 Nov 1994 08:49:37 GMT`
+std::string_view
+format_http_date(
+	std::time_t when,
+	char (&buffer)[32]
+)
+{
+	struct tm utc;
+	::gmtime_r(&when, &utc);
+	auto length = std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &utc);
+	return {buffer, length};
+}
+
+bool
+parse_http_date(
+	std::string_view value,
+	std::time_t & when
+)
+{
+	char copy[64];
+	if ( sizeof(copy) <= value.size() )
+	{
+		return false;
+	}
+	value.copy(copy, value.size());
+	copy[value.size()] = '\0';
+
+	struct tm utc{};
+	auto * end = ::strptime(copy, "%a, %d %b %Y %H:%M:%S GMT", &utc);
+	if ( nullptr == end || '\0' != *end )
+	{
+		return false;
+	}
+	when = ::timegm(&utc);
+	return true;
+}
+
+std::string_view
+format_etag(
+	const http_open_file & file,
+	char (&buffer)[64]
+)
+{
+	auto modified = static_cast<std::uint64_t>(file.modified().tv_sec) * 1000000000u
+		+ static_cast<std::uint64_t>(file.modified().tv_nsec);
+	auto result = fmt::format_to_n(
+		buffer,
+		sizeof(buffer),
+		"\"{:x}-{:x}-{:x}\"",
+		static_cast<std::uint64_t>(file.inode()),
+		file.size(),
+		modified
+	);
+	return {buffer, result.size};
+}
+
+std::string_view
+trim(
+	std::string_view value
+)
+{
+	while ( ! value.empty() && ( ' ' == value.front() || '\t' == value.front() ) )
+	{
+		value.remove_prefix(1);
+	}
+	while ( ! value.empty() && ( ' ' == value.back() || '\t' == value.back() ) )
+	{
+		value.remove_suffix(1);
+	}
+	return value;
+}
+
+// If-None-Match uses the weak comparison: W/ prefixes are ignored
+bool
+etag_list_matches(
+	std::string_view list,
+	std::string_view etag
+)
+{
+	while ( ! list.empty() )
+	{
+		auto comma = list.find(',');
+		auto candidate = trim(list.substr(0, comma));
+		list.remove_prefix(std::string_view::npos == comma ? list.size() : comma + 1);
+
+		if ( "*" == candidate )
+		{
+			return true;
+		}
+		if ( 0 == candidate.compare(0, 2, "W/") )
+		{
+			candidate.remove_prefix(2);
+		}
+		if ( candidate == etag )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool
+parse_offset(
+	std::string_view digits,
+	std::uint64_t & value
+)
+{
+	if ( digits.empty() || 19 < digits.size() )
+	{
+		return false;
+	}
+	value = 0;
+	for ( char c : digits )
+	{
+		if ( c < '0' || '9' < c )
+		{
+			return false;
+		}
+		value = value * 10 + static_cast<std::uint64_t>(c - '0');
+	}
+	return true;
+}
+
+enum class byte_range
+{
+	// no usable Range: send everything
+	none,
+	satisfiable,
+	unsatisfiable
+};
+
+// single `bytes=first-last`, `bytes=first-` or `bytes=-suffix`
+byte_range
+parse_byte_range(
+	std::string_view value,
+	std::uint64_t size,
+	std::uint64_t & first,
+	std::uint64_t & length
+)
+{
+	value = trim(value);
+	if ( 0 != value.compare(0, 6, "bytes=") )
+	{
+		return byte_range::none;
+	}
+	value.remove_prefix(6);
+	if ( std::string_view::npos != value.find(',') )
+	{
+		return byte_range::none;
+	}
+
+	auto dash = value.find('-');
+	if ( std::string_view::npos == dash )
+	{
+		return byte_range::none;
+	}
+	auto first_digits = trim(value.substr(0, dash));
+	auto last_digits = trim(value.substr(dash + 1));
+
+	std::uint64_t last = 0;
+	if ( first_digits.empty() )
+	{
+		std::uint64_t suffix = 0;
+		if ( ! parse_offset(last_digits, suffix) )
+		{
+			return byte_range::none;
+		}
+		if ( 0 == suffix || 0 == size )
+		{
+			return byte_range::unsatisfiable;
+		}
+		first = suffix < size ? size - suffix : 0;
+		length = size - first;
+		return byte_range::satisfiable;
+	}
+
+	if ( ! parse_offset(first_digits, first) )
+	{
+		return byte_range::none;
+	}
+	if ( last_digits.empty() )
+	{
+		last = size - 1;
+	}
+	else if ( ! parse_offset(last_digits, last) || last < first )
+	{
+		return byte_range::none;
+	}
+
+	if ( size <= first )
+	{
+		return byte_range::unsatisfiable;
+	}
+	if ( size <= last )
+	{
+		last = size - 1;
+	}
+	length = last - first + 1;
+	return byte_range::satisfiable;
+}
+
+std::string_view
+content_type(
+	const fs::path & path
+)
+{
+	static const std::pair<std::string_view, std::string_view> types[] = {
+		{".css", "text/css"},
+		{".gif", "image/gif"},
+		{".gz", "application/gzip"},
+		{".htm", "text/html"},
+		{".html", "text/html"},
+		{".jpeg", "image/jpeg"},
+		{".jpg", "image/jpeg"},
+		{".js", "application/javascript"},
+		{".json", "application/json"},
+		{".pdf", "application/pdf"},
+		{".png", "image/png"},
+		{".svg", "image/svg+xml"},
+		{".tar", "application/x-tar"},
+		{".txt", "text/plain"},
+		{".wasm", "application/wasm"},
+		{".xml", "application/xml"},
+		{".zip", "application/zip"},
+	};
+
+	auto extension = path.extension().string();
+	for ( const auto & type : types )
+	{
+		if ( type.first == extension )
+		{
+			return type.second;
+		}
+	}
+	return "application/octet-stream";
+}
+
+} // namespace
+
+http_file_cache::http_file_cache(
+	std::size_t capacity
+)
+: capacity_(capacity)
+{
+}
+
+std::shared_ptr<const http_open_file>
+http_file_cache::open(
+	const std::string & path,
+	boost::system::error_code & ec
+)
+{
+	struct stat status;
+	if ( 0 != ::stat(path.c_str(), &status) )
+	{
+		ec.assign(errno, boost::system::system_category());
+		return {};
+	}
+	if ( ! S_ISREG(status.st_mode) )
+	{
+		ec = boost::system::errc::make_error_code(
+			S_ISDIR(status.st_mode)
+			? boost::system::errc::is_a_directory
+			: boost::system::errc::invalid_argument
+		);
+		return {};
+	}
+
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+		auto found = index_.find(path);
+		if ( index_.end() != found )
+		{
+			if ( found->second->second->same_as(status) )
+			{
+				++hits_;
+				entries_.splice(entries_.begin(), entries_, found->second);
+				ec = {};
+				return entries_.front().second;
+			}
+
+			// replaced or modified since it was opened
+			auto stale = found->second;
+			index_.erase(found);
+			entries_.erase(stale);
+		}
+	}
+
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if ( fd < 0 )
+	{
+		ec.assign(errno, boost::system::system_category());
+		return {};
+	}
+
+	// describe what was actually opened, not what was stat()ed before
+	if ( 0 != ::fstat(fd, &status) || ! S_ISREG(status.st_mode) )
+	{
+		ec = boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+		::close(fd);
+		return {};
+	}
+
+	auto file = std::make_shared<const http_open_file>(fd, status);
+	ec = {};
+
+	std::lock_guard<std::mutex> lock{mutex_};
+	++misses_;
+	if ( 0 == capacity_ )
+	{
+		return file;
+	}
+
+	// another thread may have opened it in the meantime
+	auto found = index_.find(path);
+	if ( index_.end() != found )
+	{
+		auto replaced = found->second;
+		index_.erase(found);
+		entries_.erase(replaced);
+	}
+
+	entries_.emplace_front(path, file);
+	index_.emplace(entries_.front().first, entries_.begin());
+
+	while ( capacity_ < entries_.size() )
+	{
+		index_.erase(entries_.back().first);
+		entries_.pop_back();
+	}
+
+	return file;
+}
+
+std::size_t
+http_file_cache::size() const
+{
+	std::lock_guard<std::mutex> lock{mutex_};
+	return entries_.size();
+}
+
+std::size_t
+http_file_cache::hits() const
+{
+	std::lock_guard<std::mutex> lock{mutex_};
+	return hits_;
+}
+
+std::size_t
+http_file_cache::misses() const
+{
+	std::lock_guard<std::mutex> lock{mutex_};
+	return misses_;
+}
+
+http_file_endpoint::http_file_endpoint(
+	std::string prefix,
+	fs::path root,
+	http_file_cache & cache
+)
+: prefix_(std::move(prefix))
+, root_(std::move(root))
+, cache_(cache)
+{
+	while ( ! prefix_.empty() && '/' == prefix_.back() )
+	{
+		prefix_.pop_back();
+	}
+}
+
+std::string_view
+http_file_endpoint::path()
+{
+	return prefix_;
+}
+
+fs::path
+http_file_endpoint::file_path(
+	std::string_view target_path
+) const
+{
+	if ( 0 != target_path.compare(0, prefix_.size(), prefix_) )
+	{
+		return {};
+	}
+	target_path.remove_prefix(prefix_.size());
+	if ( ! target_path.empty() && '/' != target_path.front() )
+	{
+		// `/prefixed` is not below `/prefix`
+		return {};
+	}
+
+	std::string decoded;
+	if ( ! percent_decode(target_path, decoded) )
+	{
+		return {};
+	}
+
+	fs::path file = root_;
+	bool named = false;
+	std::string_view rest{decoded};
+	while ( ! rest.empty() )
+	{
+		auto slash = rest.find('/');
+		auto segment = rest.substr(0, slash);
+		rest.remove_prefix(std::string_view::npos == slash ? rest.size() : slash + 1);
+
+		if ( segment.empty() )
+		{
+			continue;
+		}
+		if ( "." == segment || ".." == segment )
+		{
+			return {};
+		}
+		file /= std::string{segment};
+		named = true;
+	}
+
+	return named ? file : fs::path{};
+}
+
+http_response
+http_file_endpoint::handle(
+	http_connection & connection,
+	http_request & request
+)
+{
+	auto method = request.method();
+	if ( http::verb::get != method && http::verb::head != method )
+	{
+		auto response = http_status_response(request, http::status::method_not_allowed);
+		response.set(http::field::allow, "GET, HEAD");
+		return response;
+	}
+
+	auto path = file_path(http_target_path(request.target()));
+	if ( path.empty() )
+	{
+		return http_status_response(request, http::status::not_found);
+	}
+
+	boost::system::error_code ec;
+	auto file = cache_.open(path.string(), ec);
+	if ( ! file )
+	{
+		return http_status_response(
+			request,
+			boost::system::errc::permission_denied == ec
+			? http::status::forbidden
+			: http::status::not_found
+		);
+	}
+
+	// the sibling must be at least as new: one left over from an older
+	// version of the file is ignored rather than served
+	bool gzipped = false;
+	if ( precompressed_ )
+	{
+		if ( http_accepts_coding(request[http::field::accept_encoding], http_content_coding::gzip) )
+		{
+			auto sibling = cache_.open(path.string() + ".gz", ec);
+			if (
+				sibling
+				&& (
+					file->modified().tv_sec < sibling->modified().tv_sec
+					|| (
+						file->modified().tv_sec == sibling->modified().tv_sec
+						&& file->modified().tv_nsec <= sibling->modified().tv_nsec
+					)
+				)
+			)
+			{
+				file = std::move(sibling);
+				gzipped = true;
+			}
+		}
+	}
+
+	char etag_buffer[64];
+	auto etag = format_etag(*file, etag_buffer);
+	char date_buffer[32];
+	auto last_modified = format_http_date(file->modified().tv_sec, date_buffer);
+
+	auto with_validators = [&](http_response & response)
+	{
+		response.set(http::field::etag, to_beast(etag));
+		response.set(http::field::last_modified, to_beast(last_modified));
+		if ( precompressed_ )
+		{
+			response.set(http::field::vary, "Accept-Encoding");
+		}
+	};
+
+	// If-None-Match wins over If-Modified-Since when both are present
+	auto if_none_match = to_std(request[http::field::if_none_match]);
+	bool not_modified = false;
+	if ( ! if_none_match.empty() )
+	{
+		not_modified = etag_list_matches(if_none_match, etag);
+	}
+	else
+	{
+		std::time_t since;
+		if ( parse_http_date(to_std(request[http::field::if_modified_since]), since) )
+		{
+			not_modified = file->modified().tv_sec <= since;
+		}
+	}
+	if ( not_modified )
+	{
+		auto response = http_status_response(request, http::status::not_modified);
+		with_validators(response);
+		return response;
+	}
+
+	auto status = http::status::ok;
+	std::uint64_t first = 0;
+	std::uint64_t length = file->size();
+	char range_buffer[80];
+	std::string_view content_range;
+
+	auto range = to_std(request[http::field::range]);
+	auto if_range = to_std(request[http::field::if_range]);
+	if (
+		http::verb::get == method
+		&& ! range.empty()
+		&& ( if_range.empty() || if_range == etag || if_range == last_modified )
+	)
+	{
+		switch ( parse_byte_range(range, file->size(), first, length) )
+		{
+		case byte_range::none:
+			first = 0;
+			length = file->size();
+			break;
+
+		case byte_range::satisfiable:
+		{
+			status = http::status::partial_content;
+			auto written = fmt::format_to_n(
+				range_buffer,
+				sizeof(range_buffer),
+				"bytes {}-{}/{}",
+				first,
+				first + length - 1,
+				file->size()
+			);
+			content_range = {range_buffer, written.size};
+			break;
+		}
+
+		case byte_range::unsatisfiable:
+		{
+			auto response = http_status_response(request, http::status::range_not_satisfiable);
+			auto written = fmt::format_to_n(
+				range_buffer,
+				sizeof(range_buffer),
+				"bytes */{}",
+				file->size()
+			);
+			response.set(http::field::content_range, to_beast({range_buffer, written.size}));
+			with_validators(response);
+			return response;
+		}
+		}
+	}
+
+	auto response = http_status_response(request, status);
+	response.set(http::field::content_type, to_beast(content_type(path)));
+	response.set(http::field::accept_ranges, "bytes");
+	if ( gzipped )
+	{
+		response.set(http::field::content_encoding, "gzip");
+	}
+	with_validators(response);
+	if ( ! content_range.empty() )
+	{
+		response.set(http::field::content_range, to_beast(content_range));
+	}
+	response.content_length(length);
+
+	if ( http::verb::get == method && 0u < length )
+	{
+		connection.send_file(std::move(file), first, length);
+	}
+	return response;
+}
+
+} // namespace koti
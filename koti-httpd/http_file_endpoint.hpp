@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <boost/filesystem/path.hpp>
+namespace fs = boost::filesystem;
+
+#include "httpd.hpp"
+#include "http_open_file.hpp"
+
+namespace koti {
+
+// Least-recently-used set of open file descriptors, keyed on path. Every
+// lookup stat()s the path, and a file that was replaced or changed since
+// it was opened is opened again, so the cache never serves stale bytes or
+// metadata; it only saves the open().
+//
+// Evicting an entry does not close a descriptor that a connection is still
+// sending from; it closes when that send finishes.
+class http_file_cache
+{
+public:
+	explicit
+	http_file_cache(
+		std::size_t capacity = 256
+	);
+
+	http_file_cache(const http_file_cache & copy_ctor) = delete;
+	http_file_cache & operator=(const http_file_cache & copy_assign) = delete;
+
+	// the regular file at path, or null with ec set
+	std::shared_ptr<const http_open_file>
+	open(
+		const std::string & path,
+		boost::system::error_code & ec
+	);
+
+	std::size_t
+	capacity() const
+	{
+		return capacity_;
+	}
+
+	std::size_t
+	size() const;
+
+	std::size_t
+	hits() const;
+
+	std::size_t
+	misses() const;
+
+protected:
+	using entry = std::pair<std::string, std::shared_ptr<const http_open_file>>;
+	using entries = std::list<entry>;
+
+	std::size_t capacity_;
+	mutable std::mutex mutex_;
+
+	// most recently used first
+	entries entries_;
+	std::unordered_map<std::string_view, entries::iterator> index_;
+	std::size_t hits_ = 0;
+	std::size_t misses_ = 0;
+};
+
+// Serves the files below root at URL paths below prefix, eg. with prefix
+// `/artifacts` and root `/srv/artifacts`, `/artifacts/a/b.tar` is
+// `/srv/artifacts/a/b.tar`.
+//
+// File bytes are sent straight from the descriptor to the socket with
+// sendfile(2) (see http_connection::send_file()); the response itself only
+// carries the header. GET and HEAD only. Supports:
+//	- single byte ranges (Range, If-Range), answered with 206 or 416;
+//	  multiple ranges are ignored and the whole file is sent
+//	- validators from stat(): a strong ETag of inode, size and
+//	  modification time, and Last-Modified; If-None-Match and
+//	  If-Modified-Since are answered with 304
+//	- with set_precompressed(), a gzip-compressed sibling `<file>.gz`, no
+//	  older than the file, is sent in its place (Content-Encoding: gzip) to
+//	  clients that accept gzip; ranges and validators are then those of
+//	  the sibling
+//
+// Targets are percent-decoded; `.` and `..` segments are refused, as are
+// directories (there is no listing).
+class http_file_endpoint
+: public http_path_endpoint
+{
+public:
+	http_file_endpoint(
+		std::string prefix,
+		fs::path root,
+		http_file_cache & cache
+	);
+
+	std::string_view
+	path(
+	) override;
+
+	http_response
+	handle(
+		http_connection & connection,
+		http_request & request
+	) override;
+
+	// file below root for the target's path, or empty when the target is
+	// outside prefix or tries to leave root
+	fs::path
+	file_path(
+		std::string_view target_path
+	) const;
+
+	void
+	set_precompressed(
+		bool precompressed
+	)
+	{
+		precompressed_ = precompressed;
+	}
+
+	bool
+	precompressed() const
+	{
+		return precompressed_;
+	}
+
+protected:
+	std::string prefix_;
+	fs::path root_;
+	http_file_cache & cache_;
+	bool precompressed_ = false;
+};
+
+} // namespace koti
@@ -0,0 +1,147 @@
+#include "http_handoff.hpp"
+
+extern "C" {
+#include <sys/socket.h>
+#include <unistd.h>
+} // extern "C"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <boost/asio/error.hpp>
+
+namespace koti {
+
+namespace {
+
+boost::system::error_code
+last_error()
+{
+	return {errno, boost::system::system_category()};
+}
+
+} // namespace
+
+void
+http_send_descriptors(
+	int control,
+	http_handoff_tag tag,
+	const std::vector<int> & descriptors,
+	boost::system::error_code & ec
+)
+{
+	ec.clear();
+	std::size_t sent = 0;
+	do
+	{
+		auto count = std::min(http_handoff_batch, descriptors.size() - sent);
+
+		char byte = static_cast<char>(tag);
+		::iovec payload{&byte, 1};
+
+		alignas(::cmsghdr) char control_buffer[CMSG_SPACE(sizeof(int) * http_handoff_batch)];
+		::msghdr message{};
+		message.msg_iov = &payload;
+		message.msg_iovlen = 1;
+		if ( 0 < count )
+		{
+			message.msg_control = control_buffer;
+			message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+			auto * header = CMSG_FIRSTHDR(&message);
+			header->cmsg_level = SOL_SOCKET;
+			header->cmsg_type = SCM_RIGHTS;
+			header->cmsg_len = CMSG_LEN(sizeof(int) * count);
+			std::memcpy(CMSG_DATA(header), descriptors.data() + sent, sizeof(int) * count);
+		}
+
+		ssize_t result;
+		do
+		{
+			result = ::sendmsg(control, &message, MSG_NOSIGNAL);
+		} while ( result < 0 && EINTR == errno );
+
+		if ( result < 0 )
+		{
+			ec = last_error();
+			return;
+		}
+		sent += count;
+	} while ( sent < descriptors.size() );
+}
+
+http_handoff_tag
+http_receive_descriptors(
+	int control,
+	std::vector<int> & descriptors,
+	boost::system::error_code & ec
+)
+{
+	ec.clear();
+
+	char byte = 0;
+	::iovec payload{&byte, 1};
+
+	alignas(::cmsghdr) char control_buffer[CMSG_SPACE(sizeof(int) * http_handoff_batch)];
+	::msghdr message{};
+	message.msg_iov = &payload;
+	message.msg_iovlen = 1;
+	message.msg_control = control_buffer;
+	message.msg_controllen = sizeof(control_buffer);
+
+	ssize_t result;
+	do
+	{
+		result = ::recvmsg(control, &message, MSG_CMSG_CLOEXEC);
+	} while ( result < 0 && EINTR == errno );
+
+	if ( result < 0 )
+	{
+		ec = last_error();
+		return http_handoff_tag::done;
+	}
+
+	// descriptors are ours once received, whatever else is wrong with
+	// the message
+	for ( auto * header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header) )
+	{
+		if ( SOL_SOCKET != header->cmsg_level || SCM_RIGHTS != header->cmsg_type )
+		{
+			continue;
+		}
+
+		auto count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		auto first = descriptors.size();
+		descriptors.resize(first + count);
+		std::memcpy(descriptors.data() + first, CMSG_DATA(header), sizeof(int) * count);
+	}
+
+	if ( 0 == result )
+	{
+		ec = boost::asio::error::eof;
+		return http_handoff_tag::done;
+	}
+	if ( message.msg_flags & MSG_CTRUNC )
+	{
+		// more descriptors than we can hold in this process
+		ec = boost::asio::error::no_descriptors;
+	}
+	return static_cast<http_handoff_tag>(byte);
+}
+
+int
+http_socket_family(
+	int native
+)
+{
+	::sockaddr_storage address{};
+	::socklen_t length = sizeof(address);
+	if ( ::getsockname(native, reinterpret_cast<::sockaddr *>(&address), &length) < 0 )
+	{
+		return AF_UNSPEC;
+	}
+	return address.ss_family;
+}
+
+} // namespace koti
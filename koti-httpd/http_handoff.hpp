@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <boost/system/error_code.hpp>
+
+namespace koti {
+
+// Descriptors passed from a running kotid to the one replacing it, over a
+// local stream socket (SCM_RIGHTS). Every message is one tag byte, with or
+// without descriptors attached. In order:
+//
+//   old -> new   listeners     every listening socket, in one message
+//   new -> old   accepting     the new process accepts on them; the old
+//                              one stops
+//   old -> new   connections   idle keep-alive connections, as many
+//                              messages as it takes
+//   old -> new   done          nothing more is coming; the old process
+//                              drains what it is still serving and exits
+//
+// A passed socket is the same socket in both processes, so connections
+// waiting in the accept queue are not lost, and an abstract name is never
+// unbound in between.
+enum class http_handoff_tag : char
+{
+	listeners = 'L',
+	accepting = 'A',
+	connections = 'C',
+	done = 'E'
+};
+
+// most descriptors one message carries (the kernel's SCM_MAX_FD)
+constexpr std::size_t http_handoff_batch = 253;
+
+// sends tag with the descriptors, in as many messages as it takes. the
+// descriptors stay open here
+void
+http_send_descriptors(
+	int control,
+	http_handoff_tag tag,
+	const std::vector<int> & descriptors,
+	boost::system::error_code & ec
+);
+
+// receives one message and appends its descriptors, which the caller then
+// owns. the other end hanging up is reported as asio::error::eof
+http_handoff_tag
+http_receive_descriptors(
+	int control,
+	std::vector<int> & descriptors,
+	boost::system::error_code & ec
+);
+
+// AF_UNIX, AF_INET or AF_INET6; AF_UNSPEC when native is not a socket
+int
+http_socket_family(
+	int native
+);
+
+} // namespace koti
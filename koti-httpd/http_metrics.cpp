@@ -0,0 +1,92 @@
+#include "http_metrics.hpp"
+
+#include <utility>
+
+namespace koti {
+
+namespace {
+
+std::atomic<std::uint64_t> next_metrics_id{1};
+
+// the shards this thread has been given, by the id of their http_metrics
+thread_local std::vector<std::pair<std::uint64_t, http_metrics::shard *>> local_shards;
+thread_local std::pair<std::uint64_t, http_metrics::shard *> last_shard{0, nullptr};
+
+} // namespace
+
+http_metrics::http_metrics()
+: id_(next_metrics_id.fetch_add(1, std::memory_order_relaxed))
+{
+}
+
+http_metrics::shard &
+http_metrics::local()
+{
+	if ( id_ == last_shard.first )
+	{
+		return *last_shard.second;
+	}
+
+	for ( const auto & known : local_shards )
+	{
+		if ( id_ == known.first )
+		{
+			last_shard = known;
+			return *known.second;
+		}
+	}
+
+	shard * made = nullptr;
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+		shards_.push_back(std::make_unique<shard>());
+		made = shards_.back().get();
+	}
+	local_shards.emplace_back(id_, made);
+	last_shard = local_shards.back();
+	return *made;
+}
+
+http_metrics::snapshot
+http_metrics::collect() const
+{
+	snapshot s;
+	std::lock_guard<std::mutex> lock{mutex_};
+	for ( const auto & from : shards_ )
+	{
+		for ( std::size_t i = 0; i < s.counters.size(); ++i )
+		{
+			s.counters[i] += from->counters_[i].load(std::memory_order_relaxed);
+		}
+		for ( std::size_t i = 0; i < verb_count; ++i )
+		{
+			s.verbs[i] += from->verbs_[i].load(std::memory_order_relaxed);
+		}
+		for ( std::size_t i = 0; i < status_count; ++i )
+		{
+			s.statuses[i] += from->statuses_[i].load(std::memory_order_relaxed);
+		}
+		for ( std::size_t p = 0; p < s.histograms.size(); ++p )
+		{
+			auto & to = s.histograms[p];
+			const auto & h = from->histograms_[p];
+			for ( std::size_t i = 0; i < histogram_buckets; ++i )
+			{
+				auto n = h.buckets[i].load(std::memory_order_relaxed);
+				to.buckets[i] += n;
+				to.count += n;
+			}
+			to.sum_nanoseconds += h.sum_nanoseconds.load(std::memory_order_relaxed);
+		}
+	}
+	return s;
+}
+
+std::size_t
+http_metrics::shards() const
+{
+	std::lock_guard<std::mutex> lock{mutex_};
+	return shards_.size();
+}
+
+} // namespace koti
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include <boost/beast/http/verb.hpp>
+
+namespace koti {
+
+// Counters and latency histograms of an http server.
+//
+// Every thread that records gets its own shard, on its own cache lines, and
+// is its only writer: recording is a relaxed load and store with no lock
+// prefix and no line shared with another thread. Shards are only summed
+// when somebody asks (see collect()), so the cost of a scrape is paid by
+// the scrape.
+class http_metrics
+{
+public:
+	enum class counter
+	{
+		// connections taken into service
+		accepted,
+
+		// connections dropped on arrival: the connection table was full, or
+		// their peer had as many as it may (see http_peer_limiter)
+		rejected_full,
+		rejected_peer,
+
+		bytes_received,
+		bytes_sent,
+
+		// bodies compressed by the connection (see http_compression): bytes
+		// before, and after
+		compressed_in,
+		compressed_out,
+
+		count
+	};
+
+	enum class phase
+	{
+		// from the first byte of a request to the last
+		parse,
+
+		// in the endpoint, until its response is known
+		handle,
+
+		// from the first byte of a response to the last
+		write,
+
+		count
+	};
+
+	// log-linear buckets over microseconds, HDR style: four per power of
+	// two, so a bucket is at most 25% wide, from 1us up to 2^26us (~67s).
+	// the last bucket holds everything longer
+	static constexpr std::size_t sub_buckets = 4;
+	static constexpr std::size_t octaves = 25;
+	static constexpr std::size_t histogram_buckets = sub_buckets + (octaves - 1) * sub_buckets + 1;
+
+	static constexpr std::size_t verb_count = static_cast<std::size_t>(boost::beast::http::verb::unlink) + 1;
+	static constexpr std::size_t lowest_status = 100;
+	static constexpr std::size_t status_count = 500;
+
+	static
+	constexpr
+	std::size_t
+	bucket_of(
+		std::uint64_t microseconds
+	)
+	{
+		if ( microseconds < sub_buckets )
+		{
+			return static_cast<std::size_t>(microseconds);
+		}
+
+		std::size_t octave = 63u - static_cast<std::size_t>(__builtin_clzll(microseconds));
+		if ( octaves < octave )
+		{
+			return histogram_buckets - 1;
+		}
+		auto sub = static_cast<std::size_t>(microseconds >> (octave - 2)) & (sub_buckets - 1);
+		return sub_buckets + (octave - 2) * sub_buckets + sub;
+	}
+
+	// the first value past bucket index; every value in it is below this
+	static
+	constexpr
+	std::uint64_t
+	bucket_bound(
+		std::size_t index
+	)
+	{
+		if ( index < sub_buckets )
+		{
+			return index + 1;
+		}
+		auto octave = (index - sub_buckets) / sub_buckets + 2;
+		auto sub = (index - sub_buckets) % sub_buckets;
+		return static_cast<std::uint64_t>(sub_buckets + sub + 1) << (octave - 2);
+	}
+
+	class alignas(64) shard
+	{
+	public:
+		void
+		add(
+			counter c,
+			std::uint64_t n = 1
+		)
+		{
+			bump(counters_[static_cast<std::size_t>(c)], n);
+		}
+
+		// one request answered with status
+		void
+		request(
+			boost::beast::http::verb method,
+			unsigned status
+		)
+		{
+			auto verb = static_cast<std::size_t>(method);
+			bump(verbs_[verb < verb_count ? verb : 0], 1);
+			if ( lowest_status <= status && status < lowest_status + status_count )
+			{
+				bump(statuses_[status - lowest_status], 1);
+			}
+		}
+
+		void
+		record(
+			phase p,
+			std::chrono::steady_clock::duration took
+		)
+		{
+			auto & h = histograms_[static_cast<std::size_t>(p)];
+			auto nanoseconds = static_cast<std::uint64_t>(
+				std::max<std::chrono::nanoseconds::rep>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(took).count())
+			);
+			bump(h.buckets[bucket_of(nanoseconds / 1000)], 1);
+			bump(h.sum_nanoseconds, nanoseconds);
+		}
+
+	protected:
+		friend class http_metrics;
+
+		// only ever written by the shard's own thread
+		static
+		void
+		bump(
+			std::atomic<std::uint64_t> & value,
+			std::uint64_t n
+		)
+		{
+			value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+
+		struct histogram
+		{
+			std::array<std::atomic<std::uint64_t>, histogram_buckets> buckets{};
+			std::atomic<std::uint64_t> sum_nanoseconds{0};
+		};
+
+		std::array<std::atomic<std::uint64_t>, static_cast<std::size_t>(counter::count)> counters_{};
+		std::array<std::atomic<std::uint64_t>, verb_count> verbs_{};
+		std::array<std::atomic<std::uint64_t>, status_count> statuses_{};
+		std::array<histogram, static_cast<std::size_t>(phase::count)> histograms_{};
+	};
+
+	// the sum of every shard at one point in time (give or take the
+	// increments racing the sum)
+	struct snapshot
+	{
+		struct histogram
+		{
+			std::array<std::uint64_t, histogram_buckets> buckets{};
+			std::uint64_t count = 0;
+			std::uint64_t sum_nanoseconds = 0;
+		};
+
+		std::array<std::uint64_t, static_cast<std::size_t>(counter::count)> counters{};
+		std::array<std::uint64_t, verb_count> verbs{};
+		std::array<std::uint64_t, status_count> statuses{};
+		std::array<histogram, static_cast<std::size_t>(phase::count)> histograms{};
+
+		std::uint64_t
+		operator[](
+			counter c
+		) const
+		{
+			return counters[static_cast<std::size_t>(c)];
+		}
+
+		const histogram &
+		operator[](
+			phase p
+		) const
+		{
+			return histograms[static_cast<std::size_t>(p)];
+		}
+	};
+
+	http_metrics();
+
+	http_metrics(const http_metrics & copy_ctor) = delete;
+	http_metrics & operator=(const http_metrics & copy_assign) = delete;
+
+	// the calling thread's shard, made on its first use. the shard lives as
+	// long as the metrics do, so nothing recorded is lost when a thread ends
+	shard &
+	local();
+
+	snapshot
+	collect() const;
+
+	std::size_t
+	shards() const;
+
+protected:
+	// told apart by id rather than address: a thread's cached shard must
+	// not be mistaken for one of a later http_metrics at the same address
+	const std::uint64_t id_;
+
+	mutable std::mutex mutex_;
+	std::vector<std::unique_ptr<shard>> shards_;
+};
+
+} // namespace koti
@@ -0,0 +1,189 @@
+#include "http_metrics_endpoint.hpp"
+
+#include <iterator>
+#include <utility>
+
+#include "fmt/format.h"
+
+namespace koti {
+
+namespace {
+
+using output = std::back_insert_iterator<std::string>;
+
+void
+header(
+	output out,
+	std::string_view name,
+	std::string_view type,
+	std::string_view help
+)
+{
+	fmt::format_to(out, "# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+}
+
+void
+histogram(
+	output out,
+	std::string_view name,
+	std::string_view help,
+	const http_metrics::snapshot::histogram & h
+)
+{
+	header(out, name, "histogram", help);
+
+	std::uint64_t cumulative = 0;
+	for ( std::size_t i = 0; i + 1 < http_metrics::histogram_buckets; ++i )
+	{
+		cumulative += h.buckets[i];
+		fmt::format_to(
+			out,
+			"{}_bucket{{le=\"{}\"}} {}\n",
+			name,
+			static_cast<double>(http_metrics::bucket_bound(i)) / 1e6,
+			cumulative
+		);
+	}
+	fmt::format_to(out, "{}_bucket{{le=\"+Inf\"}} {}\n", name, h.count);
+	fmt::format_to(out, "{}_sum {}\n", name, static_cast<double>(h.sum_nanoseconds) / 1e9);
+	fmt::format_to(out, "{}_count {}\n", name, h.count);
+}
+
+} // namespace
+
+http_metrics_endpoint::http_metrics_endpoint(
+	http_metrics & metrics,
+	std::string path
+)
+: metrics_(metrics)
+, path_(std::move(path))
+{
+}
+
+std::string_view
+http_metrics_endpoint::path()
+{
+	return path_;
+}
+
+void
+http_metrics_endpoint::add_counter(
+	std::string name,
+	std::string help,
+	sample value
+)
+{
+	series_.push_back({std::move(name), std::move(help), "counter", std::move(value)});
+}
+
+void
+http_metrics_endpoint::add_gauge(
+	std::string name,
+	std::string help,
+	sample value
+)
+{
+	series_.push_back({std::move(name), std::move(help), "gauge", std::move(value)});
+}
+
+std::string
+http_metrics_endpoint::render() const
+{
+	using counter = http_metrics::counter;
+	using phase = http_metrics::phase;
+
+	auto s = metrics_.collect();
+	std::string text;
+	text.reserve(32 * 1024);
+	auto out = std::back_inserter(text);
+
+	header(out, "koti_http_connections_accepted_total", "counter", "Connections taken into service.");
+	fmt::format_to(out, "koti_http_connections_accepted_total {}\n", s[counter::accepted]);
+
+	header(out, "koti_http_connections_rejected_total", "counter", "Connections dropped on arrival.");
+	fmt::format_to(out, "koti_http_connections_rejected_total{{reason=\"full\"}} {}\n", s[counter::rejected_full]);
+	fmt::format_to(out, "koti_http_connections_rejected_total{{reason=\"peer\"}} {}\n", s[counter::rejected_peer]);
+
+	header(out, "koti_http_requests_total", "counter", "Requests answered, by method.");
+	for ( std::size_t i = 0; i < http_metrics::verb_count; ++i )
+	{
+		if ( 0u < s.verbs[i] )
+		{
+			auto method = http::to_string(static_cast<http::verb>(i));
+			fmt::format_to(
+				out,
+				"koti_http_requests_total{{method=\"{}\"}} {}\n",
+				std::string_view{method.data(), method.size()},
+				s.verbs[i]
+			);
+		}
+	}
+
+	header(out, "koti_http_responses_total", "counter", "Responses sent, by status code.");
+	for ( std::size_t i = 0; i < http_metrics::status_count; ++i )
+	{
+		if ( 0u < s.statuses[i] )
+		{
+			fmt::format_to(
+				out,
+				"koti_http_responses_total{{code=\"{}\"}} {}\n",
+				http_metrics::lowest_status + i,
+				s.statuses[i]
+			);
+		}
+	}
+
+	header(out, "koti_http_received_bytes_total", "counter", "Bytes of requests read.");
+	fmt::format_to(out, "koti_http_received_bytes_total {}\n", s[counter::bytes_received]);
+	header(out, "koti_http_sent_bytes_total", "counter", "Bytes of responses written.");
+	fmt::format_to(out, "koti_http_sent_bytes_total {}\n", s[counter::bytes_sent]);
+	header(out, "koti_http_compressed_bytes_total", "counter", "Bytes of response bodies compressed, before and after.");
+	fmt::format_to(out, "koti_http_compressed_bytes_total{{side=\"in\"}} {}\n", s[counter::compressed_in]);
+	fmt::format_to(out, "koti_http_compressed_bytes_total{{side=\"out\"}} {}\n", s[counter::compressed_out]);
+
+	histogram(out, "koti_http_parse_seconds", "Time from the first byte of a request to its last.", s[phase::parse]);
+	histogram(out, "koti_http_handle_seconds", "Time in the endpoint until the response was known.", s[phase::handle]);
+	histogram(out, "koti_http_write_seconds", "Time from the first byte of a response to its last.", s[phase::write]);
+
+	for ( const auto & extra : series_ )
+	{
+		header(out, extra.name, extra.type, extra.help);
+		fmt::format_to(out, "{} {}\n", extra.name, extra.value());
+	}
+
+	return text;
+}
+
+http_response
+http_metrics_endpoint::handle(
+	http_connection & connection,
+	http_request & request
+)
+{
+	(void)connection;
+
+	if ( http::verb::get != request.method() && http::verb::head != request.method() )
+	{
+		auto response = http_status_response(request, http::status::method_not_allowed);
+		response.set(http::field::allow, "GET, HEAD");
+		return response;
+	}
+
+	auto text = render();
+	auto response = http_make_response(request.get_allocator());
+	response.result(http::status::ok);
+	response.version(request.version());
+	response.keep_alive(request.keep_alive());
+	response.set(http::field::content_type, "text/plain; version=0.0.4; charset=utf-8");
+	response.set(http::field::cache_control, "no-store");
+	response.body().assign(text.data(), text.size());
+	response.prepare_payload();
+	if ( http::verb::head == request.method() )
+	{
+		// the length of what a GET would have sent
+		response.body().clear();
+	}
+	return response;
+}
+
+} // namespace koti
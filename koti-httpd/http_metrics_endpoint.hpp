@@ -0,0 +1,81 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "httpd.hpp"
+#include "http_metrics.hpp"
+
+namespace koti {
+
+// Serves http_metrics, plus whatever else was added to it, in the Prometheus
+// text exposition format:
+//	koti_http_connections_accepted_total
+//	koti_http_connections_rejected_total{reason="full"|"peer"}
+//	koti_http_requests_total{method}
+//	koti_http_responses_total{code}
+//	koti_http_received_bytes_total, koti_http_sent_bytes_total
+//	koti_http_{parse,handle,write}_seconds	histograms
+//
+// The shards are summed for each scrape, on the scraping connection's
+// thread; nothing is aggregated in between.
+class http_metrics_endpoint
+: public http_path_endpoint
+{
+public:
+	// read on the scraping thread; must be safe to call from any io thread
+	using sample = std::function<double()>;
+
+	explicit
+	http_metrics_endpoint(
+		http_metrics & metrics,
+		std::string path = "/metrics"
+	);
+
+	std::string_view
+	path(
+	) override;
+
+	// further series, reported after those of metrics in the order they
+	// were added. add them all before the endpoint is first served
+	void
+	add_counter(
+		std::string name,
+		std::string help,
+		sample value
+	);
+
+	void
+	add_gauge(
+		std::string name,
+		std::string help,
+		sample value
+	);
+
+	// the whole exposition
+	std::string
+	render() const;
+
+	http_response
+	handle(
+		http_connection & connection,
+		http_request & request
+	) override;
+
+protected:
+	struct series
+	{
+		std::string name;
+		std::string help;
+		const char * type;
+		sample value;
+	};
+
+	http_metrics & metrics_;
+	std::string path_;
+	std::vector<series> series_;
+};
+
+} // namespace koti
@@ -0,0 +1,95 @@
+#pragma once
+
+extern "C" {
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+} // extern "C"
+
+#include <cstdint>
+#include <ctime>
+
+namespace koti {
+
+// A regular file held open for sending, along with the stat() it was
+// opened under. Shared between the cache that opened it and any
+// connection still sending it; the descriptor closes with the last owner.
+class http_open_file
+{
+public:
+	// takes ownership of fd
+	http_open_file(
+		int fd,
+		const struct stat & status
+	)
+	: fd_(fd)
+	, device_(status.st_dev)
+	, inode_(status.st_ino)
+	, size_(static_cast<std::uint64_t>(status.st_size))
+	, modified_(status.st_mtim)
+	{
+	}
+
+	http_open_file(const http_open_file & copy_ctor) = delete;
+	http_open_file & operator=(const http_open_file & copy_assign) = delete;
+
+	~http_open_file()
+	{
+		if ( 0 <= fd_ )
+		{
+			::close(fd_);
+		}
+	}
+
+	int
+	native_handle() const
+	{
+		return fd_;
+	}
+
+	std::uint64_t
+	size() const
+	{
+		return size_;
+	}
+
+	dev_t
+	device() const
+	{
+		return device_;
+	}
+
+	ino_t
+	inode() const
+	{
+		return inode_;
+	}
+
+	const struct timespec &
+	modified() const
+	{
+		return modified_;
+	}
+
+	// whether status still describes the file that was opened
+	bool
+	same_as(
+		const struct stat & status
+	) const
+	{
+		return status.st_dev == device_
+			&& status.st_ino == inode_
+			&& static_cast<std::uint64_t>(status.st_size) == size_
+			&& status.st_mtim.tv_sec == modified_.tv_sec
+			&& status.st_mtim.tv_nsec == modified_.tv_nsec;
+	}
+
+protected:
+	int fd_;
+	dev_t device_;
+	ino_t inode_;
+	std::uint64_t size_;
+	struct timespec modified_;
+};
+
+} // namespace koti
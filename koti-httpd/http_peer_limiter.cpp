@@ -0,0 +1,233 @@
+#include "http_peer_limiter.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace koti {
+
+namespace {
+
+std::size_t
+round_up_to_power_of_two(
+	std::size_t value
+)
+{
+	std::size_t power = 1;
+	while ( power < value )
+	{
+		power <<= 1;
+	}
+	return power;
+}
+
+// spreads consecutive uids and pids over the table
+std::uint64_t
+mix(
+	std::uint64_t key
+)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdull;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ull;
+	key ^= key >> 33;
+	return key;
+}
+
+} // namespace
+
+http_peer_limiter::http_peer_limiter(
+	const http_peer_limits & limits,
+	std::size_t slots
+)
+: limits_(limits)
+, mask_(round_up_to_power_of_two(std::max<std::size_t>(1u, slots)) - 1)
+, slots_(new slot[mask_ + 1])
+{
+	if ( 0 < limits_.requests_per_second )
+	{
+		interval_ = static_cast<std::int64_t>(std::llround(1e9 / limits_.requests_per_second));
+		interval_ = std::max<std::int64_t>(1, interval_);
+
+		auto burst = 0u < limits_.burst
+			? limits_.burst
+			: static_cast<std::size_t>(std::max(1.0, std::ceil(limits_.requests_per_second)));
+		tolerance_ = interval_ * static_cast<std::int64_t>(burst - 1);
+	}
+}
+
+std::uint64_t
+http_peer_limiter::key_of(
+	const local_stream::ucred & peer
+) const
+{
+	// 0 marks a free slot; the +1 keeps uid 0 (with pid 0) apart from it
+	std::uint64_t key = static_cast<std::uint64_t>(peer.uid) + 1;
+	if ( limits_.per_pid )
+	{
+		key |= static_cast<std::uint64_t>(static_cast<std::uint32_t>(peer.pid)) << 32;
+	}
+	return key;
+}
+
+bool
+http_peer_limiter::idle(
+	const slot & candidate,
+	std::int64_t now
+) const
+{
+	return 0 == candidate.connections_.load()
+		&& candidate.arrival_.load(std::memory_order_relaxed) <= now;
+}
+
+bool
+http_peer_limiter::reclaim(
+	slot & candidate,
+	std::uint64_t key,
+	std::uint64_t replacement,
+	std::int64_t now
+)
+{
+	if ( false == candidate.key_.compare_exchange_strong(key, reclaiming) )
+	{
+		return false;
+	}
+
+	// admit_connection() counts first and checks the key after, so either
+	// it sees reclaiming and tries again, or this sees its connection
+	if ( false == idle(candidate, now) )
+	{
+		candidate.key_.store(key, std::memory_order_release);
+		return false;
+	}
+
+	candidate.arrival_.store(0, std::memory_order_relaxed);
+	candidate.key_.store(replacement, std::memory_order_release);
+	return true;
+}
+
+http_peer_limiter::slot *
+http_peer_limiter::find(
+	const local_stream::ucred & peer
+)
+{
+	auto key = key_of(peer);
+	auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()
+	).count();
+
+	slot * stale = nullptr;
+	std::uint64_t stale_key = 0;
+
+	auto index = mix(key) & mask_;
+	for ( std::size_t probe = 0; probe <= mask_; ++probe )
+	{
+		auto & candidate = slots_[(index + probe) & mask_];
+		auto current = candidate.key_.load(std::memory_order_acquire);
+		while ( reclaiming == current )
+		{
+			// only ever for a few instructions
+			current = candidate.key_.load(std::memory_order_acquire);
+		}
+
+		if ( key == current )
+		{
+			return &candidate;
+		}
+		if ( 0 == current )
+		{
+			if ( candidate.key_.compare_exchange_strong(current, key, std::memory_order_acq_rel) )
+			{
+				peers_.fetch_add(1, std::memory_order_relaxed);
+				return &candidate;
+			}
+			if ( key == current )
+			{
+				// claimed for the same peer by another thread
+				return &candidate;
+			}
+		}
+		if ( nullptr == stale && idle(candidate, now) )
+		{
+			stale = &candidate;
+			stale_key = current;
+		}
+	}
+
+	// the table is full and peer is not in it
+	if ( stale && reclaim(*stale, stale_key, key, now) )
+	{
+		return stale;
+	}
+	return &overflow_;
+}
+
+http_peer_limiter::slot *
+http_peer_limiter::admit_connection(
+	const local_stream::ucred & peer
+)
+{
+	auto key = key_of(peer);
+	for ( ;; )
+	{
+		auto * found = find(peer);
+		auto current = found->connections_.load(std::memory_order_relaxed);
+		do
+		{
+			if ( 0 < limits_.connections && limits_.connections <= current )
+			{
+				refused_connections_.fetch_add(1, std::memory_order_relaxed);
+				return nullptr;
+			}
+		}
+		while ( false == found->connections_.compare_exchange_weak(current, current + 1) );
+
+		// counted against the peer the slot belongs to now, unless it was
+		// handed over in between (see reclaim())
+		if ( &overflow_ == found || key == found->key_.load() )
+		{
+			return found;
+		}
+		found->connections_.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
+void
+http_peer_limiter::release_connection(
+	slot * peer
+)
+{
+	peer->connections_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool
+http_peer_limiter::admit_request(
+	slot * peer,
+	std::chrono::steady_clock::time_point now,
+	std::chrono::nanoseconds & retry_after
+)
+{
+	if ( 0 == interval_ )
+	{
+		return true;
+	}
+
+	auto at = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+	auto arrival = peer->arrival_.load(std::memory_order_relaxed);
+	for ( ;; )
+	{
+		auto earliest = std::max(arrival, at);
+		if ( tolerance_ < earliest - at )
+		{
+			retry_after = std::chrono::nanoseconds{earliest - at - tolerance_};
+			limited_requests_.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		if ( peer->arrival_.compare_exchange_weak(arrival, earliest + interval_, std::memory_order_relaxed) )
+		{
+			return true;
+		}
+	}
+}
+
+} // namespace koti
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "net.hpp"
+
+namespace koti {
+
+// Limits on what one local peer, as identified by SO_PEERCRED, may take.
+// Zero means unlimited.
+struct http_peer_limits
+{
+	// open connections per peer; further ones are refused when accepted
+	std::size_t connections = 0;
+
+	// sustained requests per second per peer, with bursts of up to burst
+	// requests; requests over the rate are answered with 429
+	double requests_per_second = 0;
+	std::size_t burst = 0;
+
+	// tell peers apart by uid and pid rather than by uid alone
+	bool per_pid = false;
+};
+
+// Admission control per peer. Every peer gets a slot in a fixed-size open
+// addressed table; slots are claimed with a compare-and-swap, so there are
+// no locks anywhere. Once the table is full, a new peer takes over the slot
+// of a peer with no connections whose bucket has refilled, which loses
+// nothing; peers arriving while no slot is idle share one overflow slot.
+// The request rate is enforced with GCRA, the single-word equivalent of a
+// token bucket: each slot holds the theoretical arrival time of its next
+// request.
+class http_peer_limiter
+{
+public:
+	class slot
+	{
+	public:
+		// connections currently admitted
+		std::size_t
+		connections() const
+		{
+			return connections_.load(std::memory_order_relaxed);
+		}
+
+	protected:
+		friend class http_peer_limiter;
+
+		std::atomic<std::uint64_t> key_{0};
+		std::atomic<std::size_t> connections_{0};
+		std::atomic<std::int64_t> arrival_{0};
+	};
+
+	static constexpr std::size_t default_slots = 4096;
+
+	explicit
+	http_peer_limiter(
+		const http_peer_limits & limits,
+		std::size_t slots = default_slots
+	);
+
+	http_peer_limiter(const http_peer_limiter & copy_ctor) = delete;
+	http_peer_limiter & operator=(const http_peer_limiter & copy_assign) = delete;
+
+	const http_peer_limits &
+	limits() const
+	{
+		return limits_;
+	}
+
+	// the slot of peer; never null. only good for as long as it has
+	// connections admitted
+	slot *
+	find(
+		const local_stream::ucred & peer
+	);
+
+	// counts a new connection against peer, and returns its slot. null
+	// when the peer is at its limit, in which case nothing was counted
+	slot *
+	admit_connection(
+		const local_stream::ucred & peer
+	);
+
+	// every admitted connection must be released exactly once
+	void
+	release_connection(
+		slot * peer
+	);
+
+	// counts one request against its peer. false when it is over the rate;
+	// retry_after is then how long until one would be admitted
+	bool
+	admit_request(
+		slot * peer,
+		std::chrono::steady_clock::time_point now,
+		std::chrono::nanoseconds & retry_after
+	);
+
+	std::uint64_t
+	refused_connections() const
+	{
+		return refused_connections_.load(std::memory_order_relaxed);
+	}
+
+	std::uint64_t
+	limited_requests() const
+	{
+		return limited_requests_.load(std::memory_order_relaxed);
+	}
+
+	// slots claimed by a peer, not counting the overflow slot
+	std::size_t
+	peers() const
+	{
+		return peers_.load(std::memory_order_relaxed);
+	}
+
+protected:
+	// a slot being taken over from an idle peer. no key is: pids fit in 22
+	// bits
+	static constexpr std::uint64_t reclaiming = ~std::uint64_t{0};
+
+	std::uint64_t
+	key_of(
+		const local_stream::ucred & peer
+	) const;
+
+	// without connections, and with a full bucket as of now
+	bool
+	idle(
+		const slot & candidate,
+		std::int64_t now
+	) const;
+
+	// hands candidate, last seen with key, over to a new peer. false when
+	// it got busy or was taken first
+	bool
+	reclaim(
+		slot & candidate,
+		std::uint64_t key,
+		std::uint64_t replacement,
+		std::int64_t now
+	);
+
+	http_peer_limits limits_;
+
+	// nanoseconds between two requests at the sustained rate, and how far
+	// ahead of now a peer's arrival time may run (the burst)
+	std::int64_t interval_ = 0;
+	std::int64_t tolerance_ = 0;
+
+	std::size_t mask_;
+	std::unique_ptr<slot[]> slots_;
+	slot overflow_;
+
+	std::atomic<std::size_t> peers_{0};
+	std::atomic<std::uint64_t> refused_connections_{0};
+	std::atomic<std::uint64_t> limited_requests_{0};
+};
+
+} // namespace koti
@@ -0,0 +1,531 @@
+#include "http_response_cache.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <sstream>
+
+namespace koti {
+
+namespace {
+
+std::string_view
+trim(
+	std::string_view text
+)
+{
+	auto first = text.find_first_not_of(" \t");
+	if ( std::string_view::npos == first )
+	{
+		return {};
+	}
+	auto last = text.find_last_not_of(" \t");
+	return text.substr(first, last - first + 1);
+}
+
+bool
+same_name(
+	std::string_view lhs,
+	std::string_view rhs
+)
+{
+	return boost::beast::iequals(
+		boost::beast::string_view{lhs.data(), lhs.size()},
+		boost::beast::string_view{rhs.data(), rhs.size()}
+	);
+}
+
+// calls visit(name, value) with every directive of a Cache-Control (or
+// Pragma) field; value is empty for a directive without one
+template <
+	class Visit
+>
+void
+for_each_directive(
+	boost::beast::string_view beast_field,
+	Visit visit
+)
+{
+	std::string_view field{beast_field.data(), beast_field.size()};
+	while ( false == field.empty() )
+	{
+		auto comma = field.find(',');
+		auto directive = trim(field.substr(0, comma));
+		field = std::string_view::npos == comma ? std::string_view{} : field.substr(comma + 1);
+
+		auto equals = directive.find('=');
+		auto name = trim(directive.substr(0, equals));
+		std::string_view value;
+		if ( std::string_view::npos != equals )
+		{
+			value = trim(directive.substr(equals + 1));
+			if ( 2u <= value.size() && '"' == value.front() && '"' == value.back() )
+			{
+				value = value.substr(1, value.size() - 2);
+			}
+		}
+		visit(name, value);
+	}
+}
+
+bool
+has_directive(
+	boost::beast::string_view field,
+	std::string_view wanted
+)
+{
+	bool found = false;
+	for_each_directive(field, [&](std::string_view name, std::string_view)
+	{
+		found = found || same_name(name, wanted);
+	});
+	return found;
+}
+
+// whether each field a Vary lists is one of names; "*" never is
+bool
+varies_only_on(
+	boost::beast::string_view beast_field,
+	const std::vector<std::string> & names
+)
+{
+	std::string_view field{beast_field.data(), beast_field.size()};
+	while ( false == field.empty() )
+	{
+		auto comma = field.find(',');
+		auto name = trim(field.substr(0, comma));
+		field = std::string_view::npos == comma ? std::string_view{} : field.substr(comma + 1);
+
+		if (
+			false == name.empty()
+			&& std::none_of(names.begin(), names.end(), [name](const std::string & known)
+			{
+				return same_name(known, name);
+			})
+		)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// the statuses a response may be kept for without being told it may
+// (RFC 7231, 6.1)
+bool
+cacheable_status(
+	unsigned status
+)
+{
+	switch ( status )
+	{
+	case 200: case 203: case 204: case 300: case 301: case 308:
+	case 404: case 405: case 410: case 414: case 501:
+		return true;
+	default:
+		return false;
+	}
+}
+
+std::size_t
+cost_of(
+	const std::string & key,
+	const std::string & serialized
+)
+{
+	return key.size() + serialized.size();
+}
+
+} // namespace
+
+http_cache_endpoint::http_cache_endpoint(
+	http_endpoint & child,
+	http_response_cache_policy policy
+)
+: child_(child)
+, policy_(std::move(policy))
+{
+	std::size_t count = 1;
+	while ( count < policy_.shards )
+	{
+		count <<= 1;
+	}
+	shards_.reserve(count);
+	for ( std::size_t i = 0; i < count; ++i )
+	{
+		shards_.push_back(std::make_unique<shard>());
+	}
+	shard_mask_ = count - 1;
+	shard_capacity_ = policy_.capacity_bytes / count;
+}
+
+http_response
+http_cache_endpoint::handle(
+	http_connection & connection,
+	http_request & request
+)
+{
+	bool head = http::verb::head == request.method();
+	bool bypass =
+		( false == head && http::verb::get != request.method() )
+		|| 11 != request.version()
+		|| false == request.keep_alive()
+		|| connection.draining()
+		|| has_directive(request[http::field::cache_control], "no-store");
+
+	// a shared cache must not hand one user's answer to another
+	if ( false == bypass && request.end() != request.find(http::field::authorization) )
+	{
+		bypass = std::none_of(policy_.vary_on.begin(), policy_.vary_on.end(), [](const std::string & name)
+		{
+			return same_name(name, "Authorization");
+		});
+	}
+	if ( bypass )
+	{
+		return child_.handle(connection, request);
+	}
+
+	std::string key;
+	key_of(request, key);
+
+	bool revalidate =
+		has_directive(request[http::field::cache_control], "no-cache")
+		|| has_directive(request[http::field::pragma], "no-cache");
+	if ( false == revalidate )
+	{
+		if ( auto hit = find(key) )
+		{
+			hits_.fetch_add(1, std::memory_order_relaxed);
+			connection.send_serialized(
+				hit->serialized,
+				head ? hit->header_size : hit->serialized->size()
+			);
+
+			auto response = http_make_response(request.get_allocator());
+			response.version(11);
+			response.result(hit->status);
+			response.keep_alive(true);
+			return response;
+		}
+	}
+	misses_.fetch_add(1, std::memory_order_relaxed);
+
+	auto response = child_.handle(connection, request);
+	if ( head || connection.body_attached() || policy_.maximum_entry < response.body().size() )
+	{
+		return response;
+	}
+
+	auto ttl = freshness(response);
+	if ( 0 == ttl.count() )
+	{
+		return response;
+	}
+
+	auto fresh = serialize(response);
+	fresh->key = std::move(key);
+	fresh->expires = clock::now() + ttl;
+	insert(std::move(fresh));
+	return response;
+}
+
+http_endpoint *
+http_cache_endpoint::resolve(
+	http_connection & connection,
+	const http_request_header & header
+)
+{
+	return child_.resolve(connection, header) ? this : nullptr;
+}
+
+http_body_handling
+http_cache_endpoint::body_handling(
+	http_connection & connection,
+	const http_request_header & header
+)
+{
+	auto * endpoint = child_.resolve(connection, header);
+	return endpoint ? endpoint->body_handling(connection, header) : http_body_handling{};
+}
+
+http_execution
+http_cache_endpoint::execution(
+	http_connection & connection,
+	const http_request_header & header
+)
+{
+	auto * endpoint = child_.resolve(connection, header);
+	return endpoint ? endpoint->execution(connection, header) : http_execution::io_thread;
+}
+
+void
+http_cache_endpoint::clear()
+{
+	for ( auto & s : shards_ )
+	{
+		std::unique_lock<std::shared_mutex> lock{s->mutex};
+		s->index.clear();
+		s->slots.clear();
+		s->free_slots.clear();
+		s->hand = 0;
+		s->bytes = 0;
+	}
+}
+
+std::size_t
+http_cache_endpoint::size() const
+{
+	std::size_t bytes = 0;
+	for ( const auto & s : shards_ )
+	{
+		std::shared_lock<std::shared_mutex> lock{s->mutex};
+		bytes += s->bytes;
+	}
+	return bytes;
+}
+
+std::size_t
+http_cache_endpoint::entries() const
+{
+	std::size_t count = 0;
+	for ( const auto & s : shards_ )
+	{
+		std::shared_lock<std::shared_mutex> lock{s->mutex};
+		count += s->index.size();
+	}
+	return count;
+}
+
+void
+http_cache_endpoint::key_of(
+	const http_request_header & request,
+	std::string & key
+) const
+{
+	auto target = request.target();
+	key.assign(target.data(), target.size());
+	for ( const auto & name : policy_.vary_on )
+	{
+		// no target or field value holds a line feed
+		auto value = request[boost::beast::string_view{name.data(), name.size()}];
+		key += '\n';
+		key.append(value.data(), value.size());
+	}
+}
+
+http_cache_endpoint::shard &
+http_cache_endpoint::shard_of(
+	std::string_view key
+)
+{
+	return *shards_[std::hash<std::string_view>{}(key) & shard_mask_];
+}
+
+std::shared_ptr<const http_cache_endpoint::entry>
+http_cache_endpoint::find(
+	std::string_view key
+)
+{
+	auto & s = shard_of(key);
+
+	std::shared_lock<std::shared_mutex> lock{s.mutex};
+	auto found = s.index.find(key);
+	if ( s.index.end() == found )
+	{
+		return {};
+	}
+
+	const auto & e = s.slots[found->second];
+	if ( e->expires <= clock::now() )
+	{
+		// replaced by the next miss, or evicted first
+		return {};
+	}
+
+	// the only write a hit makes
+	if ( false == e->referenced.load(std::memory_order_relaxed) )
+	{
+		e->referenced.store(true, std::memory_order_relaxed);
+	}
+	return e;
+}
+
+void
+http_cache_endpoint::insert(
+	std::shared_ptr<const entry> fresh
+)
+{
+	auto cost = cost_of(fresh->key, *fresh->serialized);
+	if ( shard_capacity_ < cost )
+	{
+		return;
+	}
+
+	auto & s = shard_of(fresh->key);
+	std::unique_lock<std::shared_mutex> lock{s.mutex};
+
+	// another thread may have missed on it as well
+	auto found = s.index.find(fresh->key);
+	if ( s.index.end() != found )
+	{
+		evict(s, found->second);
+	}
+
+	// an entry used since the hand last passed it gets another round;
+	// an expired one never does
+	auto now = clock::now();
+	while ( 0u < s.bytes && shard_capacity_ < s.bytes + cost )
+	{
+		if ( s.slots.size() <= s.hand )
+		{
+			s.hand = 0;
+		}
+
+		const auto & candidate = s.slots[s.hand];
+		if (
+			candidate
+			&& (
+				candidate->expires <= now
+				|| false == candidate->referenced.exchange(false, std::memory_order_relaxed)
+			)
+		)
+		{
+			evict(s, s.hand);
+			evictions_.fetch_add(1, std::memory_order_relaxed);
+		}
+		++s.hand;
+	}
+
+	std::size_t slot;
+	if ( s.free_slots.empty() )
+	{
+		slot = s.slots.size();
+		s.slots.emplace_back();
+	}
+	else
+	{
+		slot = s.free_slots.back();
+		s.free_slots.pop_back();
+	}
+
+	std::string_view key{fresh->key};
+	s.slots[slot] = std::move(fresh);
+	s.index.emplace(key, slot);
+	s.bytes += cost;
+}
+
+void
+http_cache_endpoint::evict(
+	shard & s,
+	std::size_t slot
+)
+{
+	auto & e = s.slots[slot];
+	s.bytes -= cost_of(e->key, *e->serialized);
+	s.index.erase(e->key);
+
+	// a connection still writing it keeps its bytes alive
+	e.reset();
+	s.free_slots.push_back(slot);
+}
+
+std::chrono::milliseconds
+http_cache_endpoint::freshness(
+	const http_response & response
+) const
+{
+	if (
+		false == cacheable_status(response.result_int())
+		|| 11 != response.version()
+		|| false == response.keep_alive()
+		|| response.chunked()
+		|| false == response.has_content_length()
+		|| response.end() != response.find(http::field::set_cookie)
+	)
+	{
+		return std::chrono::milliseconds{0};
+	}
+
+	// the key only tells requests apart by vary_on; an answer chosen by
+	// any other field would be handed to requests it was not chosen for
+	auto varies = response.equal_range(http::field::vary);
+	for ( auto field = varies.first; field != varies.second; ++field )
+	{
+		if ( false == varies_only_on(field->value(), policy_.vary_on) )
+		{
+			return std::chrono::milliseconds{0};
+		}
+	}
+
+	bool forbidden = false;
+	std::optional<long long> max_age, s_maxage;
+	for_each_directive(response[http::field::cache_control], [&](std::string_view name, std::string_view value)
+	{
+		auto seconds = [&]()
+		{
+			long long parsed = 0;
+			auto result = std::from_chars(value.data(), value.data() + value.size(), parsed);
+			if ( std::errc{} != result.ec || parsed < 0 )
+			{
+				return 0ll;
+			}
+
+			// a year is forever as far as we are concerned
+			return std::min(parsed, 365ll * 24 * 60 * 60);
+		};
+
+		if (
+			same_name(name, "no-store")
+			|| same_name(name, "no-cache")
+			|| same_name(name, "private")
+		)
+		{
+			forbidden = true;
+		}
+		else if ( same_name(name, "s-maxage") )
+		{
+			s_maxage = seconds();
+		}
+		else if ( same_name(name, "max-age") )
+		{
+			max_age = seconds();
+		}
+	});
+	if ( forbidden )
+	{
+		return std::chrono::milliseconds{0};
+	}
+
+	if ( s_maxage )
+	{
+		return std::chrono::seconds{*s_maxage};
+	}
+	if ( max_age )
+	{
+		return std::chrono::seconds{*max_age};
+	}
+	return policy_.ttl;
+}
+
+std::shared_ptr<http_cache_endpoint::entry>
+http_cache_endpoint::serialize(
+	const http_response & response
+) const
+{
+	std::ostringstream out;
+	out << response.base();
+	auto header_size = static_cast<std::size_t>(out.tellp());
+	const auto & body = response.body();
+	out.write(body.data(), static_cast<std::streamsize>(body.size()));
+
+	auto fresh = std::make_shared<entry>();
+	fresh->serialized = std::make_shared<const std::string>(out.str());
+	fresh->header_size = header_size;
+	fresh->status = response.result_int();
+	return fresh;
+}
+
+} // namespace koti
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "httpd.hpp"
+
+namespace koti {
+
+struct http_response_cache_policy
+{
+	// bytes of serialized responses held, across every shard
+	std::size_t capacity_bytes = 64 * 1024 * 1024;
+
+	// larger responses are passed through and never held
+	std::size_t maximum_entry = 1024 * 1024;
+
+	// how long a response stays fresh unless its Cache-Control says
+	std::chrono::milliseconds ttl{std::chrono::seconds(1)};
+
+	// request header fields that tell responses to the same target apart
+	std::vector<std::string> vary_on;
+
+	// lookups on different shards never contend; rounded up to a power of
+	// two
+	std::size_t shards = 16;
+};
+
+// Answers GET and HEAD from what child answered to an earlier GET of the
+// same target, while that answer is fresh. Entries are kept serialized, so
+// a hit is handed to the connection as one write (see
+// http_connection::send_serialized()) without building a response at all;
+// HEAD is sent the header of the same bytes.
+//
+// A response is kept for policy.ttl, or for its Cache-Control s-maxage or
+// max-age. Only responses a shared cache may keep are: a cacheable status,
+// no no-store, no-cache or private directive, no Set-Cookie, a Vary naming
+// only vary_on fields, a Content-Length and no body from a file or a
+// writer. A request with
+// Cache-Control no-cache (or Pragma: no-cache) skips the lookup and
+// refreshes the entry; no-store, an Authorization field not in vary_on, or
+// anything but a persistent HTTP/1.1 connection bypasses the cache.
+//
+// Lookups take their shard's lock shared and only mark the entry as used;
+// inserts take it exclusively and make room by CLOCK (second chance)
+// eviction, expired entries first. Safe to use from every thread.
+//
+// Hits are not compressed by the connection; vary on Accept-Encoding and
+// have child compress if that matters.
+class http_cache_endpoint
+: public http_endpoint
+{
+public:
+	explicit
+	http_cache_endpoint(
+		http_endpoint & child,
+		http_response_cache_policy policy = {}
+	);
+
+	http_cache_endpoint(const http_cache_endpoint & copy_ctor) = delete;
+	http_cache_endpoint & operator=(const http_cache_endpoint & copy_assign) = delete;
+
+	http_response
+	handle(
+		http_connection & connection,
+		http_request & request
+	) override;
+
+	// this, when child has an endpoint for header
+	http_endpoint *
+	resolve(
+		http_connection & connection,
+		const http_request_header & header
+	) override;
+
+	// child's, for the endpoint child resolves to
+	http_body_handling
+	body_handling(
+		http_connection & connection,
+		const http_request_header & header
+	) override;
+
+	http_execution
+	execution(
+		http_connection & connection,
+		const http_request_header & header
+	) override;
+
+	const http_response_cache_policy &
+	policy() const
+	{
+		return policy_;
+	}
+
+	// drops every entry
+	void
+	clear();
+
+	// bytes of serialized responses held
+	std::size_t
+	size() const;
+
+	std::size_t
+	entries() const;
+
+	std::uint64_t
+	hits() const
+	{
+		return hits_.load(std::memory_order_relaxed);
+	}
+
+	std::uint64_t
+	misses() const
+	{
+		return misses_.load(std::memory_order_relaxed);
+	}
+
+	std::uint64_t
+	evictions() const
+	{
+		return evictions_.load(std::memory_order_relaxed);
+	}
+
+protected:
+	using clock = std::chrono::steady_clock;
+
+	struct entry
+	{
+		// the target and the vary_on fields
+		std::string key;
+
+		std::shared_ptr<const std::string> serialized;
+
+		// of serialized; what a HEAD is sent
+		std::size_t header_size = 0;
+
+		unsigned status = 0;
+		clock::time_point expires;
+
+		// set by every hit, cleared as the clock hand passes. unset at
+		// first, so what is never hit again goes before what is
+		mutable std::atomic<bool> referenced{false};
+	};
+
+	struct shard
+	{
+		alignas(64) mutable std::shared_mutex mutex;
+		std::unordered_map<std::string_view, std::size_t> index;
+
+		// the clock; empty slots are listed in free_slots
+		std::vector<std::shared_ptr<const entry>> slots;
+		std::vector<std::size_t> free_slots;
+		std::size_t hand = 0;
+		std::size_t bytes = 0;
+	};
+
+	// the target and the vary_on fields of request
+	void
+	key_of(
+		const http_request_header & request,
+		std::string & key
+	) const;
+
+	shard &
+	shard_of(
+		std::string_view key
+	);
+
+	std::shared_ptr<const entry>
+	find(
+		std::string_view key
+	);
+
+	void
+	insert(
+		std::shared_ptr<const entry> fresh
+	);
+
+	// frees slot; with shard's lock held exclusively
+	void
+	evict(
+		shard & s,
+		std::size_t slot
+	);
+
+	// how long response may be kept; zero when it may not
+	std::chrono::milliseconds
+	freshness(
+		const http_response & response
+	) const;
+
+	// the whole response and the size of its header, for keeping
+	std::shared_ptr<entry>
+	serialize(
+		const http_response & response
+	) const;
+
+	http_endpoint & child_;
+	http_response_cache_policy policy_;
+	std::vector<std::unique_ptr<shard>> shards_;
+	std::size_t shard_mask_;
+	std::size_t shard_capacity_;
+	std::atomic<std::uint64_t> hits_{0};
+	std::atomic<std::uint64_t> misses_{0};
+	std::atomic<std::uint64_t> evictions_{0};
+};
+
+} // namespace koti
@@ -0,0 +1,199 @@
+#include "http_response_writer.hpp"
+
+#include <utility>
+
+namespace koti {
+
+http_response_writer::http_response_writer(
+	executor_type executor,
+	std::size_t high_water
+)
+: executor_(std::move(executor))
+, high_water_(high_water)
+{
+}
+
+bool
+http_response_writer::write(
+	std::string_view data
+)
+{
+	std::lock_guard<std::mutex> lock{mutex_};
+	if ( closed_ || finished_ )
+	{
+		return false;
+	}
+
+	pending_.append(data.data(), data.size());
+	schedule_wake();
+
+	if ( high_water_ <= pending_.size() + in_flight_ )
+	{
+		drain_wanted_ = true;
+		return false;
+	}
+	return true;
+}
+
+bool
+http_response_writer::write_event(
+	std::string_view data,
+	std::string_view event
+)
+{
+	std::string framed;
+	if ( ! event.empty() )
+	{
+		framed.append("event: ").append(event.data(), event.size()).append("\n");
+	}
+	for ( ;; )
+	{
+		auto newline = data.find('\n');
+		auto line = data.substr(0, newline);
+		framed.append("data: ").append(line.data(), line.size()).append("\n");
+		if ( std::string_view::npos == newline )
+		{
+			break;
+		}
+		data.remove_prefix(newline + 1);
+	}
+	framed.append("\n");
+	return write(framed);
+}
+
+void
+http_response_writer::finish()
+{
+	std::lock_guard<std::mutex> lock{mutex_};
+	if ( closed_ || finished_ )
+	{
+		return;
+	}
+	finished_ = true;
+	schedule_wake();
+}
+
+bool
+http_response_writer::closed() const
+{
+	std::lock_guard<std::mutex> lock{mutex_};
+	return closed_ || finished_;
+}
+
+std::size_t
+http_response_writer::pending() const
+{
+	std::lock_guard<std::mutex> lock{mutex_};
+	return pending_.size() + in_flight_;
+}
+
+void
+http_response_writer::on_drain(
+	std::function<void()> callback
+)
+{
+	std::lock_guard<std::mutex> lock{mutex_};
+	on_drain_ = std::move(callback);
+}
+
+void
+http_response_writer::attach(
+	std::function<void()> wake
+)
+{
+	std::lock_guard<std::mutex> lock{mutex_};
+	wake_ = std::move(wake);
+	work_.emplace(executor_);
+}
+
+void
+http_response_writer::detach()
+{
+	std::function<void()> drained;
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+		closed_ = true;
+		wake_ = nullptr;
+		work_.reset();
+		pending_.clear();
+		pending_.shrink_to_fit();
+		in_flight_ = 0;
+		if ( drain_wanted_ )
+		{
+			drain_wanted_ = false;
+			drained = on_drain_;
+		}
+	}
+
+	// let a producer waiting for room find out it will never get any
+	if ( drained )
+	{
+		drained();
+	}
+}
+
+bool
+http_response_writer::take(
+	std::string & sending
+)
+{
+	std::lock_guard<std::mutex> lock{mutex_};
+	sending.swap(pending_);
+	in_flight_ = sending.size();
+	return finished_;
+}
+
+void
+http_response_writer::sent()
+{
+	std::function<void()> drained;
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+		in_flight_ = 0;
+		if ( drain_wanted_ && pending_.size() <= high_water_ / 2 )
+		{
+			drain_wanted_ = false;
+			drained = on_drain_;
+		}
+	}
+
+	if ( drained )
+	{
+		drained();
+	}
+}
+
+void
+http_response_writer::schedule_wake()
+{
+	// under mutex_. one wake in flight is enough: it takes everything
+	// queued by the time it runs
+	if ( wake_posted_ || ! wake_ )
+	{
+		return;
+	}
+	wake_posted_ = true;
+
+	asio::post(executor_, [self = shared_from_this()]()
+	{
+		self->run_wake();
+	});
+}
+
+void
+http_response_writer::run_wake()
+{
+	std::function<void()> wake;
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+		wake_posted_ = false;
+		wake = wake_;
+	}
+
+	if ( wake )
+	{
+		wake();
+	}
+}
+
+} // namespace koti
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <boost/asio.hpp>
+namespace asio = boost::asio;
+
+namespace koti {
+
+// Body of a response that is produced after handle() has returned, eg. a
+// long-running job's output or a server-sent event stream. Obtained from
+// http_connection::stream_response() while handling the request; the
+// response handle() returns supplies the status and header fields, and
+// the connection sends it chunked (close-delimited to HTTP/1.0 clients).
+//
+// Every member may be called from any thread. Data is copied in and sent
+// as fast as the socket takes it. Like a node.js stream, write() returns
+// false once more than high_water bytes are waiting; the producer should
+// then hold off until the drain callback runs.
+//
+//	auto writer = connection.stream_response();
+//	std::thread{[writer]()
+//	{
+//		while ( more() && writer->write(next()) ) {}
+//		writer->finish();
+//	}}.detach();
+//	return http_status_response(request, http::status::ok);
+class http_response_writer
+: public std::enable_shared_from_this<http_response_writer>
+{
+public:
+	using executor_type = asio::any_io_executor;
+
+	static constexpr std::size_t default_high_water = 64 * 1024;
+
+	http_response_writer(
+		executor_type executor,
+		std::size_t high_water = default_high_water
+	);
+
+	http_response_writer(const http_response_writer & copy_ctor) = delete;
+	http_response_writer & operator=(const http_response_writer & copy_assign) = delete;
+
+	// queue data. false when the producer should wait for the drain
+	// callback, or when the stream is closed and the data was discarded
+	bool
+	write(
+		std::string_view data
+	);
+
+	// queue one server-sent event (text/event-stream); a multi-line data
+	// becomes one `data:` line per line
+	bool
+	write_event(
+		std::string_view data,
+		std::string_view event = {}
+	);
+
+	// end the body once everything queued is sent
+	void
+	finish();
+
+	// no longer accepting data: finished, or the client went away
+	bool
+	closed() const;
+
+	// bytes queued or being written
+	std::size_t
+	pending() const;
+
+	std::size_t
+	high_water() const
+	{
+		return high_water_;
+	}
+
+	// run, on the connection's thread, after a write() returned false and
+	// the backlog has dropped to half of high_water, or the stream closed
+	void
+	on_drain(
+		std::function<void()> callback
+	);
+
+	// http_connection's side
+
+	// wake is run on the connection's thread whenever there is something
+	// new to send. until detach(), the stream counts as outstanding work:
+	// its io_context must not run dry while the producer is still busy
+	void
+	attach(
+		std::function<void()> wake
+	);
+
+	// closes the stream for good; from the connection's thread
+	void
+	detach();
+
+	// swaps the queued data into sending (which must be empty); true once
+	// nothing more will ever be queued
+	bool
+	take(
+		std::string & sending
+	);
+
+	// what take() handed out has been written
+	void
+	sent();
+
+protected:
+	void
+	schedule_wake();
+
+	void
+	run_wake();
+
+	executor_type executor_;
+	std::size_t high_water_;
+
+	mutable std::mutex mutex_;
+	std::string pending_;
+	std::size_t in_flight_ = 0;
+	bool finished_ = false;
+	bool closed_ = false;
+	bool wake_posted_ = false;
+	bool drain_wanted_ = false;
+	std::function<void()> wake_;
+	std::function<void()> on_drain_;
+	std::optional<asio::executor_work_guard<executor_type>> work_;
+};
+
+} // namespace koti
@@ -0,0 +1,373 @@
+#include "http_router.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace koti {
+
+namespace {
+
+// next non-empty segment of path, consuming it (and its separator)
+std::string_view
+next_segment(
+	std::string_view & path
+)
+{
+	while ( ! path.empty() && '/' == path.front() )
+	{
+		path.remove_prefix(1);
+	}
+
+	auto end = path.find('/');
+	if ( std::string_view::npos == end )
+	{
+		end = path.size();
+	}
+
+	auto segment = path.substr(0, end);
+	path.remove_prefix(end);
+	return segment;
+}
+
+} // namespace
+
+struct http_router::node
+{
+	// literal children, sorted by segment for binary search
+	std::vector<std::pair<std::string, std::unique_ptr<node>>> literals;
+
+	std::unique_ptr<node> parameter;
+	std::string parameter_name;
+
+	std::unique_ptr<node> wildcard;
+	std::string wildcard_name;
+
+	// endpoint per verb; only routes ending here have any
+	std::vector<std::pair<http::verb, http_endpoint*>> verbs;
+	http_endpoint * any_verb = nullptr;
+
+	bool
+	is_route() const
+	{
+		return any_verb || ! verbs.empty();
+	}
+
+	node *
+	find_literal(
+		std::string_view segment
+	) const
+	{
+		auto at = std::lower_bound(
+			literals.begin(),
+			literals.end(),
+			segment,
+			[](const auto & literal, std::string_view key)
+		{
+			return std::string_view{literal.first} < key;
+		});
+		if ( literals.end() == at || at->first != segment )
+		{
+			return nullptr;
+		}
+		return at->second.get();
+	}
+
+	node &
+	literal(
+		std::string_view segment
+	)
+	{
+		auto at = std::lower_bound(
+			literals.begin(),
+			literals.end(),
+			segment,
+			[](const auto & literal, std::string_view key)
+		{
+			return std::string_view{literal.first} < key;
+		});
+		if ( literals.end() == at || at->first != segment )
+		{
+			at = literals.emplace(at, std::string{segment}, std::make_unique<node>());
+		}
+		return *at->second;
+	}
+
+	http_endpoint *
+	endpoint_for(
+		http::verb verb
+	) const
+	{
+		for ( const auto & v : verbs )
+		{
+			if ( v.first == verb )
+			{
+				return v.second;
+			}
+		}
+		return any_verb;
+	}
+
+	void
+	set_endpoint(
+		http::verb verb,
+		http_endpoint & endpoint
+	)
+	{
+		if ( http::verb::unknown == verb )
+		{
+			any_verb = &endpoint;
+			return;
+		}
+		for ( auto & v : verbs )
+		{
+			if ( v.first == verb )
+			{
+				v.second = &endpoint;
+				return;
+			}
+		}
+		verbs.emplace_back(verb, &endpoint);
+	}
+};
+
+http_router::http_router()
+: root_(std::make_unique<node>())
+{
+}
+
+http_router::~http_router() = default;
+
+http_router &
+http_router::add(
+	std::string_view pattern,
+	http_endpoint & endpoint
+)
+{
+	return add(http::verb::unknown, pattern, endpoint);
+}
+
+http_router &
+http_router::add(
+	std::string_view pattern,
+	http_verb_endpoint & endpoint
+)
+{
+	return add(endpoint.type(), pattern, endpoint);
+}
+
+http_router &
+http_router::add(
+	http_path_endpoint & endpoint
+)
+{
+	return add(http::verb::unknown, endpoint.path(), endpoint);
+}
+
+http_router &
+http_router::add(
+	http::verb verb,
+	std::string_view pattern,
+	http_endpoint & endpoint
+)
+{
+	node * at = root_.get();
+	for (
+		auto segment = next_segment(pattern);
+		! segment.empty();
+		segment = next_segment(pattern)
+	)
+	{
+		switch ( segment.front() )
+		{
+		case ':':
+			segment.remove_prefix(1);
+			if ( ! at->parameter )
+			{
+				at->parameter = std::make_unique<node>();
+				at->parameter_name = std::string{segment};
+			}
+			else if ( at->parameter_name != segment )
+			{
+				throw std::invalid_argument{
+					"route parameter :" + std::string{segment}
+					+ " conflicts with :" + at->parameter_name
+				};
+			}
+			at = at->parameter.get();
+			break;
+
+		case '*':
+			segment.remove_prefix(1);
+			if ( ! next_segment(pattern).empty() )
+			{
+				throw std::invalid_argument{"route wildcard must be the last segment"};
+			}
+			if ( segment.empty() )
+			{
+				segment = "*";
+			}
+			if ( ! at->wildcard )
+			{
+				at->wildcard = std::make_unique<node>();
+				at->wildcard_name = std::string{segment};
+			}
+			else if ( at->wildcard_name != segment )
+			{
+				throw std::invalid_argument{
+					"route wildcard *" + std::string{segment}
+					+ " conflicts with *" + at->wildcard_name
+				};
+			}
+			at = at->wildcard.get();
+			break;
+
+		default:
+			at = &at->literal(segment);
+			break;
+		}
+	}
+
+	at->set_endpoint(verb, endpoint);
+	return *this;
+}
+
+const http_router::node *
+http_router::match(
+	std::string_view path,
+	http_route_captures & captures
+) const
+{
+	return match_from(*root_, path, captures);
+}
+
+const http_router::node *
+http_router::match_from(
+	const node & at,
+	std::string_view path,
+	http_route_captures & captures
+)
+{
+	auto rest = path;
+	auto segment = next_segment(rest);
+
+	if ( segment.empty() )
+	{
+		if ( at.is_route() )
+		{
+			return &at;
+		}
+		// a trailing wildcard also matches nothing at all
+		if ( at.wildcard && at.wildcard->is_route() )
+		{
+			captures.add(at.wildcard_name, {});
+			return at.wildcard.get();
+		}
+		return nullptr;
+	}
+
+	// literal > parameter > wildcard; a dead end backs out to the next
+	if ( const auto * literal = at.find_literal(segment) )
+	{
+		if ( const auto * found = match_from(*literal, rest, captures) )
+		{
+			return found;
+		}
+	}
+
+	if ( at.parameter )
+	{
+		auto captured = captures.size();
+		captures.add(at.parameter_name, segment);
+		if ( const auto * found = match_from(*at.parameter, rest, captures) )
+		{
+			return found;
+		}
+		captures.resize(captured);
+	}
+
+	if ( at.wildcard && at.wildcard->is_route() )
+	{
+		// everything from this segment on, without the leading '/'
+		while ( ! path.empty() && '/' == path.front() )
+		{
+			path.remove_prefix(1);
+		}
+		captures.add(at.wildcard_name, path);
+		return at.wildcard.get();
+	}
+
+	return nullptr;
+}
+
+http_endpoint *
+http_router::resolve(
+	http_connection & connection,
+	const http_request_header & header
+)
+{
+	auto & captures = connection.route_captures();
+	auto captured = captures.size();
+
+	const node * route = match(http_target_path(header.target()), captures);
+	if ( nullptr == route )
+	{
+		captures.resize(captured);
+		return nullptr;
+	}
+
+	auto * endpoint = route->endpoint_for(header.method());
+	if ( nullptr == endpoint )
+	{
+		captures.resize(captured);
+		return nullptr;
+	}
+
+	return endpoint->resolve(connection, header);
+}
+
+http_response
+http_router::handle(
+	http_connection & connection,
+	http_request & request
+)
+{
+	auto & captures = connection.route_captures();
+	auto captured = captures.size();
+
+	const node * route = match(http_target_path(request.target()), captures);
+	if ( nullptr == route )
+	{
+		captures.resize(captured);
+		return http_status_response(request, http::status::not_found);
+	}
+
+	auto * endpoint = route->endpoint_for(request.method());
+	if ( nullptr == endpoint )
+	{
+		captures.resize(captured);
+
+		auto response = http_status_response(request, http::status::method_not_allowed);
+		std::string allow;
+		for ( const auto & v : route->verbs )
+		{
+			if ( ! allow.empty() )
+			{
+				allow += ", ";
+			}
+			auto name = http::to_string(v.first);
+			allow.append(name.data(), name.size());
+		}
+		response.set(http::field::allow, allow);
+		return response;
+	}
+
+	// let a nested router or other composite pick its own child
+	auto * resolved = endpoint->resolve(connection, request);
+	if ( nullptr == resolved )
+	{
+		return http_status_response(request, http::status::not_found);
+	}
+	return resolved->handle(connection, request);
+}
+
+} // namespace koti
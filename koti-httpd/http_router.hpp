@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "httpd.hpp"
+
+namespace koti {
+
+// Radix trie of endpoints keyed on path segments.
+//
+// Patterns are made of `/`-separated segments:
+//	literal		matches itself exactly
+//	:name		matches any one segment, captured as `name`
+//	*name		matches the rest of the path (possibly empty), captured as
+//			`name`; a bare `*` is captured as `*`. must be last
+//
+// Literal segments are preferred over parameters, and parameters over
+// wildcards; when a preferred branch does not lead to a route, the next is
+// tried. Empty segments are ignored, so `/a//b/` is `/a/b`.
+//
+// Each route holds one endpoint per verb plus an optional endpoint for any
+// verb. A path that matches with no endpoint for the request's verb is
+// answered with 405 and an Allow header; no match at all is 404.
+class http_router
+: public http_endpoint
+{
+public:
+	http_router();
+	~http_router() override;
+
+	http_router(const http_router & copy_ctor) = delete;
+	http_router & operator=(const http_router & copy_assign) = delete;
+
+	// route any verb of pattern to endpoint
+	http_router &
+	add(
+		std::string_view pattern,
+		http_endpoint & endpoint
+	);
+
+	http_router &
+	add(
+		http::verb verb,
+		std::string_view pattern,
+		http_endpoint & endpoint
+	);
+
+	// routes only the endpoint's own verb
+	http_router &
+	add(
+		std::string_view pattern,
+		http_verb_endpoint & endpoint
+	);
+
+	// routes endpoint at its own path()
+	http_router &
+	add(
+		http_path_endpoint & endpoint
+	);
+
+	http_endpoint *
+	resolve(
+		http_connection & connection,
+		const http_request_header & header
+	) override;
+
+	http_response
+	handle(
+		http_connection & connection,
+		http_request & request
+	) override;
+
+protected:
+	struct node;
+
+	// node the path leads to (with captures recorded), or nullptr
+	const node *
+	match(
+		std::string_view path,
+		http_route_captures & captures
+	) const;
+
+	static
+	const node *
+	match_from(
+		const node & at,
+		std::string_view path,
+		http_route_captures & captures
+	);
+
+	std::unique_ptr<node> root_;
+};
+
+} // namespace koti
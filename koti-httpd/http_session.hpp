@@ -1,6 +1,6 @@
 #pragma once
 
-#include "tcp_connection.hpp"
+#include "httpd.hpp"
 
 #include <boost/beast.hpp>
 
@@ -8,21 +8,24 @@ namespace koti {
 
 namespace http = boost::beast::http;
 
+// Owns an http_connection for code that drives one by hand rather than
+// through an httpd and its connection list. The connection may have been
+// accepted on a local socket or over TCP.
 class http_session
 {
 public:
 	using pointer = std::unique_ptr<http_session>;
-	using connection_ptr = tcp_connection::pointer;
+	using connection_ptr = http_connection::ptr;
 
-	http_session(connection_ptr && socket)
-		: connection_(std::move(socket))
+	http_session(connection_ptr && connection)
+		: connection_(std::move(connection))
 	{
 	}
 
-	static pointer upgrade(connection_ptr && socket)
+	static pointer upgrade(connection_ptr && connection)
 	{
 		pointer session = std::make_unique<http_session>(
-			std::move(socket)
+			std::move(connection)
 		);
 
 		return session;
@@ -30,15 +33,17 @@ public:
 
 	bool is_connected() const
 	{
-		// need to add query to tcp_connection
+		return connection_
+			&& http_connection::state::closed != connection_->current_state()
+			&& connection_->socket().is_open();
 	}
 
-	tcp_connection & connection()
+	http_connection & connection()
 	{
 		return *connection_;
 	}
 
-	const tcp_connection & connection() const
+	const http_connection & connection() const
 	{
 		return *connection_;
 	}
@@ -46,7 +51,7 @@ public:
 protected:
 
 	connection_ptr connection_;
-	
+
 };
 
 } // namespace koti
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace koti {
+
+// Bounded lock-free queue between exactly one pushing and one popping
+// thread.
+//
+// Each side owns one index and only reads the other's, with acquire, when
+// its cached copy says the queue is full (or empty); most pushes and pops
+// touch no cache line the other side writes. The capacity is rounded up to
+// a power of two.
+template <
+	class T
+>
+class http_spsc_queue
+{
+public:
+	explicit
+	http_spsc_queue(
+		std::size_t capacity
+	)
+	: slots_(round_up(capacity))
+	, mask_(slots_.size() - 1)
+	{
+	}
+
+	http_spsc_queue(const http_spsc_queue & copy_ctor) = delete;
+	http_spsc_queue & operator=(const http_spsc_queue & copy_assign) = delete;
+
+	// from the pushing thread only. false when full
+	bool
+	try_push(
+		T value
+	)
+	{
+		auto tail = tail_.load(std::memory_order_relaxed);
+		if ( slots_.size() == tail - head_cache_ )
+		{
+			head_cache_ = head_.load(std::memory_order_acquire);
+			if ( slots_.size() == tail - head_cache_ )
+			{
+				return false;
+			}
+		}
+
+		slots_[tail & mask_] = std::move(value);
+		tail_.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// from the popping thread only. false when empty
+	bool
+	try_pop(
+		T & value
+	)
+	{
+		auto head = head_.load(std::memory_order_relaxed);
+		if ( head == tail_cache_ )
+		{
+			tail_cache_ = tail_.load(std::memory_order_acquire);
+			if ( head == tail_cache_ )
+			{
+				return false;
+			}
+		}
+
+		value = std::move(slots_[head & mask_]);
+		head_.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	std::size_t
+	capacity() const
+	{
+		return slots_.size();
+	}
+
+	// exact only while neither side is busy with it
+	std::size_t
+	size() const
+	{
+		return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+	}
+
+protected:
+	static
+	std::size_t
+	round_up(
+		std::size_t capacity
+	)
+	{
+		std::size_t size = 1;
+		while ( size < capacity )
+		{
+			size <<= 1;
+		}
+		return size;
+	}
+
+	std::vector<T> slots_;
+	std::size_t mask_;
+
+	// written by the popping side
+	alignas(64) std::atomic<std::size_t> head_{0};
+	std::size_t tail_cache_ = 0;
+
+	// written by the pushing side
+	alignas(64) std::atomic<std::size_t> tail_{0};
+	std::size_t head_cache_ = 0;
+};
+
+} // namespace koti
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+#include "httpd.hpp"
+
+namespace koti {
+
+// seeded FNV-1a
+constexpr
+std::uint64_t
+http_route_hash(
+	std::string_view path,
+	std::uint64_t seed
+)
+{
+	std::uint64_t hash = 14695981039346656037ull ^ (seed * 0x9e3779b97f4a7c15ull);
+	for ( char c : path )
+	{
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// Fixed set of exact paths, hashed into a collision-free table while
+// compiling. A lookup is one hash, one slot and one string compare.
+//
+//	static constexpr auto routes = koti::make_http_static_route_table(
+//		"/status", "/metrics", "/version"
+//	);
+//	static_assert(1 == routes.find("/metrics"));
+//
+// Evaluation fails (and so does compilation, for a constexpr table) when
+// the paths contain duplicates.
+template <
+	std::size_t N
+>
+class http_static_route_table
+{
+public:
+	static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+	// power of two of at least twice the routes; sparse enough that a
+	// perfect seed is found within a handful of tries
+	static constexpr std::size_t table_size = []()
+	{
+		std::size_t size = 1;
+		while ( size < 2 * N )
+		{
+			size <<= 1;
+		}
+		return size;
+	}();
+
+	constexpr
+	explicit
+	http_static_route_table(
+		const std::array<std::string_view, N> & paths
+	)
+	: paths_(paths)
+	, seed_(find_seed(paths))
+	, slots_(build(paths, seed_))
+	{
+	}
+
+	// index of path in the original list, or npos
+	constexpr
+	std::size_t
+	find(
+		std::string_view path
+	) const
+	{
+		auto slot = slots_[http_route_hash(path, seed_) & (table_size - 1)];
+		if ( 0 == slot || paths_[slot - 1] != path )
+		{
+			return npos;
+		}
+		return slot - 1;
+	}
+
+	constexpr
+	std::size_t
+	size() const
+	{
+		return N;
+	}
+
+	constexpr
+	std::string_view
+	path(
+		std::size_t index
+	) const
+	{
+		return paths_[index];
+	}
+
+	constexpr
+	std::uint64_t
+	seed() const
+	{
+		return seed_;
+	}
+
+protected:
+	// slot holds route index + 1; 0 is empty
+	using slots_type = std::array<std::size_t, table_size>;
+
+	static
+	constexpr
+	bool
+	is_perfect(
+		const std::array<std::string_view, N> & paths,
+		std::uint64_t seed
+	)
+	{
+		std::array<bool, table_size> used{};
+		for ( const auto & path : paths )
+		{
+			auto slot = http_route_hash(path, seed) & (table_size - 1);
+			if ( used[slot] )
+			{
+				return false;
+			}
+			used[slot] = true;
+		}
+		return true;
+	}
+
+	static
+	constexpr
+	std::uint64_t
+	find_seed(
+		const std::array<std::string_view, N> & paths
+	)
+	{
+		for ( std::size_t i = 0; i < N; ++i )
+		{
+			for ( std::size_t j = i + 1; j < N; ++j )
+			{
+				if ( paths[i] == paths[j] )
+				{
+					throw std::invalid_argument{"duplicate path in static route table"};
+				}
+			}
+		}
+
+		for ( std::uint64_t seed = 0; seed < 0x10000; ++seed )
+		{
+			if ( is_perfect(paths, seed) )
+			{
+				return seed;
+			}
+		}
+		throw std::invalid_argument{"no perfect hash seed for static route table"};
+	}
+
+	static
+	constexpr
+	slots_type
+	build(
+		const std::array<std::string_view, N> & paths,
+		std::uint64_t seed
+	)
+	{
+		slots_type slots{};
+		for ( std::size_t i = 0; i < N; ++i )
+		{
+			slots[http_route_hash(paths[i], seed) & (table_size - 1)] = i + 1;
+		}
+		return slots;
+	}
+
+	std::array<std::string_view, N> paths_;
+	std::uint64_t seed_;
+	slots_type slots_;
+};
+
+template <
+	typename... Paths
+>
+constexpr
+auto
+make_http_static_route_table(
+	Paths... paths
+)
+{
+	return http_static_route_table<sizeof...(Paths)>{
+		std::array<std::string_view, sizeof...(Paths)>{std::string_view{paths}...}
+	};
+}
+
+// Dispatches exact paths of a static route table to the endpoint at the
+// same index; anything else is 404.
+template <
+	std::size_t N
+>
+class http_static_router
+: public http_endpoint
+{
+public:
+	using table_type = http_static_route_table<N>;
+	using endpoints_type = std::array<http_endpoint*, N>;
+
+	http_static_router(
+		const table_type & table,
+		const endpoints_type & endpoints
+	)
+	: table_(table)
+	, endpoints_(endpoints)
+	{
+	}
+
+	http_endpoint *
+	resolve(
+		http_connection & connection,
+		const http_request_header & header
+	) override
+	{
+		auto index = table_.find(http_target_path(header.target()));
+		if ( table_type::npos == index || nullptr == endpoints_[index] )
+		{
+			return nullptr;
+		}
+		return endpoints_[index]->resolve(connection, header);
+	}
+
+	http_response
+	handle(
+		http_connection & connection,
+		http_request & request
+	) override
+	{
+		auto * endpoint = resolve(connection, request);
+		if ( nullptr == endpoint )
+		{
+			return http_status_response(request, http::status::not_found);
+		}
+		return endpoint->handle(connection, request);
+	}
+
+protected:
+	table_type table_;
+	endpoints_type endpoints_;
+};
+
+} // namespace koti
@@ -0,0 +1,159 @@
+#include "http_timer_wheel.hpp"
+
+#include <algorithm>
+
+namespace koti {
+
+asio::io_context::id http_timer_wheel::id;
+
+http_timer_wheel::http_timer_wheel(
+	asio::io_context & iox
+)
+: asio::io_context::service(iox)
+, tick_timer_(iox)
+, epoch_(std::chrono::steady_clock::now())
+, slots_(new link[slots])
+{
+	static_assert(0u == (slots & (slots - 1)), "slots must be a power of two");
+}
+
+void
+http_timer_wheel::arm(
+	timer & t,
+	std::chrono::steady_clock::duration after
+)
+{
+	if ( t.wheel_ )
+	{
+		t.unlink();
+		--armed_;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	if ( 0u == armed_ && false == scheduled_ )
+	{
+		// nothing was due; skip the ticks that passed meanwhile
+		current_ = std::max(current_, tick_at(now) + 1);
+	}
+
+	// rounded up, so a timer never fires before its deadline
+	auto deadline = now + after - epoch_;
+	auto expiry = static_cast<std::uint64_t>((deadline + resolution - std::chrono::nanoseconds{1}) / resolution);
+
+	t.wheel_ = this;
+	t.expiry_ = std::max(expiry, current_);
+	slots_[t.expiry_ & (slots - 1)].push_back(&t);
+	++armed_;
+
+	if ( false == scheduled_ )
+	{
+		schedule();
+	}
+}
+
+void
+http_timer_wheel::cancel(
+	timer & t
+)
+{
+	if ( this != t.wheel_ )
+	{
+		return;
+	}
+
+	// the tick timer is left running; it stops by itself once it finds
+	// nothing armed, which saves re-arming it for every idle connection
+	t.unlink();
+	t.wheel_ = nullptr;
+	--armed_;
+}
+
+void
+http_timer_wheel::shutdown()
+{
+	// the io_context is going away; whatever is still armed never fires
+	for ( std::size_t i = 0; i < slots; ++i )
+	{
+		auto & slot = slots_[i];
+		while ( slot.linked() )
+		{
+			auto * t = static_cast<timer *>(slot.next_);
+			t->unlink();
+			t->wheel_ = nullptr;
+		}
+	}
+	armed_ = 0;
+	scheduled_ = false;
+
+	boost::system::error_code ignored;
+	tick_timer_.cancel(ignored);
+}
+
+std::uint64_t
+http_timer_wheel::tick_at(
+	std::chrono::steady_clock::time_point when
+) const
+{
+	return static_cast<std::uint64_t>((when - epoch_) / resolution);
+}
+
+void
+http_timer_wheel::schedule()
+{
+	scheduled_ = true;
+	tick_timer_.expires_at(epoch_ + current_ * resolution);
+	tick_timer_.async_wait([this](const boost::system::error_code & ec)
+	{
+		on_tick(ec);
+	});
+}
+
+void
+http_timer_wheel::on_tick(
+	const boost::system::error_code & ec
+)
+{
+	scheduled_ = false;
+	if ( asio::error::operation_aborted == ec )
+	{
+		return;
+	}
+
+	// gather everything due first: a callback may arm or cancel timers,
+	// including ones that are due in this very tick
+	auto now = tick_at(std::chrono::steady_clock::now());
+	link due;
+	auto last = std::min(now, current_ + slots - 1);
+	for ( auto tick = current_; tick <= last; ++tick )
+	{
+		auto & slot = slots_[tick & (slots - 1)];
+		for ( auto * l = slot.next_; l != &slot; )
+		{
+			auto * t = static_cast<timer *>(l);
+			l = l->next_;
+			if ( t->expiry_ <= now )
+			{
+				t->unlink();
+				due.push_back(t);
+			}
+		}
+	}
+	current_ = now + 1;
+
+	while ( due.linked() )
+	{
+		auto * t = static_cast<timer *>(due.next_);
+		t->unlink();
+		t->wheel_ = nullptr;
+		--armed_;
+		expired_.fetch_add(1, std::memory_order_relaxed);
+		t->on_expired_();
+	}
+
+	if ( 0u < armed_ && false == scheduled_ )
+	{
+		schedule();
+	}
+}
+
+} // namespace koti
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include <boost/asio.hpp>
+namespace asio = boost::asio;
+
+namespace koti {
+
+// Timeouts for every connection of an io_context, kept on one hashed timing
+// wheel instead of a steady_timer each. Arming, re-arming and cancelling a
+// timer only relinks it between intrusive lists, and the wheel wakes up once
+// per tick for all of its timers rather than once per timer. It only ticks
+// while something is armed, so an idle io_context still runs out of work.
+//
+// Deadlines are rounded up to whole ticks: a timer never fires early, and
+// late by at most one tick. Deadlines beyond one turn of the wheel wait in
+// their slot until the turn they are due in.
+//
+// Like the connections it serves, a wheel belongs to the one thread running
+// its io_context; nothing here is synchronized except the counters.
+class http_timer_wheel
+: public asio::io_context::service
+{
+	struct link
+	{
+		link * prev_ = this;
+		link * next_ = this;
+
+		bool
+		linked() const
+		{
+			return next_ != this;
+		}
+
+		void
+		unlink()
+		{
+			prev_->next_ = next_;
+			next_->prev_ = prev_;
+			prev_ = next_ = this;
+		}
+
+		// appends item to the list this is the head of
+		void
+		push_back(
+			link * item
+		)
+		{
+			item->prev_ = prev_;
+			item->next_ = this;
+			prev_->next_ = item;
+			prev_ = item;
+		}
+	};
+
+public:
+	static asio::io_context::id id;
+
+	static constexpr std::chrono::milliseconds resolution{100};
+	static constexpr std::size_t slots = 1024;
+
+	// one deadline, usually a member of what it times out. destroying an
+	// armed timer cancels it
+	class timer
+	: protected link
+	{
+	public:
+		explicit
+		timer(
+			std::function<void()> on_expired
+		)
+		: on_expired_(std::move(on_expired))
+		{
+		}
+
+		timer(const timer & copy_ctor) = delete;
+		timer & operator=(const timer & copy_assign) = delete;
+
+		~timer()
+		{
+			if ( wheel_ )
+			{
+				wheel_->cancel(*this);
+			}
+		}
+
+		bool
+		armed() const
+		{
+			return nullptr != wheel_;
+		}
+
+	protected:
+		friend class http_timer_wheel;
+
+		http_timer_wheel * wheel_ = nullptr;
+		std::uint64_t expiry_ = 0;
+		std::function<void()> on_expired_;
+	};
+
+	explicit
+	http_timer_wheel(
+		asio::io_context & iox
+	);
+
+	http_timer_wheel(const http_timer_wheel & copy_ctor) = delete;
+	http_timer_wheel & operator=(const http_timer_wheel & copy_assign) = delete;
+
+	// the wheel of the io_context executor belongs to, made on first use
+	template <
+		typename Executor
+	>
+	static
+	http_timer_wheel &
+	use(
+		const Executor & executor
+	)
+	{
+		return asio::use_service<http_timer_wheel>(
+			static_cast<asio::io_context &>(asio::query(executor, asio::execution::context))
+		);
+	}
+
+	// (re-)arms t to expire after the given time, replacing any earlier
+	// deadline. it expires at most once per arming, from this wheel's thread
+	void
+	arm(
+		timer & t,
+		std::chrono::steady_clock::duration after
+	);
+
+	void
+	cancel(
+		timer & t
+	);
+
+	// timers armed right now
+	std::size_t
+	armed() const
+	{
+		return armed_;
+	}
+
+	// timers that expired since the wheel was made
+	std::uint64_t
+	expired() const
+	{
+		return expired_.load(std::memory_order_relaxed);
+	}
+
+protected:
+	void
+	shutdown() override;
+
+	std::uint64_t
+	tick_at(
+		std::chrono::steady_clock::time_point when
+	) const;
+
+	void
+	schedule();
+
+	void
+	on_tick(
+		const boost::system::error_code & ec
+	);
+
+	asio::steady_timer tick_timer_;
+	std::chrono::steady_clock::time_point epoch_;
+	std::unique_ptr<link[]> slots_;
+
+	// every tick before this one has been processed
+	std::uint64_t current_ = 0;
+	std::size_t armed_ = 0;
+	bool scheduled_ = false;
+	std::atomic<std::uint64_t> expired_{0};
+};
+
+} // namespace koti
@@ -0,0 +1,507 @@
+#include "http_uring_acceptor.hpp"
+
+extern "C" {
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+} // extern "C"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+namespace koti {
+
+namespace {
+
+// user_data of the accept, and of the cancellation of it
+constexpr std::uint64_t accept_tag = 1;
+constexpr std::uint64_t cancel_tag = 2;
+
+int
+uring_setup(
+	unsigned entries,
+	io_uring_params * params
+)
+{
+	return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int
+uring_enter(
+	int fd,
+	unsigned to_submit,
+	unsigned min_complete,
+	unsigned flags
+)
+{
+	return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int
+uring_register(
+	int fd,
+	unsigned opcode,
+	const void * arg,
+	unsigned count
+)
+{
+	return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+boost::system::error_code
+last_error(
+)
+{
+	return {errno, boost::system::system_category()};
+}
+
+} // namespace
+
+// the mapped submission and completion queues of one io_uring. only ever
+// touched from one thread; the kernel is the other side of each queue
+struct http_uring_acceptor::ring
+{
+	int fd = -1;
+	int event = -1;
+
+	void * sq_map = MAP_FAILED;
+	std::size_t sq_map_size = 0;
+	void * cq_map = MAP_FAILED;
+	std::size_t cq_map_size = 0;
+	io_uring_sqe * sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+	std::size_t sqes_size = 0;
+
+	unsigned * sq_tail = nullptr;
+	unsigned * sq_mask = nullptr;
+	unsigned * sq_flags = nullptr;
+	unsigned * sq_array = nullptr;
+	unsigned * cq_head = nullptr;
+	unsigned * cq_tail = nullptr;
+	unsigned * cq_mask = nullptr;
+	io_uring_cqe * cqes = nullptr;
+
+	bool accept_in_flight = false;
+
+	~ring()
+	{
+		if ( 0 <= fd && accept_in_flight )
+		{
+			// teardown of a ring is asynchronous; cancel the accept and drop
+			// the fixed file first so the listening socket is let go of by
+			// the time this returns
+			auto * sqe = next_sqe();
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = -1;
+			sqe->addr = accept_tag;
+			sqe->user_data = cancel_tag;
+			if ( submit() )
+			{
+				// nothing will end the accept; only reap what is there
+				accept_in_flight = false;
+			}
+		}
+		if ( 0 <= fd )
+		{
+			discard_completions();
+			uring_register(fd, IORING_UNREGISTER_FILES, nullptr, 0);
+		}
+
+		if ( MAP_FAILED != static_cast<void *>(sqes) )
+		{
+			::munmap(sqes, sqes_size);
+		}
+		if ( MAP_FAILED != cq_map && cq_map != sq_map )
+		{
+			::munmap(cq_map, cq_map_size);
+		}
+		if ( MAP_FAILED != sq_map )
+		{
+			::munmap(sq_map, sq_map_size);
+		}
+		if ( 0 <= fd )
+		{
+			::close(fd);
+		}
+	}
+
+	boost::system::error_code
+	map(
+		const io_uring_params & p
+	)
+	{
+		sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		if ( p.features & IORING_FEAT_SINGLE_MMAP )
+		{
+			sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+		}
+
+		sq_map = ::mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if ( MAP_FAILED == sq_map )
+		{
+			return last_error();
+		}
+
+		if ( p.features & IORING_FEAT_SINGLE_MMAP )
+		{
+			cq_map = sq_map;
+		}
+		else
+		{
+			cq_map = ::mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			if ( MAP_FAILED == cq_map )
+			{
+				return last_error();
+			}
+		}
+
+		sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+		sqes = static_cast<io_uring_sqe *>(::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+		if ( MAP_FAILED == static_cast<void *>(sqes) )
+		{
+			return last_error();
+		}
+
+		auto * sq = static_cast<char *>(sq_map);
+		sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+		sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+		sq_flags = reinterpret_cast<unsigned *>(sq + p.sq_off.flags);
+		sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+
+		auto * cq = static_cast<char *>(cq_map);
+		cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+		cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+		cq_mask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+		return {};
+	}
+
+	// a zeroed entry at the tail of the submission queue, handed to the
+	// kernel by submit(). the queue only ever holds the one accept, so it
+	// has room
+	io_uring_sqe *
+	next_sqe(
+	)
+	{
+		auto index = *sq_tail & *sq_mask;
+		auto * sqe = &sqes[index];
+		std::memset(sqe, 0, sizeof(*sqe));
+		sq_array[index] = index;
+		return sqe;
+	}
+
+	boost::system::error_code
+	submit(
+	)
+	{
+		__atomic_store_n(sq_tail, *sq_tail + 1, __ATOMIC_RELEASE);
+		while ( uring_enter(fd, 1, 0, 0) < 0 )
+		{
+			if ( EINTR != errno )
+			{
+				return last_error();
+			}
+		}
+		return {};
+	}
+
+	// reaps every completion, waiting for the last of the accept, and
+	// closes the connections nobody was handed
+	void
+	discard_completions(
+	)
+	{
+		for ( ;; )
+		{
+			auto head = *cq_head;
+			if ( head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) )
+			{
+				if ( flush_overflow() )
+				{
+					continue;
+				}
+				if ( false == accept_in_flight )
+				{
+					return;
+				}
+				if ( uring_enter(fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && EINTR != errno )
+				{
+					return;
+				}
+				continue;
+			}
+
+			auto cqe = cqes[head & *cq_mask];
+			__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+			if ( accept_tag != cqe.user_data )
+			{
+				continue;
+			}
+			if ( 0 <= cqe.res )
+			{
+				::close(cqe.res);
+			}
+			if ( 0 == ( cqe.flags & IORING_CQE_F_MORE ) )
+			{
+				accept_in_flight = false;
+			}
+		}
+	}
+
+	// moves completions the kernel could not fit in the queue into it, now
+	// that it has been emptied; false when there were none. nothing signals
+	// the eventfd for them
+	bool
+	flush_overflow(
+	)
+	{
+		if ( 0 == ( __atomic_load_n(sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW ) )
+		{
+			return false;
+		}
+		return 0 <= uring_enter(fd, 0, 0, IORING_ENTER_GETEVENTS);
+	}
+};
+
+std::unique_ptr<http_uring_acceptor>
+http_uring_acceptor::create(
+	const asio::any_io_executor & executor,
+	int listening,
+	boost::system::error_code & ec,
+	unsigned entries
+)
+{
+	auto r = std::make_unique<ring>();
+
+	// room for a burst of connections before the kernel has to hold
+	// completions back
+	io_uring_params params{};
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = entries * 8;
+	r->fd = uring_setup(entries, &params);
+	if ( r->fd < 0 )
+	{
+		// ENOSYS without io_uring, EPERM where it is disabled
+		ec = last_error();
+		return nullptr;
+	}
+
+	ec = r->map(params);
+	if ( ec )
+	{
+		return nullptr;
+	}
+
+	// the accept refers to the listening socket by index 0, which saves
+	// looking its descriptor up on every completion
+	if ( uring_register(r->fd, IORING_REGISTER_FILES, &listening, 1) < 0 )
+	{
+		ec = last_error();
+		return nullptr;
+	}
+
+	r->event = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if ( r->event < 0 )
+	{
+		ec = last_error();
+		return nullptr;
+	}
+	if ( uring_register(r->fd, IORING_REGISTER_EVENTFD, &r->event, 1) < 0 )
+	{
+		ec = last_error();
+		::close(r->event);
+		return nullptr;
+	}
+
+	ec = {};
+	return std::unique_ptr<http_uring_acceptor>{new http_uring_acceptor{executor, std::move(r)}};
+}
+
+http_uring_acceptor::http_uring_acceptor(
+	const asio::any_io_executor & executor,
+	std::unique_ptr<ring> r
+)
+: ring_(std::move(r))
+, signal_(executor, ring_->event)
+, backoff_(executor)
+{
+}
+
+http_uring_acceptor::~http_uring_acceptor()
+{
+	*alive_ = false;
+
+	// the accept goes before the eventfd it signals
+	ring_.reset();
+}
+
+void
+http_uring_acceptor::start(
+	accept_handler handler
+)
+{
+	handler_ = std::move(handler);
+	submit_accept();
+	wait();
+}
+
+void
+http_uring_acceptor::submit_accept(
+)
+{
+	auto * sqe = ring_->next_sqe();
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = 0;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->ioprio = multishot_ ? IORING_ACCEPT_MULTISHOT : 0;
+	sqe->user_data = accept_tag;
+
+	auto ec = ring_->submit();
+	if ( ec )
+	{
+		handler_(ec, -1);
+		return;
+	}
+	ring_->accept_in_flight = true;
+}
+
+void
+http_uring_acceptor::wait(
+)
+{
+	signal_.async_wait(
+		asio::posix::stream_descriptor::wait_read,
+		[this, alive = alive_](const boost::system::error_code & ec)
+	{
+		if ( *alive )
+		{
+			on_signalled(ec);
+		}
+	});
+}
+
+void
+http_uring_acceptor::on_signalled(
+	const boost::system::error_code & ec
+)
+{
+	if ( ec )
+	{
+		return;
+	}
+
+	std::uint64_t signalled;
+	while ( ::read(ring_->event, &signalled, sizeof(signalled)) < 0 && EINTR == errno )
+	{
+	}
+
+	// the handler may destroy this acceptor; nothing is touched once it has
+	auto alive = alive_;
+	bool resubmit = false;
+	bool stopped = false;
+	bool failed = false;
+
+	auto head = *ring_->cq_head;
+	for ( ;; )
+	{
+		auto tail = __atomic_load_n(ring_->cq_tail, __ATOMIC_ACQUIRE);
+		if ( head == tail )
+		{
+			if ( ring_->flush_overflow() )
+			{
+				continue;
+			}
+			break;
+		}
+
+		auto cqe = ring_->cqes[head & *ring_->cq_mask];
+		++head;
+		__atomic_store_n(ring_->cq_head, head, __ATOMIC_RELEASE);
+
+		if ( accept_tag != cqe.user_data )
+		{
+			continue;
+		}
+
+		if ( 0 == ( cqe.flags & IORING_CQE_F_MORE ) )
+		{
+			ring_->accept_in_flight = false;
+			resubmit = true;
+		}
+
+		if ( 0 <= cqe.res )
+		{
+			++accepted_;
+			backoff_delay_ = std::chrono::milliseconds{0};
+			handler_({}, cqe.res);
+		}
+		else if ( -EINVAL == cqe.res && multishot_ )
+		{
+			// before 5.19: accept one connection per submission instead
+			multishot_ = false;
+		}
+		else if ( -ECANCELED == cqe.res )
+		{
+			stopped = true;
+		}
+		else
+		{
+			boost::system::error_code accept_ec{-cqe.res, boost::system::system_category()};
+			stopped = -EBADF == cqe.res || -ENOTSOCK == cqe.res || -EINVAL == cqe.res;
+
+			// EMFILE, ENFILE, ENOBUFS, ENOMEM: the same again right away
+			failed = false == stopped
+				&& -ECONNABORTED != cqe.res
+				&& -EAGAIN != cqe.res
+				&& -EINTR != cqe.res;
+			handler_(accept_ec, -1);
+		}
+
+		if ( false == *alive )
+		{
+			return;
+		}
+	}
+
+	if ( resubmit && false == stopped )
+	{
+		if ( failed )
+		{
+			back_off();
+		}
+		else
+		{
+			backoff_delay_ = std::chrono::milliseconds{0};
+			submit_accept();
+		}
+	}
+	if ( false == stopped )
+	{
+		wait();
+	}
+}
+
+void
+http_uring_acceptor::back_off(
+)
+{
+	backoff_delay_ = 0 == backoff_delay_.count()
+		? backoff_initial
+		: std::min(backoff_delay_ * 2, backoff_maximum);
+	backoff_.expires_after(backoff_delay_);
+	backoff_.async_wait([this, alive = alive_](const boost::system::error_code & ec)
+	{
+		if ( *alive && ! ec )
+		{
+			submit_accept();
+		}
+	});
+}
+
+} // namespace koti
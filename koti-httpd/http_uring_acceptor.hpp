@@ -0,0 +1,129 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include <boost/asio.hpp>
+namespace asio = boost::asio;
+
+#include <boost/system/error_code.hpp>
+
+namespace koti {
+
+// How a listener waits for connections.
+enum class http_io_backend
+{
+	// Asio's reactor: a readiness wakeup, then accept(2) per connection
+	epoll,
+
+	// a multishot accept on an io_uring; see http_uring_acceptor
+	io_uring
+};
+
+// Accepts connections on a listening socket through io_uring instead of the
+// reactor. A single multishot accept, submitted once against the listening
+// socket registered as a fixed file, keeps producing one completion per
+// connection, so the kernel accepts while the thread is busy elsewhere and
+// no accept(2) is made at all. The ring signals an eventfd that the owning
+// io_context waits on; every wakeup reaps all connections accepted so far.
+//
+// Accepted sockets are plain descriptors, handed on to be served by the
+// reactor like any other. Talks to the kernel directly (no liburing), and
+// falls back to re-submitting single accepts on kernels without multishot.
+// After an accept fails for want of descriptors or memory, it is submitted
+// again only once a delay is up, doubling from backoff_initial to
+// backoff_maximum with every failure in a row.
+//
+// Belongs to the thread running the io_context it was made with.
+class http_uring_acceptor
+{
+public:
+	// one accepted descriptor, or the error accepting it failed with. the
+	// callee owns the descriptor
+	using accept_handler = std::function<void(const boost::system::error_code &, int)>;
+
+	static constexpr unsigned default_entries = 64;
+
+	static constexpr std::chrono::milliseconds backoff_initial{10};
+	static constexpr std::chrono::milliseconds backoff_maximum{100};
+
+	// a ring accepting on listening, which must outlive it. ec is set, and
+	// null returned, when the kernel lacks io_uring or refuses the ring
+	static
+	std::unique_ptr<http_uring_acceptor>
+	create(
+		const asio::any_io_executor & executor,
+		int listening,
+		boost::system::error_code & ec,
+		unsigned entries = default_entries
+	);
+
+	http_uring_acceptor(const http_uring_acceptor & copy_ctor) = delete;
+	http_uring_acceptor & operator=(const http_uring_acceptor & copy_assign) = delete;
+
+	// cancels the accept; handler is not called again
+	~http_uring_acceptor();
+
+	// submits the accept and calls handler for every connection from then
+	// on, on the io_context's thread
+	void
+	start(
+		accept_handler handler
+	);
+
+	// connections accepted so far
+	std::uint64_t
+	accepted() const
+	{
+		return accepted_;
+	}
+
+	// whether the kernel took the multishot accept
+	bool
+	multishot() const
+	{
+		return multishot_;
+	}
+
+protected:
+	struct ring;
+
+	http_uring_acceptor(
+		const asio::any_io_executor & executor,
+		std::unique_ptr<ring> r
+	);
+
+	void
+	submit_accept(
+	);
+
+	void
+	wait(
+	);
+
+	// submits the accept again once backoff_delay_ is up
+	void
+	back_off(
+	);
+
+	void
+	on_signalled(
+		const boost::system::error_code & ec
+	);
+
+	std::unique_ptr<ring> ring_;
+	asio::posix::stream_descriptor signal_;
+	asio::steady_timer backoff_;
+	std::chrono::milliseconds backoff_delay_{0};
+	accept_handler handler_;
+	std::uint64_t accepted_ = 0;
+	bool multishot_ = true;
+
+	// cleared by the destructor; a wakeup still queued sees it and leaves
+	std::shared_ptr<bool> alive_ = std::make_shared<bool>(true);
+};
+
+} // namespace koti
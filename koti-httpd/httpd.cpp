@@ -5,4 +5,72 @@
 
 namespace koti {
 
+std::string_view
+http_path_endpoints::path()
+{
+	return {};
+}
+
+http_endpoint *
+http_path_endpoints::resolve(
+	http_connection & connection,
+	const http_request_header & header
+)
+{
+	auto path = http_target_path(header.target());
+	for ( auto * child : paths_ )
+	{
+		if ( child && child->path() == path )
+		{
+			return child->resolve(connection, header);
+		}
+	}
+	return nullptr;
+}
+
+http_response
+http_path_endpoints::handle(
+	http_connection & connection,
+	http_request & request
+)
+{
+	auto * endpoint = resolve(connection, request);
+	if ( nullptr == endpoint )
+	{
+		return http_status_response(request, http::status::not_found);
+	}
+	return endpoint->handle(connection, request);
+}
+
+http_endpoint *
+http_endpoints::resolve(
+	http_connection & connection,
+	const http_request_header & header
+)
+{
+	auto path = http_target_path(header.target());
+	for ( auto * child : paths_ )
+	{
+		if ( child && child->path() == path )
+		{
+			return child->resolve(connection, header);
+		}
+	}
+	return nullptr;
+}
+
+http_response
+http_endpoints::handle(
+	http_connection & connection,
+	http_request & request
+)
+{
+	auto * endpoint = resolve(connection, request);
+	if ( nullptr == endpoint )
+	{
+		return http_status_response(request, http::status::not_found);
+	}
+	return endpoint->handle(connection, request);
+}
+
 } // namespace koti
@@ -1,30 +1,117 @@
 #pragma once
 
+extern "C" {
+#include <linux/filter.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+} // extern "C"
+
 #include "fmt/ostream.h"
 #include "spdlog/spdlog.h"
 namespace spd = spdlog;
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
 #include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
 #include <vector>
 #include <functional>
+#include <future>
+#include <limits>
 
 #include <boost/filesystem/path.hpp>
 namespace fs = boost::filesystem;
 
 #include "options.hpp"
+#include "http_access_log.hpp"
+#include "http_arena.hpp"
+#include "http_body_sink.hpp"
+#include "http_buffer_pool.hpp"
+#include "http_compression.hpp"
+#include "http_handoff.hpp"
+#include "http_metrics.hpp"
+#include "http_open_file.hpp"
+#include "http_peer_limiter.hpp"
+#include "http_response_writer.hpp"
+#include "http_spsc_queue.hpp"
+#include "http_timer_wheel.hpp"
+#include "http_uring_acceptor.hpp"
+#include "io_context_pool.hpp"
+#include "worker_pool.hpp"
 
 #include "net.hpp"
 #include "net_connection.hpp"
 #include "net_listener.hpp"
 
+#include <boost/asio/generic/stream_protocol.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/beast.hpp>
 
 namespace koti {
 
 namespace http = boost::beast::http;
 
+// Requests and responses allocate their fields and bodies through a
+// resource-backed allocator. An http_connection points it at its per-request
+// http_arena, so handling a request does not touch the global heap once
+// the connection is warmed up. Endpoints should build responses with
+// http_make_response(request.get_allocator()) (or any allocator they
+// like; a response from another resource is copied into the arena).
+using http_allocator = http_arena_allocator<char>;
+using http_fields = http::basic_fields<http_allocator>;
+using http_body = http::basic_string_body<char, std::char_traits<char>, http_allocator>;
+using http_request_header = http::request_header<http_fields>;
+using http_request = http::request<http_body, http_fields>;
+using http_response = http::response<http_body, http_fields>;
+
+// Raw bytes read from (or batched for) a connection. Borrowed from an
+// http_buffer_pool when the connection has one.
+using http_io_buffer = boost::beast::basic_flat_buffer<http_buffer_allocator<char>>;
+
+inline
+http_request
+http_make_request(
+	const http_allocator & allocator = {}
+)
+{
+	return http_request{
+		std::piecewise_construct,
+		std::make_tuple(allocator),
+		std::make_tuple(allocator)
+	};
+}
+
+inline
+http_response
+http_make_response(
+	const http_allocator & allocator = {}
+)
+{
+	return http_response{
+		std::piecewise_construct,
+		std::make_tuple(allocator),
+		std::make_tuple(allocator)
+	};
+}
+
 class httpd_logs {
 protected:
 	using logging_pointer = std::shared_ptr<spd::logger>;
@@ -52,16 +139,247 @@ protected:
 	}
 };
 
+// Values an endpoint captured from the request target while resolving it,
+// eg. the `id` of `/users/:id`. Values view into the request's target and
+// are only valid while that request is being handled.
+class http_route_captures
+{
+public:
+	using value_type = std::pair<std::string_view, std::string_view>;
+	using container_type = std::vector<value_type>;
+
+	void
+	clear(
+	)
+	{
+		// keeps capacity; steady state does not allocate
+		captures_.clear();
+	}
+
+	void
+	add(
+		std::string_view name,
+		std::string_view value
+	)
+	{
+		captures_.emplace_back(name, value);
+	}
+
+	// value captured for name, empty when there is none
+	std::string_view
+	find(
+		std::string_view name
+	) const
+	{
+		for ( const auto & capture : captures_ )
+		{
+			if ( capture.first == name )
+			{
+				return capture.second;
+			}
+		}
+		return {};
+	}
+
+	std::size_t
+	size() const
+	{
+		return captures_.size();
+	}
+
+	bool
+	empty() const
+	{
+		return captures_.empty();
+	}
+
+	void
+	resize(
+		std::size_t size
+	)
+	{
+		captures_.resize(size);
+	}
+
+	container_type::const_iterator
+	begin() const
+	{
+		return captures_.begin();
+	}
+
+	container_type::const_iterator
+	end() const
+	{
+		return captures_.end();
+	}
+
+protected:
+	container_type captures_;
+};
+
+// path portion of a request target, without query string or fragment
+inline
+std::string_view
+http_target_path(
+	boost::beast::string_view beast_target
+)
+{
+	std::string_view target{beast_target.data(), beast_target.size()};
+	auto end = target.find_first_of("?#");
+	if ( std::string_view::npos != end )
+	{
+		target.remove_suffix(target.size() - end);
+	}
+	return target;
+}
+
+// empty response carrying only a status, for answers the server produces
+// itself (no route, wrong verb, ...)
+inline
+http_response
+http_status_response(
+	const http_request_header & request,
+	http::status status
+)
+{
+	auto response = http_make_response(request.get_allocator());
+	response.result(status);
+	response.version(request.version());
+
+	// message::keep_alive() is not available on a bare header
+	http::token_list connection{request[http::field::connection]};
+	response.keep_alive(
+		request.version() < 11
+		? connection.exists("keep-alive")
+		: ! connection.exists("close")
+	);
+	response.prepare_payload();
+	return response;
+}
+
+// How an endpoint wants the body of a request read: collected into
+// request.body() (the default), or pushed into a sink piece by piece as it
+// arrives. Bodies larger than limit are refused with 413.
+struct http_body_handling
+{
+	static constexpr std::uint64_t default_limit = 1024 * 1024;
+
+	std::uint64_t limit = default_limit;
+
+	// when set, receives the body instead of request.body(), and stays
+	// available from http_connection::body_sink() while the request is
+	// handled
+	std::unique_ptr<http_body_sink> sink;
+};
+
+// Where an endpoint's handle() runs. Endpoints that block (disk, other
+// services) or burn CPU should ask for a worker so the connections sharing
+// their io_context are not held up; see http_connection::set_worker_pool().
+enum class http_execution
+{
+	io_thread,
+	worker_pool
+};
+
+// How long a connection may take over each part of an exchange before it
+// is dropped. Zero means no limit.
+struct http_timeouts
+{
+	// waiting for the first byte of a request, including between requests
+	// on a keep-alive connection
+	std::chrono::milliseconds idle{0};
+
+	// reading a request's header, all of it
+	std::chrono::milliseconds header{0};
+
+	// reading a request's body; for bodies streamed into a sink, between
+	// two pieces of it
+	std::chrono::milliseconds body{0};
+
+	// writing one response, or one piece of a response that is sent in
+	// pieces (files, streams)
+	std::chrono::milliseconds write{0};
+};
+
+// How a TCP listener sets up its sockets. A local listener ignores them.
+struct http_tcp_options
+{
+	// TCP_NODELAY on accepted connections: a response goes out as soon as
+	// it is written rather than waiting for the previous one to be acked
+	bool no_delay = true;
+
+	// TCP_DEFER_ACCEPT: a connection is only accepted once the client has
+	// sent something, or this long has passed. zero accepts right away
+	std::chrono::seconds defer_accept{0};
+
+	// with an io_context_pool, one SO_REUSEPORT acceptor per context in
+	// place of the listener's own, so the kernel spreads connections over
+	// the threads and each is accepted on the thread that serves it
+	bool reuse_port = false;
+
+	// with reuse_port, a BPF program hands each connection to the acceptor
+	// of the cpu its packets arrived on (modulo the number of acceptors)
+	// instead of by a hash of its addresses. best paired with threads
+	// pinned to cores, so the acceptor's thread runs on that cpu too
+	bool steer_by_cpu = false;
+};
+
 class http_connection;
 class http_endpoint
 {
 public:
 	virtual
-	http::response<http::string_body>
+	~http_endpoint() = default;
+
+	virtual
+	http_response
 	handle(
 		http_connection & connection,
-		http::request<http::string_body> & request
+		http_request & request
 	) = 0;
+
+	// the endpoint that will handle a request with this header. composite
+	// endpoints (routers) override this to pick one of their children and
+	// record any captures on the connection; nullptr when nothing matches
+	virtual
+	http_endpoint *
+	resolve(
+		http_connection & connection,
+		const http_request_header & header
+	)
+	{
+		(void)connection;
+		(void)header;
+		return this;
+	}
+
+	// asked once the header of a request this endpoint resolved for is in,
+	// before any of its body is read
+	virtual
+	http_body_handling
+	body_handling(
+		http_connection & connection,
+		const http_request_header & header
+	)
+	{
+		(void)connection;
+		(void)header;
+		return {};
+	}
+
+	// asked once a request this endpoint resolved for is complete, before
+	// it is handled
+	virtual
+	http_execution
+	execution(
+		http_connection & connection,
+		const http_request_header & header
+	)
+	{
+		(void)connection;
+		(void)header;
+		return http_execution::io_thread;
+	}
 };
 
 class http_verb_endpoint
@@ -93,10 +411,18 @@ public:
 	path(
 	) override;
 
-	http::response<http::string_body>
+	http_response
 	handle(
 		http_connection & connection,
-		http::request<http::string_body> & request
+		http_request & request
+	) override;
+
+	// first child whose path() equals the target's path. linear; prefer
+	// http_router for more than a handful of children
+	http_endpoint *
+	resolve(
+		http_connection & connection,
+		const http_request_header & header
 	) override;
 
 	using paths_type = std::vector<http_path_endpoint*>;
@@ -123,22 +449,75 @@ class http_endpoints
 : public http_endpoint
 {
 public:
-	http::response<http::string_body>
+	http_response
 	handle(
 		http_connection & connection,
-		http::request<http::string_body> & request
+		http_request & request
+	) override;
+
+	http_endpoint *
+	resolve(
+		http_connection & connection,
+		const http_request_header & header
 	) override;
 
+	std::vector<http_path_endpoint*> &
+	paths(
+	)
+	{
+		return paths_;
+	}
+
 protected:
 	std::vector<http_path_endpoint*> paths_;
 };
 
+// Generation-tagged reference to the slot a connection occupies in its
+// owner's connection table. A slot's generation changes whenever it is
+// released, so a handle kept past its connection's life no longer matches.
+struct http_connection_handle
+{
+	static constexpr std::uint32_t invalid_index = UINT32_MAX;
+
+	std::uint32_t index = invalid_index;
+	std::uint32_t generation = 0;
+
+	bool
+	valid() const
+	{
+		return invalid_index != index;
+	}
+
+	friend
+	bool
+	operator==(
+		const http_connection_handle & lhs,
+		const http_connection_handle & rhs
+	)
+	{
+		return lhs.index == rhs.index && lhs.generation == rhs.generation;
+	}
+
+	friend
+	bool
+	operator!=(
+		const http_connection_handle & lhs,
+		const http_connection_handle & rhs
+	)
+	{
+		return !(lhs == rhs);
+	}
+};
+
+// Connections are served the same whatever they were accepted on: a local
+// socket or TCP, both are just a stream of bytes once accepted.
+using http_stream = asio::generic::stream_protocol;
+
 class http_connection
-: protected koti::local_stream::socket
+: protected http_stream::socket
 , protected httpd_logs
 {
 public:
-	using koti::local_stream::socket::basic_stream_socket;
 	using ptr = std::unique_ptr<http_connection>;
 
 	void
@@ -147,31 +526,70 @@ public:
 		root_ = root;
 	}
 
-	const koti::local_stream::socket &
+	const http_stream::socket &
 	socket() const
 	{
 		return *this;
 	}
 
-	koti::local_stream::socket &
+	http_stream::socket &
 	socket()
 	{
 		return *this;
 	}
 
+	// a connection accepted on a local socket; the peer is who SO_PEERCRED
+	// says it is
 	http_connection(koti::local_stream::socket && s)
-	: koti::local_stream::socket(std::move(s))
-	, cached_remote_identity_{local_stream::remote_identity(*this)}
+	: http_connection(s, local_stream::remote_identity(s))
+	{
+	}
+
+	// a connection accepted over TCP. there are no credentials to ask the
+	// kernel for, so every TCP peer has the same identity: uid and gid -1,
+	// pid 0. don't admit them against an http_peer_limiter, which would
+	// count them all as one peer
+	http_connection(asio::ip::tcp::socket && s)
+	: http_connection(s, tcp_identity())
+	{
+	}
+
+	~http_connection()
 	{
+		if ( timeout_.armed() )
+		{
+			wheel_->cancel(timeout_);
+		}
+
+		if ( peer_ )
+		{
+			peer_limiter_->release_connection(peer_);
+		}
 	}
 
-	using koti::local_stream::socket::close;
+	using http_stream::socket::close;
+
+	// called exactly once, from the connection's own thread, when it has
+	// finished for good: the socket is closed and its buffers released. the
+	// callee may destroy the connection; nothing touches it afterwards
+	using closed_handler = std::function<void(http_connection &)>;
 
+	void
+	set_closed_handler(
+		closed_handler handler
+	)
+	{
+		closed_handler_ = std::move(handler);
+	}
+
+	// closes the socket only. outstanding operations complete with
+	// operation_aborted and finish the connection from there
 	void
 	close(
 	)
 	{
-		this->koti::local_stream::socket::close();
+		this->http_stream::socket::close();
+		state_ = state::closed;
 
 		logger()->debug(
 			"UID:{}\tGID:{}\tPID:{}\tclosed",
@@ -181,8 +599,9 @@ public:
 		);
 	}
 
-	using koti::local_stream::socket::local_endpoint;
-	using koti::local_stream::socket::remote_endpoint;
+	using http_stream::socket::local_endpoint;
+	using http_stream::socket::remote_endpoint;
+	using http_stream::socket::get_executor;
 
 	const koti::local_stream::ucred &
 	cached_remote_identity() const
@@ -190,254 +609,3570 @@ public:
 		return cached_remote_identity_;
 	}
 
+	const http_connection_handle &
+	handle() const
+	{
+		return handle_;
+	}
+
+	// filled in by the endpoint that resolved the current request
+	http_route_captures &
+	route_captures()
+	{
+		return route_captures_;
+	}
+
+	const http_route_captures &
+	route_captures() const
+	{
+		return route_captures_;
+	}
+
 	void
-	on_response_written(
-		const boost::system::error_code & ec,
-		std::size_t // bytes_transferred
+	set_handle(
+		const http_connection_handle & handle
 	)
 	{
-		if ( ec )
+		handle_ = handle;
+	}
+
+	// gives up the socket of a connection that is waiting for a request
+	// with nothing of it read, so another process can carry on serving
+	// it. returns the descriptor, or -1 when the connection is busy or
+	// the client has already started sending. the connection then
+	// finishes like a closed one, leaving the descriptor open. from the
+	// connection's own thread only, and only with a pooled read buffer
+	int
+	release_if_idle(
+	)
+	{
+		if ( false == idle() )
 		{
-			logger()->error(
-				"UID:{}\tGID:{}\tPID:{}\t{}\t{}",
-				cached_remote_identity().uid,
-				cached_remote_identity().gid,
-				cached_remote_identity().pid,
-				ec.message()
-			);
+			return -1;
 		}
 
-		if ( false == response_.keep_alive() )
+		// the wait completes with operation_aborted and finishes us
+		boost::system::error_code ec;
+		auto native = socket().release(ec);
+		if ( ec )
 		{
-			logger()->info(
-				"UID:{}\tGID:{}\tPID:{}\tkeep_alive: false",
-				cached_remote_identity().uid,
-				cached_remote_identity().gid,
-				cached_remote_identity().pid
-			);
-			this->close();
+			return -1;
 		}
+		return native;
 	}
 
-	void
-	on_http_header(
-		const boost::system::error_code & ec,
-		std::size_t bytes_transferred
+	// closes a connection that release_if_idle() would give up; it has
+	// nothing to answer. false when it is busy. from the connection's own
+	// thread only
+	bool
+	close_if_idle(
 	)
 	{
-		if ( ec )
+		if ( false == idle() )
 		{
-			logger()->error(
-				"UID:{}\tGID:{}\tPID:{}\terror: {}",
-				cached_remote_identity().uid,
-				cached_remote_identity().gid,
-				cached_remote_identity().pid,
-				ec.message()
-			);
-			return;
+			return false;
 		}
-		logger()->debug(
-			"UID:{}\tGID:{}\tPID:{}\t{}\t{}",
-			cached_remote_identity().uid,
-			cached_remote_identity().gid,
-			cached_remote_identity().pid,
-			request_.method(),
-			request_.target()
-		);
 
-		try
-		{
-			if ( root_ )
-			{
-				response_ = root_->handle(*this, request_);
-			}
-			else
-			{
-				response_ = {};
-				response_.version(11);
-				response_.result(http::status::internal_server_error);
-				response_.set(http::field::comments, "no-root-endpoint-installed");
-				response_.keep_alive(false);
-			}
+		close();
+		return true;
+	}
 
-			if ( response_.result() == http::status::connection_closed_without_response )
-			{
-				this->http_connection::close();
-				return;
-			}
+	// while *draining is set, every response closes the connection once
+	// it is out. the flag must outlive the connection
+	void
+	set_draining(
+		const std::atomic<bool> * draining
+	)
+	{
+		draining_ = draining;
+	}
 
-			logger()->info(
-				"UID:{}\tGID:{}\tPID:{}\t{}\t{}\t{}\t{}",
-				cached_remote_identity().uid,
-				cached_remote_identity().gid,
-				cached_remote_identity().pid,
-				static_cast<int>(response_.result()),
-				response_.result(),
-				request_.method(),
-				request_.target()
-			);
+	// whether the current response will close the connection for draining
+	bool
+	draining() const
+	{
+		return draining_ && draining_->load(std::memory_order_relaxed);
+	}
 
-			http::async_write(
-				socket(),
-				response_,
-				std::bind(
-					&http_connection::on_response_written,
-					this,
-					std::placeholders::_1,
-					std::placeholders::_2
-				)
-			);
-		}
-		catch (...)
-		{
-			
-		}
+	enum class state
+	{
+		// waiting for (the rest of) a request
+		reading,
+
+		// request is being handed to the endpoint
+		handling,
+
+		// response(s) are being written
+		writing,
+
+		closed
+	};
+
+	state
+	current_state() const
+	{
+		return state_;
 	}
 
+	// maximum number of pipelined responses gathered into a single write.
+	// 1 writes every response on its own
 	void
-	async_read()
+	set_pipeline_batch(
+		std::size_t batch
+	)
 	{
-		http::async_read(
-			socket(),
-			buffer_,
-			request_,
-			std::bind(
-				&http_connection::on_http_header,
-				this,
-				std::placeholders::_1,
-				std::placeholders::_2
-			)
-		);
+		pipeline_batch_ = std::max<std::size_t>(1u, batch);
 	}
 
-protected:
-	local_stream::ucred cached_remote_identity_;
-	boost::beast::flat_buffer buffer_;
-	http::request<http::string_body> request_;
-	http::response<http::string_body> response_;
-	http_endpoint * root_ = nullptr;
-};
+	std::size_t
+	pipeline_batch() const
+	{
+		return pipeline_batch_;
+	}
 
-enum class http_listener_action
-{
-	cancel_and_stop,
-	normal,
-	reject_connection
-};
+	// borrow the read and write buffers from pool, and cap the read buffer
+	// at limit bytes (0: no cap beyond the parser's own header and body
+	// limits); a request that does not fit fails with buffer_overflow.
+	// with a pool, the read buffer is handed back whenever the connection
+	// is idle, so a quiet keep-alive connection holds no buffer at all.
+	// call before the first async_read()
+	void
+	set_read_buffer(
+		http_buffer_pool * pool,
+		std::size_t limit = 0
+	)
+	{
+		http_buffer_allocator<char> allocator{pool};
+		buffer_ = http_io_buffer{
+			0u == limit ? std::numeric_limits<std::size_t>::max() : limit,
+			allocator
+		};
+		write_buffer_ = http_io_buffer{allocator};
+	}
 
-class http_listener
-: protected koti::local_stream::acceptor
-{
+	// hand the access log line of every request to log instead of writing
+	// it from this thread. null logs synchronously
+	void
+	set_access_log(
+		http_access_log * log
+	)
+	{
+		access_log_ = log;
+	}
+
+	// counts this connection against its peer's limits for as long as it
+	// exists, and rate-limits its requests. false when the peer already
+	// has as many connections as it may; the connection should be dropped.
+	// limiter must outlive the connection
+	bool
+	admit_peer(
+		http_peer_limiter & limiter
+	)
+	{
+		auto * peer = limiter.admit_connection(cached_remote_identity());
+		if ( nullptr == peer )
+		{
+			return false;
+		}
+
+		peer_limiter_ = &limiter;
+		peer_ = peer;
+		return true;
+	}
+
+	// count this connection's traffic and time its requests into metrics,
+	// from whichever thread does the work. null records nothing. metrics
+	// must outlive the connection
+	void
+	set_metrics(
+		http_metrics * metrics
+	)
+	{
+		metrics_ = metrics;
+	}
+
+	// compress the bodies of responses to clients that accept it, as
+	// compression's policy says (see http_compression): whole string bodies
+	// through its cache, streamed ones as they are written. responses sent
+	// with send_file() go out as they are. null compresses nothing.
+	// compression must outlive the connection
+	void
+	set_compression(
+		http_compression * compression
+	)
+	{
+		compression_ = compression;
+	}
+
+	// drop the connection when a phase of an exchange takes longer than
+	// timeouts allows. the deadlines live on the timing wheel of the
+	// connection's io_context (see http_timer_wheel)
+	void
+	set_timeouts(
+		const http_timeouts & timeouts
+	)
+	{
+		timeouts_ = timeouts;
+	}
+
+	const http_timeouts &
+	timeouts() const
+	{
+		return timeouts_;
+	}
+
+	// run the endpoints that ask for it (see http_endpoint::execution()) on
+	// pool. when pool is saturated such requests are answered with 503
+	// right away. null runs everything on the connection's own thread.
+	// pool must be stopped before the connection is destroyed
+	void
+	set_worker_pool(
+		worker_pool * pool
+	)
+	{
+		worker_pool_ = pool;
+	}
+
+	// follow the current response's header with length bytes of file from
+	// offset, sent with sendfile(2) so they never pass through userspace.
+	// for endpoints, from within handle(): the response must carry the
+	// matching Content-Length and an empty body
+	void
+	send_file(
+		std::shared_ptr<const http_open_file> file,
+		std::uint64_t offset,
+		std::uint64_t length
+	)
+	{
+		file_ = std::move(file);
+		file_offset_ = offset;
+		file_remaining_ = length;
+	}
+
+	// answer with the first size bytes of response, a whole response
+	// already serialized (status line, header and body), written as they
+	// are: no serializing and no compression. for endpoints, from within
+	// handle(): what handle() returns is only logged and decides whether
+	// the connection stays open, so it should agree with the bytes
+	void
+	send_serialized(
+		std::shared_ptr<const std::string> response,
+		std::size_t size
+	)
+	{
+		serialized_ = std::move(response);
+		serialized_size_ = std::min(size, serialized_->size());
+	}
+
+	// whether the current response's body comes from somewhere other than
+	// the response handle() returns: a file, a writer, serialized bytes or
+	// a deferral
+	bool
+	body_attached() const
+	{
+		return file_ || stream_ || serialized_ || deferred_;
+	}
+
+	// send the current response's body through the returned writer, which
+	// may be fed and finished after handle() returns, from any thread. for
+	// endpoints, from within handle(): the response supplies the status
+	// and header fields; whatever its body holds goes out first
+	std::shared_ptr<http_response_writer>
+	stream_response(
+		std::size_t high_water = http_response_writer::default_high_water
+	)
+	{
+		end_stream();
+		stream_ = std::make_shared<http_response_writer>(socket().get_executor(), high_water);
+		stream_->attach([this]()
+		{
+			flush_stream();
+		});
+		return stream_;
+	}
+
+	// for endpoints run on the connection's thread (http_execution::io_thread),
+	// from within handle(): the response will be supplied later through
+	// complete_response(), and what handle() returns is discarded. the
+	// connection waits, holding work on its io_context so the context does
+	// not run dry meanwhile
+	void
+	defer_response(
+	)
+	{
+		deferred_ = true;
+		pending_work_.emplace(get_executor());
+	}
+
+	// the response to a request whose handling was deferred; exactly once,
+	// on the connection's executor. the connection must not be closed in
+	// between
+	void
+	complete_response(
+		http_response response
+	)
+	{
+		response_ = std::move(response);
+		deferred_ = false;
+		pending_work_.reset();
+		record(http_metrics::phase::handle, handle_began_);
+
+		if ( state::writing == state_ )
+		{
+			// still busy with what came before it; picked up from there
+			deferred_ready_ = true;
+			return;
+		}
+
+		if ( deferred_failed_ )
+		{
+			auto ec = deferred_failed_;
+			deferred_failed_ = {};
+			on_response_written(ec, 0);
+			return;
+		}
+
+		send_completed_response();
+	}
+
+	// the sink the current request's body was streamed into, if its
+	// endpoint asked for one
+	http_body_sink *
+	body_sink() const
+	{
+		return body_sink_.get();
+	}
+
+	// bytes held by the read buffer right now
+	std::size_t
+	read_buffer_capacity() const
+	{
+		return buffer_.capacity();
+	}
+
+	// bytes held by the request arena right now
+	std::size_t
+	arena_capacity() const
+	{
+		return arena_.capacity();
+	}
+
+	void
+	on_response_written(
+		const boost::system::error_code & ec,
+		std::size_t // bytes_transferred
+	)
+	{
+		cancel_timeout();
+		if ( ec )
+		{
+			if ( asio::error::operation_aborted != ec )
+			{
+				logger()->error(
+					"UID:{}\tGID:{}\tPID:{}\t{}",
+					cached_remote_identity().uid,
+					cached_remote_identity().gid,
+					cached_remote_identity().pid,
+					ec.message()
+				);
+			}
+			finish();
+			return;
+		}
+
+		record(http_metrics::phase::write, write_began_);
+		serialized_.reset();
+
+		if ( false == keep_alive_ )
+		{
+			logger()->info(
+				"UID:{}\tGID:{}\tPID:{}\tkeep_alive: false",
+				cached_remote_identity().uid,
+				cached_remote_identity().gid,
+				cached_remote_identity().pid
+			);
+			finish();
+			return;
+		}
+
+		if ( buffer_.get_allocator().pool() )
+		{
+			write_buffer_.clear();
+			write_buffer_.shrink_to_fit();
+		}
+
+		// persistent connection; anything the client pipelined is still
+		// in buffer_ and is parsed before another read is issued
+		async_read();
+	}
+
+	void
+	on_readable(
+		const boost::system::error_code & ec
+	)
+	{
+		idle_wait_ = false;
+		if ( ec )
+		{
+			if ( asio::error::operation_aborted != ec )
+			{
+				logger()->error(
+					"UID:{}\tGID:{}\tPID:{}\terror: {}",
+					cached_remote_identity().uid,
+					cached_remote_identity().gid,
+					cached_remote_identity().pid,
+					ec.message()
+				);
+			}
+			finish();
+			return;
+		}
+
+		read_request();
+	}
+
+	// the response header (or a batch ending in one) is out; send any file
+	// attached to the last response
+	void
+	on_head_written(
+		const boost::system::error_code & ec,
+		std::size_t bytes_transferred
+	)
+	{
+		cancel_timeout();
+		count(http_metrics::counter::bytes_sent, bytes_transferred);
+		if ( deferred_ )
+		{
+			// a batch ahead of a deferred response is out. an error cannot
+			// finish the connection while the endpoint still holds it
+			state_ = state::handling;
+			deferred_failed_ = ec;
+			return;
+		}
+
+		if ( deferred_ready_ )
+		{
+			deferred_ready_ = false;
+			if ( ec )
+			{
+				on_response_written(ec, bytes_transferred);
+				return;
+			}
+			send_completed_response();
+			return;
+		}
+
+		if ( stream_ && ! ec && http::verb::head != request_.method() )
+		{
+			stream_head_written_ = true;
+			flush_stream();
+			return;
+		}
+
+		if ( ec || ! file_ )
+		{
+			end_stream();
+			on_response_written(ec, bytes_transferred);
+			return;
+		}
+
+		boost::system::error_code non_blocking_ec;
+		socket().native_non_blocking(true, non_blocking_ec);
+		send_file_some(non_blocking_ec);
+	}
+
+	void
+	send_file_some(
+		const boost::system::error_code & ec
+	)
+	{
+		if ( ec )
+		{
+			file_.reset();
+			on_response_written(ec, 0);
+			return;
+		}
+
+		while ( 0u < file_remaining_ )
+		{
+			auto offset = static_cast<off_t>(file_offset_);
+			auto sent = ::sendfile(
+				socket().native_handle(),
+				file_->native_handle(),
+				&offset,
+				static_cast<std::size_t>(std::min<std::uint64_t>(file_remaining_, 1u << 30))
+			);
+			if ( 0 < sent )
+			{
+				count(http_metrics::counter::bytes_sent, static_cast<std::uint64_t>(sent));
+				file_offset_ += static_cast<std::uint64_t>(sent);
+				file_remaining_ -= static_cast<std::uint64_t>(sent);
+				continue;
+			}
+			if ( sent < 0 && EINTR == errno )
+			{
+				continue;
+			}
+			if ( sent < 0 && ( EAGAIN == errno || EWOULDBLOCK == errno ) )
+			{
+				arm_timeout(timeouts_.write, "write");
+				socket().async_wait(
+					asio::socket_base::wait_write,
+					make_http_allocating_handler(
+						handler_memory_,
+						std::bind(
+							&http_connection::send_file_some,
+							this,
+							std::placeholders::_1
+						)
+					)
+				);
+				return;
+			}
+
+			// the file shrank under us (sent == 0), or the socket failed; the
+			// client was promised more bytes than it can get, so drop it
+			boost::system::error_code failed = 0 == sent
+				? boost::system::error_code{asio::error::eof}
+				: boost::system::error_code{errno, boost::system::system_category()};
+			file_.reset();
+			on_response_written(failed, 0);
+			return;
+		}
+
+		file_.reset();
+		on_response_written({}, 0);
+	}
+
+	// sends whatever the writer has queued, one chunk per wake. runs on
+	// the connection's thread; a no-op while a chunk is still on the wire
+	void
+	flush_stream(
+	)
+	{
+		if ( ! stream_ || ! stream_head_written_ || stream_sending_in_flight_ )
+		{
+			return;
+		}
+
+		bool finished = stream_->take(stream_sending_);
+		if ( stream_compressor_ )
+		{
+			compress_stream(finished);
+		}
+		if ( false == stream_sending_.empty() )
+		{
+			std::array<asio::const_buffer, 3> chunk{
+				asio::const_buffer{},
+				asio::buffer(stream_sending_),
+				asio::const_buffer{}
+			};
+			if ( stream_chunked_ )
+			{
+				auto end = fmt::format_to_n(
+					stream_chunk_header_,
+					sizeof(stream_chunk_header_),
+					"{:x}\r\n",
+					stream_sending_.size()
+				).out;
+				chunk[0] = asio::buffer(stream_chunk_header_, static_cast<std::size_t>(end - stream_chunk_header_));
+				chunk[2] = asio::buffer("\r\n", 2);
+			}
+
+			stream_sending_in_flight_ = true;
+			arm_timeout(timeouts_.write, "write");
+			asio::async_write(
+				socket(),
+				chunk,
+				make_http_allocating_handler(
+					handler_memory_,
+					std::bind(
+						&http_connection::on_stream_written,
+						this,
+						std::placeholders::_1,
+						std::placeholders::_2
+					)
+				)
+			);
+			return;
+		}
+
+		if ( false == finished )
+		{
+			// idle until the writer has more; the producer is not held to
+			// the write timeout
+			cancel_timeout();
+			return;
+		}
+
+		if ( false == stream_chunked_ )
+		{
+			end_stream();
+			on_response_written({}, 0);
+			return;
+		}
+
+		static constexpr char last_chunk[] = "0\r\n\r\n";
+		stream_sending_in_flight_ = true;
+		arm_timeout(timeouts_.write, "write");
+		asio::async_write(
+			socket(),
+			asio::buffer(last_chunk, sizeof(last_chunk) - 1),
+			make_http_allocating_handler(
+				handler_memory_,
+				std::bind(
+					&http_connection::on_stream_ended,
+					this,
+					std::placeholders::_1,
+					std::placeholders::_2
+				)
+			)
+		);
+	}
+
+	// replaces what the writer handed out with its compressed form, flushed
+	// so the client can decode everything sent so far; once finished the
+	// compressed stream is ended as well
+	void
+	compress_stream(
+		bool finished
+	)
+	{
+		std::swap(stream_sending_, stream_raw_);
+		stream_sending_.clear();
+		if ( false == stream_raw_.empty() )
+		{
+			stream_compressor_->write(stream_raw_, stream_sending_, false == finished);
+			count(http_metrics::counter::compressed_in, stream_raw_.size());
+		}
+		if ( finished )
+		{
+			stream_compressor_->finish(stream_sending_);
+			stream_compressor_.reset();
+		}
+		count(http_metrics::counter::compressed_out, stream_sending_.size());
+		stream_raw_.clear();
+	}
+
+	void
+	on_stream_written(
+		const boost::system::error_code & ec,
+		std::size_t bytes_transferred
+	)
+	{
+		stream_sending_in_flight_ = false;
+		stream_sending_.clear();
+		count(http_metrics::counter::bytes_sent, bytes_transferred);
+		if ( ec )
+		{
+			end_stream();
+			on_response_written(ec, bytes_transferred);
+			return;
+		}
+
+		stream_->sent();
+		flush_stream();
+	}
+
+	void
+	on_stream_ended(
+		const boost::system::error_code & ec,
+		std::size_t bytes_transferred
+	)
+	{
+		stream_sending_in_flight_ = false;
+		count(http_metrics::counter::bytes_sent, bytes_transferred);
+		end_stream();
+		on_response_written(ec, bytes_transferred);
+	}
+
+	// closes the writer of the current response, if any; its producer sees
+	// closed() and any further data is dropped
+	void
+	end_stream(
+	)
+	{
+		if ( stream_ )
+		{
+			auto stream = std::move(stream_);
+			stream_.reset();
+			stream->detach();
+		}
+		stream_head_written_ = false;
+		stream_sending_.clear();
+		stream_sending_.shrink_to_fit();
+		stream_raw_.clear();
+		stream_raw_.shrink_to_fit();
+		stream_compressor_.reset();
+	}
+
+	void
+	on_http_header(
+		const boost::system::error_code & ec,
+		std::size_t // bytes_transferred
+	)
+	{
+		cancel_timeout();
+		if ( ec )
+		{
+			if ( http::error::end_of_stream != ec && asio::error::operation_aborted != ec )
+			{
+				logger()->error(
+					"UID:{}\tGID:{}\tPID:{}\terror: {}",
+					cached_remote_identity().uid,
+					cached_remote_identity().gid,
+					cached_remote_identity().pid,
+					ec.message()
+				);
+			}
+			finish();
+			return;
+		}
+
+		state_ = state::handling;
+		record(http_metrics::phase::parse, read_began_);
+
+		if ( false == admit_request() )
+		{
+			async_write_response();
+			return;
+		}
+
+		if ( runs_on_worker(request_) )
+		{
+			handle_on_worker();
+			return;
+		}
+
+		if ( false == handle_request() )
+		{
+			finish();
+			return;
+		}
+
+		if ( deferred_ )
+		{
+			return;
+		}
+
+		if ( 1u < pipeline_batch_ && 0u < buffer_.size() && ! file_ && ! stream_ )
+		{
+			async_write_batch();
+			return;
+		}
+
+		async_write_response();
+	}
+
+	void
+	async_read()
+	{
+		state_ = state::reading;
+		reset_messages();
+
+		if ( 0u < buffer_.size() )
+		{
+			read_request();
+			return;
+		}
+
+		// nothing pipelined: the connection may sit idle for a while, and
+		// does not need what its largest request grew the arena to
+		arena_.trim(arena_retained);
+		if ( nullptr == buffer_.get_allocator().pool() )
+		{
+			read_request();
+			return;
+		}
+
+		// return the buffer to the pool and only borrow one again once the
+		// client has sent something
+		buffer_.shrink_to_fit();
+
+		boost::system::error_code ec;
+		if ( 0u < socket().available(ec) || ec )
+		{
+			read_request();
+			return;
+		}
+
+		// the readiness check and the wait are issued back to back from the
+		// connection's only thread, so data arriving in between still wakes
+		// the wait
+		arm_timeout(timeouts_.idle, "idle");
+		idle_wait_ = true;
+		socket().async_wait(
+			asio::socket_base::wait_read,
+			make_http_allocating_handler(
+				handler_memory_,
+				std::bind(
+					&http_connection::on_readable,
+					this,
+					std::placeholders::_1
+				)
+			)
+		);
+	}
+
+protected:
+	static constexpr std::size_t body_chunk_size = 16 * 1024;
+
+	// arena bytes a connection keeps while waiting for its next request
+	static constexpr std::size_t arena_retained = 16 * 1024;
+
+	// waiting for a request with nothing of it read
+	bool
+	idle(
+	)
+	{
+		if ( state::reading != state_ || false == idle_wait_ || 0u < buffer_.size() )
+		{
+			return false;
+		}
+
+		boost::system::error_code ec;
+		return 0u == socket().available(ec) && ! ec;
+	}
+
+	// identity is taken before s is moved from
+	template <
+		class Socket
+	>
+	http_connection(
+		Socket & s,
+		const local_stream::ucred & identity
+	)
+	: http_stream::socket(std::move(s))
+	, cached_remote_identity_{identity}
+	{
+	}
+
+	static
+	local_stream::ucred
+	tcp_identity(
+	)
+	{
+		local_stream::ucred identity{};
+		identity.uid = static_cast<decltype(identity.uid)>(-1);
+		identity.gid = static_cast<decltype(identity.gid)>(-1);
+		identity.pid = 0;
+		return identity;
+	}
+
+	using header_parser = http::request_parser<http::empty_body, http_allocator>;
+	using body_parser = http::request_parser<http_body, http_allocator>;
+	using streaming_parser = http::request_parser<http::buffer_body, http_allocator>;
+
+	// the header is read on its own; how the body is read is up to the
+	// endpoint, see on_request_header()
+	void
+	read_request(
+	)
+	{
+		forget_endpoint();
+		header_parser_.emplace(
+			std::piecewise_construct,
+			std::make_tuple(),
+			std::make_tuple(http_allocator{&arena_})
+		);
+
+		// the endpoint's limit applies, once it has been asked. (not
+		// boost::none: beast compares Content-Length against it as is)
+		header_parser_->body_limit(std::numeric_limits<std::uint64_t>::max());
+
+		if ( metrics_ )
+		{
+			read_began_ = std::chrono::steady_clock::now();
+		}
+		arm_timeout(timeouts_.header, "header");
+		http::async_read_header(
+			socket(),
+			buffer_,
+			*header_parser_,
+			make_http_allocating_handler(
+				handler_memory_,
+				std::bind(
+					&http_connection::on_request_header,
+					this,
+					std::placeholders::_1,
+					std::placeholders::_2
+				)
+			)
+		);
+	}
+
+	void
+	on_request_header(
+		const boost::system::error_code & ec,
+		std::size_t bytes_transferred
+	)
+	{
+		count(http_metrics::counter::bytes_received, bytes_transferred);
+		if ( ec )
+		{
+			on_http_header(ec, bytes_transferred);
+			return;
+		}
+
+		if ( header_parser_->is_done() )
+		{
+			// no body at all
+			request_.base() = std::move(header_parser_->get().base());
+			header_parser_.reset();
+			on_http_header(ec, bytes_transferred);
+			return;
+		}
+
+		http_body_handling handling;
+		if ( auto * endpoint = resolved_endpoint(header_parser_->get()) )
+		{
+			handling = endpoint->body_handling(*this, header_parser_->get());
+		}
+
+		auto length = header_parser_->content_length();
+		if ( length && handling.limit < *length )
+		{
+			request_.base() = std::move(header_parser_->get().base());
+			header_parser_.reset();
+			respond_without_handling(http::status::payload_too_large);
+			return;
+		}
+
+		if ( ! handling.sink )
+		{
+			body_parser_.emplace(std::move(*header_parser_), http_allocator{&arena_});
+			header_parser_.reset();
+			body_parser_->body_limit(handling.limit);
+
+			arm_timeout(timeouts_.body, "body");
+			http::async_read(
+				socket(),
+				buffer_,
+				*body_parser_,
+				make_http_allocating_handler(
+					handler_memory_,
+					std::bind(
+						&http_connection::on_request_body,
+						this,
+						std::placeholders::_1,
+						std::placeholders::_2
+					)
+				)
+			);
+			return;
+		}
+
+		body_sink_ = std::move(handling.sink);
+		streaming_parser_.emplace(std::move(*header_parser_));
+		header_parser_.reset();
+		streaming_parser_->body_limit(handling.limit);
+
+		// borrowed like the read buffer, and only for as long as the body
+		body_chunk_ = buffer_.get_allocator().allocate(body_chunk_size);
+		read_body_some();
+	}
+
+	void
+	on_request_body(
+		const boost::system::error_code & ec,
+		std::size_t bytes_transferred
+	)
+	{
+		count(http_metrics::counter::bytes_received, bytes_transferred);
+		if ( ec )
+		{
+			request_.base() = std::move(body_parser_->get().base());
+			on_body_error(ec);
+			return;
+		}
+
+		request_ = body_parser_->release();
+		body_parser_.reset();
+		on_http_header(ec, bytes_transferred);
+	}
+
+	void
+	read_body_some(
+	)
+	{
+		auto & body = streaming_parser_->get().body();
+		body.data = body_chunk_;
+		body.size = body_chunk_size;
+
+		arm_timeout(timeouts_.body, "body");
+		http::async_read_some(
+			socket(),
+			buffer_,
+			*streaming_parser_,
+			make_http_allocating_handler(
+				handler_memory_,
+				std::bind(
+					&http_connection::on_body_some,
+					this,
+					std::placeholders::_1,
+					std::placeholders::_2
+				)
+			)
+		);
+	}
+
+	void
+	on_body_some(
+		boost::system::error_code ec,
+		std::size_t bytes_transferred
+	)
+	{
+		count(http_metrics::counter::bytes_received, bytes_transferred);
+
+		// the chunk is full; not an error
+		if ( http::error::need_buffer == ec )
+		{
+			ec = {};
+		}
+
+		if ( ec )
+		{
+			request_.base() = std::move(streaming_parser_->get().base());
+			on_body_error(ec);
+			return;
+		}
+
+		auto received = body_chunk_size - streaming_parser_->get().body().size;
+		boost::system::error_code sink_ec;
+		if ( 0u < received )
+		{
+			body_sink_->write({body_chunk_, received}, sink_ec);
+		}
+
+		bool done = streaming_parser_->is_done();
+		if ( ! sink_ec && done )
+		{
+			body_sink_->finish(sink_ec);
+		}
+
+		if ( sink_ec )
+		{
+			request_.base() = std::move(streaming_parser_->get().base());
+			release_body_chunk();
+			logger()->error(
+				"UID:{}\tGID:{}\tPID:{}\t{}\t{}\tbody sink error: {}",
+				cached_remote_identity().uid,
+				cached_remote_identity().gid,
+				cached_remote_identity().pid,
+				request_.method(),
+				request_.target(),
+				sink_ec.message()
+			);
+			respond_without_handling(http::status::internal_server_error);
+			return;
+		}
+
+		if ( done )
+		{
+			request_.base() = std::move(streaming_parser_->get().base());
+			streaming_parser_.reset();
+			release_body_chunk();
+			on_http_header(ec, bytes_transferred);
+			return;
+		}
+
+		read_body_some();
+	}
+
+	// the body could not be read. request_ holds its header
+	void
+	on_body_error(
+		const boost::system::error_code & ec
+	)
+	{
+		release_body_chunk();
+
+		if ( http::error::body_limit == ec )
+		{
+			respond_without_handling(http::status::payload_too_large);
+			return;
+		}
+
+		on_http_header(ec, 0);
+	}
+
+	void
+	count(
+		http_metrics::counter c,
+		std::uint64_t n
+	)
+	{
+		if ( metrics_ && 0u < n )
+		{
+			metrics_->local().add(c, n);
+		}
+	}
+
+	// the time since began, into this thread's shard
+	void
+	record(
+		http_metrics::phase p,
+		std::chrono::steady_clock::time_point began
+	)
+	{
+		if ( metrics_ )
+		{
+			metrics_->local().record(p, std::chrono::steady_clock::now() - began);
+		}
+	}
+
+	// a whole response went out in one write
+	void
+	on_response_sent(
+		const boost::system::error_code & ec,
+		std::size_t bytes_transferred
+	)
+	{
+		count(http_metrics::counter::bytes_sent, bytes_transferred);
+		on_response_written(ec, bytes_transferred);
+	}
+
+	// (re-)starts the deadline of the phase named what; zero cancels it
+	void
+	arm_timeout(
+		std::chrono::milliseconds after,
+		const char * what
+	)
+	{
+		if ( 0 == after.count() )
+		{
+			cancel_timeout();
+			return;
+		}
+
+		if ( nullptr == wheel_ )
+		{
+			wheel_ = &http_timer_wheel::use(get_executor());
+		}
+		timeout_phase_ = what;
+		wheel_->arm(timeout_, after);
+	}
+
+	void
+	cancel_timeout(
+	)
+	{
+		if ( timeout_.armed() )
+		{
+			wheel_->cancel(timeout_);
+		}
+	}
+
+	// the phase armed last ran out. closing the socket completes whatever
+	// is outstanding on it with operation_aborted, which finishes the
+	// connection from there
+	void
+	on_timeout(
+	)
+	{
+		logger()->info(
+			"UID:{}\tGID:{}\tPID:{}\ttimed out: {}",
+			cached_remote_identity().uid,
+			cached_remote_identity().gid,
+			cached_remote_identity().pid,
+			timeout_phase_
+		);
+
+		boost::system::error_code ignored;
+		this->http_stream::socket::close(ignored);
+	}
+
+	// charges request_ to its peer's rate. when over it, response_ becomes
+	// the 429 to send instead of handling the request
+	bool
+	admit_request(
+	)
+	{
+		if ( nullptr == peer_ )
+		{
+			return true;
+		}
+
+		std::chrono::nanoseconds retry_after{0};
+		if ( peer_limiter_->admit_request(peer_, std::chrono::steady_clock::now(), retry_after) )
+		{
+			return true;
+		}
+
+		// whole seconds, rounded up
+		auto seconds = std::chrono::ceil<std::chrono::seconds>(retry_after).count();
+		char retry[24];
+		auto end = fmt::format_to_n(retry, sizeof(retry), "{}", std::max<std::int64_t>(1, seconds)).out;
+
+		file_.reset();
+		serialized_.reset();
+		end_stream();
+		response_ = http_status_response(request_, http::status::too_many_requests);
+		response_.set(http::field::retry_after, boost::beast::string_view{retry, static_cast<std::size_t>(end - retry)});
+		log_access();
+		return false;
+	}
+
+	// the endpoint root_ resolves the current request to. the router is
+	// walked once per request however often this is asked; the captures
+	// view into the header's bytes, which the arena keeps until the request
+	// is done
+	http_endpoint *
+	resolved_endpoint(
+		const http_request_header & header
+	)
+	{
+		if ( false == resolved_ )
+		{
+			route_captures_.clear();
+			endpoint_ = root_ ? root_->resolve(*this, header) : nullptr;
+			resolved_ = true;
+		}
+		return endpoint_;
+	}
+
+	// the current request is handled, or about to be replaced; its
+	// captures stay until the next one resolves
+	void
+	forget_endpoint(
+	)
+	{
+		endpoint_ = nullptr;
+		resolved_ = false;
+	}
+
+	// whether the endpoint for this request wants it handled off the
+	// connection's thread
+	bool
+	runs_on_worker(
+		const http_request_header & header
+	)
+	{
+		if ( nullptr == worker_pool_ || nullptr == root_ )
+		{
+			return false;
+		}
+
+		auto * endpoint = resolved_endpoint(header);
+		return endpoint && http_execution::worker_pool == endpoint->execution(*this, header);
+	}
+
+	// runs handle_request() on the worker pool and picks the response up
+	// again on the connection's thread. nothing else touches the
+	// connection meanwhile: no operation is outstanding on its socket, so
+	// the io_context is told to expect the result instead
+	void
+	handle_on_worker(
+	)
+	{
+		pending_work_.emplace(get_executor());
+		auto submitted = worker_pool_->try_submit([this]()
+		{
+			bool respond = handle_request();
+
+			// not from handler_memory_: at shutdown this may be left queued
+			// on a stopped io_context after the connection is gone
+			asio::post(get_executor(), [this, respond]()
+			{
+				on_worker_handled(respond);
+			});
+		});
+		if ( submitted )
+		{
+			return;
+		}
+		pending_work_.reset();
+
+		// saturated: fail fast rather than queue behind the backlog
+		response_ = http_status_response(request_, http::status::service_unavailable);
+		response_.set(http::field::retry_after, "1");
+		log_access();
+		async_write_response();
+	}
+
+	void
+	on_worker_handled(
+		bool respond
+	)
+	{
+		pending_work_.reset();
+		if ( false == respond )
+		{
+			finish();
+			return;
+		}
+
+		async_write_response();
+	}
+
+	// answers request_ with status, without the endpoint, and hangs up
+	// afterwards: the rest of its body is still unread
+	void
+	respond_without_handling(
+		http::status status
+	)
+	{
+		state_ = state::handling;
+		body_sink_.reset();
+		response_ = http_status_response(request_, status);
+		response_.keep_alive(false);
+		log_access();
+		async_write_response();
+	}
+
+	void
+	release_body_chunk(
+	)
+	{
+		if ( body_chunk_ )
+		{
+			buffer_.get_allocator().deallocate(body_chunk_, body_chunk_size);
+			body_chunk_ = nullptr;
+		}
+	}
+
+	// drops the previous request and response, then rewinds the arena they
+	// were allocated from. the messages are emptied first so nothing still
+	// points into the arena when it is reused
+	void
+	reset_messages(
+	)
+	{
+		forget_endpoint();
+		header_parser_.reset();
+		body_parser_.reset();
+		streaming_parser_.reset();
+		body_sink_.reset();
+		request_ = http_make_request(&arena_);
+		response_ = http_make_response(&arena_);
+
+		// moving a short string into a longer one keeps the longer one's
+		// buffer, which the arena is about to hand out again; let go of
+		// the bodies' buffers for real
+		http_body::value_type{http_allocator{&arena_}}.swap(request_.body());
+		http_body::value_type{http_allocator{&arena_}}.swap(response_.body());
+		arena_.reset();
+	}
+
+	// terminal state of every connection: on error, on a response that did
+	// not keep the connection alive, or when the client goes away
+	void
+	finish(
+	)
+	{
+		boost::system::error_code ignored;
+		this->http_stream::socket::close(ignored);
+		state_ = state::closed;
+		cancel_timeout();
+
+		logger()->debug(
+			"UID:{}\tGID:{}\tPID:{}\tfinished",
+			cached_remote_identity().uid,
+			cached_remote_identity().gid,
+			cached_remote_identity().pid
+		);
+
+		// an idle keep-alive connection should not pin its buffers while
+		// it waits to be reclaimed
+		file_.reset();
+		serialized_.reset();
+		end_stream();
+		deferred_ = false;
+		deferred_ready_ = false;
+		deferred_failed_ = {};
+		pending_work_.reset();
+		release_body_chunk();
+		buffer_.clear();
+		buffer_.shrink_to_fit();
+		write_buffer_.clear();
+		write_buffer_.shrink_to_fit();
+		reset_messages();
+		arena_.release();
+
+		if ( closed_handler_ )
+		{
+			// moved out first: the handler may destroy *this, and with it
+			// closed_handler_
+			auto on_closed = std::move(closed_handler_);
+			closed_handler_ = nullptr;
+			on_closed(*this);
+		}
+	}
+
+	// runs the endpoint for request_ and fills response_. returns false
+	// when the endpoint asked for the connection to be dropped without
+	// sending anything
+	bool
+	handle_request(
+	)
+	{
+		logger()->debug(
+			"UID:{}\tGID:{}\tPID:{}\t{}\t{}",
+			cached_remote_identity().uid,
+			cached_remote_identity().gid,
+			cached_remote_identity().pid,
+			request_.method(),
+			request_.target()
+		);
+
+		file_.reset();
+		serialized_.reset();
+		end_stream();
+		deferred_ = false;
+		if ( metrics_ )
+		{
+			handle_began_ = std::chrono::steady_clock::now();
+		}
+
+		try
+		{
+			if ( root_ )
+			{
+				// root_ only walks its children again to answer a request
+				// that resolves to nothing (a 404, or a 405 with Allow)
+				auto * endpoint = resolved_endpoint(request_);
+				response_ = endpoint ? endpoint->handle(*this, request_) : root_->handle(*this, request_);
+			}
+			else
+			{
+				response_ = http_make_response(&arena_);
+				response_.version(11);
+				response_.result(http::status::internal_server_error);
+				response_.set(http::field::comments, "no-root-endpoint-installed");
+				response_.keep_alive(false);
+			}
+		}
+		catch (const std::exception & e)
+		{
+			logger()->error(
+				"UID:{}\tGID:{}\tPID:{}\t{}\t{}\terror: {}",
+				cached_remote_identity().uid,
+				cached_remote_identity().gid,
+				cached_remote_identity().pid,
+				request_.method(),
+				request_.target(),
+				e.what()
+			);
+			file_.reset();
+			serialized_.reset();
+			end_stream();
+			deferred_ = false;
+			pending_work_.reset();
+			response_ = http_make_response(&arena_);
+			response_.version(11);
+			response_.result(http::status::internal_server_error);
+			response_.keep_alive(false);
+		}
+
+		forget_endpoint();
+		if ( deferred_ )
+		{
+			return true;
+		}
+
+		record(http_metrics::phase::handle, handle_began_);
+		return finish_handling();
+	}
+
+	// the common tail of handling a request, immediate or deferred. false
+	// when the endpoint asked for the connection to be dropped
+	bool
+	finish_handling(
+	)
+	{
+		if ( response_.result() == http::status::connection_closed_without_response )
+		{
+			return false;
+		}
+
+		if ( false == request_.keep_alive() || draining() )
+		{
+			response_.keep_alive(false);
+		}
+
+		compress_response();
+		log_access();
+		return true;
+	}
+
+	// encodes response_ with the coding the client likes best, if any. may
+	// run on a worker thread, which is where the cost belongs
+	void
+	compress_response(
+	)
+	{
+		if ( nullptr == compression_ || file_ || serialized_ )
+		{
+			return;
+		}
+
+		bool head = http::verb::head == request_.method();
+		if ( false == http_compression::eligible(head, response_.result_int(), response_) )
+		{
+			return;
+		}
+
+		// caches must keep the codings apart, whether or not this one is
+		// compressed
+		auto vary = response_[http::field::vary];
+		if ( vary.empty() )
+		{
+			response_.set(http::field::vary, "Accept-Encoding");
+		}
+		else if ( "*" != vary && boost::beast::string_view::npos == vary.find("Accept-Encoding") )
+		{
+			std::string merged{vary.data(), vary.size()};
+			merged.append(", Accept-Encoding");
+			response_.set(http::field::vary, merged);
+		}
+
+		auto & body = response_.body();
+		if ( ! stream_ && body.size() < compression_->policy().minimum_size )
+		{
+			return;
+		}
+
+		auto coding = http_negotiate_coding(request_[http::field::accept_encoding], compression_->policy());
+		if ( http_content_coding::identity == coding )
+		{
+			return;
+		}
+
+		if ( stream_ )
+		{
+			stream_compressor_ = std::make_unique<http_compressor>(coding, compression_->level(coding));
+			if ( false == body.empty() )
+			{
+				std::string compressed;
+				stream_compressor_->write({body.data(), body.size()}, compressed, true);
+				count(http_metrics::counter::compressed_in, body.size());
+				count(http_metrics::counter::compressed_out, compressed.size());
+				body.assign(compressed.data(), compressed.size());
+			}
+		}
+		else
+		{
+			std::shared_ptr<const std::string> compressed;
+			if ( false == compression_->compress(coding, {body.data(), body.size()}, compressed) )
+			{
+				return;
+			}
+			count(http_metrics::counter::compressed_in, body.size());
+			count(http_metrics::counter::compressed_out, compressed->size());
+			body.assign(compressed->data(), compressed->size());
+			response_.prepare_payload();
+		}
+
+		auto name = http_coding_name(coding);
+		response_.set(http::field::content_encoding, boost::beast::string_view{name.data(), name.size()});
+
+		// the compressed bytes are not the ones a strong validator vouched
+		// for; they are equivalent, though
+		auto etag = response_[http::field::etag];
+		if ( false == etag.empty() && false == etag.starts_with("W/") )
+		{
+			std::string weak{"W/"};
+			weak.append(etag.data(), etag.size());
+			response_.set(http::field::etag, weak);
+		}
+	}
+
+	void
+	send_completed_response(
+	)
+	{
+		if ( false == finish_handling() )
+		{
+			finish();
+			return;
+		}
+
+		async_write_response();
+	}
+
+	void
+	log_access(
+	)
+	{
+		if ( metrics_ )
+		{
+			metrics_->local().request(request_.method(), response_.result_int());
+		}
+
+		if ( access_log_ )
+		{
+			http_access_record record;
+			record.when = std::chrono::system_clock::now();
+			record.uid = cached_remote_identity().uid;
+			record.gid = cached_remote_identity().gid;
+			record.pid = cached_remote_identity().pid;
+			record.status = static_cast<std::uint16_t>(response_.result_int());
+			record.method = request_.method();
+			record.set_target({request_.target().data(), request_.target().size()});
+			access_log_->push(record);
+			return;
+		}
+
+		logger()->info(
+			"UID:{}\tGID:{}\tPID:{}\t{}\t{}\t{}\t{}",
+			cached_remote_identity().uid,
+			cached_remote_identity().gid,
+			cached_remote_identity().pid,
+			static_cast<int>(response_.result()),
+			response_.result(),
+			request_.method(),
+			request_.target()
+		);
+	}
+
+	// parses the next request out of buffer_ without touching the socket.
+	// returns false when buffer_ does not hold a complete request; the
+	// bytes are left in place for the next async_read
+	bool
+	parse_buffered_request(
+	)
+	{
+		if ( 0u == buffer_.size() )
+		{
+			return false;
+		}
+
+		http::request_parser<http_body, http_allocator> parser{
+			std::piecewise_construct,
+			std::make_tuple(http_allocator{&arena_}),
+			std::make_tuple(http_allocator{&arena_})
+		};
+		parser.eager(true);
+
+		if ( metrics_ )
+		{
+			read_began_ = std::chrono::steady_clock::now();
+		}
+
+		boost::system::error_code ec;
+		auto used = parser.put(buffer_.data(), ec);
+		if ( ec || false == parser.is_done() )
+		{
+			return false;
+		}
+		forget_endpoint();
+
+		// a body is read the way its endpoint asks for, and a request for
+		// the worker pool is not answered here; leave such a request to the
+		// next async_read
+		if ( parser.chunked() || 0u < parser.content_length().value_or(0) )
+		{
+			return false;
+		}
+		if ( runs_on_worker(parser.get()) )
+		{
+			return false;
+		}
+
+		buffer_.consume(used);
+		request_ = parser.release();
+		count(http_metrics::counter::bytes_received, used);
+		record(http_metrics::phase::parse, read_began_);
+		return true;
+	}
+
+	void
+	async_write_response(
+	)
+	{
+		state_ = state::writing;
+		arm_timeout(timeouts_.write, "write");
+		if ( metrics_ )
+		{
+			write_began_ = std::chrono::steady_clock::now();
+		}
+
+		if ( file_ || stream_ )
+		{
+			// header only; the body follows from the file or the writer
+			write_buffer_.consume(write_buffer_.size());
+			serialize_response();
+			keep_alive_ = response_.keep_alive();
+			asio::async_write(
+				socket(),
+				write_buffer_.data(),
+				make_http_allocating_handler(
+					handler_memory_,
+					std::bind(
+						&http_connection::on_head_written,
+						this,
+						std::placeholders::_1,
+						std::placeholders::_2
+					)
+				)
+			);
+			return;
+		}
+
+		if ( serialized_ )
+		{
+			keep_alive_ = response_.keep_alive();
+			asio::async_write(
+				socket(),
+				asio::buffer(serialized_->data(), serialized_size_),
+				make_http_allocating_handler(
+					handler_memory_,
+					std::bind(
+						&http_connection::on_response_sent,
+						this,
+						std::placeholders::_1,
+						std::placeholders::_2
+					)
+				)
+			);
+			return;
+		}
+
+		keep_alive_ = response_.keep_alive();
+		http::async_write(
+			socket(),
+			response_,
+			make_http_allocating_handler(
+				handler_memory_,
+				std::bind(
+					&http_connection::on_response_sent,
+					this,
+					std::placeholders::_1,
+					std::placeholders::_2
+				)
+			)
+		);
+	}
+
+	// appends response_ to write_buffer_. a response whose body follows
+	// from a writer gets its framing here, and whatever body it does hold
+	// goes out as the first piece
+	void
+	serialize_response(
+	)
+	{
+		if ( serialized_ )
+		{
+			write_buffer_.commit(asio::buffer_copy(
+				write_buffer_.prepare(serialized_size_),
+				asio::buffer(serialized_->data(), serialized_size_)
+			));
+			return;
+		}
+
+		auto out = boost::beast::ostream(write_buffer_);
+		if ( ! stream_ )
+		{
+			out << response_;
+			return;
+		}
+
+		// the body's length is not known yet. HTTP/1.0 has no chunked
+		// encoding, so there the end of the body is the end of the
+		// connection
+		response_.erase(http::field::content_length);
+		stream_chunked_ = 11 <= request_.version();
+		if ( stream_chunked_ )
+		{
+			response_.chunked(true);
+		}
+		else
+		{
+			response_.keep_alive(false);
+		}
+
+		out << response_.base();
+
+		auto & body = response_.body();
+		if ( body.empty() || http::verb::head == request_.method() )
+		{
+			return;
+		}
+
+		// ahead of anything the writer already holds
+		if ( stream_chunked_ )
+		{
+			out << std::hex << body.size() << std::dec << "\r\n" << body << "\r\n";
+		}
+		else
+		{
+			out << body;
+		}
+	}
+
+	// serializes response_ and the responses to any further requests that
+	// are already buffered into write_buffer_, then sends them all at once
+	void
+	async_write_batch(
+	)
+	{
+		state_ = state::writing;
+		arm_timeout(timeouts_.write, "write");
+		if ( metrics_ )
+		{
+			write_began_ = std::chrono::steady_clock::now();
+		}
+		write_buffer_.consume(write_buffer_.size());
+
+		std::size_t batched = 0;
+		for ( ;; )
+		{
+			serialize_response();
+			++batched;
+			keep_alive_ = response_.keep_alive();
+
+			if (
+				false == keep_alive_
+				|| file_
+				|| stream_
+				|| pipeline_batch_ <= batched
+				|| false == parse_buffered_request()
+			)
+			{
+				break;
+			}
+
+			if ( false == admit_request() )
+			{
+				// the 429 is batched like any other response
+				continue;
+			}
+
+			if ( false == handle_request() )
+			{
+				// flush what was already answered, then drop the client
+				keep_alive_ = false;
+				break;
+			}
+
+			if ( deferred_ )
+			{
+				// flush what was already answered; on_head_written waits
+				// for the rest
+				break;
+			}
+		}
+
+		asio::async_write(
+			socket(),
+			write_buffer_.data(),
+			make_http_allocating_handler(
+				handler_memory_,
+				std::bind(
+					&http_connection::on_head_written,
+					this,
+					std::placeholders::_1,
+					std::placeholders::_2
+				)
+			)
+		);
+	}
+
+	local_stream::ucred cached_remote_identity_;
+	http_connection_handle handle_;
+	http_route_captures route_captures_;
+	http_io_buffer buffer_;
+	http_io_buffer write_buffer_;
+
+	// declared ahead of the messages: they allocate from it, so it must be
+	// constructed before and destroyed after them
+	http_arena arena_;
+	http_handler_memory handler_memory_;
+	http_request request_{http_make_request(&arena_)};
+	http_response response_{http_make_response(&arena_)};
+	std::optional<header_parser> header_parser_;
+	std::optional<body_parser> body_parser_;
+	std::optional<streaming_parser> streaming_parser_;
+	std::unique_ptr<http_body_sink> body_sink_;
+	char * body_chunk_ = nullptr;
+	http_endpoint * root_ = nullptr;
+	http_endpoint * endpoint_ = nullptr;
+	bool resolved_ = false;
+	http_access_log * access_log_ = nullptr;
+	worker_pool * worker_pool_ = nullptr;
+	http_peer_limiter * peer_limiter_ = nullptr;
+	http_peer_limiter::slot * peer_ = nullptr;
+	http_metrics * metrics_ = nullptr;
+	http_compression * compression_ = nullptr;
+	std::chrono::steady_clock::time_point read_began_;
+	std::chrono::steady_clock::time_point handle_began_;
+	std::chrono::steady_clock::time_point write_began_;
+	http_timeouts timeouts_;
+	http_timer_wheel * wheel_ = nullptr;
+	http_timer_wheel::timer timeout_{[this]()
+	{
+		on_timeout();
+	}};
+	const char * timeout_phase_ = "";
+	std::optional<asio::executor_work_guard<http_stream::socket::executor_type>> pending_work_;
+	std::shared_ptr<const http_open_file> file_;
+	std::uint64_t file_offset_ = 0;
+	std::uint64_t file_remaining_ = 0;
+	std::shared_ptr<const std::string> serialized_;
+	std::size_t serialized_size_ = 0;
+	std::shared_ptr<http_response_writer> stream_;
+	std::string stream_sending_;
+	std::string stream_raw_;
+	std::unique_ptr<http_compressor> stream_compressor_;
+	char stream_chunk_header_[20];
+	bool stream_chunked_ = true;
+	bool stream_head_written_ = false;
+	bool stream_sending_in_flight_ = false;
+	bool deferred_ = false;
+	bool deferred_ready_ = false;
+	boost::system::error_code deferred_failed_;
+	closed_handler closed_handler_;
+	state state_ = state::reading;
+	const std::atomic<bool> * draining_ = nullptr;
+	bool idle_wait_ = false;
+	bool keep_alive_ = false;
+	std::size_t pipeline_batch_ = 1;
+};
+
+enum class http_listener_action
+{
+	cancel_and_stop,
+	normal,
+	reject_connection
+};
+
+template <
+	class Protocol
+>
+class basic_http_listener
+: protected Protocol::acceptor
+{
+public:
+	using Protocol::acceptor::acceptor;
+	using Protocol::acceptor::close;
+};
+
+using http_listener = basic_http_listener<koti::local_stream>;
+
+// "address:port", or "[address]:port" for IPv6. false when it is neither
+inline
+bool
+http_parse_tcp_endpoint(
+	const std::string & text,
+	asio::ip::tcp::endpoint & endpoint
+)
+{
+	auto colon = text.rfind(':');
+	if ( std::string::npos == colon || 0 == colon || text.size() == colon + 1 )
+	{
+		return false;
+	}
+
+	auto host = text.substr(0, colon);
+	if ( '[' == host.front() )
+	{
+		if ( host.size() < 2 || ']' != host.back() )
+		{
+			return false;
+		}
+		host = host.substr(1, host.size() - 2);
+	}
+
+	auto port = text.substr(colon + 1);
+	if ( 5 < port.size() || std::string::npos != port.find_first_not_of("0123456789") )
+	{
+		return false;
+	}
+	auto number = std::stoul(port);
+	if ( std::numeric_limits<std::uint16_t>::max() < number )
+	{
+		return false;
+	}
+
+	boost::system::error_code ec;
+	auto address = asio::ip::make_address(host, ec);
+	if ( ec )
+	{
+		return false;
+	}
+
+	endpoint = asio::ip::tcp::endpoint{address, static_cast<std::uint16_t>(number)};
+	return true;
+}
+
+// "@name" is the abstract socket name: its first byte is a nul rather
+// than the @
+inline
+local_stream::endpoint
+http_local_endpoint(
+	const std::string & path
+)
+{
+	if ( ! path.empty() && '@' == path.front() )
+	{
+		return {std::string(1u, '\0') + path.substr(1)};
+	}
+	return {path};
+}
+
+class httpd_options
+: public koti::options::configurator
+{
 public:
-	using koti::local_stream::acceptor::acceptor;
-	using koti::local_stream::acceptor::close;
+	options::validate
+	add_options(
+		options & storage
+	) override
+	{
+		storage.descriptions().add_options()
+		("local-path,l", po::value<std::string>(&socket_path_)->required(), "local unix socket path")
+		("abstract", po::bool_switch(&is_abstract_), "when selected, use an abstract socket")
+		("listen-backlog", po::value<int>(&listen_backlog_)->default_value(listen_backlog_), "maximum length of the queue of pending connections")
+		("accept-batch", po::value<std::size_t>(&accept_batch_)->default_value(accept_batch_), "maximum number of pending connections to accept per wakeup")
+		("pipeline-batch", po::value<std::size_t>(&pipeline_batch_)->default_value(pipeline_batch_), "maximum number of pipelined responses gathered into one write")
+		("read-buffer-limit", po::value<std::size_t>(&read_buffer_limit_)->default_value(read_buffer_limit_), "maximum size in bytes of a connection's read buffer; 0 for no limit")
+		("access-log", po::value<std::string>(&access_log_mode_)->default_value(access_log_mode_), "access log mode: sync writes each line from the connection's thread, async queues records for a background writer")
+		("access-log-queue", po::value<std::size_t>(&access_log_queue_)->default_value(access_log_queue_), "number of records the async access log can hold")
+		("access-log-overflow", po::value<std::string>(&access_log_overflow_)->default_value(access_log_overflow_), "what a full async access log does with a record: drop (and count it) or block")
+		("buffer-pool-retain", po::value<std::size_t>(&buffer_pool_retain_)->default_value(buffer_pool_retain_), "maximum number of bytes of idle read buffers kept for reuse")
+		("workers", po::value<std::size_t>(&workers_)->default_value(workers_), "number of threads for endpoints that block or are CPU-heavy; 0 runs them on the io threads")
+		("worker-queue", po::value<std::size_t>(&worker_queue_)->default_value(worker_queue_), "number of requests that may wait for a worker before further ones are answered with 503")
+		("peer-connections", po::value<std::size_t>(&peer_limits_.connections)->default_value(peer_limits_.connections), "maximum number of open connections per local peer (not applied over TCP); further ones are refused; 0 for no limit")
+		("peer-requests-per-second", po::value<double>(&peer_limits_.requests_per_second)->default_value(peer_limits_.requests_per_second), "sustained requests per second allowed per local peer (not applied over TCP); requests over it are answered with 429; 0 for no limit")
+		("peer-burst", po::value<std::size_t>(&peer_limits_.burst)->default_value(peer_limits_.burst), "number of requests a peer may make at once before its rate applies; 0 for one second's worth")
+		("peer-key", po::value<std::string>(&peer_key_)->default_value(peer_key_), "what tells peers apart for the limits: uid, or pid for uid and pid")
+		("peer-table", po::value<std::size_t>(&peer_table_)->default_value(peer_table_), "number of peers tracked separately; peers beyond it share one set of limits")
+		("idle-timeout", po::value<double>(&idle_timeout_)->default_value(idle_timeout_), "seconds a connection may wait for a request, including between keep-alive requests; 0 for no limit")
+		("header-timeout", po::value<double>(&header_timeout_)->default_value(header_timeout_), "seconds a client may take to send a request's header; 0 for no limit")
+		("body-timeout", po::value<double>(&body_timeout_)->default_value(body_timeout_), "seconds a client may take to send a request's body, or between pieces of a streamed body; 0 for no limit")
+		("write-timeout", po::value<double>(&write_timeout_)->default_value(write_timeout_), "seconds a client may take to accept a response, or a piece of a streamed one; 0 for no limit")
+		("io-backend", po::value<std::string>(&io_backend_)->default_value(io_backend_), "how connections are accepted: epoll, or io_uring for a multishot accept on an io_uring, falling back to epoll where the kernel lacks it")
+		("compress", po::value<std::string>(&compress_)->default_value(compress_), "content codings responses may be compressed with, as the client's Accept-Encoding prefers: gzip, bzip2, gzip,bzip2, or none to send every body as it is")
+		("gzip-level", po::value<int>(&compression_policy_.gzip_level)->default_value(compression_policy_.gzip_level), "gzip compression level, 1 (fastest) to 9 (smallest)")
+		("bzip2-level", po::value<int>(&compression_policy_.bzip2_level)->default_value(compression_policy_.bzip2_level), "bzip2 block size in units of 100k, 1 to 9")
+		("compress-min-size", po::value<std::size_t>(&compression_policy_.minimum_size)->default_value(compression_policy_.minimum_size), "bodies smaller than this many bytes are sent uncompressed")
+		("compression-cache", po::value<std::size_t>(&compression_policy_.cache_bytes)->default_value(compression_policy_.cache_bytes), "bytes of compressed bodies kept for responses that repeat; 0 for none")
+		("tcp-listen", po::value<std::string>(&tcp_listen_), "also listen for TCP connections at address:port ([address]:port for IPv6); unset serves the local socket only")
+		("tcp-no-delay", po::value<bool>(&tcp_options_.no_delay)->default_value(tcp_options_.no_delay), "set TCP_NODELAY on accepted TCP connections")
+		("tcp-defer-accept", po::value<unsigned>(&tcp_defer_accept_)->default_value(tcp_defer_accept_), "seconds a TCP connection may wait for its first bytes before it is accepted anyway (TCP_DEFER_ACCEPT); 0 accepts right away")
+		("tcp-reuseport", po::bool_switch(&tcp_options_.reuse_port), "with --threads, give each thread its own SO_REUSEPORT TCP acceptor")
+		("tcp-steer-cpu", po::bool_switch(&tcp_options_.steer_by_cpu), "with SO_REUSEPORT acceptors, accept each TCP connection on the thread of the cpu that received it; pair with --pin-threads")
+		("shard-accept", po::bool_switch(&shard_accept_), "with --threads, accept on every thread: SO_REUSEPORT acceptors for TCP, and for the local socket one accepting thread that queues each connection to the thread that serves it")
+		("accept-queue", po::value<std::size_t>(&accept_queue_)->default_value(accept_queue_), "number of accepted local connections each thread's queue can hold with --shard-accept")
+		;
+		return options::validate::ok;
+	}
+
+	options::validate
+	validate_configuration(
+		options &
+	) override
+	{
+		if ( listen_backlog_ <= 0 )
+		{
+			return options::validate::reject;
+		}
+		if ( 0 == accept_batch_ || 0 == pipeline_batch_ || 0 == accept_queue_ )
+		{
+			return options::validate::reject;
+		}
+		if ( "sync" != access_log_mode_ && "async" != access_log_mode_ )
+		{
+			return options::validate::reject;
+		}
+		if ( "drop" != access_log_overflow_ && "block" != access_log_overflow_ )
+		{
+			return options::validate::reject;
+		}
+		if ( 0 == access_log_queue_ )
+		{
+			return options::validate::reject;
+		}
+		if ( 0 < workers_ && 0 == worker_queue_ )
+		{
+			return options::validate::reject;
+		}
+		if ( "uid" != peer_key_ && "pid" != peer_key_ )
+		{
+			return options::validate::reject;
+		}
+		if ( peer_limits_.requests_per_second < 0 || 0 == peer_table_ )
+		{
+			return options::validate::reject;
+		}
+		if ( idle_timeout_ < 0 || header_timeout_ < 0 || body_timeout_ < 0 || write_timeout_ < 0 )
+		{
+			return options::validate::reject;
+		}
+		if ( "epoll" != io_backend_ && "io_uring" != io_backend_ )
+		{
+			return options::validate::reject;
+		}
+		if (
+			"gzip" != compress_
+			&& "bzip2" != compress_
+			&& "gzip,bzip2" != compress_
+			&& "bzip2,gzip" != compress_
+			&& "none" != compress_
+		)
+		{
+			return options::validate::reject;
+		}
+		if (
+			compression_policy_.gzip_level < 1 || 9 < compression_policy_.gzip_level
+			|| compression_policy_.bzip2_level < 1 || 9 < compression_policy_.bzip2_level
+		)
+		{
+			return options::validate::reject;
+		}
+		if ( ! tcp_listen_.empty() && false == http_parse_tcp_endpoint(tcp_listen_, tcp_endpoint_) )
+		{
+			return options::validate::reject;
+		}
+		tcp_options_.defer_accept = std::chrono::seconds{tcp_defer_accept_};
+		compression_policy_.gzip = std::string::npos != compress_.find("gzip");
+		compression_policy_.bzip2 = std::string::npos != compress_.find("bzip2");
+		peer_limits_.per_pid = "pid" == peer_key_;
+		return options::validate::ok;
+	}
+
+	fs::path
+	path()
+	const
+	{
+		return local_endpoint().path();
+	}
+
+	local_stream::endpoint
+	local_endpoint()
+	const
+	{
+		if ( is_abstract_ )
+		{
+			if ( socket_path_.empty() || socket_path_.front() != '\0' )
+			{
+				return http_local_endpoint("@" + socket_path_);
+			}
+		}
+
+		return http_local_endpoint(socket_path_);
+	}
+
+	std::string socket_path_;
+	bool is_abstract_ = true;
+	int listen_backlog_ = asio::socket_base::max_listen_connections;
+	std::size_t accept_batch_ = 16;
+	std::size_t pipeline_batch_ = 1;
+	std::size_t read_buffer_limit_ = 64 * 1024;
+	std::size_t buffer_pool_retain_ = 16 * 1024 * 1024;
+	std::string access_log_mode_ = "sync";
+	std::size_t access_log_queue_ = 64 * 1024;
+	std::string access_log_overflow_ = "drop";
+	std::size_t workers_ = 0;
+	std::size_t worker_queue_ = worker_pool::default_queue_limit;
+	http_peer_limits peer_limits_;
+	std::string peer_key_ = "uid";
+	std::size_t peer_table_ = http_peer_limiter::default_slots;
+	double idle_timeout_ = 60;
+	double header_timeout_ = 10;
+	double body_timeout_ = 30;
+	double write_timeout_ = 30;
+	std::string io_backend_ = "epoll";
+	std::string compress_ = "none";
+	http_compression_policy compression_policy_;
+	std::string tcp_listen_;
+	asio::ip::tcp::endpoint tcp_endpoint_;
+	unsigned tcp_defer_accept_ = 0;
+	http_tcp_options tcp_options_;
+	bool shard_accept_ = false;
+	std::size_t accept_queue_ = 1024;
+
+	bool
+	listens_on_tcp() const
+	{
+		return ! tcp_listen_.empty();
+	}
+
+	bool
+	limits_peers() const
+	{
+		return 0 < peer_limits_.connections || 0 < peer_limits_.requests_per_second;
+	}
+
+	http_timeouts
+	timeouts() const
+	{
+		auto milliseconds = [](double seconds)
+		{
+			return std::chrono::milliseconds{static_cast<std::int64_t>(std::llround(seconds * 1000))};
+		};
+
+		http_timeouts t;
+		t.idle = milliseconds(idle_timeout_);
+		t.header = milliseconds(header_timeout_);
+		t.body = milliseconds(body_timeout_);
+		t.write = milliseconds(write_timeout_);
+		return t;
+	}
+
+	http_io_backend
+	io_backend() const
+	{
+		return "io_uring" == io_backend_ ? http_io_backend::io_uring : http_io_backend::epoll;
+	}
+
+	bool
+	compresses() const
+	{
+		return compression_policy_.gzip || compression_policy_.bzip2;
+	}
+};
+
+// What httpd needs to know about the protocol it listens with, beyond
+// what asio already says.
+template <
+	class Protocol
+>
+struct http_protocol_traits;
+
+template <>
+struct http_protocol_traits<koti::local_stream>
+{
+	using protocol = koti::local_stream;
+	using endpoint = protocol::endpoint;
+	using socket = protocol::socket;
+	using acceptor = protocol::acceptor;
+
+	// every acceptor would need its own path; there is one
+	static constexpr bool shardable = false;
+
+	static
+	protocol
+	protocol_of(
+		const endpoint &
+	)
+	{
+		return protocol{};
+	}
+
+	static
+	protocol
+	protocol_of_native(
+		int
+	)
+	{
+		return protocol{};
+	}
+
+	static
+	void
+	prepare_acceptor(
+		acceptor &,
+		const http_tcp_options &
+	)
+	{
+	}
+
+	static
+	void
+	prepare_socket(
+		socket &,
+		const http_tcp_options &
+	)
+	{
+	}
+
+	static
+	void
+	steer_by_cpu(
+		acceptor &,
+		std::size_t,
+		boost::system::error_code &
+	)
+	{
+	}
+
+	static
+	std::string
+	describe(
+		const endpoint & at
+	)
+	{
+		// abstract sockets start with a nul
+		auto path = at.path();
+		if ( ! path.empty() && '\0' == path.front() )
+		{
+			path.front() = '@';
+		}
+		return path;
+	}
+
+	static
+	endpoint
+	default_endpoint(
+	)
+	{
+		return protocol::local_endpoint();
+	}
+
+	static
+	endpoint
+	configured_endpoint(
+		const httpd_options & options
+	)
+	{
+		return options.local_endpoint();
+	}
+};
+
+template <>
+struct http_protocol_traits<asio::ip::tcp>
+{
+	using protocol = asio::ip::tcp;
+	using endpoint = protocol::endpoint;
+	using socket = protocol::socket;
+	using acceptor = protocol::acceptor;
+
+	using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+	using defer_accept = asio::detail::socket_option::integer<IPPROTO_TCP, TCP_DEFER_ACCEPT>;
+
+	static constexpr bool shardable = true;
+
+	static
+	protocol
+	protocol_of(
+		const endpoint & at
+	)
+	{
+		return at.protocol();
+	}
+
+	// of a socket made elsewhere
+	static
+	protocol
+	protocol_of_native(
+		int native
+	)
+	{
+		return AF_INET6 == http_socket_family(native) ? protocol::v6() : protocol::v4();
+	}
+
+	// between open() and bind()
+	static
+	void
+	prepare_acceptor(
+		acceptor & a,
+		const http_tcp_options & options
+	)
+	{
+		a.set_option(asio::socket_base::reuse_address(true));
+		if ( options.reuse_port )
+		{
+			a.set_option(reuse_port(true));
+		}
+		if ( 0 < options.defer_accept.count() )
+		{
+			a.set_option(defer_accept(static_cast<int>(options.defer_accept.count())));
+		}
+	}
+
+	static
+	void
+	prepare_socket(
+		socket & s,
+		const http_tcp_options & options
+	)
+	{
+		if ( options.no_delay )
+		{
+			// the peer may already be gone; its first read says so
+			boost::system::error_code ignored;
+			s.set_option(protocol::no_delay(true), ignored);
+		}
+	}
+
+	// on any one acceptor of the SO_REUSEPORT group, once all of them
+	// are bound: acceptor (cpu % acceptors) takes the connection
+	static
+	void
+	steer_by_cpu(
+		acceptor & a,
+		std::size_t acceptors,
+		boost::system::error_code & ec
+	)
+	{
+		::sock_filter code[] = {
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<std::uint32_t>(SKF_AD_OFF + SKF_AD_CPU)),
+			BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, static_cast<std::uint32_t>(acceptors)),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		};
+		::sock_fprog program{
+			static_cast<unsigned short>(std::size(code)),
+			code
+		};
+
+		ec.clear();
+		if ( ::setsockopt(a.native_handle(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) < 0 )
+		{
+			ec.assign(errno, boost::system::system_category());
+		}
+	}
+
+	static
+	std::string
+	describe(
+		const endpoint & at
+	)
+	{
+		if ( at.address().is_v6() )
+		{
+			return "[" + at.address().to_string() + "]:" + std::to_string(at.port());
+		}
+		return at.address().to_string() + ":" + std::to_string(at.port());
+	}
+
+	// any free port on the loopback
+	static
+	endpoint
+	default_endpoint(
+	)
+	{
+		return {asio::ip::address_v4::loopback(), 0};
+	}
+
+	static
+	endpoint
+	configured_endpoint(
+		const httpd_options & options
+	)
+	{
+		return options.tcp_endpoint_;
+	}
 };
 
-class httpd_options
-: public koti::options::configurator
-{
-public:
-	options::validate
-	add_options(
-		options & storage
-	) override
+// Accepts connections for Handler, which is derived from it (CRTP) and
+// provides on_new_connection(ec, socket &&). Protocol is koti::local_stream
+// or asio::ip::tcp; see http_protocol_traits.
+template <
+	class Handler,
+	class Protocol = koti::local_stream
+>
+class httpd
+: protected koti::basic_http_listener<Protocol>
+{
+public:
+	using this_type = httpd;
+	using listener = koti::basic_http_listener<Protocol>;
+	using traits = http_protocol_traits<Protocol>;
+
+	using protocol = Protocol;
+	using endpoint = typename protocol::endpoint;
+	using socket = typename protocol::socket;
+	using acceptor = typename protocol::acceptor;
+
+	using handler = Handler;
+
+	httpd(
+		asio::io_service & iox
+	)
+	: listener(iox)
+	{
+	}
+
+	void
+	listen(
+		const endpoint at = traits::default_endpoint(),
+		int backlog = acceptor::max_listen_connections
+	)
+	{
+		stop_listening();
+
+		if ( reuse_port_shards() )
+		{
+			listen_sharded(at, backlog);
+			return;
+		}
+
+		open_acceptor(*this, at, backlog, tcp_options_);
+		start_accepting();
+	}
+
+	void
+	listen(
+		const httpd_options &options
+	)
+	{
+		configure(options);
+		listen(traits::configured_endpoint(options), options.listen_backlog_);
+	}
+
+	// takes over listening sockets, already bound and listening, from
+	// another process (see http_handoff_tag). with an io_context_pool,
+	// several become one shard each; without one, only the first is kept
+	void
+	adopt(
+		const std::vector<int> & natives
+	)
+	{
+		if ( natives.empty() )
+		{
+			throw std::invalid_argument{"no listening sockets to adopt"};
+		}
+
+		stop_listening();
+
+		if ( 1u < natives.size() && io_pool_ )
+		{
+			io_backend_ = http_io_backend::epoll;
+			for ( std::size_t i = 0; i < natives.size(); ++i )
+			{
+				auto shard = std::make_unique<accept_shard>(io_pool_->at(i % io_pool_->size()));
+				shard->acceptor_.assign(traits::protocol_of_native(natives[i]), natives[i]);
+				shard->acceptor_.non_blocking(true);
+				shards_.push_back(std::move(shard));
+			}
+			bound_ = shards_.front()->acceptor_.local_endpoint();
+			start_shards();
+			return;
+		}
+
+		acceptor::assign(traits::protocol_of_native(natives.front()), natives.front());
+		acceptor::non_blocking(true);
+		for ( std::size_t i = 1; i < natives.size(); ++i )
+		{
+			::close(natives[i]);
+		}
+		start_accepting();
+	}
+
+	// serves a connection accepted by another process, as if it had just
+	// been accepted here
+	void
+	adopt_connection(
+		int native
+	)
+	{
+		socket adopted{
+			io_pool_
+			? asio::any_io_executor{io_pool_->next().get_executor()}
+			: acceptor::get_executor()
+		};
+
+		boost::system::error_code ec;
+		adopted.assign(traits::protocol_of_native(native), native, ec);
+		if ( ec )
+		{
+			::close(native);
+		}
+		else
+		{
+			traits::prepare_socket(adopted, tcp_options_);
+		}
+
+		static_cast<handler*>(this)->on_new_connection(ec, std::move(adopted));
+	}
+
+	// every listening socket, for handing to another process. they stay
+	// open here until close()
+	std::vector<int>
+	listening_handles(
+	)
+	{
+		std::vector<int> natives;
+		for ( auto & shard : shards_ )
+		{
+			natives.push_back(shard->acceptor_.native_handle());
+		}
+		if ( natives.empty() && acceptor::is_open() )
+		{
+			natives.push_back(acceptor::native_handle());
+		}
+		return natives;
+	}
+
+	// everything listen(options) applies short of listening
+	void
+	configure(
+		const httpd_options &options
+	)
+	{
+		set_accept_batch(options.accept_batch_);
+		set_pipeline_batch(options.pipeline_batch_);
+		set_read_buffer_limit(options.read_buffer_limit_);
+		set_timeouts(options.timeouts());
+		set_io_backend(options.io_backend());
+		set_tcp_options(options.tcp_options_);
+		set_shard_accept(options.shard_accept_);
+		set_handoff_capacity(options.accept_queue_);
+		buffer_pool_.set_retained_limit(options.buffer_pool_retain_);
+	}
+
+	void
+	close(
+	)
+	{
+		uring_.reset();
+		if ( backoff_.timer_ )
+		{
+			backoff_.timer_->cancel();
+		}
+		close_shards();
+		listener::close();
+	}
+
+	// stops accepting for good, and has every response of the
+	// connections handed draining_flag() close its connection
+	void
+	drain(
+	)
+	{
+		draining_.store(true, std::memory_order_relaxed);
+		close();
+
+		// what was accepted and is still queued to the pool is closed
+		// rather than served
+		for ( auto & shard : handoffs_ )
+		{
+			run_on_thread_of(shard->iox_, [this, s = shard.get()]()
+			{
+				drain_handoff(*s);
+			});
+		}
+	}
+
+	bool
+	draining() const
+	{
+		return draining_.load(std::memory_order_relaxed);
+	}
+
+	// for http_connection::set_draining()
+	const std::atomic<bool> &
+	draining_flag() const
+	{
+		return draining_;
+	}
+
+	// where listen() bound; with port 0, the port the kernel picked
+	const endpoint &
+	listening_endpoint() const
+	{
+		return bound_;
+	}
+
+	// number of acceptors listen() opened: one per io_context of the pool
+	// when sharded, otherwise one
+	std::size_t
+	acceptor_count() const
+	{
+		return shards_.empty() ? 1u : shards_.size();
+	}
+
+	// with an io_context_pool, accept on every io_context of it rather than
+	// through one acceptor that registers each connection with another
+	// thread's reactor. TCP gets one SO_REUSEPORT acceptor per io_context,
+	// as with http_tcp_options::reuse_port. a local socket has one acceptor
+	// only; what it accepts is queued, as a bare descriptor, to the
+	// io_context that serves it, which wraps and starts it on its own
+	// thread. takes effect at the next listen()
+	void
+	set_shard_accept(
+		bool shard
+	)
+	{
+		shard_accept_ = shard;
+	}
+
+	bool
+	shard_accept() const
+	{
+		return shard_accept_;
+	}
+
+	// how many accepted descriptors each io_context's queue holds. when
+	// every queue is full the connection is closed, and counted in
+	// handoff_dropped()
+	void
+	set_handoff_capacity(
+		std::size_t capacity
+	)
+	{
+		handoff_capacity_ = std::max<std::size_t>(1u, capacity);
+	}
+
+	std::size_t
+	handoff_capacity() const
+	{
+		return handoff_capacity_;
+	}
+
+	std::uint64_t
+	handoff_dropped() const
+	{
+		return handoff_dropped_.load(std::memory_order_relaxed);
+	}
+
+	// why http_tcp_options::steer_by_cpu could not be applied; the
+	// connections are then spread by the kernel's hash
+	const boost::system::error_code &
+	steering_error() const
+	{
+		return steering_error_;
+	}
+
+	// applied by TCP listeners to their acceptors and accepted sockets;
+	// local listeners ignore them. takes effect at the next listen()
+	void
+	set_tcp_options(
+		const http_tcp_options & options
+	)
+	{
+		tcp_options_ = options;
+	}
+
+	const http_tcp_options &
+	tcp_options() const
+	{
+		return tcp_options_;
+	}
+
+	// how listen() accepts connections. io_uring falls back to epoll when
+	// the ring cannot be set up; io_backend() then says epoll, and
+	// io_backend_error() why
+	void
+	set_io_backend(
+		http_io_backend backend
+	)
+	{
+		io_backend_ = backend;
+	}
+
+	http_io_backend
+	io_backend() const
+	{
+		return io_backend_;
+	}
+
+	const boost::system::error_code &
+	io_backend_error() const
+	{
+		return io_backend_error_;
+	}
+
+	// maximum number of connections accepted per wakeup of the acceptor;
+	// the first comes from the asynchronous accept, the remainder are
+	// drained with non-blocking accepts until the queue is empty
+	void
+	set_accept_batch(
+		std::size_t batch
+	)
+	{
+		accept_batch_ = std::max<std::size_t>(1u, batch);
+	}
+
+	std::size_t
+	accept_batch() const
+	{
+		return accept_batch_;
+	}
+
+	// handed to each new http_connection; see
+	// http_connection::set_pipeline_batch()
+	void
+	set_pipeline_batch(
+		std::size_t batch
+	)
+	{
+		pipeline_batch_ = std::max<std::size_t>(1u, batch);
+	}
+
+	std::size_t
+	pipeline_batch() const
+	{
+		return pipeline_batch_;
+	}
+
+	// read buffers of every connection are borrowed from here; see
+	// http_connection::set_read_buffer(). connections must not outlive
+	// the listener
+	http_buffer_pool &
+	buffer_pool()
+	{
+		return buffer_pool_;
+	}
+
+	const http_buffer_pool &
+	buffer_pool() const
+	{
+		return buffer_pool_;
+	}
+
+	void
+	set_read_buffer_limit(
+		std::size_t limit
+	)
+	{
+		read_buffer_limit_ = limit;
+	}
+
+	std::size_t
+	read_buffer_limit() const
+	{
+		return read_buffer_limit_;
+	}
+
+	// handed to each new http_connection; see
+	// http_connection::set_access_log(). must outlive the connections
+	void
+	set_access_log(
+		http_access_log * log
+	)
+	{
+		access_log_ = log;
+	}
+
+	http_access_log *
+	access_log() const
+	{
+		return access_log_;
+	}
+
+	// handed to each new http_connection; see
+	// http_connection::set_worker_pool()
+	void
+	set_worker_pool(
+		worker_pool * pool
+	)
+	{
+		worker_pool_ = pool;
+	}
+
+	worker_pool *
+	get_worker_pool() const
+	{
+		return worker_pool_;
+	}
+
+	// handed to each new http_connection; see
+	// http_connection::set_metrics(). must outlive the connections
+	void
+	set_metrics(
+		http_metrics * metrics
+	)
+	{
+		metrics_ = metrics;
+	}
+
+	http_metrics *
+	metrics() const
+	{
+		return metrics_;
+	}
+
+	// handed to each new http_connection; see
+	// http_connection::set_compression(). must outlive the connections
+	void
+	set_compression(
+		http_compression * compression
+	)
+	{
+		compression_ = compression;
+	}
+
+	http_compression *
+	compression() const
+	{
+		return compression_;
+	}
+
+	// handed to each new http_connection; see
+	// http_connection::set_timeouts()
+	void
+	set_timeouts(
+		const http_timeouts & timeouts
+	)
+	{
+		timeouts_ = timeouts;
+	}
+
+	const http_timeouts &
+	timeouts() const
+	{
+		return timeouts_;
+	}
+
+	// new connections are admitted through it; see
+	// http_connection::admit_peer(). must outlive the connections
+	void
+	set_peer_limiter(
+		http_peer_limiter * limiter
+	)
+	{
+		peer_limiter_ = limiter;
+	}
+
+	http_peer_limiter *
+	peer_limiter() const
+	{
+		return peer_limiter_;
+	}
+
+	// when set, accepted sockets are handed out round-robin to the io_contexts
+	// of the pool instead of living on the listener's own io_context. the
+	// pool must outlive the listener
+	void
+	set_io_context_pool(
+		io_context_pool * pool
+	)
+	{
+		io_pool_ = pool;
+	}
+
+	io_context_pool *
+	get_io_context_pool() const
+	{
+		return io_pool_;
+	}
+
+protected:
+	// after an accept fails for want of a resource (EMFILE, ENFILE,
+	// ENOBUFS, ...), the acceptor is still readable and accepting again at
+	// once only fails again. accepting resumes after delay_ instead, which
+	// doubles with every failure in a row
+	struct accept_backoff
+	{
+		std::optional<asio::steady_timer> timer_;
+		std::chrono::milliseconds delay_{0};
+	};
+
+	static constexpr std::chrono::milliseconds accept_backoff_initial{10};
+	static constexpr std::chrono::milliseconds accept_backoff_maximum{100};
+
+	// an SO_REUSEPORT acceptor on one io_context of the pool. connections
+	// it accepts stay on that io_context
+	struct accept_shard
+	{
+		explicit
+		accept_shard(
+			asio::io_context & iox
+		)
+		: iox_(iox)
+		, acceptor_(iox)
+		{
+		}
+
+		asio::io_context & iox_;
+		acceptor acceptor_;
+		endpoint remote_;
+		accept_backoff backoff_;
+	};
+
+	// the queue from the accepting thread to one io_context of the pool
+	struct handoff_shard
+	{
+		handoff_shard(
+			asio::io_context & iox,
+			std::size_t capacity
+		)
+		: iox_(iox)
+		, queue_(capacity)
+		{
+		}
+
+		// descriptors nobody got round to
+		~handoff_shard()
+		{
+			int native;
+			while ( queue_.try_pop(native) )
+			{
+				::close(native);
+			}
+		}
+
+		asio::io_context & iox_;
+		http_spsc_queue<int> queue_;
+
+		// set by the accepting thread when it posts a drain; cleared by the
+		// drain before it pops, so a push after the last pop posts another
+		std::atomic<bool> drain_posted_{false};
+
+		// pushed to since the accepting thread last posted a drain
+		bool pushed_ = false;
+	};
+
+	endpoint internal_remote_endpoint_;
+	accept_backoff backoff_;
+	endpoint bound_;
+	std::vector<std::unique_ptr<accept_shard>> shards_;
+	std::vector<std::unique_ptr<handoff_shard>> handoffs_;
+
+	// shards of an earlier listen(). handlers of theirs may still be queued
+	// on the pool, so they live as long as the listener does
+	std::vector<std::unique_ptr<accept_shard>> retired_shards_;
+	std::vector<std::unique_ptr<handoff_shard>> retired_handoffs_;
+	std::size_t handoff_next_ = 0;
+	std::size_t handoff_capacity_ = 1024;
+	std::atomic<std::uint64_t> handoff_dropped_{0};
+	bool shard_accept_ = false;
+	std::atomic<bool> draining_{false};
+	boost::system::error_code steering_error_;
+	http_tcp_options tcp_options_;
+	io_context_pool * io_pool_ = nullptr;
+	std::size_t accept_batch_ = 16;
+	std::size_t pipeline_batch_ = 1;
+	std::size_t read_buffer_limit_ = 0;
+	http_buffer_pool buffer_pool_;
+	http_access_log * access_log_ = nullptr;
+	worker_pool * worker_pool_ = nullptr;
+	http_peer_limiter * peer_limiter_ = nullptr;
+	http_metrics * metrics_ = nullptr;
+	http_compression * compression_ = nullptr;
+	http_timeouts timeouts_;
+	http_io_backend io_backend_ = http_io_backend::epoll;
+	boost::system::error_code io_backend_error_;
+	std::unique_ptr<http_uring_acceptor> uring_;
+
+	void
+	stop_listening(
+	)
 	{
-		storage.descriptions().add_options()
-		("local-path,l", po::value<std::string>(&socket_path_)->required(), "local unix socket path")
-		("abstract", po::bool_switch(&is_abstract_), "when selected, use an abstract socket")
-		;
-		return options::validate::ok;
+		uring_.reset();
+		acceptor::close();
+		close_shards();
+		std::move(shards_.begin(), shards_.end(), std::back_inserter(retired_shards_));
+		std::move(handoffs_.begin(), handoffs_.end(), std::back_inserter(retired_handoffs_));
+		shards_.clear();
+		handoffs_.clear();
+		handoff_next_ = 0;
 	}
 
-	options::validate
-	validate_configuration(
-		options &
-	) override
+	// runs f on the thread of iox, and waits for it to have. at once when
+	// that is this thread, or when no thread runs iox
+	template <
+		class F
+	>
+	void
+	run_on_thread_of(
+		asio::io_context & iox,
+		F f
+	)
 	{
-		return options::validate::ok;
+		if (
+			nullptr == io_pool_
+			|| false == io_pool_->running()
+			|| iox.get_executor().running_in_this_thread()
+		)
+		{
+			f();
+			return;
+		}
+
+		std::promise<void> done;
+		auto finished = done.get_future();
+		asio::post(iox, [&f, &done]()
+		{
+			f();
+			done.set_value();
+		});
+		finished.wait();
 	}
 
-	fs::path
-	path()
-	const
+	// an acceptor belongs to the thread it accepts on; each shard's is
+	// closed there, after whatever was posted to it before
+	void
+	close_shards(
+	)
 	{
-		if ( is_abstract_ )
+		for ( auto & shard : shards_ )
 		{
-			if ( socket_path_.empty() || socket_path_.front() != '\0' )
+			run_on_thread_of(shard->iox_, [s = shard.get()]()
+			{
+				if ( s->backoff_.timer_ )
+				{
+					s->backoff_.timer_->cancel();
+				}
+				boost::system::error_code ignored;
+				s->acceptor_.close(ignored);
+			});
+		}
+	}
+
+	// the listener's own acceptor is open and listening
+	void
+	start_accepting(
+	)
+	{
+		bound_ = acceptor::local_endpoint();
+
+		if ( hands_off() )
+		{
+			listen_handoff();
+			return;
+		}
+
+		if ( http_io_backend::io_uring == io_backend_ && start_uring_accept() )
+		{
+			return;
+		}
+		io_backend_ = http_io_backend::epoll;
+		async_accept_next(*this, internal_remote_endpoint_);
+	}
+
+	bool
+	reuse_port_shards() const
+	{
+		return traits::shardable
+			&& nullptr != io_pool_
+			&& ( tcp_options_.reuse_port || shard_accept_ );
+	}
+
+	bool
+	hands_off() const
+	{
+		return false == traits::shardable
+			&& nullptr != io_pool_
+			&& shard_accept_;
+	}
+
+	void
+	open_acceptor(
+		acceptor & a,
+		const endpoint & at,
+		int backlog,
+		const http_tcp_options & options
+	)
+	{
+		a.open(traits::protocol_of(at));
+		traits::prepare_acceptor(a, options);
+		a.bind(at);
+		a.listen(backlog);
+
+		// the acceptor is drained with synchronous accepts after each
+		// wakeup; those must report would_block instead of sleeping
+		a.non_blocking(true);
+	}
+
+	// one acceptor per io_context, all bound to the same address; the
+	// kernel spreads new connections over them. io_uring is not used
+	void
+	listen_sharded(
+		const endpoint & at,
+		int backlog
+	)
+	{
+		io_backend_ = http_io_backend::epoll;
+		auto options = tcp_options_;
+		options.reuse_port = true;
+		for ( std::size_t i = 0; i < io_pool_->size(); ++i )
+		{
+			auto shard = std::make_unique<accept_shard>(io_pool_->at(i));
+
+			// the later ones join the first, whatever port it was given
+			open_acceptor(shard->acceptor_, shards_.empty() ? at : bound_, backlog, options);
+			if ( shards_.empty() )
 			{
-				return fs::path{std::string{1u, '\0'} + socket_path_};
+				bound_ = shard->acceptor_.local_endpoint();
 			}
+			shards_.push_back(std::move(shard));
+		}
+
+		steering_error_.clear();
+		if ( options.steer_by_cpu )
+		{
+			// acceptors are numbered in the order they joined: the same as
+			// the pool's io_contexts, whose threads pin to cpus in order
+			traits::steer_by_cpu(shards_.front()->acceptor_, shards_.size(), steering_error_);
 		}
 
-		return socket_path_;
+		start_shards();
 	}
 
-	std::string socket_path_;
-	bool is_abstract_ = true;
-};
+	void
+	start_shards(
+	)
+	{
+		for ( auto & shard : shards_ )
+		{
+			asio::post(
+				shard->acceptor_.get_executor(),
+				[this, s = shard.get()]()
+			{
+				async_accept_next(s->acceptor_, s->remote_);
+			});
+		}
+	}
 
-template <
-	class Handler
->
-class httpd
-: protected koti::http_listener
-{
-public:
-	using this_type = httpd;
+	// the listener's own thread accepts, with plain accept4() calls once
+	// the acceptor is readable; each io_context of the pool is handed its
+	// descriptors through its own queue. io_uring is not used
+	void
+	listen_handoff(
+	)
+	{
+		io_backend_ = http_io_backend::epoll;
+		for ( std::size_t i = 0; i < io_pool_->size(); ++i )
+		{
+			handoffs_.push_back(std::make_unique<handoff_shard>(io_pool_->at(i), handoff_capacity_));
+		}
+		async_wait_handoff();
+	}
 
-	using protocol = koti::local_stream;
-	using endpoint = typename protocol::endpoint;
-	using socket = typename protocol::socket;
-	using acceptor = typename protocol::acceptor;
+	void
+	async_wait_handoff(
+	)
+	{
+		acceptor::async_wait(
+			acceptor::wait_read,
+			[this](const boost::system::error_code & ec)
+		{
+			on_handoff_ready(ec);
+		});
+	}
 
-	using handler = Handler;
+	void
+	on_handoff_ready(
+		boost::system::error_code ec
+	)
+	{
+		if ( asio::error::operation_aborted == ec || ! acceptor::is_open() )
+		{
+			// listener was closed; do not re-arm
+			return;
+		}
 
-	httpd(
-		asio::io_service & iox
+		for ( std::size_t count = 0; ! ec && count < accept_batch_; ++count )
+		{
+			int native = ::accept4(acceptor::native_handle(), nullptr, nullptr, SOCK_CLOEXEC);
+			if ( native < 0 )
+			{
+				if ( EAGAIN == errno || EWOULDBLOCK == errno )
+				{
+					break;
+				}
+				if ( EINTR == errno || ECONNABORTED == errno )
+				{
+					continue;
+				}
+				ec.assign(errno, boost::system::system_category());
+				break;
+			}
+			hand_off(native);
+		}
+
+		// one wakeup per io_context per batch, and none while a drain is
+		// still on its way
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		for ( auto & shard : handoffs_ )
+		{
+			if ( std::exchange(shard->pushed_, false) && false == shard->drain_posted_.exchange(true) )
+			{
+				asio::post(shard->iox_, [this, s = shard.get()]()
+				{
+					drain_handoff(*s);
+				});
+			}
+		}
+
+		if ( ec )
+		{
+			static_cast<handler*>(this)->on_new_connection(ec, socket{acceptor::get_executor()});
+		}
+
+		if ( acceptor::is_open() )
+		{
+			resume_accepting(backoff_, acceptor::get_executor(), accept_failed(ec), [this]()
+			{
+				if ( acceptor::is_open() )
+				{
+					async_wait_handoff();
+				}
+			});
+		}
+	}
+
+	// round-robin, passing over full queues
+	void
+	hand_off(
+		int native
 	)
-	: http_listener(iox)
 	{
+		for ( std::size_t tried = 0; tried < handoffs_.size(); ++tried )
+		{
+			auto & shard = *handoffs_[handoff_next_];
+			handoff_next_ = (handoff_next_ + 1) % handoffs_.size();
+			if ( shard.queue_.try_push(native) )
+			{
+				shard.pushed_ = true;
+				return;
+			}
+		}
+
+		::close(native);
+		handoff_dropped_.fetch_add(1, std::memory_order_relaxed);
+		if ( metrics_ )
+		{
+			metrics_->local().add(http_metrics::counter::rejected_full);
+		}
 	}
 
+	// on the io_context the descriptors were queued to
 	void
-	listen(
-		const local_stream::endpoint at = local_stream::local_endpoint()
+	drain_handoff(
+		handoff_shard & shard
 	)
 	{
-		acceptor::close();
-		acceptor::open(local_stream{});
-		acceptor::bind(at);
-		acceptor::listen();
+		shard.drain_posted_.store(false);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		int native;
+		while ( shard.queue_.try_pop(native) )
+		{
+			// accepted before drain(), but not to be served after it
+			if ( draining() )
+			{
+				::close(native);
+				continue;
+			}
+
+			socket accepted{shard.iox_};
+			boost::system::error_code ec;
+			accepted.assign(traits::protocol_of(bound_), native, ec);
+			if ( ec )
+			{
+				::close(native);
+			}
+			else
+			{
+				traits::prepare_socket(accepted, tcp_options_);
+			}
+
+			static_cast<handler*>(this)->on_new_connection(ec, std::move(accepted));
+		}
+	}
+
+	// false when there is no io_uring to accept with
+	bool
+	start_uring_accept(
+	)
+	{
+		uring_ = http_uring_acceptor::create(
+			acceptor::get_executor(),
+			acceptor::native_handle(),
+			io_backend_error_
+		);
+		if ( ! uring_ )
+		{
+			return false;
+		}
 
-		acceptor::async_accept(
-			internal_remote_endpoint_,
-			std::bind(
-				&httpd<handler>::internal_on_new_connection,
-				this,
-				std::placeholders::_1,
-				std::placeholders::_2
-		));
+		uring_->start([this](const boost::system::error_code & ec, int native)
+		{
+			on_uring_accepted(ec, native);
+		});
+		return true;
 	}
 
+	// connections come out of the ring as bare descriptors; from here on
+	// they are served like any other
 	void
-	listen(
-		const httpd_options &options
+	on_uring_accepted(
+		boost::system::error_code ec,
+		int native
 	)
 	{
-		listen({options.path().string()});
+		socket accepted{
+			io_pool_
+			? asio::any_io_executor{io_pool_->next().get_executor()}
+			: acceptor::get_executor()
+		};
+		if ( ! ec )
+		{
+			accepted.assign(traits::protocol_of(bound_), native, ec);
+			if ( ec )
+			{
+				::close(native);
+			}
+			else
+			{
+				traits::prepare_socket(accepted, tcp_options_);
+			}
+		}
+
+		static_cast<handler*>(this)->on_new_connection(ec, std::move(accepted));
 	}
 
-	using http_listener::close;
+	// false for what only means there is nothing to accept right now, or
+	// that a client gave up before it was accepted
+	static
+	bool
+	accept_failed(
+		const boost::system::error_code & ec
+	)
+	{
+		return ec
+			&& asio::error::would_block != ec
+			&& asio::error::try_again != ec
+			&& asio::error::connection_aborted != ec
+			&& asio::error::interrupted != ec;
+	}
+
+	accept_backoff &
+	backoff_of(
+		const acceptor & a
+	)
+	{
+		for ( auto & shard : shards_ )
+		{
+			if ( &shard->acceptor_ == &a )
+			{
+				return shard->backoff_;
+			}
+		}
+		return backoff_;
+	}
+
+	// calls resume at once, or after a failure, once backoff's delay is up
+	template <
+		class Resume
+	>
+	void
+	resume_accepting(
+		accept_backoff & backoff,
+		const asio::any_io_executor & executor,
+		bool failed,
+		Resume resume
+	)
+	{
+		if ( false == failed )
+		{
+			backoff.delay_ = std::chrono::milliseconds{0};
+			resume();
+			return;
+		}
+
+		backoff.delay_ = 0 == backoff.delay_.count()
+			? accept_backoff_initial
+			: std::min(backoff.delay_ * 2, accept_backoff_maximum);
+		if ( ! backoff.timer_ )
+		{
+			backoff.timer_.emplace(executor);
+		}
+		backoff.timer_->expires_after(backoff.delay_);
+		backoff.timer_->async_wait([resume = std::move(resume)](const boost::system::error_code & ec)
+		{
+			if ( ! ec )
+			{
+				resume();
+			}
+		});
+	}
+
+	// a shard keeps what it accepts on its own io_context; the listener's
+	// own acceptor hands connections out round-robin over the pool
+	bool
+	distributes(
+		const acceptor & a
+	) const
+	{
+		return io_pool_ && shards_.empty() && &a == static_cast<const acceptor *>(this);
+	}
+
+	void
+	async_accept_next(
+		acceptor & a,
+		endpoint & remote
+	)
+	{
+		auto on_accepted = [this, &a, &remote](
+			const boost::system::error_code & ec,
+			socket && accepted
+		)
+		{
+			internal_on_new_connection(a, remote, ec, std::move(accepted));
+		};
+
+		if ( distributes(a) )
+		{
+			a.async_accept(
+				io_pool_->next(),
+				remote,
+				std::move(on_accepted)
+			);
+		}
+		else
+		{
+			a.async_accept(
+				remote,
+				std::move(on_accepted)
+			);
+		}
+	}
+
+	socket
+	accept_next(
+		acceptor & a,
+		endpoint & remote,
+		boost::system::error_code & ec
+	)
+	{
+		if ( distributes(a) )
+		{
+			return a.accept(io_pool_->next(), remote, ec);
+		}
+		return a.accept(remote, ec);
+	}
 
-protected:
-	koti::local_stream::endpoint internal_remote_endpoint_;
 	void
 	internal_on_new_connection(
+		acceptor & a,
+		endpoint & remote,
 		const boost::system::error_code& ec,
-		koti::local_stream::socket && socket
+		socket && accepted
 	)
 	{
-		static_cast<handler*>(this)->on_new_connection(ec, std::move(socket));
+		if ( ! ec )
+		{
+			traits::prepare_socket(accepted, tcp_options_);
+		}
+		static_cast<handler*>(this)->on_new_connection(ec, std::move(accepted));
+
+		if ( asio::error::operation_aborted == ec || ! a.is_open() )
+		{
+			// listener was closed; do not re-arm
+			return;
+		}
+
+		bool failed = accept_failed(ec);
+		for ( std::size_t count = 1; false == failed && count < accept_batch_; ++count )
+		{
+			boost::system::error_code accept_ec;
+			auto next = accept_next(a, remote, accept_ec);
+			if (
+				asio::error::would_block == accept_ec
+				|| asio::error::try_again == accept_ec
+			)
+			{
+				break;
+			}
+
+			if ( ! accept_ec )
+			{
+				traits::prepare_socket(next, tcp_options_);
+			}
+			static_cast<handler*>(this)->on_new_connection(accept_ec, std::move(next));
+
+			if ( accept_ec || ! a.is_open() )
+			{
+				failed = accept_failed(accept_ec);
+				break;
+			}
+		}
+
+		if ( a.is_open() )
+		{
+			resume_accepting(backoff_of(a), a.get_executor(), failed, [this, &a, &remote]()
+			{
+				if ( a.is_open() )
+				{
+					async_accept_next(a, remote);
+				}
+			});
+		}
 	}
 
 	static const std::string_view httpd_logger_name_;
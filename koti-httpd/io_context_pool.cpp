@@ -0,0 +1,135 @@
+#include "io_context_pool.hpp"
+
+extern "C" {
+#include <pthread.h>
+#include <sched.h>
+} // extern "C"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace koti {
+
+io_context_pool::io_context_pool(
+	std::size_t count
+)
+{
+	if ( 0 == count )
+	{
+		throw std::invalid_argument{"io_context_pool requires at least one io_context"};
+	}
+
+	contexts_.reserve(count);
+	work_.reserve(count);
+	for ( std::size_t i = 0; i < count; ++i )
+	{
+		// concurrency hint of 1: each context is only ever run by one thread
+		contexts_.push_back(std::make_unique<asio::io_context>(1));
+		work_.push_back(asio::make_work_guard(*contexts_.back()));
+	}
+}
+
+io_context_pool::~io_context_pool()
+{
+	stop();
+	join();
+}
+
+std::size_t
+io_context_pool::size() const
+{
+	return contexts_.size();
+}
+
+asio::io_context &
+io_context_pool::at(
+	std::size_t index
+)
+{
+	return *contexts_.at(index);
+}
+
+asio::io_context &
+io_context_pool::next()
+{
+	auto index = next_.fetch_add(1, std::memory_order_relaxed);
+	return *contexts_[index % contexts_.size()];
+}
+
+void
+io_context_pool::run(
+	bool pin_to_cores
+)
+{
+	if ( ! threads_.empty() )
+	{
+		throw std::logic_error{"io_context_pool is already running"};
+	}
+
+	auto cores = std::max(1u, std::thread::hardware_concurrency());
+
+	threads_.reserve(contexts_.size());
+	for ( std::size_t i = 0; i < contexts_.size(); ++i )
+	{
+		threads_.emplace_back([context = contexts_[i].get()]()
+		{
+			context->run();
+		});
+
+		if ( pin_to_cores )
+		{
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(i % cores, &cpus);
+			// best effort; an unpinned thread still works
+			::pthread_setaffinity_np(
+				threads_.back().native_handle(),
+				sizeof(cpus),
+				&cpus
+			);
+		}
+	}
+}
+
+void
+io_context_pool::stop()
+{
+	work_.clear();
+	for ( auto & context : contexts_ )
+	{
+		context->stop();
+	}
+}
+
+void
+io_context_pool::join()
+{
+	for ( auto & thread : threads_ )
+	{
+		if ( thread.joinable() )
+		{
+			thread.join();
+		}
+	}
+	threads_.clear();
+}
+
+std::size_t
+io_context_pool::poll()
+{
+	std::size_t ran = 0;
+	for ( auto & context : contexts_ )
+	{
+		context->restart();
+		ran += context->poll();
+	}
+	return ran;
+}
+
+bool
+io_context_pool::running() const
+{
+	return false == threads_.empty() && false == work_.empty();
+}
+
+} // namespace koti
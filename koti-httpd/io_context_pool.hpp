@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+namespace asio = boost::asio;
+
+namespace koti {
+
+// A set of io_contexts, each run by exactly one thread. Work placed on a
+// context (eg. an accepted connection) stays on that context's thread for
+// its whole life, so handlers of one connection never run concurrently
+// and need no strand.
+class io_context_pool
+{
+public:
+	explicit
+	io_context_pool(
+		std::size_t count
+	);
+
+	io_context_pool(const io_context_pool & copy_ctor) = delete;
+	io_context_pool & operator=(const io_context_pool & copy_assign) = delete;
+
+	~io_context_pool();
+
+	std::size_t
+	size() const;
+
+	asio::io_context &
+	at(
+		std::size_t index
+	);
+
+	// round-robin over every context in the pool
+	asio::io_context &
+	next();
+
+	// start one thread per context. when pin_to_cores is set, thread i is
+	// bound to cpu (i % hardware_concurrency)
+	void
+	run(
+		bool pin_to_cores = false
+	);
+
+	// ask every context to stop; returns without waiting
+	void
+	stop();
+
+	// wait for every thread started by run() to exit
+	void
+	join();
+
+	// once join() has returned, runs what is still queued on every context
+	// (eg. the handlers of operations aborted by closing their sockets)
+	// from the calling thread. the number of handlers run
+	std::size_t
+	poll();
+
+	// threads were started by run(), and not asked to stop since
+	bool
+	running() const;
+
+protected:
+	using work_guard = asio::executor_work_guard<asio::io_context::executor_type>;
+
+	std::vector<std::unique_ptr<asio::io_context>> contexts_;
+	std::vector<work_guard> work_;
+	std::vector<std::thread> threads_;
+	std::atomic<std::size_t> next_{0};
+};
+
+} // namespace koti
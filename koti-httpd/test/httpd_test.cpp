@@ -4,17 +4,54 @@
 extern "C"
 {
 #include <sys/types.h>
+#include <sys/poll.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <fcntl.h>
 #include <unistd.h>
 } // extern "C"
 
 #include "httpd.hpp"
+#include "http_access_log.hpp"
+#include "http_body_sink.hpp"
+#include "http_compression.hpp"
+#include "http_coroutine_endpoint.hpp"
+#include "http_file_endpoint.hpp"
+#include "http_handoff.hpp"
+#include "http_metrics.hpp"
+#include "http_metrics_endpoint.hpp"
+#include "http_peer_limiter.hpp"
+#include "http_response_cache.hpp"
+#include "http_response_writer.hpp"
+#include "http_router.hpp"
+#include "http_session.hpp"
+#include "http_spsc_queue.hpp"
+#include "http_static_routes.hpp"
+#include "http_timer_wheel.hpp"
+#include "http_uring_acceptor.hpp"
+#include "io_context_pool.hpp"
 #include "cppgetenv.hpp"
 #include "test_support.hpp"
+#include "worker_pool.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <set>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
 #include <boost/filesystem.hpp>
+#include "spdlog/sinks/base_sink.h"
+
+#include <bzlib.h>
+#include <zlib.h>
 namespace asio = boost::asio;
 
 class httpd_test_handler
@@ -39,6 +76,15 @@ public:
 	on_new_http_connection(
 		koti::http_connection::ptr & connection
 	);
+
+	std::size_t
+	accepted() const
+	{
+		return accepted_;
+	}
+
+protected:
+	std::size_t accepted_ = 0;
 };
 
 void
@@ -46,7 +92,7 @@ httpd_test_handler::on_connection_closed(
 	koti::http_connection::ptr & connection
 )
 {
-	logger()->info("{} disconnected", connection->remote_endpoint().path());
+	logger()->info("PID:{} disconnected", connection->cached_remote_identity().pid);
 }
 
 void
@@ -64,14 +110,16 @@ httpd_test_handler::on_new_connection(
 		return;
 	}
 
+	++accepted_;
+
 	koti::http_connection::ptr
 	connection = std::make_unique<koti::http_connection>(
 		std::move(socket)
 	);
 
 	logger()->info(
-		"{} connected",
-		connection->remote_endpoint().path()
+		"PID:{} connected",
+		connection->cached_remote_identity().pid
 	);
 
 	on_new_http_connection(connection);
@@ -95,6 +143,7 @@ public:
     boost::asio::io_context iox_;
 
     using connection = koti::http_connection;
+    using handler = httpd_test_handler;
     void reset()
     {
         ptr_ = std::make_unique<httpd>(iox_);
@@ -141,3 +190,3753 @@ TEST_F(httpd_tests, dont_delete_me_prove_a_point_to_myself_because_i_can)
 
     
 }
+
+namespace {
+
+int
+connect_local(
+    const koti::local_stream::endpoint & at
+)
+{
+    int native = ::socket(AF_LOCAL, SOCK_STREAM, 0);
+    if ( native < 0 )
+    {
+        return native;
+    }
+    if ( ::connect(native, at.data(), at.size()) < 0 )
+    {
+        ::close(native);
+        return -1;
+    }
+    return native;
+}
+
+void
+run_until_accepted(
+    boost::asio::io_context & iox,
+    const httpd_test_handler & server,
+    std::size_t expected
+)
+{
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while ( server.accepted() < expected && std::chrono::steady_clock::now() < until )
+    {
+        iox.run_one_for(std::chrono::milliseconds(100));
+    }
+}
+
+} // namespace
+
+TEST_F(httpd_tests, accepts_thousands_of_sequential_connections)
+{
+    constexpr std::size_t connection_count = 4096;
+
+    auto local = koti::local_stream::endpoint{test_socket_path().string()};
+    fs::remove(test_socket_path());
+
+    handler server{iox_};
+    server.set_accept_batch(32);
+    ASSERT_NO_THROW(server.listen(local, 128));
+
+    std::atomic<std::size_t> connect_failures{0};
+    std::thread client([&]()
+    {
+        for ( std::size_t i = 0; i < connection_count; ++i )
+        {
+            int native = connect_local(local);
+            if ( native < 0 )
+            {
+                ++connect_failures;
+                continue;
+            }
+            ::close(native);
+        }
+    });
+
+    run_until_accepted(iox_, server, connection_count);
+    client.join();
+    server.close();
+    fs::remove(test_socket_path());
+
+    EXPECT_EQ(0u, connect_failures.load());
+    EXPECT_EQ(connection_count, server.accepted());
+}
+
+TEST_F(httpd_tests, accepts_thousands_of_concurrent_connections)
+{
+    constexpr std::size_t client_count = 16;
+    constexpr std::size_t connections_per_client = 256;
+    constexpr std::size_t connection_count = client_count * connections_per_client;
+
+    auto local = koti::local_stream::endpoint{test_socket_path().string()};
+    fs::remove(test_socket_path());
+
+    handler server{iox_};
+    server.set_accept_batch(64);
+    ASSERT_NO_THROW(server.listen(local, 512));
+
+    std::atomic<std::size_t> connect_failures{0};
+    std::vector<std::thread> clients;
+    for ( std::size_t c = 0; c < client_count; ++c )
+    {
+        clients.emplace_back([&]()
+        {
+            for ( std::size_t i = 0; i < connections_per_client; ++i )
+            {
+                int native = connect_local(local);
+                if ( native < 0 )
+                {
+                    ++connect_failures;
+                    continue;
+                }
+                ::close(native);
+            }
+        });
+    }
+
+    run_until_accepted(iox_, server, connection_count);
+    for ( auto & client : clients )
+    {
+        client.join();
+    }
+    server.close();
+    fs::remove(test_socket_path());
+
+    EXPECT_EQ(0u, connect_failures.load());
+    EXPECT_EQ(connection_count, server.accepted());
+}
+
+class httpd_echo_target_endpoint
+: public koti::http_endpoint
+{
+public:
+	koti::http_response
+	handle(
+		koti::http_connection &,
+		koti::http_request & request
+	) override
+	{
+		auto response = koti::http_make_response(request.get_allocator());
+		response.version(11);
+		response.result(koti::http::status::ok);
+		response.body().assign(request.target().data(), request.target().size());
+		response.prepare_payload();
+		return response;
+	}
+};
+
+namespace {
+
+void
+exercise_pipelined_keep_alive(
+	std::size_t pipeline_batch
+)
+{
+	namespace http = koti::http;
+	constexpr std::size_t request_count = 64;
+
+	boost::asio::io_context iox;
+	koti::local_stream::socket server_side{iox};
+	koti::local_stream::socket client_side{iox};
+	boost::asio::local::connect_pair(server_side, client_side);
+
+	httpd_echo_target_endpoint root;
+	koti::http_connection connection{std::move(server_side)};
+	connection.set_root_endpoint(&root);
+	connection.set_pipeline_batch(pipeline_batch);
+	connection.async_read();
+
+	std::vector<std::string> targets;
+	std::thread client([&]()
+	{
+		// every request goes out in one write so the server sees them
+		// pipelined in its read buffer
+		std::string requests;
+		for ( std::size_t i = 0; i < request_count; ++i )
+		{
+			requests += "GET /" + std::to_string(i) + " HTTP/1.1\r\nHost: test\r\n\r\n";
+		}
+		boost::asio::write(client_side, boost::asio::buffer(requests));
+
+		boost::beast::flat_buffer buffer;
+		for ( std::size_t i = 0; i < request_count; ++i )
+		{
+			http::response<http::string_body> response;
+			http::read(client_side, buffer, response);
+			targets.push_back(response.body());
+		}
+		client_side.shutdown(koti::local_stream::socket::shutdown_both);
+	});
+
+	auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (
+		koti::http_connection::state::closed != connection.current_state()
+		&& std::chrono::steady_clock::now() < until
+	)
+	{
+		iox.run_one_for(std::chrono::milliseconds(100));
+	}
+	client.join();
+
+	ASSERT_EQ(request_count, targets.size());
+	for ( std::size_t i = 0; i < request_count; ++i )
+	{
+		EXPECT_EQ("/" + std::to_string(i), targets[i]);
+	}
+	EXPECT_EQ(koti::http_connection::state::closed, connection.current_state());
+}
+
+} // namespace
+
+TEST_F(httpd_tests, keep_alive_serves_pipelined_requests)
+{
+	exercise_pipelined_keep_alive(1);
+}
+
+TEST_F(httpd_tests, keep_alive_batches_pipelined_responses)
+{
+	exercise_pipelined_keep_alive(8);
+}
+
+TEST_F(httpd_tests, pooled_read_buffer_is_returned_while_idle)
+{
+	namespace http = koti::http;
+	constexpr std::size_t request_count = 8;
+
+	boost::asio::io_context iox;
+	koti::local_stream::socket server_side{iox};
+	koti::local_stream::socket client_side{iox};
+	boost::asio::local::connect_pair(server_side, client_side);
+
+	koti::http_buffer_pool pool;
+	httpd_echo_target_endpoint root;
+	koti::http_connection connection{std::move(server_side)};
+	connection.set_root_endpoint(&root);
+	connection.set_read_buffer(&pool, 4096);
+	connection.async_read();
+
+	auto idle = [&]()
+	{
+		return koti::http_connection::state::reading == connection.current_state()
+			&& 0u == connection.read_buffer_capacity();
+	};
+
+	for ( std::size_t i = 0; i < request_count; ++i )
+	{
+		auto request = "GET /" + std::to_string(i) + " HTTP/1.1\r\nHost: test\r\n\r\n";
+		boost::asio::write(client_side, boost::asio::buffer(request));
+
+		// answered, and back to waiting without holding a buffer
+		auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while (
+			! (0u < client_side.available() && idle())
+			&& std::chrono::steady_clock::now() < until
+		)
+		{
+			iox.run_one_for(std::chrono::milliseconds(10));
+		}
+		ASSERT_TRUE(idle());
+
+		boost::beast::flat_buffer buffer;
+		http::response<http::string_body> response;
+		http::read(client_side, buffer, response);
+		EXPECT_EQ("/" + std::to_string(i), response.body());
+
+		auto stats = pool.stats();
+		EXPECT_EQ(0u, stats.buffers_in_use);
+		EXPECT_EQ(1u, stats.buffers_cached);
+	}
+
+	// the first read borrowed from the heap; every later one reused it
+	auto stats = pool.stats();
+	EXPECT_EQ(request_count, stats.allocations);
+	EXPECT_EQ(request_count - 1, stats.reused);
+	EXPECT_EQ(0u, stats.oversize);
+}
+
+TEST_F(httpd_tests, read_buffer_limit_drops_oversized_requests)
+{
+	boost::asio::io_context iox;
+	koti::local_stream::socket server_side{iox};
+	koti::local_stream::socket client_side{iox};
+	boost::asio::local::connect_pair(server_side, client_side);
+
+	koti::http_buffer_pool pool;
+	httpd_echo_target_endpoint root;
+	koti::http_connection connection{std::move(server_side)};
+	connection.set_root_endpoint(&root);
+	connection.set_read_buffer(&pool, 1024);
+	connection.async_read();
+
+	std::string request = "GET / HTTP/1.1\r\nHost: test\r\nX-Padding: ";
+	request.append(4096, 'x');
+	request += "\r\n\r\n";
+	boost::asio::write(client_side, boost::asio::buffer(request));
+
+	auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (
+		koti::http_connection::state::closed != connection.current_state()
+		&& std::chrono::steady_clock::now() < until
+	)
+	{
+		iox.run_one_for(std::chrono::milliseconds(10));
+	}
+
+	EXPECT_EQ(koti::http_connection::state::closed, connection.current_state());
+	EXPECT_EQ(0u, connection.read_buffer_capacity());
+	EXPECT_EQ(0u, pool.stats().buffers_in_use);
+}
+
+namespace {
+
+// collects formatted lines; optionally holds the writer inside the first
+// one until released
+class http_access_log_test_sink
+: public spdlog::sinks::base_sink<std::mutex>
+{
+public:
+	std::vector<std::string>
+	lines()
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+		return lines_;
+	}
+
+	void
+	hold_first()
+	{
+		std::lock_guard<std::mutex> lock{gate_mutex_};
+		hold_ = true;
+	}
+
+	void
+	wait_until_held()
+	{
+		std::unique_lock<std::mutex> lock{gate_mutex_};
+		gate_.wait(lock, [this]()
+		{
+			return held_;
+		});
+	}
+
+	void
+	release()
+	{
+		std::lock_guard<std::mutex> lock{gate_mutex_};
+		hold_ = false;
+		gate_.notify_all();
+	}
+
+protected:
+	void
+	sink_it_(
+		const spdlog::details::log_msg & msg
+	) override
+	{
+		lines_.emplace_back(msg.payload.data(), msg.payload.size());
+
+		std::unique_lock<std::mutex> lock{gate_mutex_};
+		if ( hold_ && ! held_ )
+		{
+			held_ = true;
+			gate_.notify_all();
+			gate_.wait(lock, [this]()
+			{
+				return ! hold_;
+			});
+		}
+	}
+
+	void
+	flush_() override
+	{
+	}
+
+	std::vector<std::string> lines_;
+	std::mutex gate_mutex_;
+	std::condition_variable gate_;
+	bool hold_ = false;
+	bool held_ = false;
+};
+
+koti::http_access_record
+access_record(
+	std::string_view target
+)
+{
+	koti::http_access_record record;
+	record.when = std::chrono::system_clock::now();
+	record.status = 200;
+	record.method = koti::http::verb::get;
+	record.set_target(target);
+	return record;
+}
+
+} // namespace
+
+TEST(http_access_log_tests, connection_records_are_written_by_the_flusher)
+{
+	namespace http = koti::http;
+	constexpr std::size_t request_count = 32;
+
+	auto sink = std::make_shared<http_access_log_test_sink>();
+	koti::http_access_log log{std::make_shared<spdlog::logger>("access_test", sink), 8};
+
+	boost::asio::io_context iox;
+	koti::local_stream::socket server_side{iox};
+	koti::local_stream::socket client_side{iox};
+	boost::asio::local::connect_pair(server_side, client_side);
+
+	httpd_echo_target_endpoint root;
+	koti::http_connection connection{std::move(server_side)};
+	connection.set_root_endpoint(&root);
+	connection.set_access_log(&log);
+	connection.async_read();
+
+	std::thread client([&]()
+	{
+		boost::beast::flat_buffer buffer;
+		for ( std::size_t i = 0; i < request_count; ++i )
+		{
+			auto request = "GET /" + std::to_string(i) + " HTTP/1.1\r\nHost: test\r\n\r\n";
+			boost::asio::write(client_side, boost::asio::buffer(request));
+			http::response<http::string_body> response;
+			http::read(client_side, buffer, response);
+		}
+		client_side.shutdown(koti::local_stream::socket::shutdown_both);
+	});
+
+	auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (
+		koti::http_connection::state::closed != connection.current_state()
+		&& std::chrono::steady_clock::now() < until
+	)
+	{
+		iox.run_one_for(std::chrono::milliseconds(100));
+	}
+	client.join();
+	log.stop();
+
+	EXPECT_EQ(request_count, log.pushed());
+	EXPECT_EQ(request_count, log.written());
+	EXPECT_EQ(0u, log.dropped());
+
+	auto lines = sink->lines();
+	ASSERT_EQ(request_count, lines.size());
+	for ( std::size_t i = 0; i < request_count; ++i )
+	{
+		auto expected = "\t200\tOK\tGET\t/" + std::to_string(i);
+		EXPECT_NE(std::string::npos, lines[i].find(expected)) << lines[i];
+	}
+}
+
+TEST(http_access_log_tests, full_queue_drops_and_counts)
+{
+	auto sink = std::make_shared<http_access_log_test_sink>();
+	sink->hold_first();
+	koti::http_access_log log{
+		std::make_shared<spdlog::logger>("access_drop_test", sink),
+		4,
+		koti::http_access_log::overflow::drop
+	};
+
+	// the flusher takes the first record and stalls writing it, so the
+	// ring fills behind it
+	ASSERT_TRUE(log.push(access_record("/first")));
+	sink->wait_until_held();
+
+	std::size_t accepted = 0;
+	for ( std::size_t i = 0; i < 10; ++i )
+	{
+		accepted += log.push(access_record("/" + std::to_string(i))) ? 1 : 0;
+	}
+	EXPECT_EQ(log.capacity(), accepted);
+	EXPECT_EQ(10 - accepted, log.dropped());
+
+	sink->release();
+	log.stop();
+	EXPECT_EQ(1 + accepted, log.written());
+	EXPECT_FALSE(log.push(access_record("/late")));
+}
+
+TEST(http_access_log_tests, long_targets_are_truncated)
+{
+	std::string target(koti::http_access_record::target_capacity * 2, 'x');
+	auto record = access_record(target);
+	EXPECT_TRUE(record.target_truncated);
+	EXPECT_EQ(koti::http_access_record::target_capacity, record.target_view().size());
+}
+
+class http_file_endpoint_tests
+: public ::testing::Test
+{
+public:
+	using response_type = koti::http::response<koti::http::string_body>;
+
+	void
+	SetUp() override
+	{
+		root_ = fs::temp_directory_path() / ("koti-files-" + std::to_string(::getpid()));
+		fs::remove_all(root_);
+		fs::create_directories(root_ / "dir");
+		write_file("a.txt", content_);
+	}
+
+	void
+	TearDown() override
+	{
+		fs::remove_all(root_);
+	}
+
+	void
+	write_file(
+		const std::string & name,
+		const std::string & content
+	)
+	{
+		std::ofstream{(root_ / name).string(), std::ios::binary | std::ios::trunc} << content;
+	}
+
+	// sends each request in turn over one keep-alive connection, reading
+	// each response (header only for HEAD) before the next is sent
+	std::vector<response_type>
+	exchange(
+		const std::vector<std::string> & requests,
+		std::size_t pipeline_batch = 1
+	)
+	{
+		namespace http = koti::http;
+
+		boost::asio::io_context iox;
+		koti::local_stream::socket server_side{iox};
+		koti::local_stream::socket client_side{iox};
+		boost::asio::local::connect_pair(server_side, client_side);
+
+		koti::http_connection connection{std::move(server_side)};
+		connection.set_root_endpoint(endpoint_.get());
+		connection.set_pipeline_batch(pipeline_batch);
+		connection.async_read();
+
+		std::vector<response_type> responses;
+		std::thread client([&]()
+		{
+			boost::beast::flat_buffer buffer;
+			for ( const auto & request : requests )
+			{
+				boost::asio::write(client_side, boost::asio::buffer(request));
+
+				http::response_parser<http::string_body> parser;
+				parser.skip(0 == request.compare(0, 5, "HEAD "));
+				boost::system::error_code ec;
+				http::read(client_side, buffer, parser, ec);
+				if ( ec )
+				{
+					break;
+				}
+				responses.push_back(parser.release());
+			}
+			client_side.shutdown(koti::local_stream::socket::shutdown_both);
+		});
+
+		auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while (
+			koti::http_connection::state::closed != connection.current_state()
+			&& std::chrono::steady_clock::now() < until
+		)
+		{
+			iox.run_one_for(std::chrono::milliseconds(100));
+		}
+		client.join();
+		return responses;
+	}
+
+	static
+	std::string
+	get(
+		const std::string & target,
+		const std::string & extra = {}
+	)
+	{
+		return "GET " + target + " HTTP/1.1\r\nHost: test\r\n" + extra + "\r\n";
+	}
+
+	std::string content_ = "0123456789abcdefghijklmnopqrstuvwxyz";
+	fs::path root_;
+	koti::http_file_cache cache_{4};
+	std::unique_ptr<koti::http_file_endpoint> endpoint_;
+};
+
+TEST_F(http_file_endpoint_tests, serves_whole_files_and_ranges)
+{
+	namespace http = koti::http;
+	endpoint_ = std::make_unique<koti::http_file_endpoint>("/files/", root_, cache_);
+
+	auto responses = exchange({
+		get("/files/a.txt"),
+		get("/files/a.txt", "Range: bytes=2-5\r\n"),
+		get("/files/a.txt", "Range: bytes=-4\r\n"),
+		get("/files/a.txt", "Range: bytes=30-\r\n"),
+		get("/files/a.txt", "Range: bytes=99-\r\n"),
+		"HEAD /files/a.txt HTTP/1.1\r\nHost: test\r\n\r\n",
+		get("/files/a%2Etxt"),
+	});
+	ASSERT_EQ(7u, responses.size());
+
+	EXPECT_EQ(http::status::ok, responses[0].result());
+	EXPECT_EQ(content_, responses[0].body());
+	EXPECT_EQ("text/plain", responses[0][http::field::content_type]);
+	EXPECT_EQ("bytes", responses[0][http::field::accept_ranges]);
+	EXPECT_FALSE(responses[0][http::field::etag].empty());
+	EXPECT_FALSE(responses[0][http::field::last_modified].empty());
+
+	EXPECT_EQ(http::status::partial_content, responses[1].result());
+	EXPECT_EQ("2345", responses[1].body());
+	EXPECT_EQ("bytes 2-5/36", responses[1][http::field::content_range]);
+
+	EXPECT_EQ(http::status::partial_content, responses[2].result());
+	EXPECT_EQ("wxyz", responses[2].body());
+
+	EXPECT_EQ(http::status::partial_content, responses[3].result());
+	EXPECT_EQ("uvwxyz", responses[3].body());
+
+	EXPECT_EQ(http::status::range_not_satisfiable, responses[4].result());
+	EXPECT_EQ("bytes */36", responses[4][http::field::content_range]);
+
+	EXPECT_EQ(http::status::ok, responses[5].result());
+	EXPECT_EQ("36", responses[5][http::field::content_length]);
+	EXPECT_TRUE(responses[5].body().empty());
+
+	EXPECT_EQ(content_, responses[6].body());
+
+	// one open, every later request a cache hit
+	EXPECT_EQ(1u, cache_.misses());
+	EXPECT_EQ(6u, cache_.hits());
+}
+
+TEST_F(http_file_endpoint_tests, validators_answer_not_modified)
+{
+	namespace http = koti::http;
+	endpoint_ = std::make_unique<koti::http_file_endpoint>("/files", root_, cache_);
+
+	auto first = exchange({get("/files/a.txt")});
+	ASSERT_EQ(1u, first.size());
+	std::string etag{first[0][http::field::etag]};
+	std::string last_modified{first[0][http::field::last_modified]};
+
+	auto responses = exchange({
+		get("/files/a.txt", "If-None-Match: " + etag + "\r\n"),
+		get("/files/a.txt", "If-None-Match: \"other\", W/" + etag + "\r\n"),
+		get("/files/a.txt", "If-None-Match: \"other\"\r\n"),
+		get("/files/a.txt", "If-Modified-Since: " + last_modified + "\r\n"),
+		get("/files/a.txt", "Range: bytes=0-0\r\nIf-Range: \"other\"\r\n"),
+		get("/files/a.txt", "Range: bytes=0-0\r\nIf-Range: " + etag + "\r\n"),
+	});
+	ASSERT_EQ(6u, responses.size());
+	EXPECT_EQ(http::status::not_modified, responses[0].result());
+	EXPECT_EQ(etag, responses[0][http::field::etag]);
+	EXPECT_EQ(http::status::not_modified, responses[1].result());
+	EXPECT_EQ(http::status::ok, responses[2].result());
+	EXPECT_EQ(http::status::not_modified, responses[3].result());
+	EXPECT_EQ(http::status::ok, responses[4].result());
+	EXPECT_EQ(content_, responses[4].body());
+	EXPECT_EQ(http::status::partial_content, responses[5].result());
+	EXPECT_EQ("0", responses[5].body());
+}
+
+TEST_F(http_file_endpoint_tests, refuses_paths_outside_root)
+{
+	namespace http = koti::http;
+	endpoint_ = std::make_unique<koti::http_file_endpoint>("/files", root_, cache_);
+
+	EXPECT_TRUE(endpoint_->file_path("/files/../a.txt").empty());
+	EXPECT_TRUE(endpoint_->file_path("/files/%2e%2e/a.txt").empty());
+	EXPECT_TRUE(endpoint_->file_path("/filesa.txt").empty());
+	EXPECT_TRUE(endpoint_->file_path("/files/a%00.txt").empty());
+	EXPECT_EQ(root_ / "dir" / "a.txt", endpoint_->file_path("/files//dir/a.txt"));
+
+	auto responses = exchange({
+		get("/files/../a.txt"),
+		get("/files/dir"),
+		get("/files/missing"),
+		"POST /files/a.txt HTTP/1.1\r\nHost: test\r\nContent-Length: 0\r\n\r\n",
+	});
+	ASSERT_EQ(4u, responses.size());
+	EXPECT_EQ(http::status::not_found, responses[0].result());
+	EXPECT_EQ(http::status::not_found, responses[1].result());
+	EXPECT_EQ(http::status::not_found, responses[2].result());
+	EXPECT_EQ(http::status::method_not_allowed, responses[3].result());
+}
+
+TEST_F(http_file_endpoint_tests, large_files_wait_for_the_socket)
+{
+	// far more than a socket buffer, so sendfile() runs into EAGAIN
+	std::string large(4 * 1024 * 1024, '\0');
+	for ( std::size_t i = 0; i < large.size(); ++i )
+	{
+		large[i] = static_cast<char>('a' + i % 26);
+	}
+	write_file("large.bin", large);
+	endpoint_ = std::make_unique<koti::http_file_endpoint>("/files", root_, cache_);
+
+	auto responses = exchange({get("/files/large.bin"), get("/files/a.txt")});
+	ASSERT_EQ(2u, responses.size());
+	EXPECT_TRUE(large == responses[0].body());
+	EXPECT_EQ(content_, responses[1].body());
+}
+
+TEST_F(http_file_endpoint_tests, changed_files_are_reopened)
+{
+	endpoint_ = std::make_unique<koti::http_file_endpoint>("/files", root_, cache_);
+
+	auto before = exchange({get("/files/a.txt")});
+	ASSERT_EQ(1u, before.size());
+	EXPECT_EQ(content_, before[0].body());
+
+	// replaced under the cache: a new inode and a new size
+	fs::remove(root_ / "a.txt");
+	write_file("a.txt", "replaced");
+
+	auto after = exchange({get("/files/a.txt")}, 8);
+	ASSERT_EQ(1u, after.size());
+	EXPECT_EQ("replaced", after[0].body());
+	EXPECT_EQ(2u, cache_.misses());
+	EXPECT_EQ(1u, cache_.size());
+}
+
+TEST_F(http_file_endpoint_tests, precompressed_siblings_go_to_clients_that_accept_gzip)
+{
+	namespace http = koti::http;
+	endpoint_ = std::make_unique<koti::http_file_endpoint>("/files", root_, cache_);
+	endpoint_->set_precompressed(true);
+
+	std::string gzipped;
+	koti::http_compressor::compress(koti::http_content_coding::gzip, 9, content_, gzipped);
+	write_file("a.txt.gz", gzipped);
+
+	auto responses = exchange({
+		get("/files/a.txt", "Accept-Encoding: gzip\r\n"),
+		get("/files/a.txt"),
+		get("/files/a.txt", "Accept-Encoding: gzip;q=0\r\n"),
+	});
+	ASSERT_EQ(3u, responses.size());
+
+	EXPECT_EQ("gzip", responses[0][http::field::content_encoding]);
+	EXPECT_EQ("text/plain", responses[0][http::field::content_type]);
+	EXPECT_EQ("Accept-Encoding", responses[0][http::field::vary]);
+	EXPECT_EQ(gzipped, responses[0].body());
+
+	for ( std::size_t i : {1u, 2u} )
+	{
+		EXPECT_TRUE(responses[i][http::field::content_encoding].empty());
+		EXPECT_EQ("Accept-Encoding", responses[i][http::field::vary]);
+		EXPECT_EQ(content_, responses[i].body());
+	}
+	EXPECT_NE(responses[0][http::field::etag], responses[1][http::field::etag]);
+
+	// a sibling older than the file is stale and ignored
+	fs::last_write_time(root_ / "a.txt.gz", fs::last_write_time(root_ / "a.txt") - 60);
+	auto stale = exchange({get("/files/a.txt", "Accept-Encoding: gzip\r\n")});
+	ASSERT_EQ(1u, stale.size());
+	EXPECT_TRUE(stale[0][http::field::content_encoding].empty());
+	EXPECT_EQ(content_, stale[0].body());
+}
+
+namespace {
+
+// answers with the size of the body it got, however it was delivered
+class httpd_body_size_endpoint
+: public koti::http_endpoint
+{
+public:
+	enum class mode
+	{
+		memory,
+		callback,
+		file
+	};
+
+	koti::http_body_handling
+	body_handling(
+		koti::http_connection &,
+		const koti::http_request_header &
+	) override
+	{
+		koti::http_body_handling handling;
+		handling.limit = limit_;
+		switch ( mode_ )
+		{
+		case mode::memory:
+			break;
+
+		case mode::callback:
+			handling.sink = std::make_unique<koti::http_callback_body_sink>(
+				[this](std::string_view data, boost::system::error_code &)
+			{
+				streamed_ += data.size();
+				largest_piece_ = std::max(largest_piece_, data.size());
+			});
+			break;
+
+		case mode::file:
+			handling.sink = std::make_unique<koti::http_file_body_sink>(file_);
+			break;
+		}
+		return handling;
+	}
+
+	koti::http_response
+	handle(
+		koti::http_connection & connection,
+		koti::http_request & request
+	) override
+	{
+		std::size_t size = request.body().size();
+		if ( mode::callback == mode_ )
+		{
+			size = streamed_;
+		}
+		if ( mode::file == mode_ )
+		{
+			auto * sink = dynamic_cast<koti::http_file_body_sink *>(connection.body_sink());
+			size = sink ? sink->size() : 0;
+		}
+
+		auto response = koti::http_make_response(request.get_allocator());
+		response.version(11);
+		response.result(koti::http::status::ok);
+		response.body() = std::to_string(size);
+		response.prepare_payload();
+		return response;
+	}
+
+	mode mode_ = mode::memory;
+	std::uint64_t limit_ = koti::http_body_handling::default_limit;
+	fs::path file_;
+	std::size_t streamed_ = 0;
+	std::size_t largest_piece_ = 0;
+};
+
+// sends request and returns the response, or nothing when the server
+// hung up first
+std::vector<koti::http::response<koti::http::string_body>>
+post_to(
+	koti::http_endpoint & endpoint,
+	const std::vector<std::string> & requests,
+	koti::worker_pool * workers = nullptr,
+	koti::http_peer_limiter * limiter = nullptr,
+	koti::http_metrics * metrics = nullptr,
+	koti::http_compression * compression = nullptr
+)
+{
+	namespace http = koti::http;
+
+	boost::asio::io_context iox;
+	koti::local_stream::socket server_side{iox};
+	koti::local_stream::socket client_side{iox};
+	boost::asio::local::connect_pair(server_side, client_side);
+
+	koti::http_connection connection{std::move(server_side)};
+	connection.set_root_endpoint(&endpoint);
+	connection.set_worker_pool(workers);
+	connection.set_metrics(metrics);
+	connection.set_compression(compression);
+	if ( limiter )
+	{
+		connection.admit_peer(*limiter);
+	}
+	connection.async_read();
+
+	std::vector<http::response<http::string_body>> responses;
+	std::thread client([&]()
+	{
+		boost::beast::flat_buffer buffer;
+		for ( const auto & request : requests )
+		{
+			boost::system::error_code ec;
+			boost::asio::write(client_side, boost::asio::buffer(request), ec);
+
+			http::response<http::string_body> response;
+			http::read(client_side, buffer, response, ec);
+			if ( ec )
+			{
+				break;
+			}
+			responses.push_back(std::move(response));
+		}
+		client_side.shutdown(koti::local_stream::socket::shutdown_both);
+	});
+
+	auto until = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+	while (
+		koti::http_connection::state::closed != connection.current_state()
+		&& std::chrono::steady_clock::now() < until
+	)
+	{
+		iox.run_one_for(std::chrono::milliseconds(100));
+	}
+	client.join();
+	return responses;
+}
+
+std::string
+post_request(
+	std::size_t size
+)
+{
+	return "POST /upload HTTP/1.1\r\nHost: test\r\nContent-Length: "
+		+ std::to_string(size) + "\r\n\r\n" + std::string(size, 'u');
+}
+
+} // namespace
+
+TEST(http_body_tests, in_memory_bodies_are_limited)
+{
+	namespace http = koti::http;
+	httpd_body_size_endpoint endpoint;
+
+	auto responses = post_to(endpoint, {
+		post_request(1000),
+		"GET / HTTP/1.1\r\nHost: test\r\n\r\n",
+		post_request(2 * koti::http_body_handling::default_limit),
+	});
+	ASSERT_EQ(3u, responses.size());
+	EXPECT_EQ("1000", responses[0].body());
+	EXPECT_EQ("0", responses[1].body());
+	EXPECT_EQ(http::status::payload_too_large, responses[2].result());
+	EXPECT_FALSE(responses[2].keep_alive());
+}
+
+TEST(http_body_tests, callback_sink_sees_the_body_as_it_arrives)
+{
+	httpd_body_size_endpoint endpoint;
+	endpoint.mode_ = httpd_body_size_endpoint::mode::callback;
+	endpoint.limit_ = 64 * 1024 * 1024;
+
+	constexpr std::size_t size = 8 * 1024 * 1024;
+	std::string chunked =
+		"POST /upload HTTP/1.1\r\nHost: test\r\nTransfer-Encoding: chunked\r\n\r\n"
+		"5\r\nhello\r\n"
+		"6\r\n world\r\n"
+		"0\r\n\r\n";
+
+	auto responses = post_to(endpoint, {post_request(size), chunked});
+	ASSERT_EQ(2u, responses.size());
+	EXPECT_EQ(std::to_string(size), responses[0].body());
+	EXPECT_EQ(std::to_string(size + 11), responses[1].body());
+
+	// handed over in pieces, never as a whole
+	EXPECT_LT(0u, endpoint.largest_piece_);
+	EXPECT_GE(64u * 1024, endpoint.largest_piece_);
+}
+
+TEST(http_body_tests, file_sink_writes_the_body_to_disk)
+{
+	httpd_body_size_endpoint endpoint;
+	endpoint.mode_ = httpd_body_size_endpoint::mode::file;
+	endpoint.limit_ = 64 * 1024 * 1024;
+	endpoint.file_ = fs::temp_directory_path() / ("koti-upload-" + std::to_string(::getpid()));
+
+	constexpr std::size_t size = 3 * 1024 * 1024 + 17;
+	auto responses = post_to(endpoint, {post_request(size)});
+	ASSERT_EQ(1u, responses.size());
+	EXPECT_EQ(std::to_string(size), responses[0].body());
+	EXPECT_EQ(size, fs::file_size(endpoint.file_));
+	fs::remove(endpoint.file_);
+}
+
+TEST(http_body_tests, streamed_bodies_are_limited)
+{
+	namespace http = koti::http;
+	httpd_body_size_endpoint endpoint;
+	endpoint.mode_ = httpd_body_size_endpoint::mode::callback;
+	endpoint.limit_ = 4096;
+
+	// refused from its Content-Length alone
+	auto responses = post_to(endpoint, {post_request(1024 * 1024)});
+	ASSERT_EQ(1u, responses.size());
+	EXPECT_EQ(http::status::payload_too_large, responses[0].result());
+	EXPECT_EQ(0u, endpoint.streamed_);
+
+	// chunked: refused once the limit is crossed
+	std::string chunk(1024, 'c');
+	std::string chunked = "POST /upload HTTP/1.1\r\nHost: test\r\nTransfer-Encoding: chunked\r\n\r\n";
+	for ( std::size_t i = 0; i < 8; ++i )
+	{
+		chunked += "400\r\n" + chunk + "\r\n";
+	}
+	chunked += "0\r\n\r\n";
+
+	responses = post_to(endpoint, {chunked});
+	ASSERT_EQ(1u, responses.size());
+	EXPECT_EQ(http::status::payload_too_large, responses[0].result());
+	EXPECT_GE(4096u, endpoint.streamed_);
+}
+
+namespace {
+
+// answers with its X-Tag field and body
+class httpd_tag_endpoint
+: public koti::http_endpoint
+{
+public:
+	koti::http_response
+	handle(
+		koti::http_connection &,
+		koti::http_request & request
+	) override
+	{
+		auto tag = request["X-Tag"];
+		auto response = koti::http_make_response(request.get_allocator());
+		response.version(11);
+		response.result(koti::http::status::ok);
+		response.body().assign(tag.data(), tag.size());
+		response.body() += ':';
+		response.body() += request.body();
+		response.prepare_payload();
+		return response;
+	}
+};
+
+std::string
+tagged_post(
+	const std::string & tag,
+	const std::string & body
+)
+{
+	return "POST /upload HTTP/1.1\r\nHost: test\r\nX-Tag: " + tag
+		+ "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+} // namespace
+
+TEST(http_body_tests, keep_alive_requests_only_see_their_own_fields)
+{
+	httpd_tag_endpoint endpoint;
+
+	// the long body's buffer must not outlive its request and end up
+	// under the next request's fields
+	std::string long_body(64 * 1024, 'l');
+	auto responses = post_to(endpoint, {
+		tagged_post("first", long_body),
+		tagged_post("second", "short"),
+		tagged_post("third", "s"),
+	});
+	ASSERT_EQ(3u, responses.size());
+	EXPECT_EQ("first:" + long_body, responses[0].body());
+	EXPECT_EQ("second:short", responses[1].body());
+	EXPECT_EQ("third:s", responses[2].body());
+}
+
+TEST(http_arena_tests, trim_keeps_the_first_chunks)
+{
+	koti::http_arena arena{1024};
+	auto fill = [&]()
+	{
+		EXPECT_NE(nullptr, arena.allocate(1000));
+		EXPECT_NE(nullptr, arena.allocate(2000));
+		EXPECT_NE(nullptr, arena.allocate(4000));
+	};
+	fill();
+	EXPECT_EQ(1024u + 2048 + 4096, arena.capacity());
+
+	arena.trim(4096);
+	EXPECT_EQ(1024u + 2048, arena.capacity());
+
+	// grows back the way it did
+	fill();
+	EXPECT_EQ(1024u + 2048 + 4096, arena.capacity());
+
+	// the first chunk stays whatever retained says
+	arena.trim(0);
+	EXPECT_EQ(1024u, arena.capacity());
+}
+
+TEST_F(httpd_tests, idle_connections_trim_their_arena)
+{
+	namespace http = koti::http;
+
+	boost::asio::io_context iox;
+	koti::local_stream::socket server_side{iox};
+	koti::local_stream::socket client_side{iox};
+	boost::asio::local::connect_pair(server_side, client_side);
+
+	httpd_tag_endpoint endpoint;
+	koti::http_connection connection{std::move(server_side)};
+	connection.set_root_endpoint(&endpoint);
+	connection.async_read();
+
+	std::atomic<bool> answered{false};
+	std::string body;
+	std::thread client([&]()
+	{
+		auto request = tagged_post("large", std::string(256 * 1024, 'l'));
+		boost::asio::write(client_side, boost::asio::buffer(request));
+
+		boost::beast::flat_buffer buffer;
+		http::response<http::string_body> response;
+		http::read(client_side, buffer, response);
+		body = response.body();
+		answered = true;
+	});
+
+	auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (
+		! (answered && koti::http_connection::state::reading == connection.current_state())
+		&& std::chrono::steady_clock::now() < until
+	)
+	{
+		iox.run_one_for(std::chrono::milliseconds(10));
+	}
+	client.join();
+
+	EXPECT_EQ(6u + 256 * 1024, body.size());
+	EXPECT_LT(0u, connection.arena_capacity());
+	EXPECT_GE(16u * 1024, connection.arena_capacity());
+
+	client_side.shutdown(koti::local_stream::socket::shutdown_both);
+	until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (
+		koti::http_connection::state::closed != connection.current_state()
+		&& std::chrono::steady_clock::now() < until
+	)
+	{
+		iox.run_one_for(std::chrono::milliseconds(10));
+	}
+	EXPECT_EQ(koti::http_connection::state::closed, connection.current_state());
+}
+
+namespace {
+
+// streams its body from a thread of its own, waiting for the drain
+// callback whenever the writer pushes back
+class httpd_streaming_endpoint
+: public koti::http_endpoint
+{
+public:
+	~httpd_streaming_endpoint() override
+	{
+		for ( auto & producer : producers_ )
+		{
+			producer.join();
+		}
+	}
+
+	koti::http_response
+	handle(
+		koti::http_connection & connection,
+		koti::http_request & request
+	) override
+	{
+		namespace http = koti::http;
+
+		auto response = koti::http_make_response(request.get_allocator());
+		response.version(request.version());
+		response.result(http::status::ok);
+		if ( "/plain" == request.target() )
+		{
+			response.prepare_payload();
+			return response;
+		}
+
+		auto writer = connection.stream_response(high_water_);
+		if ( "/events" == request.target() )
+		{
+			response.set(http::field::content_type, "text/event-stream");
+			producers_.emplace_back([writer]()
+			{
+				writer->write_event("first", "tick");
+				writer->write_event("a\nb");
+				writer->finish();
+			});
+			return response;
+		}
+
+		response.body() = "head:";
+		producers_.emplace_back([this, writer]()
+		{
+			struct room
+			{
+				std::mutex mutex;
+				std::condition_variable changed;
+				bool available = true;
+			};
+			auto state = std::make_shared<room>();
+			writer->on_drain([state]()
+			{
+				std::lock_guard<std::mutex> lock{state->mutex};
+				state->available = true;
+				state->changed.notify_all();
+			});
+
+			std::string piece(piece_size_, 'p');
+			for ( std::size_t i = 0; i < pieces_ && false == writer->closed(); ++i )
+			{
+				{
+					std::unique_lock<std::mutex> lock{state->mutex};
+					state->changed.wait_for(lock, std::chrono::seconds(10), [&]()
+					{
+						return state->available;
+					});
+					state->available = false;
+				}
+				bool more = writer->write(piece);
+				largest_backlog_ = std::max(largest_backlog_.load(), writer->pending());
+				if ( more )
+				{
+					std::lock_guard<std::mutex> lock{state->mutex};
+					state->available = true;
+				}
+			}
+			writer->finish();
+		});
+		return response;
+	}
+
+	std::size_t high_water_ = 16 * 1024;
+	std::size_t piece_size_ = 4096;
+	std::size_t pieces_ = 256;
+	std::atomic<std::size_t> largest_backlog_{0};
+	std::vector<std::thread> producers_;
+};
+
+} // namespace
+
+TEST(http_response_writer_tests, streams_from_another_thread_with_backpressure)
+{
+	namespace http = koti::http;
+	httpd_streaming_endpoint endpoint;
+
+	auto responses = post_to(endpoint, {
+		"GET /stream HTTP/1.1\r\nHost: test\r\n\r\n",
+		"GET /plain HTTP/1.1\r\nHost: test\r\n\r\n",
+	});
+	ASSERT_EQ(2u, responses.size());
+	EXPECT_TRUE(responses[0].chunked());
+	EXPECT_TRUE(responses[0].keep_alive());
+	EXPECT_EQ(
+		"head:" + std::string(endpoint.pieces_ * endpoint.piece_size_, 'p'),
+		responses[0].body()
+	);
+	EXPECT_EQ(http::status::ok, responses[1].result());
+
+	// the producer was held back instead of queueing the whole body
+	EXPECT_GE(endpoint.high_water_ + endpoint.piece_size_, endpoint.largest_backlog_);
+}
+
+TEST(http_response_writer_tests, http10_bodies_end_with_the_connection)
+{
+	httpd_streaming_endpoint endpoint;
+	endpoint.pieces_ = 8;
+
+	auto responses = post_to(endpoint, {"GET /stream HTTP/1.0\r\n\r\n"});
+	ASSERT_EQ(1u, responses.size());
+	EXPECT_FALSE(responses[0].chunked());
+	EXPECT_FALSE(responses[0].keep_alive());
+	EXPECT_EQ("head:" + std::string(8 * endpoint.piece_size_, 'p'), responses[0].body());
+}
+
+TEST(http_response_writer_tests, server_sent_events)
+{
+	httpd_streaming_endpoint endpoint;
+
+	auto responses = post_to(endpoint, {"GET /events HTTP/1.1\r\nHost: test\r\n\r\n"});
+	ASSERT_EQ(1u, responses.size());
+	EXPECT_EQ("text/event-stream", responses[0][koti::http::field::content_type]);
+	EXPECT_EQ("event: tick\ndata: first\n\ndata: a\ndata: b\n\n", responses[0].body());
+}
+
+TEST(http_response_writer_tests, closed_writers_refuse_data_and_release_producers)
+{
+	boost::asio::io_context iox;
+	auto writer = std::make_shared<koti::http_response_writer>(iox.get_executor(), 8);
+	writer->attach([]() {});
+
+	bool drained = false;
+	writer->on_drain([&]()
+	{
+		drained = true;
+	});
+	EXPECT_FALSE(writer->write("more than eight bytes"));
+	EXPECT_EQ(21u, writer->pending());
+
+	writer->detach();
+	EXPECT_TRUE(drained);
+	EXPECT_TRUE(writer->closed());
+	EXPECT_EQ(0u, writer->pending());
+	EXPECT_FALSE(writer->write("x"));
+	iox.run();
+}
+
+namespace {
+
+std::string
+gunzip(
+	const std::string & in
+)
+{
+	z_stream z{};
+	inflateInit2(&z, 16 + MAX_WBITS);
+	z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+	z.avail_in = static_cast<uInt>(in.size());
+
+	std::string out;
+	char piece[16 * 1024];
+	int result = Z_OK;
+	while ( Z_OK == result )
+	{
+		z.next_out = reinterpret_cast<Bytef *>(piece);
+		z.avail_out = sizeof(piece);
+		result = inflate(&z, Z_NO_FLUSH);
+		out.append(piece, sizeof(piece) - z.avail_out);
+	}
+	inflateEnd(&z);
+	return Z_STREAM_END == result ? out : "<corrupt>";
+}
+
+std::string
+bunzip2(
+	const std::string & in
+)
+{
+	bz_stream bz{};
+	BZ2_bzDecompressInit(&bz, 0, 0);
+	bz.next_in = const_cast<char *>(in.data());
+	bz.avail_in = static_cast<unsigned>(in.size());
+
+	std::string out;
+	char piece[16 * 1024];
+	int result = BZ_OK;
+	while ( BZ_OK == result )
+	{
+		bz.next_out = piece;
+		bz.avail_out = sizeof(piece);
+		result = BZ2_bzDecompress(&bz);
+		out.append(piece, sizeof(piece) - bz.avail_out);
+	}
+	BZ2_bzDecompressEnd(&bz);
+	return BZ_STREAM_END == result ? out : "<corrupt>";
+}
+
+// a repetitive text body of the size the target asks for, eg. /text/4096
+class httpd_text_endpoint
+: public koti::http_endpoint
+{
+public:
+	koti::http_response
+	handle(
+		koti::http_connection &,
+		koti::http_request & request
+	) override
+	{
+		namespace http = koti::http;
+
+		std::string target{request.target().data(), request.target().size()};
+		auto size = std::stoul(target.substr(target.rfind('/') + 1));
+
+		auto response = koti::http_make_response(request.get_allocator());
+		response.version(request.version());
+		response.result(http::status::ok);
+		response.set(http::field::content_type, 0 == target.find("/image") ? "image/png" : "text/plain");
+		response.set(http::field::etag, "\"text\"");
+		response.body().assign(text(size));
+		response.prepare_payload();
+		return response;
+	}
+
+	static
+	std::string
+	text(
+		std::size_t size
+	)
+	{
+		std::string body;
+		for ( std::size_t i = 0; body.size() < size; ++i )
+		{
+			body += "line " + std::to_string(i % 97) + " of the body\n";
+		}
+		body.resize(size);
+		return body;
+	}
+};
+
+} // namespace
+
+TEST(http_compression_tests, codings_are_negotiated_by_q_value)
+{
+	using koti::http_content_coding;
+	koti::http_compression_policy both;
+	both.bzip2 = true;
+	koti::http_compression_policy gzip_only;
+
+	EXPECT_EQ(http_content_coding::gzip, koti::http_negotiate_coding("gzip, deflate, br", both));
+	EXPECT_EQ(http_content_coding::bzip2, koti::http_negotiate_coding("bzip2, gzip;q=0.5", both));
+	EXPECT_EQ(http_content_coding::gzip, koti::http_negotiate_coding("bzip2, gzip;q=0.5", gzip_only));
+	EXPECT_EQ(http_content_coding::gzip, koti::http_negotiate_coding("X-GZIP;Q=1.0", both));
+	EXPECT_EQ(http_content_coding::gzip, koti::http_negotiate_coding("*", both));
+	EXPECT_EQ(http_content_coding::bzip2, koti::http_negotiate_coding("*;q=0.3, gzip;q=0.2", both));
+	EXPECT_EQ(http_content_coding::identity, koti::http_negotiate_coding("gzip;q=0", both));
+	EXPECT_EQ(http_content_coding::identity, koti::http_negotiate_coding("identity", both));
+	EXPECT_EQ(http_content_coding::identity, koti::http_negotiate_coding("", both));
+
+	EXPECT_TRUE(koti::http_accepts_coding("br, gzip;q=0.1", http_content_coding::gzip));
+	EXPECT_FALSE(koti::http_accepts_coding("*, gzip;q=0", http_content_coding::gzip));
+}
+
+TEST(http_compression_tests, streamed_compression_can_be_decoded_as_it_arrives)
+{
+	auto text = httpd_text_endpoint::text(256 * 1024);
+
+	koti::http_compressor gzip{koti::http_content_coding::gzip, 6};
+	koti::http_compressor bzip2{koti::http_content_coding::bzip2, 9};
+	std::string gzipped;
+	std::string bzipped;
+	for ( std::size_t at = 0; at < text.size(); at += 10000 )
+	{
+		auto piece = std::string_view{text}.substr(at, 10000);
+		auto before = gzipped.size();
+		gzip.write(piece, gzipped, true);
+		bzip2.write(piece, bzipped, true);
+
+		// each flush is a complete block: nothing is held back
+		EXPECT_LT(before, gzipped.size());
+	}
+	gzip.finish(gzipped);
+	bzip2.finish(bzipped);
+	EXPECT_THROW(gzip.write("late", gzipped), std::logic_error);
+
+	EXPECT_EQ(text, gunzip(gzipped));
+	EXPECT_EQ(text, bunzip2(bzipped));
+	EXPECT_GT(text.size() / 4, gzipped.size());
+
+	std::string empty;
+	koti::http_compressor::compress(koti::http_content_coding::gzip, 6, "", empty);
+	EXPECT_EQ("", gunzip(empty));
+}
+
+TEST(http_compression_tests, connections_compress_what_the_client_accepts)
+{
+	namespace http = koti::http;
+	httpd_text_endpoint endpoint;
+	koti::http_compression_policy policy;
+	policy.bzip2 = true;
+	koti::http_compression compression{policy};
+	koti::http_metrics metrics;
+
+	auto responses = post_to(endpoint, {
+		"GET /text/65536 HTTP/1.1\r\nHost: test\r\nAccept-Encoding: gzip\r\n\r\n",
+		"GET /text/65536 HTTP/1.1\r\nHost: test\r\nAccept-Encoding: gzip\r\n\r\n",
+		"GET /text/65536 HTTP/1.1\r\nHost: test\r\nAccept-Encoding: bzip2\r\n\r\n",
+		"GET /text/65536 HTTP/1.1\r\nHost: test\r\n\r\n",
+		"GET /text/100 HTTP/1.1\r\nHost: test\r\nAccept-Encoding: gzip\r\n\r\n",
+		"GET /image/65536 HTTP/1.1\r\nHost: test\r\nAccept-Encoding: gzip\r\n\r\n",
+	}, nullptr, nullptr, &metrics, &compression);
+	ASSERT_EQ(6u, responses.size());
+
+	auto text = httpd_text_endpoint::text(65536);
+	for ( std::size_t i : {0u, 1u} )
+	{
+		EXPECT_EQ("gzip", responses[i][http::field::content_encoding]);
+		EXPECT_EQ("Accept-Encoding", responses[i][http::field::vary]);
+		EXPECT_EQ("W/\"text\"", responses[i][http::field::etag]);
+		EXPECT_EQ(std::to_string(responses[i].body().size()), responses[i][http::field::content_length]);
+		EXPECT_EQ(text, gunzip(responses[i].body()));
+	}
+	EXPECT_EQ("bzip2", responses[2][http::field::content_encoding]);
+	EXPECT_EQ(text, bunzip2(responses[2].body()));
+
+	// not asked for, too small to bother, or compressed already
+	for ( std::size_t i : {3u, 4u, 5u} )
+	{
+		EXPECT_TRUE(responses[i][http::field::content_encoding].empty());
+		EXPECT_EQ("\"text\"", responses[i][http::field::etag]);
+	}
+	EXPECT_EQ(text, responses[3].body());
+	EXPECT_EQ("Accept-Encoding", responses[3][http::field::vary]);
+	EXPECT_TRUE(responses[5][http::field::vary].empty());
+
+	// the repeat was served from the cache
+	EXPECT_EQ(1u, compression.cache().hits());
+	EXPECT_EQ(2u, compression.cache().misses());
+
+	auto s = metrics.collect();
+	EXPECT_EQ(3 * 65536u, s[koti::http_metrics::counter::compressed_in]);
+	EXPECT_EQ(
+		2 * responses[0].body().size() + responses[2].body().size(),
+		s[koti::http_metrics::counter::compressed_out]
+	);
+}
+
+TEST(http_compression_tests, streamed_responses_are_compressed_as_they_go)
+{
+	namespace http = koti::http;
+	httpd_streaming_endpoint endpoint;
+	endpoint.pieces_ = 64;
+	koti::http_compression compression{koti::http_compression_policy{}};
+
+	auto responses = post_to(endpoint, {
+		"GET /stream HTTP/1.1\r\nHost: test\r\nAccept-Encoding: gzip\r\n\r\n",
+		"GET /stream HTTP/1.0\r\nAccept-Encoding: gzip\r\n\r\n",
+	}, nullptr, nullptr, nullptr, &compression);
+	ASSERT_EQ(2u, responses.size());
+
+	auto expected = "head:" + std::string(64 * endpoint.piece_size_, 'p');
+	EXPECT_TRUE(responses[0].chunked());
+	EXPECT_FALSE(responses[1].chunked());
+	for ( const auto & response : responses )
+	{
+		EXPECT_EQ("gzip", response[http::field::content_encoding]);
+		EXPECT_EQ(expected, gunzip(response.body()));
+		EXPECT_GT(expected.size() / 10, response.body().size());
+	}
+}
+
+namespace {
+
+// reports the thread it was handled on; /slow asks for a worker
+class httpd_thread_endpoint
+: public koti::http_endpoint
+{
+public:
+	koti::http_execution
+	execution(
+		koti::http_connection &,
+		const koti::http_request_header & header
+	) override
+	{
+		return "/slow" == header.target()
+			? koti::http_execution::worker_pool
+			: koti::http_execution::io_thread;
+	}
+
+	koti::http_response
+	handle(
+		koti::http_connection &,
+		koti::http_request & request
+	) override
+	{
+		auto response = koti::http_make_response(request.get_allocator());
+		response.version(11);
+		response.result(koti::http::status::ok);
+		response.body() = std::this_thread::get_id() == io_thread_ ? "io" : "worker";
+		response.prepare_payload();
+		return response;
+	}
+
+	std::thread::id io_thread_ = std::this_thread::get_id();
+};
+
+} // namespace
+
+TEST(worker_pool_tests, runs_everything_submitted)
+{
+	constexpr std::size_t count = 10000;
+	std::atomic<std::size_t> ran{0};
+	koti::worker_pool pool{4, count};
+
+	for ( std::size_t i = 0; i < count / 2; ++i )
+	{
+		ASSERT_TRUE(pool.try_submit([&]()
+		{
+			++ran;
+
+			// from a worker: lands on that worker's own deque
+			pool.try_submit([&]()
+			{
+				++ran;
+			});
+		}));
+	}
+
+	auto until = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+	while ( ran < count && std::chrono::steady_clock::now() < until )
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	EXPECT_EQ(count, ran.load());
+
+	pool.stop();
+	auto stats = pool.stats();
+	EXPECT_EQ(count, stats.submitted);
+	EXPECT_EQ(count, stats.executed);
+	EXPECT_EQ(0u, stats.rejected);
+	EXPECT_EQ(0u, stats.queued);
+}
+
+TEST(worker_pool_tests, refuses_work_beyond_its_queue_limit)
+{
+	koti::worker_pool pool{1, 2};
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	bool started = false;
+	bool release = false;
+	ASSERT_TRUE(pool.try_submit([&]()
+	{
+		std::unique_lock<std::mutex> lock{mutex};
+		started = true;
+		changed.notify_all();
+		changed.wait(lock, [&]()
+		{
+			return release;
+		});
+	}));
+	{
+		std::unique_lock<std::mutex> lock{mutex};
+		changed.wait(lock, [&]()
+		{
+			return started;
+		});
+	}
+
+	// the one worker is busy: two may wait, the third is turned away
+	EXPECT_TRUE(pool.try_submit([]() {}));
+	EXPECT_TRUE(pool.try_submit([]() {}));
+	EXPECT_FALSE(pool.try_submit([]() {}));
+	EXPECT_EQ(1u, pool.stats().rejected);
+
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		release = true;
+		changed.notify_all();
+	}
+	pool.stop();
+	EXPECT_FALSE(pool.try_submit([]() {}));
+}
+
+TEST(worker_pool_tests, blocking_endpoints_run_on_workers)
+{
+	namespace http = koti::http;
+	httpd_thread_endpoint endpoint;
+	koti::worker_pool pool{2};
+
+	auto responses = post_to(endpoint, {
+		"GET /slow HTTP/1.1\r\nHost: test\r\n\r\n",
+		"GET /fast HTTP/1.1\r\nHost: test\r\n\r\n",
+		"GET /slow HTTP/1.1\r\nHost: test\r\n\r\n",
+	}, &pool);
+	ASSERT_EQ(3u, responses.size());
+	EXPECT_EQ("worker", responses[0].body());
+	EXPECT_EQ("io", responses[1].body());
+	EXPECT_EQ("worker", responses[2].body());
+	EXPECT_TRUE(responses[2].keep_alive());
+}
+
+TEST(worker_pool_tests, saturated_pool_answers_service_unavailable)
+{
+	namespace http = koti::http;
+	httpd_thread_endpoint endpoint;
+
+	// no room to queue anything: every hand-off is refused
+	koti::worker_pool pool{1, 0};
+
+	auto responses = post_to(endpoint, {
+		"GET /slow HTTP/1.1\r\nHost: test\r\n\r\n",
+		"GET /fast HTTP/1.1\r\nHost: test\r\n\r\n",
+	}, &pool);
+	ASSERT_EQ(2u, responses.size());
+	EXPECT_EQ(http::status::service_unavailable, responses[0].result());
+	EXPECT_EQ("1", responses[0][http::field::retry_after]);
+	EXPECT_TRUE(responses[0].keep_alive());
+	EXPECT_EQ("io", responses[1].body());
+}
+
+namespace {
+
+// answers /later from a timer, after handle() has returned
+class httpd_deferring_endpoint
+: public koti::http_endpoint
+{
+public:
+	koti::http_response
+	handle(
+		koti::http_connection & connection,
+		koti::http_request & request
+	) override
+	{
+		auto response = koti::http_make_response(request.get_allocator());
+		response.version(11);
+		response.result(koti::http::status::ok);
+		if ( "/later" != request.target() )
+		{
+			response.body() = "now";
+			response.prepare_payload();
+			return response;
+		}
+
+		connection.defer_response();
+		timer_ = std::make_unique<boost::asio::steady_timer>(connection.get_executor());
+		timer_->expires_after(std::chrono::milliseconds(20));
+		timer_->async_wait([&connection, &request](const boost::system::error_code &)
+		{
+			auto later = koti::http_make_response(request.get_allocator());
+			later.version(11);
+			later.result(koti::http::status::ok);
+			later.body() = "later";
+			later.prepare_payload();
+			connection.complete_response(std::move(later));
+		});
+
+		// discarded
+		response.result(koti::http::status::internal_server_error);
+		return response;
+	}
+
+	std::unique_ptr<boost::asio::steady_timer> timer_;
+};
+
+#if defined(KOTI_HTTPD_COROUTINES)
+class httpd_awaiting_endpoint
+: public koti::http_coroutine_endpoint
+{
+public:
+	explicit
+	httpd_awaiting_endpoint(
+		koti::worker_pool & pool
+	)
+	: pool_(pool)
+	{
+	}
+
+	asio::awaitable<koti::http_response>
+	async_handle(
+		koti::http_connection &,
+		koti::http_request & request
+	) override
+	{
+		if ( "/throw" == request.target() )
+		{
+			throw std::runtime_error{"thrown from a coroutine"};
+		}
+
+		boost::asio::steady_timer timer{co_await asio::this_coro::executor};
+		timer.expires_after(std::chrono::milliseconds(5));
+		co_await timer.async_wait(asio::use_awaitable);
+
+		std::size_t length = 0;
+		co_await koti::async_run(pool_, [&]()
+		{
+			length = request.target().size();
+		}, asio::use_awaitable);
+
+		auto response = koti::http_make_response(request.get_allocator());
+		response.version(11);
+		response.result(koti::http::status::ok);
+		response.body() = std::to_string(length);
+		response.prepare_payload();
+		co_return response;
+	}
+
+	koti::worker_pool & pool_;
+};
+#endif // defined(KOTI_HTTPD_COROUTINES)
+
+} // namespace
+
+TEST(http_deferred_response_tests, responses_can_be_completed_later)
+{
+	httpd_deferring_endpoint endpoint;
+
+	auto responses = post_to(endpoint, {
+		"GET /later HTTP/1.1\r\nHost: test\r\n\r\n",
+		"GET /now HTTP/1.1\r\nHost: test\r\n\r\n",
+	});
+	ASSERT_EQ(2u, responses.size());
+	EXPECT_EQ(koti::http::status::ok, responses[0].result());
+	EXPECT_EQ("later", responses[0].body());
+	EXPECT_EQ("now", responses[1].body());
+}
+
+TEST(http_deferred_response_tests, pipelined_batches_wait_for_deferred_responses)
+{
+	namespace http = koti::http;
+	httpd_deferring_endpoint endpoint;
+
+	boost::asio::io_context iox;
+	koti::local_stream::socket server_side{iox};
+	koti::local_stream::socket client_side{iox};
+	boost::asio::local::connect_pair(server_side, client_side);
+
+	koti::http_connection connection{std::move(server_side)};
+	connection.set_root_endpoint(&endpoint);
+	connection.set_pipeline_batch(8);
+
+	// all in one write, so they are parsed out of one buffer
+	boost::asio::write(client_side, boost::asio::buffer(std::string{
+		"GET /now HTTP/1.1\r\nHost: test\r\n\r\n"
+		"GET /later HTTP/1.1\r\nHost: test\r\n\r\n"
+		"GET /now HTTP/1.1\r\nHost: test\r\n\r\n"
+	}));
+	connection.async_read();
+
+	std::vector<std::string> bodies;
+	std::thread client([&]()
+	{
+		boost::beast::flat_buffer buffer;
+		for ( int i = 0; i < 3; ++i )
+		{
+			http::response<http::string_body> response;
+			boost::system::error_code ec;
+			http::read(client_side, buffer, response, ec);
+			if ( ec )
+			{
+				break;
+			}
+			bodies.push_back(response.body());
+		}
+		client_side.shutdown(koti::local_stream::socket::shutdown_both);
+	});
+
+	auto until = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+	while (
+		koti::http_connection::state::closed != connection.current_state()
+		&& std::chrono::steady_clock::now() < until
+	)
+	{
+		iox.run_one_for(std::chrono::milliseconds(100));
+	}
+	client.join();
+
+	EXPECT_EQ((std::vector<std::string>{"now", "later", "now"}), bodies);
+}
+
+TEST(http_deferred_response_tests, async_run_completes_on_the_callers_executor)
+{
+	boost::asio::io_context iox;
+	koti::worker_pool pool{2};
+
+	auto io_thread = std::this_thread::get_id();
+	std::thread::id worker_thread;
+	std::thread::id completed_on;
+	bool failed = true;
+	koti::async_run(pool, [&]()
+	{
+		worker_thread = std::this_thread::get_id();
+	}, boost::asio::bind_executor(iox, [&](std::exception_ptr e)
+	{
+		completed_on = std::this_thread::get_id();
+		failed = static_cast<bool>(e);
+	}));
+	iox.run();
+
+	EXPECT_FALSE(failed);
+	EXPECT_NE(io_thread, worker_thread);
+	EXPECT_EQ(io_thread, completed_on);
+
+	// a saturated pool completes with an error instead
+	koti::worker_pool full{1, 0};
+	std::exception_ptr refused;
+	koti::async_run(full, []() {}, boost::asio::bind_executor(iox, [&](std::exception_ptr e)
+	{
+		refused = e;
+	}));
+	iox.restart();
+	iox.run();
+	EXPECT_THROW(std::rethrow_exception(refused), boost::system::system_error);
+}
+
+#if defined(KOTI_HTTPD_COROUTINES)
+TEST(http_deferred_response_tests, coroutine_endpoints_await_timers_and_workers)
+{
+	namespace http = koti::http;
+	koti::worker_pool pool{1};
+	httpd_awaiting_endpoint endpoint{pool};
+
+	auto responses = post_to(endpoint, {
+		"GET /twelve-chars HTTP/1.1\r\nHost: test\r\n\r\n",
+		"GET /throw HTTP/1.1\r\nHost: test\r\n\r\n",
+	});
+	ASSERT_EQ(2u, responses.size());
+	EXPECT_EQ("13", responses[0].body());
+	EXPECT_EQ(http::status::internal_server_error, responses[1].result());
+	EXPECT_FALSE(responses[1].keep_alive());
+}
+#endif // defined(KOTI_HTTPD_COROUTINES)
+
+namespace {
+
+koti::local_stream::ucred
+peer(
+	uid_t uid,
+	pid_t pid = 1
+)
+{
+	koti::local_stream::ucred identity{};
+	identity.uid = uid;
+	identity.gid = uid;
+	identity.pid = pid;
+	return identity;
+}
+
+} // namespace
+
+TEST(http_peer_limiter_tests, connections_are_capped_per_uid)
+{
+	koti::http_peer_limits limits;
+	limits.connections = 2;
+	koti::http_peer_limiter limiter{limits};
+
+	auto * alice = limiter.admit_connection(peer(1000));
+	ASSERT_NE(nullptr, alice);
+	EXPECT_EQ(alice, limiter.admit_connection(peer(1000, 42)));
+	EXPECT_EQ(nullptr, limiter.admit_connection(peer(1000)));
+
+	auto * bob = limiter.admit_connection(peer(1001));
+	ASSERT_NE(nullptr, bob);
+	EXPECT_NE(alice, bob);
+	EXPECT_EQ(1u, limiter.refused_connections());
+
+	limiter.release_connection(alice);
+	EXPECT_EQ(alice, limiter.admit_connection(peer(1000)));
+	EXPECT_EQ(2u, alice->connections());
+	EXPECT_EQ(2u, limiter.peers());
+
+	// keyed by pid as well: same uid, different process
+	limits.per_pid = true;
+	koti::http_peer_limiter per_pid{limits};
+	EXPECT_NE(per_pid.find(peer(1000, 1)), per_pid.find(peer(1000, 2)));
+}
+
+TEST(http_peer_limiter_tests, requests_follow_a_token_bucket)
+{
+	koti::http_peer_limits limits;
+	limits.requests_per_second = 10;
+	limits.burst = 3;
+	koti::http_peer_limiter limiter{limits};
+	auto * alice = limiter.find(peer(1000));
+
+	auto now = std::chrono::steady_clock::now();
+	std::chrono::nanoseconds retry_after{0};
+	EXPECT_TRUE(limiter.admit_request(alice, now, retry_after));
+	EXPECT_TRUE(limiter.admit_request(alice, now, retry_after));
+	EXPECT_TRUE(limiter.admit_request(alice, now, retry_after));
+	EXPECT_FALSE(limiter.admit_request(alice, now, retry_after));
+	EXPECT_EQ(std::chrono::milliseconds(100), retry_after);
+
+	// another peer has its own bucket
+	EXPECT_TRUE(limiter.admit_request(limiter.find(peer(1001)), now, retry_after));
+
+	// one token back after one interval
+	now += std::chrono::milliseconds(100);
+	EXPECT_TRUE(limiter.admit_request(alice, now, retry_after));
+	EXPECT_FALSE(limiter.admit_request(alice, now, retry_after));
+	EXPECT_EQ(2u, limiter.limited_requests());
+}
+
+TEST(http_peer_limiter_tests, peers_beyond_the_table_share_a_slot)
+{
+	koti::http_peer_limiter limiter{{}, 2};
+	auto * first = limiter.admit_connection(peer(1));
+	auto * second = limiter.admit_connection(peer(2));
+	auto * third = limiter.admit_connection(peer(3));
+	EXPECT_NE(first, second);
+	EXPECT_NE(third, first);
+	EXPECT_NE(third, second);
+	EXPECT_EQ(third, limiter.find(peer(4)));
+	EXPECT_EQ(2u, limiter.peers());
+}
+
+TEST(http_peer_limiter_tests, full_tables_reclaim_idle_slots)
+{
+	koti::http_peer_limits limits;
+	limits.requests_per_second = 10;
+	limits.burst = 1;
+	koti::http_peer_limiter limiter{limits, 2};
+
+	auto * first = limiter.admit_connection(peer(1));
+	auto * second = limiter.admit_connection(peer(2));
+	ASSERT_NE(first, second);
+
+	// without connections, but with its next request not due for an hour
+	auto now = std::chrono::steady_clock::now();
+	std::chrono::nanoseconds retry_after{0};
+	EXPECT_TRUE(limiter.admit_request(first, now + std::chrono::hours(1), retry_after));
+	limiter.release_connection(first);
+
+	// idle since long ago
+	EXPECT_TRUE(limiter.admit_request(second, now - std::chrono::hours(1), retry_after));
+	limiter.release_connection(second);
+
+	// a new peer takes over the idle slot, with a full bucket
+	auto * third = limiter.admit_connection(peer(3));
+	EXPECT_EQ(second, third);
+	EXPECT_EQ(1u, third->connections());
+	EXPECT_TRUE(limiter.admit_request(third, now, retry_after));
+	EXPECT_EQ(2u, limiter.peers());
+
+	// and the peer it was taken from now overflows, as nothing is idle
+	auto * overflow = limiter.find(peer(2));
+	EXPECT_NE(first, overflow);
+	EXPECT_NE(third, overflow);
+	EXPECT_EQ(first, limiter.find(peer(1)));
+}
+
+TEST(http_peer_limiter_tests, requests_over_the_rate_are_answered_with_429)
+{
+	namespace http = koti::http;
+	httpd_thread_endpoint endpoint;
+
+	koti::http_peer_limits limits;
+	limits.requests_per_second = 1;
+	limits.burst = 2;
+	koti::http_peer_limiter limiter{limits};
+
+	std::string request = "GET /fast HTTP/1.1\r\nHost: test\r\n\r\n";
+	auto responses = post_to(endpoint, {request, request, request}, nullptr, &limiter);
+	ASSERT_EQ(3u, responses.size());
+	EXPECT_EQ(http::status::ok, responses[0].result());
+	EXPECT_EQ(http::status::ok, responses[1].result());
+	EXPECT_EQ(http::status::too_many_requests, responses[2].result());
+	EXPECT_EQ("1", responses[2][http::field::retry_after]);
+	EXPECT_TRUE(responses[2].keep_alive());
+
+	// the connection was released when it went away
+	EXPECT_EQ(0u, limiter.find(koti::local_stream::ucred{})->connections());
+}
+
+TEST(http_timer_wheel_tests, timers_fire_once_at_their_deadline)
+{
+	using namespace std::chrono_literals;
+	boost::asio::io_context iox;
+	auto & wheel = koti::http_timer_wheel::use(iox.get_executor());
+
+	auto began = std::chrono::steady_clock::now();
+	std::vector<std::pair<char, std::chrono::steady_clock::duration>> fired;
+	auto record = [&](char name)
+	{
+		return [&fired, &began, name]()
+		{
+			fired.emplace_back(name, std::chrono::steady_clock::now() - began);
+		};
+	};
+
+	koti::http_timer_wheel::timer a{record('a')};
+	koti::http_timer_wheel::timer b{record('b')};
+	koti::http_timer_wheel::timer c{record('c')};
+	koti::http_timer_wheel::timer d{record('d')};
+	wheel.arm(a, 250ms);
+	wheel.arm(b, 100ms);
+	wheel.arm(c, 100ms);
+	wheel.arm(d, 100ms);
+	EXPECT_EQ(4u, wheel.armed());
+
+	wheel.cancel(c);
+	wheel.arm(d, 400ms);
+	EXPECT_FALSE(c.armed());
+	EXPECT_EQ(3u, wheel.armed());
+
+	// returns once nothing is armed: the wheel does not keep the context busy
+	iox.run();
+
+	ASSERT_EQ(3u, fired.size());
+	EXPECT_EQ('b', fired[0].first);
+	EXPECT_EQ('a', fired[1].first);
+	EXPECT_EQ('d', fired[2].first);
+	EXPECT_LE(100ms, fired[0].second);
+	EXPECT_LE(250ms, fired[1].second);
+	EXPECT_LE(400ms, fired[2].second);
+	EXPECT_EQ(3u, wheel.expired());
+	EXPECT_EQ(0u, wheel.armed());
+
+	// timers beyond one turn of the wheel wait for their turn
+	auto turn = koti::http_timer_wheel::resolution * koti::http_timer_wheel::slots;
+	koti::http_timer_wheel::timer far{record('f')};
+	wheel.arm(far, turn + 50ms);
+	wheel.arm(a, 50ms);
+	iox.restart();
+	iox.run_for(300ms);
+	EXPECT_EQ(4u, fired.size());
+	EXPECT_TRUE(far.armed());
+	wheel.cancel(far);
+}
+
+namespace {
+
+// serves /fast over a socketpair with timeouts; the client sends what it is
+// given, then reads until the server hangs up. returns how long that took
+std::chrono::steady_clock::duration
+time_out(
+	const koti::http_timeouts & timeouts,
+	std::string send,
+	std::string & received
+)
+{
+	boost::asio::io_context iox;
+	koti::local_stream::socket server_side{iox};
+	koti::local_stream::socket client_side{iox};
+	boost::asio::local::connect_pair(server_side, client_side);
+
+	httpd_thread_endpoint endpoint;
+	koti::http_buffer_pool pool;
+	bool closed = false;
+	auto connection = std::make_unique<koti::http_connection>(std::move(server_side));
+	connection->set_root_endpoint(&endpoint);
+	connection->set_read_buffer(&pool);
+	connection->set_timeouts(timeouts);
+	connection->set_closed_handler([&](koti::http_connection &)
+	{
+		closed = true;
+		connection.reset();
+	});
+	connection->async_read();
+
+	auto began = std::chrono::steady_clock::now();
+	std::thread client([&]()
+	{
+		boost::system::error_code ec;
+		boost::asio::write(client_side, boost::asio::buffer(send), ec);
+		char buffer[4096];
+		for ( ;; )
+		{
+			auto got = client_side.read_some(boost::asio::buffer(buffer), ec);
+			if ( ec )
+			{
+				break;
+			}
+			received.append(buffer, got);
+		}
+	});
+
+	// runs dry once the connection is gone and its timeout with it
+	iox.run_for(std::chrono::seconds(10));
+	auto elapsed = std::chrono::steady_clock::now() - began;
+	client.join();
+
+	EXPECT_TRUE(closed);
+	EXPECT_EQ(1u, koti::http_timer_wheel::use(iox.get_executor()).expired());
+	return elapsed;
+}
+
+} // namespace
+
+TEST(http_timer_wheel_tests, connections_time_out_in_each_phase)
+{
+	using namespace std::chrono_literals;
+	koti::http_timeouts timeouts;
+	timeouts.idle = 150ms;
+	timeouts.header = 300ms;
+	timeouts.body = 450ms;
+
+	std::string received;
+
+	// never sends a thing
+	auto elapsed = time_out(timeouts, "", received);
+	EXPECT_LE(150ms, elapsed);
+	EXPECT_GT(300ms, elapsed);
+	EXPECT_TRUE(received.empty());
+
+	// trickles half a header
+	elapsed = time_out(timeouts, "GET /fast HTTP/1.1\r\nHo", received);
+	EXPECT_LE(300ms, elapsed);
+	EXPECT_GT(450ms, elapsed);
+	EXPECT_TRUE(received.empty());
+
+	// promises a body it never sends
+	elapsed = time_out(timeouts, "POST /fast HTTP/1.1\r\nHost: test\r\nContent-Length: 10\r\n\r\n12345", received);
+	EXPECT_LE(450ms, elapsed);
+	EXPECT_TRUE(received.empty());
+
+	// answered, then idles on the keep-alive connection
+	elapsed = time_out(timeouts, "GET /fast HTTP/1.1\r\nHost: test\r\n\r\n", received);
+	EXPECT_LE(150ms, elapsed);
+	EXPECT_GT(300ms, elapsed);
+	EXPECT_NE(std::string::npos, received.find("200 OK"));
+}
+
+TEST(http_metrics_tests, buckets_are_log_linear)
+{
+	using metrics = koti::http_metrics;
+	EXPECT_EQ(0u, metrics::bucket_of(0));
+	EXPECT_EQ(1u, metrics::bucket_bound(0));
+	EXPECT_EQ(metrics::histogram_buckets - 1, metrics::bucket_of(std::uint64_t{1} << 40));
+
+	for ( std::uint64_t v = 0; v < (std::uint64_t{1} << 26); v = v * 9 / 8 + 1 )
+	{
+		auto bucket = metrics::bucket_of(v);
+		ASSERT_GT(metrics::histogram_buckets - 1, bucket) << v;
+		EXPECT_LT(v, metrics::bucket_bound(bucket)) << v;
+		if ( 0u < bucket )
+		{
+			EXPECT_GE(v, metrics::bucket_bound(bucket - 1)) << v;
+		}
+
+		// no wider than a quarter of what it holds
+		auto low = 0u < bucket ? metrics::bucket_bound(bucket - 1) : 0;
+		EXPECT_GE(std::max<std::uint64_t>(1, low / 4), metrics::bucket_bound(bucket) - low) << v;
+	}
+}
+
+TEST(http_metrics_tests, shards_are_per_thread_and_summed_when_collected)
+{
+	koti::http_metrics metrics;
+	constexpr std::size_t threads = 4;
+	constexpr std::size_t each = 10000;
+
+	std::vector<std::thread> recorders;
+	for ( std::size_t t = 0; t < threads; ++t )
+	{
+		recorders.emplace_back([&metrics]()
+		{
+			for ( std::size_t i = 0; i < each; ++i )
+			{
+				auto & shard = metrics.local();
+				shard.add(koti::http_metrics::counter::bytes_sent, 3);
+				shard.request(koti::http::verb::get, 200);
+				shard.record(koti::http_metrics::phase::handle, std::chrono::microseconds(i % 100));
+			}
+		});
+	}
+	for ( auto & t : recorders )
+	{
+		t.join();
+	}
+
+	EXPECT_EQ(threads, metrics.shards());
+	auto s = metrics.collect();
+	EXPECT_EQ(3 * threads * each, s[koti::http_metrics::counter::bytes_sent]);
+	EXPECT_EQ(threads * each, s.verbs[static_cast<std::size_t>(koti::http::verb::get)]);
+	EXPECT_EQ(threads * each, s.statuses[200 - koti::http_metrics::lowest_status]);
+	EXPECT_EQ(threads * each, s[koti::http_metrics::phase::handle].count);
+	EXPECT_EQ(threads * each / 100, s[koti::http_metrics::phase::handle].buckets[0]);
+
+	// a thread keeps to its shard, even across instances
+	koti::http_metrics other;
+	auto * mine = &metrics.local();
+	other.local();
+	EXPECT_EQ(mine, &metrics.local());
+	EXPECT_EQ(threads + 1, metrics.shards());
+}
+
+TEST(http_metrics_tests, endpoint_reports_requests_in_prometheus_format)
+{
+	namespace http = koti::http;
+	httpd_thread_endpoint fast;
+	koti::http_metrics metrics;
+	koti::http_metrics_endpoint endpoint{metrics};
+	endpoint.add_gauge("test_answer", "The answer.", []() { return 42.0; });
+
+	koti::http_router router;
+	router.add("/fast", fast);
+	router.add(endpoint);
+
+	auto responses = post_to(router, {
+		"GET /fast HTTP/1.1\r\nHost: test\r\n\r\n",
+		"POST /fast HTTP/1.1\r\nHost: test\r\nContent-Length: 3\r\n\r\nabc",
+		"GET /missing HTTP/1.1\r\nHost: test\r\n\r\n",
+		"GET /metrics HTTP/1.1\r\nHost: test\r\n\r\n",
+	}, nullptr, nullptr, &metrics);
+	ASSERT_EQ(4u, responses.size());
+	EXPECT_EQ(http::status::not_found, responses[2].result());
+	ASSERT_EQ(http::status::ok, responses[3].result());
+	EXPECT_EQ("text/plain; version=0.0.4; charset=utf-8", responses[3][http::field::content_type]);
+
+	// the scrape itself is counted once it is answered
+	const auto & text = responses[3].body();
+	EXPECT_NE(std::string::npos, text.find("koti_http_requests_total{method=\"GET\"} 2\n"));
+	EXPECT_NE(std::string::npos, text.find("koti_http_requests_total{method=\"POST\"} 1\n"));
+	EXPECT_NE(std::string::npos, text.find("koti_http_responses_total{code=\"200\"} 2\n"));
+	EXPECT_NE(std::string::npos, text.find("koti_http_responses_total{code=\"404\"} 1\n"));
+	EXPECT_NE(std::string::npos, text.find("# TYPE koti_http_handle_seconds histogram\n"));
+	EXPECT_NE(std::string::npos, text.find("koti_http_handle_seconds_bucket{le=\"+Inf\"} 3\n"));
+	EXPECT_NE(std::string::npos, text.find("koti_http_parse_seconds_count 4\n"));
+	EXPECT_NE(std::string::npos, text.find("koti_http_write_seconds_count 3\n"));
+	EXPECT_NE(std::string::npos, text.find("koti_http_parse_seconds_bucket{le=\"1e-06\"} "));
+	EXPECT_NE(std::string::npos, text.find("# TYPE test_answer gauge\ntest_answer 42\n"));
+
+	auto s = metrics.collect();
+	EXPECT_LT(0u, s[koti::http_metrics::counter::bytes_received]);
+	EXPECT_LT(text.size(), s[koti::http_metrics::counter::bytes_sent]);
+	EXPECT_EQ(4u, s[koti::http_metrics::phase::write].count);
+}
+
+TEST(io_context_pool_tests, round_robin_runs_one_thread_per_context)
+{
+    constexpr std::size_t context_count = 4;
+
+    koti::io_context_pool pool{context_count};
+    ASSERT_EQ(context_count, pool.size());
+
+    std::mutex mutex;
+    std::vector<std::thread::id> ids(context_count * 2);
+    std::atomic<std::size_t> ran{0};
+
+    for ( std::size_t i = 0; i < ids.size(); ++i )
+    {
+        asio::post(pool.next(), [&, i]()
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            ids[i] = std::this_thread::get_id();
+            ++ran;
+        });
+    }
+
+    pool.run();
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while ( ran < ids.size() && std::chrono::steady_clock::now() < until )
+    {
+        std::this_thread::yield();
+    }
+    pool.stop();
+    pool.join();
+
+    ASSERT_EQ(ids.size(), ran.load());
+    for ( std::size_t i = 0; i < context_count; ++i )
+    {
+        // contexts are handed out in order, so i and i + count share a thread
+        EXPECT_EQ(ids[i], ids[i + context_count]);
+        for ( std::size_t j = i + 1; j < context_count; ++j )
+        {
+            EXPECT_NE(ids[i], ids[j]);
+        }
+    }
+}
+
+TEST(io_context_pool_tests, poll_runs_what_is_left_once_joined)
+{
+    koti::io_context_pool pool{2};
+    pool.run();
+    pool.stop();
+    pool.join();
+
+    // as when closing a socket queues its aborted operations
+    std::vector<std::thread::id> ids;
+    for ( std::size_t i = 0; i < 4; ++i )
+    {
+        asio::post(pool.next(), [&]()
+        {
+            ids.push_back(std::this_thread::get_id());
+        });
+    }
+
+    EXPECT_EQ(4u, pool.poll());
+    ASSERT_EQ(4u, ids.size());
+    for ( const auto & id : ids )
+    {
+        EXPECT_EQ(std::this_thread::get_id(), id);
+    }
+    EXPECT_EQ(0u, pool.poll());
+}
+
+TEST_F(httpd_tests, accepts_onto_io_context_pool)
+{
+    constexpr std::size_t connection_count = 1024;
+
+    auto local = koti::local_stream::endpoint{test_socket_path().string()};
+    fs::remove(test_socket_path());
+
+    koti::io_context_pool pool{4};
+    handler server{iox_};
+    server.set_io_context_pool(&pool);
+    ASSERT_NO_THROW(server.listen(local));
+    pool.run();
+
+    std::atomic<std::size_t> connect_failures{0};
+    std::thread client([&]()
+    {
+        for ( std::size_t i = 0; i < connection_count; ++i )
+        {
+            int native = connect_local(local);
+            if ( native < 0 )
+            {
+                ++connect_failures;
+                continue;
+            }
+            ::close(native);
+        }
+    });
+
+    run_until_accepted(iox_, server, connection_count);
+    client.join();
+    server.close();
+    pool.stop();
+    pool.join();
+    fs::remove(test_socket_path());
+
+    EXPECT_EQ(0u, connect_failures.load());
+    EXPECT_EQ(connection_count, server.accepted());
+}
+
+TEST_F(httpd_tests, accepts_through_io_uring)
+{
+    constexpr std::size_t connection_count = 4096;
+
+    auto local = koti::local_stream::endpoint{test_socket_path().string()};
+    fs::remove(test_socket_path());
+
+    koti::io_context_pool pool{2};
+    handler server{iox_};
+    server.set_io_context_pool(&pool);
+    server.set_io_backend(koti::http_io_backend::io_uring);
+    ASSERT_NO_THROW(server.listen(local, 128));
+    pool.run();
+
+    // kernels without io_uring fall back to the reactor; the connections
+    // are accepted all the same
+    if ( koti::http_io_backend::io_uring != server.io_backend() )
+    {
+        EXPECT_TRUE(server.io_backend_error());
+    }
+
+    std::atomic<std::size_t> connect_failures{0};
+    std::thread client([&]()
+    {
+        for ( std::size_t i = 0; i < connection_count; ++i )
+        {
+            int native = connect_local(local);
+            if ( native < 0 )
+            {
+                ++connect_failures;
+                continue;
+            }
+            ::close(native);
+        }
+    });
+
+    run_until_accepted(iox_, server, connection_count);
+    client.join();
+    server.close();
+    pool.stop();
+    pool.join();
+
+    // the ring has let go of the listening socket; its address is free
+    koti::local_stream::acceptor rebound{iox_};
+    fs::remove(test_socket_path());
+    EXPECT_NO_THROW(rebound.open(koti::local_stream{}));
+    EXPECT_NO_THROW(rebound.bind(local));
+    rebound.close();
+    fs::remove(test_socket_path());
+
+    EXPECT_EQ(0u, connect_failures.load());
+    EXPECT_EQ(connection_count, server.accepted());
+}
+
+class httpd_named_endpoint
+: public koti::http_endpoint
+{
+public:
+	explicit
+	httpd_named_endpoint(
+		std::string name
+	)
+	: name_(std::move(name))
+	{
+	}
+
+	koti::http_response
+	handle(
+		koti::http_connection & connection,
+		koti::http_request & request
+	) override
+	{
+		// name, then every capture as name=value
+		auto response = koti::http_make_response(request.get_allocator());
+		response.result(koti::http::status::ok);
+		response.version(request.version());
+		response.body().assign(name_.data(), name_.size());
+		for ( const auto & capture : connection.route_captures() )
+		{
+			response.body() += " ";
+			response.body().append(capture.first.data(), capture.first.size());
+			response.body() += "=";
+			response.body().append(capture.second.data(), capture.second.size());
+		}
+		response.prepare_payload();
+		return response;
+	}
+
+protected:
+	std::string name_;
+};
+
+class http_router_tests
+: public ::testing::Test
+{
+public:
+    http_router_tests()
+    : server_side_{iox_}
+    , client_side_{iox_}
+    {
+        boost::asio::local::connect_pair(server_side_, client_side_);
+        connection_ = std::make_unique<koti::http_connection>(std::move(server_side_));
+    }
+
+    koti::http_response
+    dispatch(
+        koti::http_endpoint & root,
+        koti::http::verb verb,
+        std::string_view target
+    )
+    {
+        auto request = koti::http_make_request();
+        request.method(verb);
+        request.target(boost::beast::string_view{target.data(), target.size()});
+        request.version(11);
+        connection_->route_captures().clear();
+        return root.handle(*connection_, request);
+    }
+
+    boost::asio::io_context iox_;
+    koti::local_stream::socket server_side_;
+    koti::local_stream::socket client_side_;
+    std::unique_ptr<koti::http_connection> connection_;
+};
+
+TEST_F(http_router_tests, literal_parameter_and_wildcard_routes)
+{
+    httpd_named_endpoint root{"root"}, users{"users"}, user{"user"}, me{"me"},
+        posts{"posts"}, files{"files"};
+
+    koti::http_router router;
+    router
+        .add("/", root)
+        .add("/users", users)
+        .add("/users/:id", user)
+        .add("/users/me", me)
+        .add("/users/:id/posts/:post", posts)
+        .add("/files/*path", files);
+
+    EXPECT_EQ("root", dispatch(router, koti::http::verb::get, "/").body());
+    EXPECT_EQ("users", dispatch(router, koti::http::verb::get, "/users?page=2").body());
+    EXPECT_EQ("user id=42", dispatch(router, koti::http::verb::get, "/users/42").body());
+    EXPECT_EQ("me", dispatch(router, koti::http::verb::get, "/users/me").body());
+    EXPECT_EQ("posts id=me post=7", dispatch(router, koti::http::verb::get, "/users/me/posts/7").body());
+    EXPECT_EQ("files path=a/b/c.txt", dispatch(router, koti::http::verb::get, "/files/a/b/c.txt").body());
+    EXPECT_EQ("files path=", dispatch(router, koti::http::verb::get, "/files").body());
+
+    EXPECT_EQ(
+        koti::http::status::not_found,
+        dispatch(router, koti::http::verb::get, "/users/42/comments").result()
+    );
+    EXPECT_EQ(
+        koti::http::status::not_found,
+        dispatch(router, koti::http::verb::get, "/nowhere").result()
+    );
+}
+
+TEST_F(http_router_tests, verb_dispatch)
+{
+    httpd_named_endpoint get{"get"}, post{"post"};
+
+    koti::http_router router;
+    router
+        .add(koti::http::verb::get, "/items/:id", get)
+        .add(koti::http::verb::post, "/items/:id", post);
+
+    EXPECT_EQ("get id=1", dispatch(router, koti::http::verb::get, "/items/1").body());
+    EXPECT_EQ("post id=1", dispatch(router, koti::http::verb::post, "/items/1").body());
+
+    auto response = dispatch(router, koti::http::verb::delete_, "/items/1");
+    EXPECT_EQ(koti::http::status::method_not_allowed, response.result());
+    EXPECT_EQ("GET, POST", response[koti::http::field::allow]);
+}
+
+TEST_F(http_router_tests, static_route_table)
+{
+    static constexpr auto routes = koti::make_http_static_route_table(
+        "/status", "/metrics", "/version", "/"
+    );
+    static_assert(4 == routes.size());
+    static_assert(1 == routes.find("/metrics"));
+    static_assert(3 == routes.find("/"));
+    static_assert(decltype(routes)::npos == routes.find("/metric"));
+
+    httpd_named_endpoint status{"status"}, metrics{"metrics"}, version{"version"}, root{"root"};
+    koti::http_static_router<4> router{routes, {&status, &metrics, &version, &root}};
+
+    EXPECT_EQ("metrics", dispatch(router, koti::http::verb::get, "/metrics").body());
+    EXPECT_EQ("root", dispatch(router, koti::http::verb::get, "/?x=1").body());
+    EXPECT_EQ(
+        koti::http::status::not_found,
+        dispatch(router, koti::http::verb::get, "/status/").result()
+    );
+}
+
+namespace {
+
+// child's, counting how often the connection asks which endpoint a
+// request goes to
+class httpd_resolve_counting_endpoint
+: public koti::http_endpoint
+{
+public:
+	explicit
+	httpd_resolve_counting_endpoint(
+		koti::http_endpoint & child
+	)
+	: child_(child)
+	{
+	}
+
+	koti::http_response
+	handle(
+		koti::http_connection & connection,
+		koti::http_request & request
+	) override
+	{
+		return child_.handle(connection, request);
+	}
+
+	koti::http_endpoint *
+	resolve(
+		koti::http_connection & connection,
+		const koti::http_request_header & header
+	) override
+	{
+		++resolves_;
+		return child_.resolve(connection, header);
+	}
+
+	std::size_t resolves_ = 0;
+
+protected:
+	koti::http_endpoint & child_;
+};
+
+} // namespace
+
+TEST(http_router_connection_tests, requests_are_resolved_once)
+{
+	namespace http = koti::http;
+	httpd_named_endpoint user{"user"};
+	httpd_thread_endpoint slow;
+	koti::http_router router;
+	router
+		.add("/users/:id", user)
+		.add("/slow", slow);
+	httpd_resolve_counting_endpoint root{router};
+	koti::worker_pool pool{2};
+
+	auto responses = post_to(root, {
+		"GET /users/42 HTTP/1.1\r\nHost: test\r\n\r\n",
+		"POST /users/7 HTTP/1.1\r\nHost: test\r\nContent-Length: 3\r\n\r\nabc",
+		"GET /slow HTTP/1.1\r\nHost: test\r\n\r\n",
+		"GET /missing HTTP/1.1\r\nHost: test\r\n\r\n",
+	}, &pool);
+	ASSERT_EQ(4u, responses.size());
+
+	// the captures of the one walk reach the endpoint, body or not
+	EXPECT_EQ("user id=42", responses[0].body());
+	EXPECT_EQ("user id=7", responses[1].body());
+	EXPECT_EQ("worker", responses[2].body());
+	EXPECT_EQ(http::status::not_found, responses[3].result());
+	EXPECT_EQ(4u, root.resolves_);
+}
+
+namespace {
+
+// serves what it accepts, on whichever thread it is handed over on;
+// connections live until the handler does
+template <
+	class Protocol
+>
+class httpd_serving_test_handler
+: public koti::httpd_logs
+, public koti::httpd<httpd_serving_test_handler<Protocol>, Protocol>
+{
+public:
+	using koti::httpd<httpd_serving_test_handler, Protocol>::httpd;
+
+	void
+	set_root_endpoint(
+		koti::http_endpoint * root
+	)
+	{
+		root_ = root;
+	}
+
+	void
+	on_new_connection(
+		const boost::system::error_code & ec,
+		typename Protocol::socket && socket
+	)
+	{
+		if ( ec )
+		{
+			++failed_;
+			return;
+		}
+
+		asio::ip::tcp::no_delay no_delay{true};
+		if constexpr ( std::is_same_v<asio::ip::tcp, Protocol> )
+		{
+			boost::system::error_code option_ec;
+			socket.get_option(no_delay, option_ec);
+		}
+
+		auto connection = std::make_unique<koti::http_connection>(std::move(socket));
+		connection->set_root_endpoint(root_);
+		connection->set_read_buffer(&this->buffer_pool());
+		connection->set_draining(&this->draining_flag());
+		auto started = connection.get();
+		{
+			std::lock_guard<std::mutex> lock{mutex_};
+			threads_.insert(std::this_thread::get_id());
+			no_delay_ = no_delay_ && no_delay.value();
+			connections_.push_back(std::move(connection));
+		}
+		++accepted_;
+		started->async_read();
+	}
+
+	std::size_t
+	accepted() const
+	{
+		return accepted_;
+	}
+
+	// accepts that failed
+	std::size_t
+	failed() const
+	{
+		return failed_;
+	}
+
+	std::size_t
+	accepting_threads()
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+		return threads_.size();
+	}
+
+	bool
+	no_delay()
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+		return no_delay_;
+	}
+
+	// from the connections' thread
+	std::vector<int>
+	release_idle()
+	{
+		std::vector<int> released;
+		std::lock_guard<std::mutex> lock{mutex_};
+		for ( auto & connection : connections_ )
+		{
+			auto native = connection->release_if_idle();
+			if ( 0 <= native )
+			{
+				released.push_back(native);
+			}
+		}
+		return released;
+	}
+
+	// from the connections' thread
+	std::size_t
+	close_idle()
+	{
+		std::size_t closed = 0;
+		std::lock_guard<std::mutex> lock{mutex_};
+		for ( auto & connection : connections_ )
+		{
+			if ( connection->close_if_idle() )
+			{
+				++closed;
+			}
+		}
+		return closed;
+	}
+
+protected:
+	koti::http_endpoint * root_ = nullptr;
+	std::atomic<std::size_t> accepted_{0};
+	std::atomic<std::size_t> failed_{0};
+	std::mutex mutex_;
+	std::set<std::thread::id> threads_;
+	bool no_delay_ = true;
+	std::vector<koti::http_connection::ptr> connections_;
+};
+
+using httpd_tcp_test_handler = httpd_serving_test_handler<asio::ip::tcp>;
+
+template <
+	class Protocol
+>
+std::string
+http_get(
+	const typename Protocol::endpoint & at,
+	std::string_view target
+)
+{
+	asio::io_context iox;
+	typename Protocol::socket client{iox};
+	boost::system::error_code ec;
+	client.connect(at, ec);
+	if ( ec )
+	{
+		return {};
+	}
+
+	auto request = std::string{"GET "} + std::string{target} + " HTTP/1.1\r\nHost: test\r\nConnection: close\r\n\r\n";
+	asio::write(client, asio::buffer(request), ec);
+
+	std::string received;
+	char buffer[4096];
+	while ( ! ec )
+	{
+		auto got = client.read_some(asio::buffer(buffer), ec);
+		received.append(buffer, got);
+	}
+	return received;
+}
+
+} // namespace
+
+TEST(http_tcp_tests, endpoint_tree_is_served_over_tcp_and_local_sockets)
+{
+	httpd_named_endpoint hello{"hello"};
+	koti::http_router router;
+	router.add("/hello", hello);
+
+	boost::asio::io_context iox;
+	httpd_tcp_test_handler server{iox};
+	server.set_root_endpoint(&router);
+	ASSERT_NO_THROW(server.listen());
+	EXPECT_TRUE(server.listening_endpoint().address().is_loopback());
+	EXPECT_NE(0u, server.listening_endpoint().port());
+	EXPECT_EQ(1u, server.acceptor_count());
+
+	std::string received;
+	std::thread client([&]()
+	{
+		received = http_get<asio::ip::tcp>(server.listening_endpoint(), "/hello");
+	});
+
+	auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while ( received.empty() && std::chrono::steady_clock::now() < until )
+	{
+		iox.run_one_for(std::chrono::milliseconds(100));
+	}
+	client.join();
+	server.close();
+
+	EXPECT_EQ(1u, server.accepted());
+	EXPECT_TRUE(server.no_delay());
+	EXPECT_NE(std::string::npos, received.find("200 OK"));
+	EXPECT_NE(std::string::npos, received.find("\r\n\r\nhello"));
+}
+
+TEST(http_tcp_tests, reuseport_shards_accept_on_every_thread)
+{
+	constexpr std::size_t connection_count = 256;
+
+	httpd_named_endpoint hello{"hello"};
+	koti::http_router router;
+	router.add("/hello", hello);
+
+	boost::asio::io_context iox;
+	koti::io_context_pool pool{4};
+	httpd_tcp_test_handler server{iox};
+	server.set_root_endpoint(&router);
+	server.set_io_context_pool(&pool);
+
+	koti::http_tcp_options options;
+	options.reuse_port = true;
+	options.defer_accept = std::chrono::seconds{1};
+	server.set_tcp_options(options);
+	ASSERT_NO_THROW(server.listen());
+	EXPECT_EQ(pool.size(), server.acceptor_count());
+	pool.run();
+
+	std::size_t answered = 0;
+	for ( std::size_t i = 0; i < connection_count; ++i )
+	{
+		auto received = http_get<asio::ip::tcp>(server.listening_endpoint(), "/hello");
+		answered += std::string::npos != received.find("200 OK") ? 1u : 0u;
+	}
+
+	server.close();
+	pool.stop();
+	pool.join();
+
+	EXPECT_EQ(connection_count, answered);
+	EXPECT_EQ(connection_count, server.accepted());
+
+	// the kernel spreads connections by their addresses; 256 of them
+	// landing on one acceptor out of four does not happen
+	EXPECT_LT(1u, server.accepting_threads());
+}
+
+TEST(http_tcp_tests, endpoints_parse_with_and_without_brackets)
+{
+	asio::ip::tcp::endpoint at;
+	ASSERT_TRUE(koti::http_parse_tcp_endpoint("127.0.0.1:8080", at));
+	EXPECT_EQ(asio::ip::make_address("127.0.0.1"), at.address());
+	EXPECT_EQ(8080u, at.port());
+	ASSERT_TRUE(koti::http_parse_tcp_endpoint("[::1]:0", at));
+	EXPECT_TRUE(at.address().is_v6());
+	EXPECT_EQ(0u, at.port());
+
+	EXPECT_FALSE(koti::http_parse_tcp_endpoint("127.0.0.1", at));
+	EXPECT_FALSE(koti::http_parse_tcp_endpoint("127.0.0.1:", at));
+	EXPECT_FALSE(koti::http_parse_tcp_endpoint("127.0.0.1:65536", at));
+	EXPECT_FALSE(koti::http_parse_tcp_endpoint("localhost:80", at));
+	EXPECT_FALSE(koti::http_parse_tcp_endpoint("[::1:80", at));
+}
+
+TEST(http_session_tests, connected_until_closed)
+{
+	boost::asio::io_context iox;
+	koti::local_stream::socket server_side{iox};
+	koti::local_stream::socket client_side{iox};
+	boost::asio::local::connect_pair(server_side, client_side);
+
+	auto session = koti::http_session::upgrade(
+		std::make_unique<koti::http_connection>(std::move(server_side))
+	);
+	EXPECT_TRUE(session->is_connected());
+	session->connection().close();
+	EXPECT_FALSE(session->is_connected());
+}
+
+TEST(http_tcp_tests, cpu_steering_still_serves_every_connection)
+{
+	constexpr std::size_t connection_count = 64;
+
+	httpd_named_endpoint hello{"hello"};
+	koti::http_router router;
+	router.add("/hello", hello);
+
+	boost::asio::io_context iox;
+	koti::io_context_pool pool{2};
+	httpd_tcp_test_handler server{iox};
+	server.set_root_endpoint(&router);
+	server.set_io_context_pool(&pool);
+	server.set_shard_accept(true);
+
+	koti::http_tcp_options options;
+	options.steer_by_cpu = true;
+	server.set_tcp_options(options);
+	ASSERT_NO_THROW(server.listen());
+	EXPECT_EQ(pool.size(), server.acceptor_count());
+	pool.run(true);
+
+	// kernels without SO_ATTACH_REUSEPORT_CBPF report it in
+	// steering_error() and spread connections by hash instead; either way
+	// every connection is served
+	std::size_t answered = 0;
+	for ( std::size_t i = 0; i < connection_count; ++i )
+	{
+		auto received = http_get<asio::ip::tcp>(server.listening_endpoint(), "/hello");
+		answered += std::string::npos != received.find("200 OK") ? 1u : 0u;
+	}
+
+	server.close();
+	pool.stop();
+	pool.join();
+
+	EXPECT_EQ(connection_count, answered);
+	EXPECT_EQ(connection_count, server.accepted());
+}
+
+TEST_F(httpd_tests, shard_accept_queues_local_connections_to_every_thread)
+{
+	constexpr std::size_t connection_count = 512;
+
+	auto local = koti::local_stream::endpoint{test_socket_path().string()};
+	fs::remove(test_socket_path());
+
+	httpd_named_endpoint hello{"hello"};
+	koti::http_router router;
+	router.add("/hello", hello);
+
+	koti::io_context_pool pool{4};
+	httpd_serving_test_handler<koti::local_stream> server{iox_};
+	server.set_root_endpoint(&router);
+	server.set_io_context_pool(&pool);
+	server.set_shard_accept(true);
+	server.set_handoff_capacity(16);
+	ASSERT_NO_THROW(server.listen(local));
+	EXPECT_EQ(1u, server.acceptor_count());
+	EXPECT_EQ(koti::http_io_backend::epoll, server.io_backend());
+	pool.run();
+
+	std::atomic<std::size_t> answered{0};
+	std::vector<std::thread> clients;
+	for ( std::size_t c = 0; c < 4; ++c )
+	{
+		clients.emplace_back([&]()
+		{
+			for ( std::size_t i = 0; i < connection_count / 4; ++i )
+			{
+				auto received = http_get<koti::local_stream>(local, "/hello");
+				answered += std::string::npos != received.find("200 OK") ? 1u : 0u;
+			}
+		});
+	}
+
+	auto until = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+	while ( answered < connection_count && std::chrono::steady_clock::now() < until )
+	{
+		iox_.run_one_for(std::chrono::milliseconds(100));
+	}
+	for ( auto & client : clients )
+	{
+		client.join();
+	}
+	server.close();
+	pool.stop();
+	pool.join();
+	fs::remove(test_socket_path());
+
+	EXPECT_EQ(connection_count, answered.load());
+	EXPECT_EQ(connection_count, server.accepted());
+	EXPECT_EQ(0u, server.handoff_dropped());
+
+	// handed out round-robin, and started by the thread that serves them
+	EXPECT_EQ(pool.size(), server.accepting_threads());
+}
+
+TEST_F(httpd_tests, draining_closes_connections_still_queued_to_the_pool)
+{
+	auto local = koti::local_stream::endpoint{test_socket_path().string()};
+	fs::remove(test_socket_path());
+
+	koti::io_context_pool pool{2};
+	httpd_serving_test_handler<koti::local_stream> server{iox_};
+	server.set_io_context_pool(&pool);
+	server.set_shard_accept(true);
+	ASSERT_NO_THROW(server.listen(local));
+	pool.run();
+
+	// the pool is busy while the connection is accepted and queued to it
+	std::promise<void> release;
+	auto released = release.get_future().share();
+	for ( std::size_t i = 0; i < pool.size(); ++i )
+	{
+		asio::post(pool.at(i), [released]() { released.wait(); });
+	}
+
+	boost::asio::io_context client_iox;
+	koti::local_stream::socket client{client_iox};
+	client.connect(local);
+	iox_.run_for(std::chrono::milliseconds(100));
+
+	// drain() waits for the pool to get round to its queues
+	std::thread releaser([&]()
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		release.set_value();
+	});
+	server.drain();
+	releaser.join();
+
+	::pollfd readable{client.native_handle(), POLLIN, 0};
+	ASSERT_EQ(1, ::poll(&readable, 1, 2000));
+	char byte;
+	EXPECT_EQ(0, ::read(client.native_handle(), &byte, 1));
+	EXPECT_EQ(0u, server.accepted());
+
+	pool.stop();
+	pool.join();
+	fs::remove(test_socket_path());
+}
+
+TEST(http_tcp_tests, listening_again_closes_shards_on_their_threads)
+{
+	httpd_named_endpoint hello{"hello"};
+	koti::http_router router;
+	router.add("/hello", hello);
+
+	boost::asio::io_context iox;
+	koti::io_context_pool pool{4};
+	httpd_tcp_test_handler server{iox};
+	server.set_root_endpoint(&router);
+	server.set_io_context_pool(&pool);
+
+	koti::http_tcp_options options;
+	options.reuse_port = true;
+	server.set_tcp_options(options);
+	pool.run();
+
+	// each listen() replaces shards that are accepting on the pool
+	std::size_t answered = 0;
+	for ( std::size_t i = 0; i < 32; ++i )
+	{
+		ASSERT_NO_THROW(server.listen());
+		auto received = http_get<asio::ip::tcp>(server.listening_endpoint(), "/hello");
+		answered += std::string::npos != received.find("200 OK") ? 1u : 0u;
+	}
+
+	server.close();
+	pool.stop();
+	pool.join();
+
+	EXPECT_EQ(32u, answered);
+	EXPECT_EQ(32u, server.accepted());
+}
+
+TEST(http_spsc_queue_tests, bounded_and_in_order)
+{
+	koti::http_spsc_queue<int> queue{3};
+	EXPECT_EQ(4u, queue.capacity());
+
+	for ( int i = 0; i < 4; ++i )
+	{
+		EXPECT_TRUE(queue.try_push(i));
+	}
+	EXPECT_FALSE(queue.try_push(4));
+	EXPECT_EQ(4u, queue.size());
+
+	int value = -1;
+	EXPECT_TRUE(queue.try_pop(value));
+	EXPECT_EQ(0, value);
+	EXPECT_TRUE(queue.try_push(4));
+	for ( int i = 1; i < 5; ++i )
+	{
+		EXPECT_TRUE(queue.try_pop(value));
+		EXPECT_EQ(i, value);
+	}
+	EXPECT_FALSE(queue.try_pop(value));
+}
+
+TEST(http_spsc_queue_tests, hands_everything_across_threads)
+{
+	constexpr std::size_t count = 1000000;
+	koti::http_spsc_queue<std::size_t> queue{64};
+
+	std::thread producer([&]()
+	{
+		for ( std::size_t i = 0; i < count; )
+		{
+			if ( queue.try_push(i) )
+			{
+				++i;
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+	});
+
+	std::size_t expected = 0;
+	bool in_order = true;
+	while ( expected < count )
+	{
+		std::size_t value;
+		if ( queue.try_pop(value) )
+		{
+			in_order = in_order && expected == value;
+			++expected;
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+	producer.join();
+
+	EXPECT_TRUE(in_order);
+	EXPECT_EQ(0u, queue.size());
+}
+
+TEST(http_handoff_tests, descriptors_cross_a_socket_pair)
+{
+	int control[2];
+	ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, control));
+	int pipes[2][2];
+	ASSERT_EQ(0, ::pipe(pipes[0]));
+	ASSERT_EQ(0, ::pipe(pipes[1]));
+
+	boost::system::error_code ec;
+	koti::http_send_descriptors(control[0], koti::http_handoff_tag::connections, {pipes[0][1], pipes[1][1]}, ec);
+	ASSERT_FALSE(ec) << ec.message();
+	koti::http_send_descriptors(control[0], koti::http_handoff_tag::done, {}, ec);
+	ASSERT_FALSE(ec) << ec.message();
+	::close(control[0]);
+
+	std::vector<int> received;
+	EXPECT_EQ(koti::http_handoff_tag::connections, koti::http_receive_descriptors(control[1], received, ec));
+	ASSERT_FALSE(ec) << ec.message();
+	ASSERT_EQ(2u, received.size());
+	EXPECT_EQ(koti::http_handoff_tag::done, koti::http_receive_descriptors(control[1], received, ec));
+	EXPECT_EQ(2u, received.size());
+	koti::http_receive_descriptors(control[1], received, ec);
+	EXPECT_EQ(boost::asio::error::eof, ec);
+	::close(control[1]);
+
+	// the received descriptors are the pipes' write ends
+	for ( std::size_t i = 0; i < 2; ++i )
+	{
+		char sent = static_cast<char>('a' + i), got = 0;
+		EXPECT_EQ(1, ::write(received[i], &sent, 1));
+		EXPECT_EQ(1, ::read(pipes[i][0], &got, 1));
+		EXPECT_EQ(sent, got);
+		::close(received[i]);
+		::close(pipes[i][0]);
+		::close(pipes[i][1]);
+	}
+
+	EXPECT_EQ(AF_UNSPEC, koti::http_socket_family(pipes[0][0]));
+}
+
+namespace {
+
+// runs f on iox, which another thread is running, and waits for it
+template <
+	class Function
+>
+auto
+run_on(
+	boost::asio::io_context & iox,
+	Function f
+)
+{
+	std::packaged_task<decltype(f())()> task{std::move(f)};
+	auto result = task.get_future();
+	asio::post(iox, [&task]() { task(); });
+	return result.get();
+}
+
+// reads one response whose body ends with body
+std::string
+read_response(
+	koti::local_stream::socket & client,
+	std::string_view body
+)
+{
+	std::string received;
+	char buffer[4096];
+	boost::system::error_code ec;
+	while ( ! ec && ( received.size() < body.size() || 0 != received.compare(received.size() - body.size(), body.size(), body) ) )
+	{
+		auto got = client.read_some(asio::buffer(buffer), ec);
+		received.append(buffer, got);
+	}
+	return received;
+}
+
+} // namespace
+
+TEST_F(httpd_tests, adopted_listeners_keep_accepting)
+{
+	auto local = koti::local_stream::endpoint{test_socket_path().string()};
+	fs::remove(test_socket_path());
+
+	httpd_named_endpoint hello{"hello"};
+	koti::http_router router;
+	router.add("/hello", hello);
+
+	httpd_serving_test_handler<koti::local_stream> old_server{iox_}, new_server{iox_};
+	old_server.set_root_endpoint(&router);
+	new_server.set_root_endpoint(&router);
+	ASSERT_NO_THROW(old_server.listen(local));
+
+	// as if from another process: a copy of the same socket
+	auto handles = old_server.listening_handles();
+	ASSERT_EQ(1u, handles.size());
+	EXPECT_EQ(AF_UNIX, koti::http_socket_family(handles.front()));
+	ASSERT_NO_THROW(new_server.adopt({::dup(handles.front())}));
+	old_server.close();
+
+	std::string received;
+	std::thread client([&]()
+	{
+		received = http_get<koti::local_stream>(local, "/hello");
+	});
+
+	auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while ( received.empty() && std::chrono::steady_clock::now() < until )
+	{
+		iox_.run_one_for(std::chrono::milliseconds(100));
+	}
+	client.join();
+	new_server.close();
+	fs::remove(test_socket_path());
+
+	EXPECT_EQ(0u, old_server.accepted());
+	EXPECT_EQ(1u, new_server.accepted());
+	EXPECT_NE(std::string::npos, received.find("200 OK"));
+}
+
+TEST_F(httpd_tests, idle_connections_are_handed_to_another_listener)
+{
+	auto local = koti::local_stream::endpoint{test_socket_path().string()};
+	fs::remove(test_socket_path());
+
+	httpd_named_endpoint hello{"hello"};
+	koti::http_router router;
+	router.add("/hello", hello);
+
+	httpd_serving_test_handler<koti::local_stream> old_server{iox_}, new_server{iox_};
+	old_server.set_root_endpoint(&router);
+	new_server.set_root_endpoint(&router);
+	ASSERT_NO_THROW(old_server.listen(local));
+
+	auto work = asio::make_work_guard(iox_);
+	std::thread runner([&]() { iox_.run(); });
+
+	boost::asio::io_context client_iox;
+	koti::local_stream::socket client{client_iox};
+	client.connect(local);
+	std::string_view request = "GET /hello HTTP/1.1\r\nHost: test\r\n\r\n";
+	asio::write(client, asio::buffer(request.data(), request.size()));
+	EXPECT_NE(std::string::npos, read_response(client, "hello").find("200 OK"));
+
+	// the connection goes back to waiting just after the response is out
+	std::vector<int> released;
+	auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while ( released.empty() && std::chrono::steady_clock::now() < until )
+	{
+		released = run_on(iox_, [&]() { return old_server.release_idle(); });
+	}
+	ASSERT_EQ(1u, released.size());
+	run_on(iox_, [&]()
+	{
+		new_server.adopt_connection(released.front());
+		old_server.close();
+		return 0;
+	});
+
+	// same client connection, served by the other listener
+	asio::write(client, asio::buffer(request.data(), request.size()));
+	EXPECT_NE(std::string::npos, read_response(client, "hello").find("200 OK"));
+
+	work.reset();
+	iox_.stop();
+	runner.join();
+	new_server.close();
+	fs::remove(test_socket_path());
+
+	EXPECT_EQ(1u, old_server.accepted());
+	EXPECT_EQ(1u, new_server.accepted());
+}
+
+TEST_F(httpd_tests, draining_closes_connections_after_their_response)
+{
+	auto local = koti::local_stream::endpoint{test_socket_path().string()};
+	fs::remove(test_socket_path());
+
+	httpd_named_endpoint hello{"hello"};
+	koti::http_router router;
+	router.add("/hello", hello);
+
+	httpd_serving_test_handler<koti::local_stream> server{iox_};
+	server.set_root_endpoint(&router);
+	ASSERT_NO_THROW(server.listen(local));
+
+	auto work = asio::make_work_guard(iox_);
+	std::thread runner([&]() { iox_.run(); });
+
+	boost::asio::io_context client_iox;
+	koti::local_stream::socket busy{client_iox}, idle{client_iox};
+	busy.connect(local);
+	idle.connect(local);
+	std::string_view request = "GET /hello HTTP/1.1\r\nHost: test\r\n\r\n";
+	asio::write(busy, asio::buffer(request.data(), request.size()));
+	auto before = read_response(busy, "hello");
+	EXPECT_NE(std::string::npos, before.find("200 OK"));
+	EXPECT_EQ(std::string::npos, before.find("Connection: close"));
+
+	auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while ( server.accepted() < 2u && std::chrono::steady_clock::now() < until )
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	run_on(iox_, [&]()
+	{
+		server.drain();
+		return 0;
+	});
+	EXPECT_TRUE(server.draining());
+
+	// no longer accepting
+	koti::local_stream::socket late{client_iox};
+	boost::system::error_code ec;
+	late.connect(local, ec);
+	EXPECT_TRUE(ec);
+
+	// answered, then closed
+	asio::write(busy, asio::buffer(request.data(), request.size()));
+	auto after = read_response(busy, "hello");
+	EXPECT_NE(std::string::npos, after.find("200 OK"));
+	EXPECT_NE(std::string::npos, after.find("Connection: close"));
+	char byte;
+	busy.read_some(asio::buffer(&byte, 1), ec);
+	EXPECT_EQ(asio::error::eof, ec);
+
+	// nothing to answer on this one
+	EXPECT_EQ(1u, run_on(iox_, [&]() { return server.close_idle(); }));
+	idle.read_some(asio::buffer(&byte, 1), ec);
+	EXPECT_EQ(asio::error::eof, ec);
+
+	work.reset();
+	iox_.stop();
+	runner.join();
+	fs::remove(test_socket_path());
+
+	EXPECT_EQ(2u, server.accepted());
+}
+
+namespace {
+
+// answers with the target and how many requests it has handled, and the
+// request's X-Reply-Cache-Control as its Cache-Control
+class httpd_counting_endpoint
+: public koti::http_endpoint
+{
+public:
+	koti::http_response
+	handle(
+		koti::http_connection & connection,
+		koti::http_request & request
+	) override
+	{
+		(void)connection;
+		auto response = koti::http_make_response(request.get_allocator());
+		response.result(koti::http::status::ok);
+		response.version(request.version());
+		response.body().assign(request.target().data(), request.target().size());
+		response.body() += " " + std::to_string(++handled_);
+		auto cache_control = request["X-Reply-Cache-Control"];
+		if ( false == cache_control.empty() )
+		{
+			response.set(koti::http::field::cache_control, cache_control);
+		}
+		auto vary = request["X-Reply-Vary"];
+		if ( false == vary.empty() )
+		{
+			response.set(koti::http::field::vary, vary);
+		}
+		response.prepare_payload();
+		return response;
+	}
+
+	std::size_t
+	handled() const
+	{
+		return handled_;
+	}
+
+protected:
+	std::atomic<std::size_t> handled_{0};
+};
+
+// serves root on one local connection until destroyed
+struct httpd_cache_test_server
+{
+	httpd_cache_test_server(
+		boost::asio::io_context & iox,
+		const koti::local_stream::endpoint & at,
+		koti::http_endpoint & root
+	)
+	: iox_(iox)
+	, server_(iox)
+	, work_(asio::make_work_guard(iox))
+	{
+		server_.set_root_endpoint(&root);
+		server_.listen(at);
+		runner_ = std::thread([this]() { iox_.run(); });
+		client_.connect(at);
+	}
+
+	~httpd_cache_test_server()
+	{
+		work_.reset();
+		iox_.stop();
+		runner_.join();
+	}
+
+	// one request with the given extra header lines, and its response
+	std::string
+	exchange(
+		std::string_view method,
+		std::string_view target,
+		std::string_view fields = {}
+	)
+	{
+		std::string request{method};
+		request += " ";
+		request += target;
+		request += " HTTP/1.1\r\nHost: test\r\n";
+		request += fields;
+		request += "\r\n";
+		asio::write(client_, asio::buffer(request));
+
+		// the header, then as much body as it says there is
+		std::string received;
+		boost::system::error_code ec;
+		auto header_end = asio::read_until(client_, asio::dynamic_buffer(received), "\r\n\r\n", ec);
+		std::size_t length = 0;
+		auto field = received.find("Content-Length: ");
+		if ( "HEAD" != method && std::string::npos != field && field < header_end )
+		{
+			length = std::stoul(received.substr(field + 16));
+		}
+		if ( received.size() < header_end + length )
+		{
+			asio::read(client_, asio::dynamic_buffer(received), asio::transfer_exactly(header_end + length - received.size()), ec);
+		}
+		return received;
+	}
+
+	boost::asio::io_context & iox_;
+	httpd_serving_test_handler<koti::local_stream> server_;
+	asio::executor_work_guard<boost::asio::io_context::executor_type> work_;
+	std::thread runner_;
+	boost::asio::io_context client_iox_;
+	koti::local_stream::socket client_{client_iox_};
+};
+
+// the body of a response, from its last blank line on
+std::string
+response_body(
+	const std::string & response
+)
+{
+	auto blank = response.rfind("\r\n\r\n");
+	return std::string::npos == blank ? std::string{} : response.substr(blank + 4);
+}
+
+} // namespace
+
+TEST_F(httpd_tests, response_cache_answers_repeated_gets)
+{
+	auto local = koti::local_stream::endpoint{test_socket_path().string()};
+	fs::remove(test_socket_path());
+
+	httpd_counting_endpoint counting;
+	koti::http_response_cache_policy policy;
+	policy.ttl = std::chrono::minutes(1);
+	koti::http_cache_endpoint cache{counting, policy};
+
+	{
+		httpd_cache_test_server server{iox_, local, cache};
+
+		// the hit is the same bytes, without the child
+		auto first = server.exchange("GET", "/a");
+		EXPECT_EQ("/a 1", response_body(first));
+		EXPECT_EQ(first, server.exchange("GET", "/a"));
+		EXPECT_EQ(1u, counting.handled());
+
+		// the header of the same bytes, and nothing after it
+		auto head = server.exchange("HEAD", "/a");
+		EXPECT_EQ(0u, first.find(head));
+		EXPECT_NE(std::string::npos, head.find("Content-Length: 4"));
+		EXPECT_EQ(first, server.exchange("GET", "/a"));
+
+		// kept only when a shared cache may
+		EXPECT_EQ("/p 2", response_body(server.exchange("GET", "/p", "X-Reply-Cache-Control: private\r\n")));
+		EXPECT_EQ("/p 3", response_body(server.exchange("GET", "/p")));
+		EXPECT_EQ("/p 3", response_body(server.exchange("GET", "/p")));
+
+		// no-cache asks the child again and keeps its answer
+		EXPECT_EQ("/a 4", response_body(server.exchange("GET", "/a", "Cache-Control: no-cache\r\n")));
+		EXPECT_EQ("/a 4", response_body(server.exchange("GET", "/a")));
+
+		// max-age=0: stale at once
+		EXPECT_EQ("/z 5", response_body(server.exchange("GET", "/z", "X-Reply-Cache-Control: max-age=0\r\n")));
+		EXPECT_EQ("/z 6", response_body(server.exchange("GET", "/z")));
+
+		// not for everyone
+		EXPECT_EQ("/a 7", response_body(server.exchange("GET", "/a", "Authorization: Basic dTpw\r\n")));
+	}
+	fs::remove(test_socket_path());
+
+	EXPECT_EQ(5u, cache.hits());
+	EXPECT_EQ(3u, cache.entries());
+}
+
+TEST_F(httpd_tests, response_cache_varies_on_chosen_fields)
+{
+	auto local = koti::local_stream::endpoint{test_socket_path().string()};
+	fs::remove(test_socket_path());
+
+	httpd_counting_endpoint counting;
+	koti::http_response_cache_policy policy;
+	policy.ttl = std::chrono::minutes(1);
+	policy.vary_on = {"Accept-Language"};
+	koti::http_cache_endpoint cache{counting, policy};
+
+	{
+		httpd_cache_test_server server{iox_, local, cache};
+		EXPECT_EQ("/a 1", response_body(server.exchange("GET", "/a", "Accept-Language: fi\r\n")));
+		EXPECT_EQ("/a 2", response_body(server.exchange("GET", "/a", "Accept-Language: en\r\n")));
+		EXPECT_EQ("/a 1", response_body(server.exchange("GET", "/a", "Accept-Language: fi\r\n")));
+		EXPECT_EQ("/a 2", response_body(server.exchange("GET", "/a", "Accept-Language: en\r\n")));
+	}
+	fs::remove(test_socket_path());
+
+	EXPECT_EQ(2u, counting.handled());
+}
+
+TEST_F(httpd_tests, response_cache_keeps_only_what_varies_on_chosen_fields)
+{
+	auto local = koti::local_stream::endpoint{test_socket_path().string()};
+	fs::remove(test_socket_path());
+
+	httpd_counting_endpoint counting;
+	koti::http_response_cache_policy policy;
+	policy.ttl = std::chrono::minutes(1);
+	policy.vary_on = {"Accept-Language"};
+	koti::http_cache_endpoint cache{counting, policy};
+
+	{
+		httpd_cache_test_server server{iox_, local, cache};
+
+		// named in any case, the key tells these apart
+		EXPECT_EQ("/a 1", response_body(server.exchange("GET", "/a", "X-Reply-Vary: accept-language\r\n")));
+		EXPECT_EQ("/a 1", response_body(server.exchange("GET", "/a", "X-Reply-Vary: accept-language\r\n")));
+
+		// chosen by fields the key does not hold
+		EXPECT_EQ("/b 2", response_body(server.exchange("GET", "/b", "X-Reply-Vary: Accept-Language, Accept-Encoding\r\n")));
+		EXPECT_EQ("/b 3", response_body(server.exchange("GET", "/b", "X-Reply-Vary: Accept-Language, Accept-Encoding\r\n")));
+		EXPECT_EQ("/c 4", response_body(server.exchange("GET", "/c", "X-Reply-Vary: *\r\n")));
+		EXPECT_EQ("/c 5", response_body(server.exchange("GET", "/c", "X-Reply-Vary: *\r\n")));
+	}
+	fs::remove(test_socket_path());
+
+	EXPECT_EQ(5u, counting.handled());
+	EXPECT_EQ(1u, cache.entries());
+}
+
+TEST_F(httpd_tests, response_cache_stays_under_its_capacity)
+{
+	auto local = koti::local_stream::endpoint{test_socket_path().string()};
+	fs::remove(test_socket_path());
+
+	httpd_counting_endpoint counting;
+	koti::http_response_cache_policy policy;
+	policy.ttl = std::chrono::minutes(1);
+	policy.capacity_bytes = 1024;
+	policy.shards = 1;
+	koti::http_cache_endpoint cache{counting, policy};
+
+	{
+		httpd_cache_test_server server{iox_, local, cache};
+		server.exchange("GET", "/hot");
+		for ( int i = 0; i < 64; ++i )
+		{
+			server.exchange("GET", "/cold/" + std::to_string(i));
+
+			// used between every insert: always given a second chance
+			EXPECT_EQ("/hot 1", response_body(server.exchange("GET", "/hot")));
+		}
+	}
+	fs::remove(test_socket_path());
+
+	EXPECT_LE(cache.size(), policy.capacity_bytes);
+	EXPECT_LT(0u, cache.evictions());
+	EXPECT_LT(cache.entries(), 65u);
+
+	cache.clear();
+	EXPECT_EQ(0u, cache.size());
+	EXPECT_EQ(0u, cache.entries());
+}
+
+namespace {
+
+void
+exercise_accept_backoff(
+	boost::asio::io_context & iox,
+	const fs::path & socket_path,
+	koti::http_io_backend backend
+)
+{
+	auto local = koti::local_stream::endpoint{socket_path.string()};
+	fs::remove(socket_path);
+
+	boost::asio::io_context client_iox;
+	koti::local_stream::socket client{client_iox};
+	client.open();
+
+	// io_uring takes the limit from when the accept was submitted, so it
+	// is lowered before listening, and the descriptors left under it are
+	// then used up. every accept fails with EMFILE while the connection
+	// stays queued
+	::rlimit saved;
+	ASSERT_EQ(0, ::getrlimit(RLIMIT_NOFILE, &saved));
+	int lowest = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+	ASSERT_LE(0, lowest);
+	::close(lowest);
+	::rlimit capped = saved;
+	capped.rlim_cur = static_cast<rlim_t>(lowest + 64);
+	ASSERT_EQ(0, ::setrlimit(RLIMIT_NOFILE, &capped));
+
+	httpd_serving_test_handler<koti::local_stream> server{iox};
+	server.set_io_backend(backend);
+	ASSERT_NO_THROW(server.listen(local));
+
+	std::vector<int> spent;
+	for ( int native; 0 <= (native = ::open("/dev/null", O_RDONLY | O_CLOEXEC)); )
+	{
+		spent.push_back(native);
+	}
+	client.connect(local);
+
+	iox.run_for(std::chrono::milliseconds(300));
+	for ( auto native : spent )
+	{
+		::close(native);
+	}
+	ASSERT_EQ(0, ::setrlimit(RLIMIT_NOFILE, &saved));
+
+	// 10, 20, 40, 80, 100 ms apart rather than back to back
+	EXPECT_LE(1u, server.failed());
+	EXPECT_GE(8u, server.failed());
+	EXPECT_EQ(0u, server.accepted());
+
+	// and accepting resumes once there are descriptors again
+	iox.restart();
+	auto until = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while ( 0u == server.accepted() && std::chrono::steady_clock::now() < until )
+	{
+		iox.run_for(std::chrono::milliseconds(10));
+	}
+	EXPECT_EQ(1u, server.accepted());
+
+	server.close();
+	fs::remove(socket_path);
+}
+
+} // namespace
+
+TEST_F(httpd_tests, accepting_backs_off_while_out_of_descriptors)
+{
+	exercise_accept_backoff(iox_, test_socket_path(), koti::http_io_backend::epoll);
+}
+
+TEST_F(httpd_tests, uring_accepting_backs_off_while_out_of_descriptors)
+{
+	// where the kernel lacks io_uring, this is the reactor again
+	exercise_accept_backoff(iox_, test_socket_path(), koti::http_io_backend::io_uring);
+}
+
+TEST_F(httpd_tests, connections_left_in_the_uring_are_closed)
+{
+	auto & iox = iox_;
+	auto local = koti::local_stream::endpoint{test_socket_path().string()};
+	fs::remove(test_socket_path());
+	koti::local_stream::acceptor listening{iox, local};
+
+	boost::system::error_code ec;
+	auto uring = koti::http_uring_acceptor::create(iox.get_executor(), listening.native_handle(), ec);
+	if ( ! uring )
+	{
+		// no io_uring here
+		fs::remove(test_socket_path());
+		return;
+	}
+	uring->start([](const boost::system::error_code &, int native)
+	{
+		::close(native);
+	});
+
+	// accepted by the kernel, but never reaped: the io_context does not run
+	koti::local_stream::socket client{iox};
+	client.connect(local);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	uring.reset();
+
+	// the server side went away with the ring
+	::pollfd readable{client.native_handle(), POLLIN, 0};
+	ASSERT_EQ(1, ::poll(&readable, 1, 2000));
+	char byte;
+	EXPECT_EQ(0, ::read(client.native_handle(), &byte, 1));
+
+	listening.close();
+	fs::remove(test_socket_path());
+}
+
@@ -0,0 +1,188 @@
+#include "worker_pool.hpp"
+
+#include <stdexcept>
+#include <utility>
+
+namespace koti {
+
+namespace {
+
+// the pool and slot of the worker running on this thread, if any
+thread_local const worker_pool * current_pool = nullptr;
+thread_local std::size_t current_worker = 0;
+
+} // namespace
+
+worker_pool::worker_pool(
+	std::size_t count,
+	std::size_t queue_limit
+)
+: queue_limit_(queue_limit)
+{
+	if ( 0 == count )
+	{
+		throw std::invalid_argument{"worker_pool requires at least one worker"};
+	}
+
+	workers_.reserve(count);
+	for ( std::size_t i = 0; i < count; ++i )
+	{
+		workers_.push_back(std::make_unique<worker>());
+	}
+	for ( std::size_t i = 0; i < count; ++i )
+	{
+		workers_[i]->thread = std::thread{[this, i]()
+		{
+			run(i);
+		}};
+	}
+}
+
+worker_pool::~worker_pool()
+{
+	stop();
+}
+
+bool
+worker_pool::try_submit(
+	task work
+)
+{
+	if ( stopping_.load() )
+	{
+		rejected_.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	// claim a slot before publishing the task; a worker that sees queued_
+	// ahead of the deque only spins until the push lands
+	if ( queue_limit_ <= queued_.fetch_add(1) )
+	{
+		queued_.fetch_sub(1);
+		rejected_.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	auto index = this == current_pool
+		? current_worker
+		: next_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+	{
+		auto & target = *workers_[index];
+		std::lock_guard<std::mutex> lock{target.mutex};
+		target.tasks.push_back(std::move(work));
+	}
+	submitted_.fetch_add(1, std::memory_order_relaxed);
+
+	if ( 0u < sleeping_.load() )
+	{
+		std::lock_guard<std::mutex> lock{sleep_mutex_};
+		wake_.notify_one();
+	}
+	return true;
+}
+
+void
+worker_pool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock{sleep_mutex_};
+		stopping_ = true;
+		wake_.notify_all();
+	}
+
+	for ( auto & w : workers_ )
+	{
+		if ( w->thread.joinable() )
+		{
+			w->thread.join();
+		}
+	}
+
+	for ( auto & w : workers_ )
+	{
+		std::lock_guard<std::mutex> lock{w->mutex};
+		queued_.fetch_sub(w->tasks.size());
+		w->tasks.clear();
+	}
+}
+
+worker_pool::statistics
+worker_pool::stats() const
+{
+	statistics s;
+	s.submitted = submitted_.load(std::memory_order_relaxed);
+	s.rejected = rejected_.load(std::memory_order_relaxed);
+	s.executed = executed_.load(std::memory_order_relaxed);
+	s.stolen = stolen_.load(std::memory_order_relaxed);
+	s.queued = queued_.load(std::memory_order_relaxed);
+	return s;
+}
+
+void
+worker_pool::run(
+	std::size_t index
+)
+{
+	current_pool = this;
+	current_worker = index;
+
+	task work;
+	while ( false == stopping_.load() )
+	{
+		if ( pop(index, work) )
+		{
+			queued_.fetch_sub(1);
+			work();
+			work = nullptr;
+			executed_.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock{sleep_mutex_};
+		sleeping_.fetch_add(1);
+		wake_.wait(lock, [this]()
+		{
+			return stopping_.load() || 0u < queued_.load();
+		});
+		sleeping_.fetch_sub(1);
+	}
+
+	current_pool = nullptr;
+}
+
+bool
+worker_pool::pop(
+	std::size_t index,
+	task & work
+)
+{
+	// oldest first, ours and then everyone else's: these are requests
+	// with clients waiting, so fairness matters more than cache warmth
+	{
+		auto & own = *workers_[index];
+		std::lock_guard<std::mutex> lock{own.mutex};
+		if ( ! own.tasks.empty() )
+		{
+			work = std::move(own.tasks.front());
+			own.tasks.pop_front();
+			return true;
+		}
+	}
+
+	// a contended victim is skipped rather than waited for
+	for ( std::size_t i = 1; i < workers_.size(); ++i )
+	{
+		auto & victim = *workers_[(index + i) % workers_.size()];
+		std::unique_lock<std::mutex> lock{victim.mutex, std::try_to_lock};
+		if ( lock.owns_lock() && ! victim.tasks.empty() )
+		{
+			work = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			stolen_.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace koti
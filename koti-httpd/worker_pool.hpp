@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace koti {
+
+// Threads for work that must not run on an io_context's thread: handlers
+// that block or burn CPU. Each worker keeps its own deque. Tasks submitted
+// from a worker stay with it; others are spread round-robin, and an idle
+// worker steals from the others. At most queue_limit tasks may be waiting
+// at once; beyond that submissions are refused, so callers can shed load
+// instead of letting latency grow without bound.
+class worker_pool
+{
+public:
+	using task = std::function<void()>;
+
+	static constexpr std::size_t default_queue_limit = 1024;
+
+	struct statistics
+	{
+		std::uint64_t submitted = 0;
+		std::uint64_t rejected = 0;
+		std::uint64_t executed = 0;
+		std::uint64_t stolen = 0;
+		std::size_t queued = 0;
+	};
+
+	explicit
+	worker_pool(
+		std::size_t count,
+		std::size_t queue_limit = default_queue_limit
+	);
+
+	worker_pool(const worker_pool & copy_ctor) = delete;
+	worker_pool & operator=(const worker_pool & copy_assign) = delete;
+
+	~worker_pool();
+
+	std::size_t
+	size() const
+	{
+		return workers_.size();
+	}
+
+	std::size_t
+	queue_limit() const
+	{
+		return queue_limit_;
+	}
+
+	// false, and work is dropped, when the pool is saturated or stopped
+	bool
+	try_submit(
+		task work
+	);
+
+	// refuse new work and wait for the workers to finish the tasks they are
+	// running. tasks still waiting are discarded
+	void
+	stop();
+
+	statistics
+	stats() const;
+
+protected:
+	struct alignas(64) worker
+	{
+		std::mutex mutex;
+		std::deque<task> tasks;
+		std::thread thread;
+	};
+
+	void
+	run(
+		std::size_t index
+	);
+
+	bool
+	pop(
+		std::size_t index,
+		task & work
+	);
+
+	std::size_t queue_limit_;
+	std::vector<std::unique_ptr<worker>> workers_;
+
+	std::mutex sleep_mutex_;
+	std::condition_variable wake_;
+	std::atomic<std::size_t> sleeping_{0};
+	std::atomic<bool> stopping_{false};
+
+	alignas(64) std::atomic<std::size_t> queued_{0};
+	std::atomic<std::size_t> next_{0};
+	std::atomic<std::uint64_t> submitted_{0};
+	std::atomic<std::uint64_t> rejected_{0};
+	std::atomic<std::uint64_t> executed_{0};
+	std::atomic<std::uint64_t> stolen_{0};
+};
+
+} // namespace koti
@@ -1,9 +1,18 @@
 
 #include "application.hpp"
 
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
 #include <cstdint>
 #include <cstddef>
 #include <iostream>
+#include <mutex>
 #include <string>
 #include <type_traits>
 #include <vector>
@@ -12,8 +21,37 @@
 
 namespace koti {
 
+namespace {
+
+// blocking sends and receives on native fail with EAGAIN after seconds;
+// zero waits forever
+void
+set_timeouts(
+	int native,
+	double seconds,
+	boost::system::error_code & ec
+)
+{
+	auto microseconds = std::llround(seconds * 1000000);
+	timeval limit{};
+	limit.tv_sec = static_cast<time_t>(microseconds / 1000000);
+	limit.tv_usec = static_cast<suseconds_t>(microseconds % 1000000);
+	if (
+		0 != ::setsockopt(native, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof limit)
+		|| 0 != ::setsockopt(native, SOL_SOCKET, SO_SNDTIMEO, &limit, sizeof limit)
+	)
+	{
+		ec.assign(errno, boost::system::system_category());
+	}
+}
+
+} // namespace
+
+template <
+	class Protocol
+>
 void
-httpd_handler::on_connection_closed(
+basic_httpd_handler<Protocol>::on_connection_closed(
 	http_connection::ptr & connection
 )
 {
@@ -25,10 +63,13 @@ httpd_handler::on_connection_closed(
 	);
 }
 
+template <
+	class Protocol
+>
 void
-httpd_handler::on_new_connection(
+basic_httpd_handler<Protocol>::on_new_connection(
 	const boost::system::error_code& ec,
-	koti::local_stream::socket && socket
+	socket && accepted
 )
 {
 	if ( ec )
@@ -42,14 +83,14 @@ httpd_handler::on_new_connection(
 
 	if ( nullptr == connections_ )
 	{
-		auto remote = local_stream::remote_identity(socket);
+		http_connection refused{std::move(accepted)};
 		logger()->error(
 			"UID:{}\tGID:{}\tPID:{}\tconnected, but no connections list to put into",
-			remote.uid,
-			remote.gid,
-			remote.pid
+			refused.cached_remote_identity().uid,
+			refused.cached_remote_identity().gid,
+			refused.cached_remote_identity().pid
 		);
-		socket.close();
+		refused.close();
 		return;
 	}
 
@@ -58,11 +99,31 @@ httpd_handler::on_new_connection(
 	{
 		new_connection = 
 			std::make_unique<http_connection>(
-				std::move(socket)
+				std::move(accepted)
+			);
+
+		if ( this->peer_limiter() && false == new_connection->admit_peer(*this->peer_limiter()) )
+		{
+			// dropped before it takes a slot from anyone else
+			if ( this->metrics() )
+			{
+				this->metrics()->local().add(http_metrics::counter::rejected_peer);
+			}
+			logger()->warn(
+				"UID:{}\tGID:{}\tPID:{}\trefused: too many connections from peer",
+				new_connection->cached_remote_identity().uid,
+				new_connection->cached_remote_identity().gid,
+				new_connection->cached_remote_identity().pid
 			);
+			return;
+		}
 
 		auto & connection =
 		connections_->add_connection(std::move(new_connection));
+		if ( this->metrics() )
+		{
+			this->metrics()->local().add(http_metrics::counter::accepted);
+		}
 
 		logger()->info(
 			"UID:{}\tGID:{}\tPID:{}\tconnected",
@@ -75,6 +136,12 @@ httpd_handler::on_new_connection(
 	}
 	catch (const std::exception & e)
 	{
+		if ( new_connection && this->metrics() )
+		{
+			// still ours: the connection table had no slot for it
+			this->metrics()->local().add(http_metrics::counter::rejected_full);
+		}
+
 		if ( new_connection )
 		{
 			logger()->error(
@@ -89,21 +156,72 @@ httpd_handler::on_new_connection(
 		{
 			logger()->error(
 				"{}\terror: failed to construct http connection:\t{}",
-				acceptor::local_endpoint().path(),
+				traits::describe(this->listening_endpoint()),
 				e.what()
 			);
 		}
 	}
 }
 
+template <
+	class Protocol
+>
 void
-httpd_handler::on_new_http_connection(
+basic_httpd_handler<Protocol>::on_new_http_connection(
 	http_connection::ptr & connection
 )
 {
-	connection->async_read();
+	connection->set_root_endpoint(root_);
+	connection->set_pipeline_batch(this->pipeline_batch());
+	connection->set_read_buffer(&this->buffer_pool(), this->read_buffer_limit());
+	connection->set_access_log(this->access_log());
+	connection->set_worker_pool(this->get_worker_pool());
+	connection->set_timeouts(this->timeouts());
+	connection->set_metrics(this->metrics());
+	connection->set_compression(this->compression());
+	connection->set_draining(&this->draining_flag());
+	connection->set_closed_handler(
+		[this](http_connection & c)
+	{
+		on_http_connection_finished(c);
+	});
+
+	// the connection may belong to another thread's io_context; start it
+	// there rather than racing that thread from the listener
+	asio::dispatch(
+		connection->get_executor(),
+		[c = connection.get()]()
+	{
+		c->async_read();
+	});
 }
 
+template <
+	class Protocol
+>
+void
+basic_httpd_handler<Protocol>::on_http_connection_finished(
+	http_connection & connection
+)
+{
+	if ( nullptr == connections_ )
+	{
+		return;
+	}
+
+	// destroyed on the way out, after the list's lock is released
+	auto removed = connections_->remove_connection(connection.handle());
+	if ( ! removed )
+	{
+		return;
+	}
+
+	on_connection_closed(removed);
+}
+
+template class basic_httpd_handler<koti::local_stream>;
+template class basic_httpd_handler<asio::ip::tcp>;
+
 application::application(
 	options::commandline_arguments options
 )
@@ -125,6 +243,20 @@ application::add_options(
 
 	storage.descriptions().add_options()
 	("maximum-connection-count,m", po::value<decltype(maximum_connection_count_)>(&maximum_connection_count_),"maximum number of connections to accept; additional connections will be rejected")
+	("threads,t", po::value<decltype(thread_count_)>(&thread_count_)->default_value(thread_count_), "number of connection I/O threads, each running its own io_context; 1 serves everything on the main thread")
+	("pin-threads", po::bool_switch(&pin_threads_), "pin each connection I/O thread to its own core")
+	("static-root", po::value<decltype(static_root_)>(&static_root_), "directory of files to serve; nothing is served when unset")
+	("static-prefix", po::value<decltype(static_prefix_)>(&static_prefix_)->default_value(static_prefix_), "URL path the files of --static-root are served under")
+	("static-fd-cache", po::value<decltype(static_fd_cache_)>(&static_fd_cache_)->default_value(static_fd_cache_), "number of open file descriptors kept for serving static files")
+	("response-cache", po::value<decltype(response_cache_bytes_)>(&response_cache_bytes_)->default_value(response_cache_bytes_), "bytes of GET responses kept to answer the same request again; 0 keeps none")
+	("response-cache-ttl", po::value<decltype(response_cache_ttl_)>(&response_cache_ttl_)->default_value(response_cache_ttl_), "seconds a cached response is served for unless its Cache-Control says otherwise")
+	("response-cache-vary", po::value<decltype(response_cache_vary_)>(&response_cache_vary_)->multitoken(), "request header fields that tell cached responses to the same target apart")
+	("metrics-path", po::value<decltype(metrics_path_)>(&metrics_path_)->default_value(metrics_path_), "URL path metrics are served at in the Prometheus text format; empty to serve none")
+	("control-path", po::value<decltype(control_path_)>(&control_path_), "local socket a replacement process started with --takeover connects to; @name for an abstract socket. unset allows no takeover")
+	("takeover", po::value<decltype(takeover_path_)>(&takeover_path_), "--control-path of a running process to take the listening sockets over from; it then drains and exits")
+	("takeover-timeout", po::value<decltype(takeover_timeout_)>(&takeover_timeout_)->default_value(takeover_timeout_), "seconds to wait on each step of --takeover before listening instead; 0 waits forever")
+	("handoff-idle", po::bool_switch(&handoff_idle_), "when handing over, also pass on connections waiting for their next request")
+	("drain-timeout", po::value<decltype(drain_timeout_)>(&drain_timeout_)->default_value(drain_timeout_), "seconds to wait for connections still being served once no longer accepting")
 	;
 
 	return options::validate::ok;
@@ -135,6 +267,41 @@ application::validate_configuration(
 	options &
 )
 {
+	if ( 0 == thread_count_ )
+	{
+		logger()->error("--threads must be at least 1");
+		return options::validate::reject;
+	}
+	if ( ! static_root_.empty() && ! fs::is_directory(static_root_) )
+	{
+		logger()->error("--static-root {} is not a directory", static_root_);
+		return options::validate::reject;
+	}
+	if ( static_prefix_.empty() || '/' != static_prefix_.front() )
+	{
+		logger()->error("--static-prefix must start with /");
+		return options::validate::reject;
+	}
+	if ( ! metrics_path_.empty() && '/' != metrics_path_.front() )
+	{
+		logger()->error("--metrics-path must start with /");
+		return options::validate::reject;
+	}
+	if ( response_cache_ttl_ < 0 )
+	{
+		logger()->error("--response-cache-ttl must not be negative");
+		return options::validate::reject;
+	}
+	if ( drain_timeout_ < 0 )
+	{
+		logger()->error("--drain-timeout must not be negative");
+		return options::validate::reject;
+	}
+	if ( takeover_timeout_ < 0 )
+	{
+		logger()->error("--takeover-timeout must not be negative");
+		return options::validate::reject;
+	}
 	return options::validate::ok;
 }
 
@@ -144,7 +311,6 @@ application::exit_status application::run()
 
 	http_server_ = std::make_unique<httpd_handler>(iox_);
 	http_server_->set_connections(*this);
-	set_maximum_connections(maximum_connection_count_);
 
 	auto configured = options_.configure();
 	if ( options::validate::reject == configured )
@@ -159,12 +325,241 @@ application::exit_status application::run()
 	{
 		throw exception::unhandled_value(configured);
 	}
+	set_maximum_connections(maximum_connection_count_);
+
+	if ( 1 < thread_count_ )
+	{
+		io_pool_ = std::make_unique<io_context_pool>(thread_count_);
+		http_server_->set_io_context_pool(io_pool_.get());
+		io_pool_->run(pin_threads_);
+	}
 
-	http_server_->listen(httpd_options_);
+	if ( ! static_root_.empty() )
+	{
+		file_cache_ = std::make_unique<http_file_cache>(static_fd_cache_);
+		file_endpoint_ = std::make_unique<http_file_endpoint>(
+			static_prefix_,
+			static_root_,
+			*file_cache_
+		);
+		file_endpoint_->set_precompressed(httpd_options_.compression_policy_.gzip);
+
+		auto pattern = std::string{file_endpoint_->path()} + "/*path";
+		router_.add(pattern, *file_endpoint_);
+		logger()->info("serving {} at {}", static_root_, pattern);
+	}
+	http_server_->set_metrics(&metrics_);
+	if ( httpd_options_.compresses() )
+	{
+		compression_ = std::make_unique<http_compression>(httpd_options_.compression_policy_);
+		http_server_->set_compression(compression_.get());
+	}
+	if ( ! metrics_path_.empty() )
+	{
+		metrics_endpoint_ = std::make_unique<http_metrics_endpoint>(metrics_, metrics_path_);
+		metrics_endpoint_->add_gauge(
+			"kotid_connections_active",
+			"Connections being served.",
+			[this]() { return static_cast<double>(active_connection_count()); }
+		);
+		metrics_endpoint_->add_gauge(
+			"kotid_connections_maximum",
+			"Connections that may be served at once.",
+			[this]() { return static_cast<double>(maximum_connection_count()); }
+		);
+		metrics_endpoint_->add_counter(
+			"kotid_connections_timed_out_total",
+			"Connections dropped by a timeout.",
+			[this]() { return static_cast<double>(timed_out_connections()); }
+		);
+		metrics_endpoint_->add_gauge(
+			"kotid_drain_state",
+			"0 while serving, 1 while draining, 2 once drained.",
+			[this]() { return static_cast<double>(drain_state_.load(std::memory_order_relaxed)); }
+		);
+		metrics_endpoint_->add_gauge(
+			"kotid_buffer_pool_bytes_in_use",
+			"Bytes of read buffers lent to connections.",
+			[this]() { return static_cast<double>(buffer_pool_stats().bytes_in_use); }
+		);
+		metrics_endpoint_->add_gauge(
+			"kotid_buffer_pool_bytes_cached",
+			"Bytes of idle read buffers kept for reuse.",
+			[this]() { return static_cast<double>(buffer_pool_stats().bytes_cached); }
+		);
+		if ( httpd_options_.compresses() )
+		{
+			metrics_endpoint_->add_counter(
+				"kotid_compression_cache_hits_total",
+				"Compressed bodies served from the compression cache.",
+				[this]() { return static_cast<double>(compression_->cache().hits()); }
+			);
+			metrics_endpoint_->add_counter(
+				"kotid_compression_cache_misses_total",
+				"Bodies compressed because the compression cache did not hold them.",
+				[this]() { return static_cast<double>(compression_->cache().misses()); }
+			);
+			metrics_endpoint_->add_gauge(
+				"kotid_compression_cache_bytes",
+				"Bytes of compressed bodies held by the compression cache.",
+				[this]() { return static_cast<double>(compression_->cache().size()); }
+			);
+		}
+		router_.add(*metrics_endpoint_);
+		logger()->info("serving metrics at {}", metrics_path_);
+	}
+	http_endpoint * root = &router_;
+	if ( 0 < response_cache_bytes_ )
+	{
+		http_response_cache_policy policy;
+		policy.capacity_bytes = response_cache_bytes_;
+		policy.maximum_entry = std::min(policy.maximum_entry, response_cache_bytes_);
+		policy.ttl = std::chrono::milliseconds{static_cast<std::int64_t>(std::llround(response_cache_ttl_ * 1000))};
+		policy.vary_on = response_cache_vary_;
+		response_cache_ = std::make_unique<http_cache_endpoint>(router_, policy);
+		root = response_cache_.get();
+		if ( metrics_endpoint_ )
+		{
+			metrics_endpoint_->add_counter(
+				"kotid_response_cache_hits_total",
+				"Requests answered from the response cache.",
+				[this]() { return static_cast<double>(response_cache_->hits()); }
+			);
+			metrics_endpoint_->add_counter(
+				"kotid_response_cache_misses_total",
+				"Requests the response cache passed on to be handled.",
+				[this]() { return static_cast<double>(response_cache_->misses()); }
+			);
+			metrics_endpoint_->add_counter(
+				"kotid_response_cache_evictions_total",
+				"Responses dropped from the response cache to make room.",
+				[this]() { return static_cast<double>(response_cache_->evictions()); }
+			);
+			metrics_endpoint_->add_gauge(
+				"kotid_response_cache_bytes",
+				"Bytes of serialized responses held by the response cache.",
+				[this]() { return static_cast<double>(response_cache_->size()); }
+			);
+		}
+		logger()->info("caching responses\tbytes:{}\tttl:{}s", response_cache_bytes_, response_cache_ttl_);
+	}
+	http_server_->set_root_endpoint(root);
+
+	if ( "async" == httpd_options_.access_log_mode_ )
+	{
+		access_log_ = std::make_unique<http_access_log>(
+			logger(),
+			httpd_options_.access_log_queue_,
+			"block" == httpd_options_.access_log_overflow_
+				? http_access_log::overflow::block
+				: http_access_log::overflow::drop
+		);
+		http_server_->set_access_log(access_log_.get());
+		if ( metrics_endpoint_ )
+		{
+			metrics_endpoint_->add_counter(
+				"kotid_access_log_written_total",
+				"Access log records written.",
+				[this]() { return static_cast<double>(access_log_->written()); }
+			);
+			metrics_endpoint_->add_counter(
+				"kotid_access_log_dropped_total",
+				"Access log records dropped because the queue was full.",
+				[this]() { return static_cast<double>(access_log_->dropped()); }
+			);
+		}
+	}
+
+	if ( httpd_options_.limits_peers() )
+	{
+		peer_limiter_ = std::make_unique<http_peer_limiter>(
+			httpd_options_.peer_limits_,
+			httpd_options_.peer_table_
+		);
+		http_server_->set_peer_limiter(peer_limiter_.get());
+		if ( metrics_endpoint_ )
+		{
+			metrics_endpoint_->add_counter(
+				"kotid_peer_limited_requests_total",
+				"Requests answered with 429 for going over their peer's rate.",
+				[this]() { return static_cast<double>(peer_limiter_->limited_requests()); }
+			);
+		}
+	}
+
+	if ( 0 < httpd_options_.workers_ )
+	{
+		worker_pool_ = std::make_unique<worker_pool>(
+			httpd_options_.workers_,
+			httpd_options_.worker_queue_
+		);
+		http_server_->set_worker_pool(worker_pool_.get());
+		if ( metrics_endpoint_ )
+		{
+			metrics_endpoint_->add_counter(
+				"kotid_worker_pool_executed_total",
+				"Requests handled on the worker pool.",
+				[this]() { return static_cast<double>(worker_pool_->stats().executed); }
+			);
+			metrics_endpoint_->add_counter(
+				"kotid_worker_pool_rejected_total",
+				"Requests answered with 503 because the worker pool was saturated.",
+				[this]() { return static_cast<double>(worker_pool_->stats().rejected); }
+			);
+			metrics_endpoint_->add_gauge(
+				"kotid_worker_pool_queued",
+				"Requests waiting for a worker.",
+				[this]() { return static_cast<double>(worker_pool_->stats().queued); }
+			);
+		}
+	}
+
+	if ( takeover_path_.empty() || false == take_over() )
+	{
+		http_server_->listen(httpd_options_);
+		if ( httpd_options_.listens_on_tcp() )
+		{
+			make_tcp_server();
+			tcp_server_->listen(httpd_options_);
+		}
+	}
+	log_listeners();
+
+	if ( ! control_path_.empty() )
+	{
+		listen_for_successor();
+	}
+
+	signals_ = std::make_unique<asio::signal_set>(iox_, SIGINT, SIGTERM);
+	wait_for_signal();
 
 	iox_.run();
+	signals_.reset();
 
-	for ( auto & c : connections_ )
+	if ( worker_pool_ )
+	{
+		// handlers already running finish with their connections still
+		// alive; the ones still waiting are dropped
+		worker_pool_->stop();
+	}
+
+	if ( io_pool_ )
+	{
+		// connections are only touched from their own thread; once every
+		// pool thread has exited they can be closed from here
+		io_pool_->stop();
+		io_pool_->join();
+	}
+
+	// nothing is accepted while what is left is run below
+	http_server_->close();
+	if ( tcp_server_ )
+	{
+		tcp_server_->close();
+	}
+
+	std::vector<http_connection_handle> remaining;
+	for_each_connection([&](http_connection::ptr & c)
 	{
 		logger()->info(
 			"UID:{}\tGID:{}\tPID:{}\tforcing closed",
@@ -173,10 +568,582 @@ application::exit_status application::run()
 			c->cached_remote_identity().pid
 		);
 		c->close();
-		c.reset();
+		remaining.push_back(c->handle());
+	});
+
+	// close() queued the aborted operations on the stopped io_contexts,
+	// and they live in their connection's handler memory: run them out
+	// before any connection is freed
+	std::size_t ran;
+	do
+	{
+		ran = io_pool_ ? io_pool_->poll() : 0;
+		iox_.restart();
+		ran += iox_.poll();
 	}
+	while ( 0u < ran );
+
+	// destroyed now rather than with the list: the io_contexts and the
+	// buffer pool they use are gone by then
+	for ( const auto & handle : remaining )
+	{
+		remove_connection(handle);
+	}
+
+	if ( access_log_ )
+	{
+		access_log_->stop();
+		logger()->info(
+			"access log\twritten:{}\tdropped:{}",
+			access_log_->written(),
+			access_log_->dropped()
+		);
+	}
+
+	if ( worker_pool_ )
+	{
+		auto workers = worker_pool_->stats();
+		logger()->info(
+			"worker pool\tsubmitted:{}\texecuted:{}\tstolen:{}\trejected:{}",
+			workers.submitted,
+			workers.executed,
+			workers.stolen,
+			workers.rejected
+		);
+	}
+
+	if ( peer_limiter_ )
+	{
+		logger()->info(
+			"peer limits\tpeers:{}\trefused connections:{}\tlimited requests:{}",
+			peer_limiter_->peers(),
+			peer_limiter_->refused_connections(),
+			peer_limiter_->limited_requests()
+		);
+	}
+
+	logger()->info("timeouts\ttimed out:{}", timed_out_connections());
+
+	auto metrics = metrics_.collect();
+	logger()->info(
+		"traffic\taccepted:{}\trejected:{}\treceived:{}B\tsent:{}B",
+		metrics[http_metrics::counter::accepted],
+		metrics[http_metrics::counter::rejected_full] + metrics[http_metrics::counter::rejected_peer],
+		metrics[http_metrics::counter::bytes_received],
+		metrics[http_metrics::counter::bytes_sent]
+	);
+
+	auto pool = buffer_pool_stats();
+	logger()->info(
+		"buffer pool\tallocations:{}\treused:{}\toversize:{}\tin use:{}/{}B\tcached:{}/{}B",
+		pool.allocations,
+		pool.reused,
+		pool.oversize,
+		pool.buffers_in_use,
+		pool.bytes_in_use,
+		pool.buffers_cached,
+		pool.bytes_cached
+	);
 
 	return exit_status::success();
 }
 
+void
+application::make_tcp_server()
+{
+	tcp_server_ = std::make_unique<tcp_httpd_handler>(iox_);
+	tcp_server_->serve_like(*http_server_);
+	tcp_server_->configure(httpd_options_);
+}
+
+void
+application::log_listeners()
+{
+	if (
+		http_io_backend::io_uring == httpd_options_.io_backend()
+		&& http_io_backend::io_uring != http_server_->io_backend()
+	)
+	{
+		logger()->warn(
+			"io_uring unavailable, accepting with epoll instead: {}",
+			http_server_->io_backend_error().message()
+		);
+	}
+
+	if ( io_pool_ && httpd_options_.shard_accept_ )
+	{
+		logger()->info(
+			"handing local connections to {} threads through queues of {}",
+			io_pool_->size(),
+			http_server_->handoff_capacity()
+		);
+	}
+
+	if ( tcp_server_ )
+	{
+		logger()->info(
+			"serving TCP at {} with {} acceptor(s)",
+			tcp_httpd_handler::traits::describe(tcp_server_->listening_endpoint()),
+			tcp_server_->acceptor_count()
+		);
+		if ( tcp_server_->steering_error() )
+		{
+			logger()->warn(
+				"cannot steer TCP connections by cpu, leaving it to the kernel: {}",
+				tcp_server_->steering_error().message()
+			);
+		}
+	}
+}
+
+void
+application::listen_for_successor()
+{
+	auto at = http_local_endpoint(control_path_);
+	if ( '@' != control_path_.front() )
+	{
+		// left behind by whoever had it last
+		boost::system::error_code ignored;
+		fs::remove(control_path_, ignored);
+	}
+
+	control_ = std::make_unique<local_stream::acceptor>(iox_);
+	control_->open(local_stream{});
+	control_->bind(at);
+	control_->listen(1);
+	control_->async_accept(
+		[this](const boost::system::error_code & ec, local_stream::socket successor)
+	{
+		if ( ec )
+		{
+			if ( asio::error::operation_aborted != ec )
+			{
+				logger()->error("control socket\terror: {}", ec.message());
+			}
+			return;
+		}
+
+		successor_ = std::make_unique<local_stream::socket>(std::move(successor));
+		hand_over();
+	});
+	logger()->info("waiting for a successor at {}", control_path_);
+}
+
+void
+application::hand_over()
+{
+	// there is only ever one successor; it listens here once we are done
+	boost::system::error_code ec;
+	control_->close(ec);
+
+	auto listeners = http_server_->listening_handles();
+	if ( tcp_server_ )
+	{
+		auto tcp = tcp_server_->listening_handles();
+		listeners.insert(listeners.end(), tcp.begin(), tcp.end());
+	}
+
+	http_send_descriptors(successor_->native_handle(), http_handoff_tag::listeners, listeners, ec);
+	if ( ec )
+	{
+		logger()->error("handing listening sockets to successor\terror: {}", ec.message());
+		successor_.reset();
+		listen_for_successor();
+		return;
+	}
+
+	asio::async_read(
+		*successor_,
+		asio::buffer(&successor_reply_, 1),
+		[this](const boost::system::error_code & ec, std::size_t)
+	{
+		on_successor_accepting(ec);
+	});
+}
+
+void
+application::on_successor_accepting(
+	const boost::system::error_code & ec
+)
+{
+	if ( ec || static_cast<char>(http_handoff_tag::accepting) != successor_reply_ )
+	{
+		// still ours to serve
+		logger()->error(
+			"successor did not take over\terror: {}",
+			ec ? ec.message() : std::string{"unexpected reply"}
+		);
+		successor_.reset();
+		listen_for_successor();
+		return;
+	}
+
+	// the successor accepts on the same sockets; closing ours leaves them
+	// open there. what is still being served here closes after its
+	// response and reconnects to the successor
+	http_server_->drain();
+	if ( tcp_server_ )
+	{
+		tcp_server_->drain();
+	}
+
+	std::vector<int> idle;
+	if ( handoff_idle_ )
+	{
+		idle = release_idle_connections();
+	}
+
+	boost::system::error_code send_ec;
+	if ( ! idle.empty() )
+	{
+		http_send_descriptors(successor_->native_handle(), http_handoff_tag::connections, idle, send_ec);
+	}
+	for ( int native : idle )
+	{
+		::close(native);
+	}
+	if ( ! send_ec )
+	{
+		http_send_descriptors(successor_->native_handle(), http_handoff_tag::done, {}, send_ec);
+	}
+
+	logger()->info(
+		"handed over to successor\tidle connections:{}{}",
+		idle.size(),
+		send_ec ? "\terror: " + send_ec.message() : std::string{}
+	);
+	successor_.reset();
+	drain();
+}
+
+bool
+application::take_over()
+{
+	// a predecessor that stops answering is given up on; asio's blocking
+	// connect and write wait out a would_block with poll() rather than the
+	// socket's timeouts, so connect natively
+	local_stream::socket predecessor{iox_};
+	boost::system::error_code ec;
+	predecessor.open(local_stream{}, ec);
+	if ( ! ec )
+	{
+		set_timeouts(predecessor.native_handle(), takeover_timeout_, ec);
+	}
+	if ( ! ec )
+	{
+		auto at = http_local_endpoint(takeover_path_);
+		if ( 0 != ::connect(predecessor.native_handle(), at.data(), static_cast<socklen_t>(at.size())) )
+		{
+			ec.assign(errno, boost::system::system_category());
+		}
+	}
+	if ( ec )
+	{
+		logger()->warn("nothing to take over from at {}: {}", takeover_path_, ec.message());
+		return false;
+	}
+
+	std::vector<int> listeners;
+	auto tag = http_receive_descriptors(predecessor.native_handle(), listeners, ec);
+	if ( ec || http_handoff_tag::listeners != tag || listeners.empty() )
+	{
+		for ( int native : listeners )
+		{
+			::close(native);
+		}
+		logger()->warn(
+			"{} handed over no listening sockets: {}",
+			takeover_path_,
+			ec ? ec.message() : std::string{"unexpected message"}
+		);
+		return false;
+	}
+
+	std::vector<int> local, tcp;
+	for ( int native : listeners )
+	{
+		( AF_UNIX == http_socket_family(native) ? local : tcp ).push_back(native);
+	}
+
+	http_server_->configure(httpd_options_);
+	if ( local.empty() )
+	{
+		http_server_->listen(httpd_options_);
+	}
+	else
+	{
+		http_server_->adopt(local);
+	}
+
+	if ( httpd_options_.listens_on_tcp() )
+	{
+		make_tcp_server();
+		if ( tcp.empty() )
+		{
+			tcp_server_->listen(httpd_options_);
+		}
+		else
+		{
+			tcp_server_->adopt(tcp);
+		}
+	}
+	else
+	{
+		for ( int native : tcp )
+		{
+			::close(native);
+		}
+	}
+
+	auto accepting = static_cast<char>(http_handoff_tag::accepting);
+	if ( 1 != ::send(predecessor.native_handle(), &accepting, 1, MSG_NOSIGNAL) )
+	{
+		ec.assign(errno, boost::system::system_category());
+	}
+
+	std::size_t adopted = 0;
+	while ( ! ec && http_handoff_tag::done != tag )
+	{
+		std::vector<int> connections;
+		tag = http_receive_descriptors(predecessor.native_handle(), connections, ec);
+		for ( int native : connections )
+		{
+			if ( AF_UNIX == http_socket_family(native) )
+			{
+				http_server_->adopt_connection(native);
+			}
+			else if ( tcp_server_ )
+			{
+				tcp_server_->adopt_connection(native);
+			}
+			else
+			{
+				::close(native);
+			}
+		}
+		adopted += connections.size();
+	}
+	if ( ec )
+	{
+		logger()->warn("{} stopped handing over connections: {}", takeover_path_, ec.message());
+	}
+
+	logger()->info(
+		"took over from {}\tlistening sockets:{}\tconnections:{}",
+		takeover_path_,
+		listeners.size(),
+		adopted
+	);
+	return true;
+}
+
+void
+application::on_connection_threads(
+	const std::function<void(http_connection &)> & visit
+)
+{
+	std::vector<std::pair<http_connection_handle, asio::any_io_executor>> live;
+	for_each_connection([&](http_connection::ptr & c)
+	{
+		live.emplace_back(c->handle(), c->get_executor());
+	});
+
+	std::mutex mutex;
+	std::condition_variable visited_all;
+	std::size_t pending = live.size();
+
+	// on the connection's own thread, the only one that may end it
+	auto on_thread = [&](const http_connection_handle & handle)
+	{
+		if ( auto * connection = find_connection(handle) )
+		{
+			visit(*connection);
+		}
+
+		std::lock_guard<std::mutex> lock{mutex};
+		--pending;
+		visited_all.notify_one();
+	};
+
+	for ( const auto & [handle, executor] : live )
+	{
+		if ( io_pool_ )
+		{
+			asio::post(executor, [&on_thread, handle = handle]()
+			{
+				on_thread(handle);
+			});
+		}
+		else
+		{
+			on_thread(handle);
+		}
+	}
+
+	std::unique_lock<std::mutex> lock{mutex};
+	visited_all.wait(lock, [&]() { return 0 == pending; });
+}
+
+std::vector<int>
+application::release_idle_connections()
+{
+	std::mutex mutex;
+	std::vector<int> released;
+	on_connection_threads([&](http_connection & connection)
+	{
+		int native = connection.release_if_idle();
+		if ( 0 <= native )
+		{
+			std::lock_guard<std::mutex> lock{mutex};
+			released.push_back(native);
+		}
+	});
+	return released;
+}
+
+std::size_t
+application::close_idle_connections()
+{
+	std::atomic<std::size_t> closed{0};
+	on_connection_threads([&](http_connection & connection)
+	{
+		if ( connection.close_if_idle() )
+		{
+			closed.fetch_add(1, std::memory_order_relaxed);
+		}
+	});
+	return closed.load();
+}
+
+void
+application::wait_for_signal()
+{
+	signals_->async_wait([this](const boost::system::error_code & ec, int signal)
+	{
+		if ( ec )
+		{
+			return;
+		}
+
+		if ( drain_state::serving == drain_state_.load() )
+		{
+			logger()->info("signal {}: draining; another one stops at once", signal);
+			drain();
+			wait_for_signal();
+			return;
+		}
+
+		logger()->warn("signal {} while draining: stopping", signal);
+		work_.reset();
+		iox_.stop();
+	});
+}
+
+void
+application::drain()
+{
+	if ( drain_state::serving != drain_state_.exchange(drain_state::draining) )
+	{
+		return;
+	}
+
+	http_server_->drain();
+	if ( tcp_server_ )
+	{
+		tcp_server_->drain();
+	}
+	if ( control_ )
+	{
+		boost::system::error_code ignored;
+		control_->close(ignored);
+	}
+
+	// nothing to answer on these; the rest close after their response
+	auto idle = close_idle_connections();
+	logger()->info(
+		"draining\tconnections:{}\tclosed idle:{}",
+		active_connection_count(),
+		idle
+	);
+
+	// the last connection to go finishes it sooner, see on_emptied()
+	drain_timer_ = std::make_unique<asio::steady_timer>(iox_);
+	drain_timer_->expires_after(
+		std::chrono::milliseconds{static_cast<std::int64_t>(std::llround(drain_timeout_ * 1000))}
+	);
+	drain_timer_->async_wait([this](const boost::system::error_code & ec)
+	{
+		if ( ! ec )
+		{
+			finish_drain();
+		}
+	});
+	if ( 0 == active_connection_count() )
+	{
+		finish_drain();
+	}
+}
+
+void
+application::finish_drain()
+{
+	auto draining = drain_state::draining;
+	if ( false == drain_state_.compare_exchange_strong(draining, drain_state::drained) )
+	{
+		return;
+	}
+
+	drain_timer_->cancel();
+	logger()->info("drained\tconnections left:{}", active_connection_count());
+	work_.reset();
+	iox_.stop();
+}
+
+void
+application::on_emptied()
+{
+	// on whichever thread the connection finished; drain() and its timer
+	// run on iox_
+	if ( drain_state::draining == drain_state_.load() )
+	{
+		asio::post(iox_, [this]()
+		{
+			finish_drain();
+		});
+	}
+}
+
+http_buffer_pool::statistics
+application::buffer_pool_stats() const
+{
+	auto stats = http_server_->buffer_pool().stats();
+	if ( tcp_server_ )
+	{
+		auto tcp = tcp_server_->buffer_pool().stats();
+		stats.allocations += tcp.allocations;
+		stats.reused += tcp.reused;
+		stats.oversize += tcp.oversize;
+		stats.buffers_in_use += tcp.buffers_in_use;
+		stats.bytes_in_use += tcp.bytes_in_use;
+		stats.buffers_cached += tcp.buffers_cached;
+		stats.bytes_cached += tcp.bytes_cached;
+	}
+	return stats;
+}
+
+std::uint64_t
+application::timed_out_connections()
+{
+	// each io_context times out its own connections
+	std::uint64_t timed_out = http_timer_wheel::use(iox_.get_executor()).expired();
+	if ( io_pool_ )
+	{
+		for ( std::size_t i = 0; i < io_pool_->size(); ++i )
+		{
+			timed_out += http_timer_wheel::use(io_pool_->at(i).get_executor()).expired();
+		}
+	}
+	return timed_out;
+}
+
 } // namespace koti
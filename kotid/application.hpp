@@ -7,6 +7,8 @@ extern "C" {
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <atomic>
+#include <functional>
 
 #include <boost/asio.hpp>
 namespace asio = boost::asio;
@@ -21,79 +23,81 @@ namespace po = boost::program_options;
 namespace beast = boost::beast;
 
 #include "httpd.hpp"
+#include "http_file_endpoint.hpp"
+#include "http_handoff.hpp"
+#include "http_response_cache.hpp"
+#include "http_metrics.hpp"
+#include "http_metrics_endpoint.hpp"
+#include "http_router.hpp"
+#include "http_connection_list.hpp"
+#include "io_context_pool.hpp"
+#include "worker_pool.hpp"
 #include "options.hpp"
 #include "exceptions/unhandled_value.hpp"
 
 namespace koti {
 
-class http_connection_list
+template <
+	class Protocol
+>
+class basic_httpd_handler final
+: public httpd_logs
+, public httpd<basic_httpd_handler<Protocol>, Protocol>
 {
 public:
-	auto & add_connection(
-		http_connection::ptr && ptr
-	)
-	{
-		auto at = std::find_if(
-			connections_.begin(),
-			connections_.end(),
-			[&](const auto & ptr)
-		{
-			return ! ptr;
-		});
-		if ( connections_.end() == at )
-		{
-			throw std::runtime_error{"too many connections"};
-		}
-		(*at) = std::move(ptr);
-		return *at;
-	}
+	using base = httpd<basic_httpd_handler<Protocol>, Protocol>;
+	using base::base;
+	using typename base::socket;
+	using typename base::traits;
 
 	void
-	set_maximum_connections(
-		size_t new_maximum
+	set_connections(
+		http_connection_list & connections
 	)
 	{
-		// prefer to keep non-null (active) connections
-		std::sort(std::begin(connections_),std::end(connections_));
-		connections_.resize(new_maximum);
+		connections_ = &connections;
 	}
 
-	size_t
-	active_connection_count() const
+	http_connection_list *
+	connections() const
 	{
-		return std::accumulate(
-			std::begin(connections_),
-			std::end(connections_),
-			0u,
-			[](size_t count, const http_connection::ptr & ptr)
-		{
-			return count + (bool)ptr;
-		});
+		return connections_;
 	}
 
-	size_t
-	maximum_connection_count() const
+	// endpoint every new connection hands its requests to
+	void
+	set_root_endpoint(
+		http_endpoint * root
+	)
 	{
-		return connections_.size();
+		root_ = root;
 	}
 
-protected:
-	std::vector<http_connection::ptr> connections_;
-};
-
-class httpd_handler final
-: public httpd_logs
-, public httpd<httpd_handler>
-{
-public:
-	using httpd::httpd;
+	http_endpoint *
+	root_endpoint() const
+	{
+		return root_;
+	}
 
+	// hand new connections everything other hands its own: the same
+	// connection list, endpoint tree, threads, limits and logs. not the
+	// peer limiter, which tells peers apart by SO_PEERCRED: over TCP every
+	// client would be the same peer
+	template <
+		class Other
+	>
 	void
-	set_connections(
-		http_connection_list & connections
+	serve_like(
+		const Other & other
 	)
 	{
-		connections_ = &connections;
+		set_connections(*other.connections());
+		set_root_endpoint(other.root_endpoint());
+		this->set_io_context_pool(other.get_io_context_pool());
+		this->set_metrics(other.metrics());
+		this->set_compression(other.compression());
+		this->set_access_log(other.access_log());
+		this->set_worker_pool(other.get_worker_pool());
 	}
 
 	void
@@ -104,7 +108,7 @@ public:
 	void
 	on_new_connection(
 		const boost::system::error_code& ec,
-		local_stream::socket && socket
+		socket && accepted
 	);
 
 	void
@@ -112,10 +116,24 @@ public:
 		http_connection::ptr & connection
 	);
 
+	// terminal callback of every connection in the list; returns its slot
+	void
+	on_http_connection_finished(
+		http_connection & connection
+	);
+
 protected:
-	http_connection_list * connections_;
+	http_connection_list * connections_ = nullptr;
+	http_endpoint * root_ = nullptr;
 };
 
+// defined in application.cpp for these two
+using httpd_handler = basic_httpd_handler<koti::local_stream>;
+using tcp_httpd_handler = basic_httpd_handler<asio::ip::tcp>;
+
+extern template class basic_httpd_handler<koti::local_stream>;
+extern template class basic_httpd_handler<asio::ip::tcp>;
+
 class application final
 : public options::configurator
 , public http_connection_list
@@ -178,21 +196,131 @@ public:
 
 	exit_status run();
 
+	// connections dropped by a timeout, across every io_context
+	std::uint64_t
+	timed_out_connections();
+
 	auto &
 	http_server()
 	{
 		return http_server_;
 	}
 
+	// null unless --tcp-listen is given
+	auto &
+	tcp_server()
+	{
+		return tcp_server_;
+	}
+
+	// read buffers of both listeners
+	http_buffer_pool::statistics
+	buffer_pool_stats() const;
+
 	// io_context
 	asio::io_context iox_;
 	std::unique_ptr<asio::io_service::work> work_;
 
 protected:
+	void
+	make_tcp_server();
+
+	void
+	log_listeners();
+
+	// hot upgrade, see http_handoff_tag. the old process listens on
+	// --control-path for its successor, which is started with --takeover
+	void
+	listen_for_successor();
+
+	void
+	hand_over();
+
+	void
+	on_successor_accepting(
+		const boost::system::error_code & ec
+	);
+
+	// false when there was nothing to take over from; listen instead
+	bool
+	take_over();
+
+	// calls visit with every connection, each on its own thread, and
+	// returns once all of them have been
+	void
+	on_connection_threads(
+		const std::function<void(http_connection &)> & visit
+	);
+
+	// from every connection that is waiting for a request with nothing of
+	// it read; they finish here as their descriptors are handed on
+	std::vector<int>
+	release_idle_connections();
+
+	std::size_t
+	close_idle_connections();
+
+	// SIGINT or SIGTERM drains; a second one stops without waiting
+	void
+	wait_for_signal();
+
+	// stops accepting, closes idle connections and has the others close
+	// after their next response, then waits for them for at most
+	// --drain-timeout and stops iox_. once only
+	void
+	drain();
+
+	// stops iox_ once the last connection is gone or --drain-timeout ran
+	// out, whichever is first
+	void
+	finish_drain();
+
+	void
+	on_emptied() override;
+
 	std::size_t maximum_connection_count_ = 1;
+	std::size_t thread_count_ = 1;
+	bool pin_threads_ = false;
+	std::unique_ptr<io_context_pool> io_pool_;
+	std::unique_ptr<http_access_log> access_log_;
+	std::unique_ptr<worker_pool> worker_pool_;
+	std::unique_ptr<http_peer_limiter> peer_limiter_;
+	std::unique_ptr<http_compression> compression_;
+	http_metrics metrics_;
+	std::string metrics_path_ = "/metrics";
+	std::unique_ptr<http_metrics_endpoint> metrics_endpoint_;
+	std::string static_root_;
+	std::string static_prefix_ = "/";
+	std::size_t static_fd_cache_ = 256;
+	std::unique_ptr<http_file_cache> file_cache_;
+	std::unique_ptr<http_file_endpoint> file_endpoint_;
+	std::size_t response_cache_bytes_ = 0;
+	double response_cache_ttl_ = 1;
+	std::vector<std::string> response_cache_vary_;
+	std::unique_ptr<http_cache_endpoint> response_cache_;
+	http_router router_;
 	options options_;
 	httpd_options httpd_options_;
 	std::unique_ptr<httpd_handler> http_server_;
+	std::unique_ptr<tcp_httpd_handler> tcp_server_;
+	std::string control_path_;
+	std::string takeover_path_;
+	double takeover_timeout_ = 5;
+	bool handoff_idle_ = false;
+	double drain_timeout_ = 30;
+	std::unique_ptr<local_stream::acceptor> control_;
+	std::unique_ptr<local_stream::socket> successor_;
+	char successor_reply_ = 0;
+	std::unique_ptr<asio::steady_timer> drain_timer_;
+	std::unique_ptr<asio::signal_set> signals_;
+
+	struct drain_state
+	{
+		static constexpr int serving = 0;
+		static constexpr int draining = 1;
+		static constexpr int drained = 2;
+	};
+	std::atomic<int> drain_state_{drain_state::serving};
 };
 
 } // namespace koti
@@ -0,0 +1,516 @@
+// Load generator for kotid over AF_LOCAL sockets.
+//
+// Opens --connections client connections, spread over --threads threads
+// each running its own io_context, and has every connection send
+// requests in a closed loop: --depth pipelined requests at a time, then
+// wait for all of their responses. Without --keep-alive each request gets
+// a connection of its own.
+//
+// Without --connect, a kotid is started in-process on an abstract socket;
+// --server-arg passes options on to it. Unless told to serve files, it
+// only has its metrics, so the default target measures a 404.
+//
+// After --warmup seconds, requests are measured for --duration seconds.
+// The result is one JSON object on stdout: requests per second, and
+// latency percentiles in microseconds, from the moment a request (or its
+// pipelined batch) was written to the moment its response was read
+// completely.
+//
+//	kotid_bench --connections 64 --depth 4 --duration 10
+//	kotid_bench --connect @kotid --keep-alive false --body-size 4096
+
+extern "C" {
+#include <unistd.h>
+} // extern "C"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+namespace asio = boost::asio;
+
+#include <boost/beast.hpp>
+namespace http = boost::beast::http;
+
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+#include "fmt/format.h"
+#include "spdlog/spdlog.h"
+
+#include "application.hpp"
+#include "net.hpp"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct settings
+{
+	std::string connect;
+	std::vector<std::string> server_args;
+	std::size_t connections = 16;
+	std::size_t threads = 1;
+	std::size_t depth = 1;
+	bool keep_alive = true;
+	std::size_t body_size = 0;
+	std::string target = "/";
+	double duration = 5;
+	double warmup = 1;
+	bool verbose = false;
+};
+
+enum class phase
+{
+	warmup,
+	measure,
+	stop
+};
+
+// what the connections of one thread saw; only that thread writes it
+struct tally
+{
+	std::vector<std::uint64_t> latencies;
+	std::uint64_t errors = 0;
+	std::uint64_t bytes_received = 0;
+};
+
+// one client connection, looping over batches of depth requests until
+// the phase turns to stop
+class client
+{
+public:
+	client(
+		asio::io_context & iox,
+		const koti::local_stream::endpoint & at,
+		const settings & s,
+		const std::string & batch,
+		const std::atomic<phase> & now,
+		tally & results
+	)
+	: socket_(iox)
+	, at_(at)
+	, settings_(s)
+	, batch_(batch)
+	, phase_(now)
+	, results_(results)
+	{
+	}
+
+	void
+	start()
+	{
+		if ( phase::stop == phase_.load(std::memory_order_relaxed) )
+		{
+			return;
+		}
+
+		boost::system::error_code ignored;
+		socket_.close(ignored);
+		buffer_.clear();
+		socket_.async_connect(at_, [this](const boost::system::error_code & ec)
+		{
+			if ( ec )
+			{
+				failed();
+				return;
+			}
+			send();
+		});
+	}
+
+protected:
+	void
+	send()
+	{
+		if ( phase::stop == phase_.load(std::memory_order_relaxed) )
+		{
+			boost::system::error_code ignored;
+			socket_.close(ignored);
+			return;
+		}
+
+		outstanding_ = settings_.keep_alive ? settings_.depth : 1;
+		sent_at_ = clock_type::now();
+		asio::async_write(socket_, asio::buffer(batch_), [this](const boost::system::error_code & ec, std::size_t)
+		{
+			if ( ec )
+			{
+				failed();
+				return;
+			}
+			receive();
+		});
+	}
+
+	void
+	receive()
+	{
+		parser_.emplace();
+		parser_->body_limit(std::numeric_limits<std::uint64_t>::max());
+		http::async_read(socket_, buffer_, *parser_, [this](const boost::system::error_code & ec, std::size_t bytes)
+		{
+			if ( ec )
+			{
+				failed();
+				return;
+			}
+
+			results_.bytes_received += bytes;
+			if ( phase::measure == phase_.load(std::memory_order_relaxed) )
+			{
+				auto took = clock_type::now() - sent_at_;
+				results_.latencies.push_back(static_cast<std::uint64_t>(
+					std::chrono::duration_cast<std::chrono::nanoseconds>(took).count()
+				));
+			}
+
+			if ( 0u < --outstanding_ )
+			{
+				receive();
+				return;
+			}
+
+			if ( settings_.keep_alive && parser_->get().keep_alive() )
+			{
+				send();
+				return;
+			}
+			start();
+		});
+	}
+
+	void
+	failed()
+	{
+		if ( phase::stop == phase_.load(std::memory_order_relaxed) )
+		{
+			return;
+		}
+		++results_.errors;
+
+		// not straight back: a refusing server would be hammered
+		auto retry = std::make_shared<asio::steady_timer>(socket_.get_executor(), std::chrono::milliseconds(10));
+		retry->async_wait([this, retry](const boost::system::error_code &)
+		{
+			start();
+		});
+	}
+
+	koti::local_stream::socket socket_;
+	koti::local_stream::endpoint at_;
+	const settings & settings_;
+	const std::string & batch_;
+	const std::atomic<phase> & phase_;
+	tally & results_;
+	boost::beast::flat_buffer buffer_;
+	std::optional<http::response_parser<http::string_body>> parser_;
+	clock_type::time_point sent_at_;
+	std::size_t outstanding_ = 0;
+};
+
+std::string
+make_batch(
+	const settings & s
+)
+{
+	std::string request = fmt::format(
+		"{} {} HTTP/1.1\r\nHost: kotid\r\nUser-Agent: kotid_bench\r\n",
+		0u < s.body_size ? "POST" : "GET",
+		s.target
+	);
+	if ( false == s.keep_alive )
+	{
+		request += "Connection: close\r\n";
+	}
+	if ( 0u < s.body_size )
+	{
+		request += fmt::format("Content-Length: {}\r\n\r\n", s.body_size);
+		request.append(s.body_size, 'b');
+	}
+	else
+	{
+		request += "\r\n";
+	}
+
+	std::string batch;
+	for ( std::size_t i = 0; i < (s.keep_alive ? s.depth : 1); ++i )
+	{
+		batch += request;
+	}
+	return batch;
+}
+
+// kotid, run on a thread of its own until stop()
+class in_process_kotid
+{
+public:
+	in_process_kotid(
+		const settings & s
+	)
+	: name_("kotid-bench-" + std::to_string(::getpid()))
+	{
+		args_ = {
+			"kotid",
+			"--local-path", name_,
+			"--abstract",
+			"--maximum-connection-count", std::to_string(s.connections + 16),
+		};
+		args_.insert(args_.end(), s.server_args.begin(), s.server_args.end());
+		for ( auto & arg : args_ )
+		{
+			argv_.push_back(arg.data());
+		}
+		argv_.push_back(nullptr);
+
+		application_ = std::make_unique<koti::application>(
+			koti::options::commandline_arguments{static_cast<int>(args_.size()), argv_.data()}
+		);
+		thread_ = std::thread{[this]()
+		{
+			status_ = application_->run().value();
+		}};
+	}
+
+	~in_process_kotid()
+	{
+		stop();
+	}
+
+	std::string
+	path() const
+	{
+		return "@" + name_;
+	}
+
+	// true once it accepts connections
+	bool
+	wait_until_listening(
+		std::chrono::seconds patience
+	)
+	{
+		asio::io_context iox;
+		auto until = clock_type::now() + patience;
+		while ( clock_type::now() < until )
+		{
+			koti::local_stream::socket probe{iox};
+			boost::system::error_code ec;
+			probe.connect(koti::http_local_endpoint(path()), ec);
+			if ( ! ec )
+			{
+				return true;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		return false;
+	}
+
+	int
+	stop()
+	{
+		if ( thread_.joinable() )
+		{
+			asio::post(application_->iox_, [this]()
+			{
+				application_->iox_.stop();
+			});
+			thread_.join();
+		}
+		return status_;
+	}
+
+protected:
+	std::string name_;
+	std::vector<std::string> args_;
+	std::vector<char *> argv_;
+	std::unique_ptr<koti::application> application_;
+	std::thread thread_;
+	int status_ = EXIT_SUCCESS;
+};
+
+std::uint64_t
+percentile(
+	std::vector<std::uint64_t> & sorted,
+	double p
+)
+{
+	if ( sorted.empty() )
+	{
+		return 0;
+	}
+	auto rank = static_cast<std::size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+	return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+} // namespace
+
+int
+main(
+	int argc,
+	char ** argv
+)
+{
+	settings s;
+	po::options_description descriptions{"kotid_bench"};
+	descriptions.add_options()
+	("help,h", "show this help")
+	("connect", po::value<std::string>(&s.connect), "socket path of a running kotid; @name for an abstract socket. without it, a kotid is started in-process")
+	("server-arg", po::value<std::vector<std::string>>(&s.server_args), "option passed to the in-process kotid, eg. --server-arg=--threads=4; repeatable")
+	("connections,c", po::value<std::size_t>(&s.connections)->default_value(s.connections), "number of concurrent connections")
+	("threads,t", po::value<std::size_t>(&s.threads)->default_value(s.threads), "number of client threads")
+	("depth,d", po::value<std::size_t>(&s.depth)->default_value(s.depth), "requests pipelined per connection before waiting for their responses")
+	("keep-alive", po::value<bool>(&s.keep_alive)->default_value(s.keep_alive), "reuse connections; when false every request opens a connection of its own")
+	("body-size", po::value<std::size_t>(&s.body_size)->default_value(s.body_size), "bytes of request body; 0 sends GETs, anything else POSTs")
+	("target", po::value<std::string>(&s.target)->default_value(s.target), "request target")
+	("duration", po::value<double>(&s.duration)->default_value(s.duration), "seconds to measure for")
+	("warmup", po::value<double>(&s.warmup)->default_value(s.warmup), "seconds to run before measuring")
+	("verbose", po::bool_switch(&s.verbose), "keep the in-process kotid's log")
+	;
+
+	try
+	{
+		po::variables_map vm;
+		po::store(po::parse_command_line(argc, argv, descriptions), vm);
+		po::notify(vm);
+		if ( vm.count("help") )
+		{
+			std::cout << descriptions << '\n';
+			return EXIT_SUCCESS;
+		}
+	}
+	catch (const std::exception & e)
+	{
+		std::cerr << e.what() << '\n' << descriptions << '\n';
+		return EXIT_FAILURE;
+	}
+
+	if ( 0 == s.connections || 0 == s.threads || 0 == s.depth || s.duration <= 0 || s.warmup < 0 )
+	{
+		std::cerr << "--connections, --threads, --depth and --duration must be positive\n";
+		return EXIT_FAILURE;
+	}
+
+	if ( false == s.verbose )
+	{
+		spdlog::set_level(spdlog::level::warn);
+	}
+
+	std::unique_ptr<in_process_kotid> server;
+	if ( s.connect.empty() )
+	{
+		server = std::make_unique<in_process_kotid>(s);
+		if ( false == server->wait_until_listening(std::chrono::seconds(5)) )
+		{
+			std::cerr << "in-process kotid did not start listening\n";
+			return EXIT_FAILURE;
+		}
+		s.connect = server->path();
+	}
+
+	auto at = koti::http_local_endpoint(s.connect);
+	auto batch = make_batch(s);
+	std::atomic<phase> now{phase::warmup};
+
+	auto threads = std::min(s.threads, s.connections);
+	std::vector<std::unique_ptr<asio::io_context>> contexts;
+	std::vector<tally> tallies(threads);
+	std::vector<std::unique_ptr<client>> clients;
+	for ( std::size_t t = 0; t < threads; ++t )
+	{
+		contexts.push_back(std::make_unique<asio::io_context>(1));
+		tallies[t].latencies.reserve(1u << 20);
+	}
+	for ( std::size_t c = 0; c < s.connections; ++c )
+	{
+		auto t = c % threads;
+		clients.push_back(std::make_unique<client>(*contexts[t], at, s, batch, now, tallies[t]));
+		clients.back()->start();
+	}
+
+	std::vector<std::thread> runners;
+	for ( auto & iox : contexts )
+	{
+		runners.emplace_back([&iox]()
+		{
+			iox->run();
+		});
+	}
+
+	std::this_thread::sleep_for(std::chrono::duration<double>(s.warmup));
+	now = phase::measure;
+	auto began = clock_type::now();
+	std::this_thread::sleep_for(std::chrono::duration<double>(s.duration));
+	now = phase::stop;
+	auto elapsed = std::chrono::duration<double>(clock_type::now() - began).count();
+
+	// connections close at the end of their batch; give stragglers a
+	// moment, then stop regardless
+	for ( auto & iox : contexts )
+	{
+		asio::post(*iox, [&iox]()
+		{
+			auto deadline = std::make_shared<asio::steady_timer>(*iox, std::chrono::seconds(1));
+			deadline->async_wait([&iox, deadline](const boost::system::error_code &)
+			{
+				iox->stop();
+			});
+		});
+	}
+	for ( auto & runner : runners )
+	{
+		runner.join();
+	}
+	clients.clear();
+
+	std::vector<std::uint64_t> latencies;
+	std::uint64_t errors = 0;
+	std::uint64_t bytes = 0;
+	for ( auto & t : tallies )
+	{
+		latencies.insert(latencies.end(), t.latencies.begin(), t.latencies.end());
+		errors += t.errors;
+		bytes += t.bytes_received;
+	}
+	std::sort(latencies.begin(), latencies.end());
+
+	auto us = [](std::uint64_t ns)
+	{
+		return static_cast<double>(ns) / 1e3;
+	};
+	std::cout << fmt::format(
+		"{{\"connections\":{},\"threads\":{},\"depth\":{},\"keep_alive\":{},\"body_size\":{},"
+		"\"seconds\":{:.3f},\"requests\":{},\"errors\":{},\"requests_per_second\":{:.1f},\"bytes_received\":{},"
+		"\"latency_us\":{{\"p50\":{:.1f},\"p99\":{:.1f},\"p999\":{:.1f},\"max\":{:.1f}}}}}",
+		s.connections,
+		threads,
+		s.keep_alive ? s.depth : 1,
+		s.keep_alive ? "true" : "false",
+		s.body_size,
+		elapsed,
+		latencies.size(),
+		errors,
+		static_cast<double>(latencies.size()) / elapsed,
+		bytes,
+		us(percentile(latencies, 0.50)),
+		us(percentile(latencies, 0.99)),
+		us(percentile(latencies, 0.999)),
+		us(latencies.empty() ? 0 : latencies.back())
+	) << std::endl;
+
+	if ( server && EXIT_SUCCESS != server->stop() )
+	{
+		return EXIT_FAILURE;
+	}
+	return latencies.empty() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,286 @@
+// Microbenchmarks of the per-request hot paths: parsing a request, routing
+// it to an endpoint, taking a connection in and out of the connection list,
+// recording metrics and re-arming a connection's timeout.
+//
+//	kotid_microbench --benchmark_filter=router
+//	kotid_microbench --benchmark_format=json > before.json
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <boost/asio.hpp>
+namespace asio = boost::asio;
+
+#include "http_arena.hpp"
+#include "http_connection_list.hpp"
+#include "http_metrics.hpp"
+#include "http_router.hpp"
+#include "http_timer_wheel.hpp"
+#include "httpd.hpp"
+#include "net.hpp"
+
+namespace {
+
+constexpr std::string_view small_request =
+	"GET /users/42/posts/7?page=2 HTTP/1.1\r\n"
+	"Host: localhost\r\n"
+	"User-Agent: kotid_microbench\r\n"
+	"Accept: */*\r\n"
+	"\r\n";
+
+constexpr std::string_view large_request =
+	"POST /files/a/b/c.txt HTTP/1.1\r\n"
+	"Host: localhost\r\n"
+	"User-Agent: kotid_microbench\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+	"Accept-Language: en-GB,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Cookie: session=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+	"Content-Type: application/json\r\n"
+	"Content-Length: 63\r\n"
+	"\r\n"
+	"{\"name\":\"kotid\",\"values\":[1,2,3,4,5,6,7,8,9,10],\"enabled\":true}";
+
+// a connection with nothing at the other end, as routing needs one to
+// record its captures on
+class idle_connection
+{
+public:
+	idle_connection()
+	: server_side_{iox_}
+	, client_side_{iox_}
+	{
+		asio::local::connect_pair(server_side_, client_side_);
+		connection_ = std::make_unique<koti::http_connection>(std::move(server_side_));
+	}
+
+	koti::http_connection &
+	operator*()
+	{
+		return *connection_;
+	}
+
+protected:
+	asio::io_context iox_;
+	koti::local_stream::socket server_side_;
+	koti::local_stream::socket client_side_;
+	koti::http_connection::ptr connection_;
+};
+
+class bench_endpoint
+: public koti::http_endpoint
+{
+public:
+	koti::http_response
+	handle(
+		koti::http_connection & connection,
+		koti::http_request & request
+	) override
+	{
+		(void)connection;
+		auto response = koti::http_make_response(request.get_allocator());
+		response.result(koti::http::status::ok);
+		return response;
+	}
+};
+
+void
+parse(
+	benchmark::State & state,
+	std::string_view text
+)
+{
+	// as a connection parses: into its arena, reset after every request
+	koti::http_arena arena;
+	for ( auto _ : state )
+	{
+		koti::http_allocator allocator{&arena};
+		koti::http::request_parser<koti::http_body, koti::http_allocator> parser{
+			std::piecewise_construct,
+			std::make_tuple(allocator),
+			std::make_tuple(allocator)
+		};
+		parser.eager(true);
+
+		boost::beast::error_code ec;
+		parser.put(asio::buffer(text.data(), text.size()), ec);
+		if ( ec || false == parser.is_done() )
+		{
+			state.SkipWithError("request did not parse");
+			break;
+		}
+		benchmark::DoNotOptimize(parser.get().target().data());
+		arena.reset();
+	}
+	state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * text.size()));
+}
+
+void
+parse_small_request(
+	benchmark::State & state
+)
+{
+	parse(state, small_request);
+}
+BENCHMARK(parse_small_request);
+
+void
+parse_large_request(
+	benchmark::State & state
+)
+{
+	parse(state, large_request);
+}
+BENCHMARK(parse_large_request);
+
+void
+router_resolve(
+	benchmark::State & state,
+	std::string_view target
+)
+{
+	idle_connection connection;
+	bench_endpoint root, users, user, me, posts, files, metrics;
+
+	koti::http_router router;
+	router
+		.add("/", root)
+		.add("/users", users)
+		.add("/users/:id", user)
+		.add("/users/me", me)
+		.add("/users/:id/posts/:post", posts)
+		.add("/files/*path", files)
+		.add(koti::http::verb::get, "/metrics", metrics);
+
+	auto request = koti::http_make_request();
+	request.method(koti::http::verb::get);
+	request.target(boost::beast::string_view{target.data(), target.size()});
+	request.version(11);
+
+	for ( auto _ : state )
+	{
+		(*connection).route_captures().clear();
+		benchmark::DoNotOptimize(router.resolve(*connection, request.base()));
+	}
+}
+
+void
+router_literal(
+	benchmark::State & state
+)
+{
+	router_resolve(state, "/metrics");
+}
+BENCHMARK(router_literal);
+
+void
+router_parameters(
+	benchmark::State & state
+)
+{
+	router_resolve(state, "/users/42/posts/7?page=2");
+}
+BENCHMARK(router_parameters);
+
+void
+router_wildcard(
+	benchmark::State & state
+)
+{
+	router_resolve(state, "/files/a/b/c.txt");
+}
+BENCHMARK(router_wildcard);
+
+void
+router_not_found(
+	benchmark::State & state
+)
+{
+	router_resolve(state, "/users/42/comments");
+}
+BENCHMARK(router_not_found);
+
+// one connection in and out of a list that holds state.range(0) others
+void
+connection_list_add_remove(
+	benchmark::State & state
+)
+{
+	auto occupied = static_cast<std::size_t>(state.range(0));
+
+	asio::io_context iox;
+	koti::http_connection_list list;
+	list.set_maximum_connections(occupied + 1);
+
+	std::vector<koti::local_stream::socket> peers;
+	auto make = [&]
+	{
+		koti::local_stream::socket server_side{iox}, client_side{iox};
+		asio::local::connect_pair(server_side, client_side);
+		peers.push_back(std::move(client_side));
+		return std::make_unique<koti::http_connection>(std::move(server_side));
+	};
+	for ( std::size_t i = 0; i < occupied; ++i )
+	{
+		list.add_connection(make());
+	}
+
+	auto connection = make();
+	for ( auto _ : state )
+	{
+		auto & added = list.add_connection(std::move(connection));
+		connection = list.remove_connection(added->handle());
+	}
+}
+BENCHMARK(connection_list_add_remove)->Arg(0)->Arg(1024)->Arg(4096);
+
+void
+metrics_record(
+	benchmark::State & state
+)
+{
+	static koti::http_metrics metrics;
+
+	auto & shard = metrics.local();
+	for ( auto _ : state )
+	{
+		shard.add(koti::http_metrics::counter::bytes_received, 512);
+		shard.record(koti::http_metrics::phase::handle, std::chrono::microseconds{150});
+		shard.request(koti::http::verb::get, 200);
+	}
+}
+BENCHMARK(metrics_record)->ThreadRange(1, 8);
+
+// what every request does to its connection's timeout
+void
+timer_wheel_rearm(
+	benchmark::State & state
+)
+{
+	asio::io_context iox;
+	auto & wheel = koti::http_timer_wheel::use(iox.get_executor());
+
+	std::vector<std::unique_ptr<koti::http_timer_wheel::timer>> timers;
+	for ( std::int64_t i = 0; i < state.range(0); ++i )
+	{
+		timers.push_back(std::make_unique<koti::http_timer_wheel::timer>([]{}));
+		wheel.arm(*timers.back(), std::chrono::seconds{60});
+	}
+
+	koti::http_timer_wheel::timer timer{[]{}};
+	for ( auto _ : state )
+	{
+		wheel.arm(timer, std::chrono::seconds{10});
+		wheel.arm(timer, std::chrono::seconds{60});
+	}
+}
+BENCHMARK(timer_wheel_rearm)->Arg(0)->Arg(10000);
+
+} // namespace
+
+BENCHMARK_MAIN();
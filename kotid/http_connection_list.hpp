@@ -0,0 +1,254 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+
+#include "httpd.hpp"
+
+namespace koti {
+
+// Slab of connection slots. Free slots are threaded into an intrusive free
+// list, so adding and removing a connection are O(1) regardless of the
+// configured maximum, and the live count is kept as a counter rather than
+// recomputed.
+//
+// Connections are accepted on the listener's thread but run (and finish)
+// on any thread of the io_context pool, so every mutation takes the list's
+// lock; the counters can be read without it.
+class http_connection_list
+{
+public:
+	virtual
+	~http_connection_list() = default;
+
+	http_connection::ptr &
+	add_connection(
+		http_connection::ptr && ptr
+	)
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+
+		if ( http_connection_handle::invalid_index == free_head_ )
+		{
+			throw std::runtime_error{"too many connections"};
+		}
+
+		auto index = free_head_;
+		auto & at = slots_[index];
+		free_head_ = at.next_free;
+		at.next_free = http_connection_handle::invalid_index;
+
+		at.connection = std::move(ptr);
+		at.connection->set_handle({index, at.generation});
+		live_.fetch_add(1, std::memory_order_relaxed);
+		return at.connection;
+	}
+
+	// the connection for handle, or nullptr when the handle is stale
+	http_connection *
+	find_connection(
+		const http_connection_handle & handle
+	) const
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+
+		const auto * at = find_slot(handle);
+		return at ? at->connection.get() : nullptr;
+	}
+
+	// empties the slot for handle and hands its connection back, so the
+	// caller can destroy it outside of the lock. a stale handle yields null.
+	// removing the last live connection calls on_emptied(), unlocked
+	http_connection::ptr
+	remove_connection(
+		const http_connection_handle & handle
+	)
+	{
+		http_connection::ptr removed;
+		bool emptied = false;
+		{
+			std::lock_guard<std::mutex> lock{mutex_};
+
+			auto * at = find_slot(handle);
+			if ( nullptr == at )
+			{
+				return {};
+			}
+
+			removed = std::move(at->connection);
+			++at->generation;
+			emptied = 1u == live_.fetch_sub(1, std::memory_order_relaxed);
+
+			if ( handle.index < maximum_.load(std::memory_order_relaxed) )
+			{
+				at->next_free = free_head_;
+				free_head_ = handle.index;
+			}
+			else
+			{
+				// slot was above a lowered maximum; let it go
+				trim_retired_slots();
+			}
+		}
+
+		if ( emptied )
+		{
+			on_emptied();
+		}
+		return removed;
+	}
+
+	// grows or shrinks the table without disturbing live connections.
+	// slots are never moved, so references handed out by add_connection()
+	// stay valid. live connections above a lowered maximum keep their slot
+	// until they finish; it is reclaimed afterwards
+	void
+	set_maximum_connections(
+		size_t new_maximum
+	)
+	{
+		if ( http_connection_handle::invalid_index <= new_maximum )
+		{
+			throw std::length_error{"maximum connection count is too large"};
+		}
+
+		std::lock_guard<std::mutex> lock{mutex_};
+
+		auto old_maximum = maximum_.load(std::memory_order_relaxed);
+		maximum_.store(new_maximum, std::memory_order_relaxed);
+
+		if ( old_maximum < new_maximum )
+		{
+			if ( slots_.size() < new_maximum )
+			{
+				slots_.resize(new_maximum);
+			}
+
+			// push highest first so the lowest slots are handed out first
+			for ( auto index = new_maximum; old_maximum < index--; )
+			{
+				if ( ! slots_[index].connection )
+				{
+					slots_[index].next_free = free_head_;
+					free_head_ = static_cast<std::uint32_t>(index);
+				}
+			}
+			return;
+		}
+
+		// rebuild the free list from the slots that remain in range
+		free_head_ = http_connection_handle::invalid_index;
+		for ( auto index = new_maximum; 0 < index--; )
+		{
+			auto & at = slots_[index];
+			if ( ! at.connection )
+			{
+				at.next_free = free_head_;
+				free_head_ = static_cast<std::uint32_t>(index);
+			}
+		}
+		trim_retired_slots();
+	}
+
+	size_t
+	active_connection_count() const
+	{
+		return live_.load(std::memory_order_relaxed);
+	}
+
+	size_t
+	maximum_connection_count() const
+	{
+		return maximum_.load(std::memory_order_relaxed);
+	}
+
+	// visits every live connection under the list's lock
+	template <typename Function>
+	void
+	for_each_connection(
+		Function && function
+	)
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+
+		for ( auto & at : slots_ )
+		{
+			if ( at.connection )
+			{
+				function(at.connection);
+			}
+		}
+	}
+
+protected:
+	// the last live connection was just removed, on the thread that
+	// removed it
+	virtual
+	void
+	on_emptied(
+	)
+	{
+	}
+
+	// own cache line per slot: neighbouring slots are claimed and released
+	// from different threads
+	struct alignas(64) slot
+	{
+		http_connection::ptr connection;
+		std::uint32_t generation = 0;
+		std::uint32_t next_free = http_connection_handle::invalid_index;
+	};
+
+	const slot *
+	find_slot(
+		const http_connection_handle & handle
+	) const
+	{
+		if ( slots_.size() <= handle.index )
+		{
+			return nullptr;
+		}
+		const auto & at = slots_[handle.index];
+		if ( at.generation != handle.generation || ! at.connection )
+		{
+			return nullptr;
+		}
+		return &at;
+	}
+
+	slot *
+	find_slot(
+		const http_connection_handle & handle
+	)
+	{
+		return const_cast<slot *>(
+			static_cast<const http_connection_list *>(this)->find_slot(handle)
+		);
+	}
+
+	// drops empty slots past the maximum from the end of the table
+	void
+	trim_retired_slots(
+	)
+	{
+		auto maximum = maximum_.load(std::memory_order_relaxed);
+		while ( maximum < slots_.size() && ! slots_.back().connection )
+		{
+			slots_.pop_back();
+		}
+	}
+
+	mutable std::mutex mutex_;
+
+	// deque: growing never relocates existing slots
+	std::deque<slot> slots_;
+	std::uint32_t free_head_ = http_connection_handle::invalid_index;
+	std::atomic<std::size_t> live_{0};
+	std::atomic<std::size_t> maximum_{0};
+};
+
+} // namespace koti
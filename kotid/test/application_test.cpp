@@ -1,12 +1,17 @@
 extern "C" {
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 } // extern "C"
 
 #include "../application.hpp"
 
 #include "gtest/gtest.h"
 
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <memory>
 #include <cerrno>
 #include <cstdlib>
@@ -166,22 +171,35 @@ TEST_F(application_test, local_path) {
             return;
         }
 
+        // nothing is routed at /, and the connection stays open for the
+        // next request
         http::response<http::string_body> & message = parser.get();
         EXPECT_FALSE(message.chunked());
-        EXPECT_FALSE(message.has_content_length());
-        EXPECT_FALSE(message.keep_alive());
+        EXPECT_TRUE(message.has_content_length());
+        EXPECT_TRUE(message.keep_alive());
         ASSERT_EQ(static_cast<bool>(message.payload_size()), true);
         EXPECT_EQ(*message.payload_size(), 0);
 
         auto header = message.base();
         EXPECT_EQ(11, header.version());
-        EXPECT_EQ(http::status::internal_server_error, header.result());
+        EXPECT_EQ(http::status::not_found, header.result());
         EXPECT_EQ(header.find(http::field::server), header.end());
-        EXPECT_NE(header.find(http::field::comments), header.end());
-        EXPECT_EQ(header[http::field::comments], "no-root-endpoint-installed");
+        EXPECT_EQ(header.find(http::field::comments), header.end());
         app_->iox_.stop();
     };
 
+    // the server keeps the connection, so a response ends where its
+    // Content-Length says rather than at end of file
+    auto response_complete = [&]()
+    {
+        namespace http = boost::beast::http;
+        http::response_parser<http::string_body> parser;
+        boost::system::error_code ec;
+        parser.eager(true);
+        parser.put(boost::asio::buffer(native_readbuf.data(), total_read), ec);
+        return ! ec && parser.is_done();
+    };
+
     std::function<void()> do_read = [&]()
     {
         if ( native_readbuf.size() < static_cast<std::size_t>(total_read) )
@@ -216,6 +234,11 @@ TEST_F(application_test, local_path) {
         else
         {
             total_read += result;
+            if ( response_complete() )
+            {
+                post(do_check);
+                return;
+            }
         }
         post(do_read);
     };
@@ -315,3 +338,388 @@ TEST_F(application_test, local_path) {
     EXPECT_NO_THROW(asio::post(app_->iox_, inject));
     EXPECT_NO_THROW(run());
 }
+
+// an application running on a thread of its own, stopped when destroyed
+class application_thread
+{
+public:
+	explicit
+	application_thread(
+		std::vector<std::string> args
+	)
+	: args_(std::move(args))
+	{
+		args_.insert(args_.begin(), "./test");
+		for ( const auto & arg : args_ )
+		{
+			args_raw_.push_back(arg.c_str());
+		}
+		args_raw_.push_back(nullptr);
+		app_ = std::make_unique<koti::application>(
+			koti::options::commandline_arguments{
+				static_cast<int>(args_.size()),
+				const_cast<char**>(args_raw_.data())
+			}
+		);
+		thread_ = std::thread{[this]()
+		{
+			try
+			{
+				app_->run();
+			}
+			catch ( const std::exception & e )
+			{
+				ADD_FAILURE() << e.what();
+			}
+			finished_.store(true);
+		}};
+	}
+
+	~application_thread()
+	{
+		app_->iox_.stop();
+		thread_.join();
+	}
+
+	// whether run() returned within timeout
+	bool
+	finished_within(
+		std::chrono::steady_clock::duration timeout
+	) const
+	{
+		auto until = std::chrono::steady_clock::now() + timeout;
+		while ( false == finished_.load() && std::chrono::steady_clock::now() < until )
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		return finished_.load();
+	}
+
+private:
+	std::vector<std::string> args_;
+	std::vector<const char*> args_raw_;
+	std::unique_ptr<koti::application> app_;
+	std::atomic<bool> finished_{false};
+	std::thread thread_;
+};
+
+using native_socket = std::unique_ptr<int, std::function<void(int*)>>;
+
+// a blocking socket connected to at that gives up on a send or receive
+// after a second; null when the connect failed
+native_socket
+connect_to(
+	const koti::local_stream::endpoint & at
+)
+{
+	native_socket native{new int{::socket(AF_LOCAL, SOCK_STREAM, 0)}, [](int * fd)
+	{
+		::close(*fd);
+		delete fd;
+	}};
+	timeval limit{1, 0};
+	::setsockopt(*native, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof limit);
+	::setsockopt(*native, SOL_SOCKET, SO_SNDTIMEO, &limit, sizeof limit);
+	if ( 0 != ::connect(*native, at.data(), static_cast<socklen_t>(at.size())) )
+	{
+		native.reset();
+	}
+	return native;
+}
+
+// the status of GET / sent over native, which is left open; 0 when no
+// response came
+unsigned
+exchange_get(
+	int native
+)
+{
+	std::string_view request{"GET / HTTP/1.1\r\nHost: test\r\n\r\n"};
+	if ( static_cast<ssize_t>(request.size()) != ::send(native, request.data(), request.size(), MSG_NOSIGNAL) )
+	{
+		return 0;
+	}
+
+	namespace http = boost::beast::http;
+	http::response_parser<http::string_body> parser;
+	parser.eager(true);
+	boost::system::error_code ec;
+	char buffer[4096];
+	while ( ! ec && false == parser.is_done() )
+	{
+		auto result = ::recv(native, buffer, sizeof buffer, 0);
+		if ( result <= 0 )
+		{
+			break;
+		}
+		parser.put(boost::asio::buffer(buffer, result), ec);
+	}
+	return ! ec && parser.is_done() ? parser.get().result_int() : 0;
+}
+
+// the status of GET / over at, trying again until deadline; 0 when no
+// response came
+unsigned
+get_status(
+	const koti::local_stream::endpoint & at,
+	std::chrono::steady_clock::time_point deadline
+)
+{
+	for ( ; std::chrono::steady_clock::now() < deadline; std::this_thread::sleep_for(std::chrono::milliseconds(10)) )
+	{
+		if ( auto native = connect_to(at) )
+		{
+			if ( auto status = exchange_get(*native) )
+			{
+				return status;
+			}
+		}
+	}
+	return 0;
+}
+
+TEST_F(application_test, stops_with_idle_connections_open) {
+	fs::path path = koti::test::test_socket_path();
+	auto at = koti::http_local_endpoint(path.string());
+
+	// on the main thread, and on a pool of them
+	for ( std::string threads : {"1", "4"} )
+	{
+		SCOPED_TRACE(threads);
+		fs::remove(path);
+
+		std::vector<native_socket> clients;
+		{
+			application_thread server{{
+				"--local-path", path.string(),
+				"--threads", threads,
+				"--maximum-connection-count", "16"
+			}};
+			ASSERT_EQ(404u, get_status(at, std::chrono::steady_clock::now() + std::chrono::seconds(5)));
+
+			// each waiting for its next request, with a read outstanding
+			for ( int i = 0; i < 8; ++i )
+			{
+				clients.push_back(connect_to(at));
+				ASSERT_TRUE(clients.back());
+				EXPECT_EQ(404u, exchange_get(*clients.back()));
+			}
+		}
+
+		for ( const auto & client : clients )
+		{
+			char byte;
+			EXPECT_EQ(0, ::recv(*client, &byte, 1, 0));
+		}
+	}
+}
+
+TEST_F(application_test, abstract_local_path) {
+	std::string name = "kotid_abstract_test_" + std::to_string(::getpid());
+
+	application_thread server{{
+		"--local-path", name,
+		"--abstract"
+	}};
+	EXPECT_EQ(404u, get_status(koti::http_local_endpoint("@" + name), std::chrono::steady_clock::now() + std::chrono::seconds(5)));
+}
+
+TEST_F(application_test, takeover_hands_the_listener_over) {
+	fs::path path = koti::test::test_socket_path();
+	std::string control = "@kotid_takeover_test_" + std::to_string(::getpid());
+	auto at = koti::http_local_endpoint(path.string());
+
+	// left behind by the tests before
+	fs::remove(path);
+
+	auto predecessor = std::make_unique<application_thread>(std::vector<std::string>{
+		"--local-path", path.string(),
+		"--control-path", control
+	});
+	ASSERT_EQ(404u, get_status(at, std::chrono::steady_clock::now() + std::chrono::seconds(5)));
+
+	application_thread successor{{
+		"--local-path", path.string(),
+		"--takeover", control
+	}};
+
+	// the predecessor drains and exits once its successor accepts, which
+	// then answers on the same listening socket
+	EXPECT_TRUE(predecessor->finished_within(std::chrono::seconds(5)));
+	predecessor.reset();
+	EXPECT_EQ(404u, get_status(at, std::chrono::steady_clock::now() + std::chrono::seconds(5)));
+}
+
+TEST_F(application_test, takeover_gives_up_on_a_silent_predecessor) {
+	fs::path path = koti::test::test_socket_path();
+	std::string control = "@kotid_takeover_test_" + std::to_string(::getpid());
+	auto at = koti::http_local_endpoint(path.string());
+
+	// left behind by the tests before
+	fs::remove(path);
+
+	// connects are queued in the backlog and never answered; closed before
+	// the successor is stopped, so it is never stuck on it
+	asio::io_context iox;
+	auto silent = std::make_unique<koti::local_stream::acceptor>(iox);
+	silent->open(koti::local_stream{});
+	silent->bind(koti::http_local_endpoint(control));
+	silent->listen(1);
+
+	auto started = std::chrono::steady_clock::now();
+	application_thread successor{{
+		"--local-path", path.string(),
+		"--takeover", control,
+		"--takeover-timeout", "0.2"
+	}};
+	auto status = get_status(at, started + std::chrono::seconds(5));
+	silent.reset();
+
+	EXPECT_EQ(404u, status);
+	EXPECT_LT(std::chrono::steady_clock::now() - started, std::chrono::seconds(3));
+}
+
+class http_connection_list_test : public ::testing::Test {
+public:
+	koti::http_connection::ptr
+	make_connection()
+	{
+		koti::local_stream::socket server_side{iox_};
+		peers_.emplace_back(iox_);
+		boost::asio::local::connect_pair(server_side, peers_.back());
+		return std::make_unique<koti::http_connection>(std::move(server_side));
+	}
+
+	asio::io_context iox_;
+	std::deque<koti::local_stream::socket> peers_;
+	koti::http_connection_list list_;
+};
+
+TEST_F(http_connection_list_test, rejects_past_maximum) {
+	list_.set_maximum_connections(3);
+	ASSERT_EQ(3u, list_.maximum_connection_count());
+
+	for ( int i = 0; i < 3; ++i )
+	{
+		EXPECT_NO_THROW(list_.add_connection(make_connection()));
+	}
+	EXPECT_EQ(3u, list_.active_connection_count());
+	EXPECT_THROW(list_.add_connection(make_connection()), std::runtime_error);
+	EXPECT_EQ(3u, list_.active_connection_count());
+}
+
+TEST_F(http_connection_list_test, removed_slots_are_reused_and_handles_go_stale) {
+	list_.set_maximum_connections(1);
+
+	auto first = list_.add_connection(make_connection())->handle();
+	ASSERT_TRUE(first.valid());
+	EXPECT_NE(nullptr, list_.find_connection(first));
+
+	auto removed = list_.remove_connection(first);
+	EXPECT_NE(nullptr, removed);
+	EXPECT_EQ(0u, list_.active_connection_count());
+	EXPECT_EQ(nullptr, list_.find_connection(first));
+	EXPECT_EQ(nullptr, list_.remove_connection(first));
+
+	auto second = list_.add_connection(make_connection())->handle();
+	EXPECT_EQ(first.index, second.index);
+	EXPECT_NE(first, second);
+	EXPECT_EQ(nullptr, list_.find_connection(first));
+	EXPECT_NE(nullptr, list_.find_connection(second));
+}
+
+TEST_F(http_connection_list_test, removing_the_last_connection_says_so) {
+	struct counting_list : koti::http_connection_list
+	{
+		void
+		on_emptied() override
+		{
+			++emptied;
+		}
+
+		std::size_t emptied = 0;
+	} list;
+	list.set_maximum_connections(2);
+
+	auto first = list.add_connection(make_connection())->handle();
+	auto second = list.add_connection(make_connection())->handle();
+
+	list.remove_connection(first);
+	EXPECT_EQ(0u, list.emptied);
+	list.remove_connection(second);
+	EXPECT_EQ(1u, list.emptied);
+
+	// a stale handle removes nothing
+	list.remove_connection(second);
+	EXPECT_EQ(1u, list.emptied);
+}
+
+TEST_F(http_connection_list_test, resize_keeps_live_connections) {
+	list_.set_maximum_connections(4);
+
+	std::vector<koti::http_connection_handle> handles;
+	std::vector<koti::http_connection *> connections;
+	for ( int i = 0; i < 4; ++i )
+	{
+		auto & c = list_.add_connection(make_connection());
+		handles.push_back(c->handle());
+		connections.push_back(c.get());
+	}
+
+	list_.set_maximum_connections(2);
+	EXPECT_EQ(2u, list_.maximum_connection_count());
+	EXPECT_EQ(4u, list_.active_connection_count());
+	for ( std::size_t i = 0; i < handles.size(); ++i )
+	{
+		EXPECT_EQ(connections[i], list_.find_connection(handles[i]));
+	}
+
+	// slots above the new maximum are not handed out again
+	list_.remove_connection(handles[3]);
+	EXPECT_THROW(list_.add_connection(make_connection()), std::runtime_error);
+
+	list_.remove_connection(handles[0]);
+	EXPECT_NO_THROW(list_.add_connection(make_connection()));
+
+	list_.set_maximum_connections(8);
+	EXPECT_EQ(connections[1], list_.find_connection(handles[1]));
+	EXPECT_EQ(connections[2], list_.find_connection(handles[2]));
+	EXPECT_EQ(3u, list_.active_connection_count());
+	for ( int i = 0; i < 5; ++i )
+	{
+		EXPECT_NO_THROW(list_.add_connection(make_connection()));
+	}
+	EXPECT_THROW(list_.add_connection(make_connection()), std::runtime_error);
+}
+
+TEST_F(http_connection_list_test, finished_connections_return_their_slot) {
+	constexpr std::size_t rounds = 16;
+	list_.set_maximum_connections(1);
+
+	koti::httpd_handler handler{iox_};
+	handler.set_connections(list_);
+
+	for ( std::size_t i = 0; i < rounds; ++i )
+	{
+		koti::local_stream::socket server_side{iox_};
+		koti::local_stream::socket client_side{iox_};
+		boost::asio::local::connect_pair(server_side, client_side);
+
+		handler.on_new_connection({}, std::move(server_side));
+		ASSERT_EQ(1u, list_.active_connection_count());
+
+		// the client hanging up is the connection's terminal event
+		client_side.close();
+
+		iox_.restart();
+		auto until = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+		while (
+			0u < list_.active_connection_count()
+			&& std::chrono::steady_clock::now() < until
+		)
+		{
+			iox_.run_one_for(std::chrono::milliseconds(100));
+		}
+		ASSERT_EQ(0u, list_.active_connection_count());
+	}
+}